@@ -0,0 +1,1833 @@
+// =============================================================================
+// File: bench.cpp
+// =============================================================================
+// Description:
+//      This program measures the throughput of the ral::File operations. It
+//      is built & run by "make bench" and writes its scratch raf to /tmp.
+//      It also times Bank's balance posting kernel & a ColumnStore report.
+//      Async reads & writes are timed through io_uring & its fallback.
+//      Sweeps of raf sizes & read/write mixes & a Bank driven through its
+//      API (whole & split across shards) report latency percentiles too.
+//      Results can be saved as JSON & compared with a saved baseline (see main).
+//      It ends with a stress test of a concurrent raf & one killing a raf's
+//      writers mid-flight, & exits with 1 if those find a torn or lost
+//      record or a bitmap out of step with the slots.
+//      Usage: bench [ops per case] [records to grow the raf to]
+//                   [--json file] [--baseline file] [--tolerance percent]
+// =============================================================================
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <csignal>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <new>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include "Bank.h"
+#include "Checksum.h"
+#include "Cipher.h"
+#include "ColumnStore.h"
+#include "ral.h"
+#include "Ring.h"
+#include "Stats.h"
+using namespace std;
+
+// === BenchFields =============================================================
+// The same layout as Bank::AccountFields.
+// =============================================================================
+struct BenchFields {
+    int id = 0;
+    char name[100] = "UNKNOWN";
+    int64_t balance = 0;
+};
+
+// === BenchRecord =============================================================
+// A record encoded with a single memcpy, like Bank::Account.
+// =============================================================================
+class BenchRecord : public ral::PodRecord<BenchFields> {
+public:
+    int getId() override { return id; }
+};
+
+// === StreamRecord ============================================================
+// A record that only implements the stringstream interface.
+// =============================================================================
+class StreamRecord : public ral::Record {
+public:
+    BenchFields fields;
+
+    int getId() override { return fields.id; }
+    size_t getSize() override { return sizeof(fields); }
+
+    bool serialize(stringstream &ss) override {
+        ss.write((char*)&fields.id, sizeof(fields.id));
+        ss.write((char*)fields.name, sizeof(fields.name));
+        ss.write((char*)&fields.balance, sizeof(fields.balance));
+        return true;
+    }
+
+    bool deserialize(stringstream &ss) override {
+        ss.read((char*)&fields.id, sizeof(fields.id));
+        ss.read((char*)fields.name, sizeof(fields.name));
+        ss.read((char*)&fields.balance, sizeof(fields.balance));
+        return true;
+    }
+};
+
+// every allocation made by the benchmark is counted; the replacements below
+// are kept out of line so the compiler pairs each new with its own delete
+// rather than with the malloc/free inside them
+static atomic<long> allocations(0);
+
+__attribute__((noinline)) static void* allocate(size_t size) {
+    allocations++;
+    void* pointer = malloc(size == 0 ? 1 : size);
+    if (pointer == nullptr) {
+        throw bad_alloc();
+    }
+    return pointer;
+}
+
+__attribute__((noinline)) static void release(void* pointer) noexcept {
+    free(pointer);
+}
+
+void* operator new(size_t size) {
+    return allocate(size);
+}
+
+void* operator new[](size_t size) {
+    return allocate(size);
+}
+
+void operator delete(void* pointer) noexcept {
+    release(pointer);
+}
+
+void operator delete(void* pointer, size_t) noexcept {
+    release(pointer);
+}
+
+void operator delete[](void* pointer) noexcept {
+    release(pointer);
+}
+
+void operator delete[](void* pointer, size_t) noexcept {
+    release(pointer);
+}
+
+// global variable
+static const string BENCH_FILE = "/tmp/onb_bench";
+static const int RECORDS = 100;
+
+// === Result ==================================================================
+// One line of the report. The latency percentiles are in microseconds & are
+// negative for cases timed as a whole rather than per operation.
+// =============================================================================
+struct Result {
+    string name;
+    long ops;
+    double ops_per_sec;
+    double allocs_per_op;
+    double p50 = -1;
+    double p99 = -1;
+    double p999 = -1;
+};
+
+// every case reported, in order, for --json & --baseline
+static vector<Result> reported;
+
+// ==== report =================================================================
+// Prints one result line: name, operations, operations per second & heap
+// allocations per operation, then the latency percentiles if there are any.
+// =============================================================================
+static void report(const string &name, long ops, double seconds,
+    long allocs = 0, double p50 = -1, double p99 = -1, double p999 = -1) {
+    Result result;
+    result.name = name;
+    result.ops = ops;
+    result.ops_per_sec = ops / seconds;
+    result.allocs_per_op = (double)allocs / ops;
+    result.p50 = p50;
+    result.p99 = p99;
+    result.p999 = p999;
+    reported.push_back(result);
+
+    printf("%-24s %10ld ops %14.0f ops/sec %8.2f allocs/op", name.c_str(),
+        ops, result.ops_per_sec, result.allocs_per_op);
+    if (p50 >= 0) {
+        printf("  p50 %8.2f  p99 %8.2f  p99.9 %8.2f us", p50, p99, p999);
+    }
+    printf("\n");
+}
+
+// ==== timeIt =================================================================
+// Runs fn(i) for i in [0, ops) and reports how long it took.
+// =============================================================================
+template <class Fn> static void timeIt(const string &name, long ops, Fn fn) {
+    long allocs = allocations;
+    auto start = chrono::steady_clock::now();
+    for (long i = 0; i < ops; i++) {
+        fn(i);
+    }
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+    report(name, ops, elapsed.count(), allocations - allocs);
+}
+
+// ==== timeEach ===============================================================
+// Like timeIt, but times every call too and reports the 50th, 99th & 99.9th
+// percentile latencies. The clock reads add ~40 ns to each operation, so
+// compare its throughput with other timeEach cases only.
+// =============================================================================
+template <class Fn> static void timeEach(const string &name, long ops,
+    Fn fn) {
+    vector<double> latencies(ops);
+    long allocs = allocations;
+    auto start = chrono::steady_clock::now();
+    auto before = start;
+    for (long i = 0; i < ops; i++) {
+        fn(i);
+        auto after = chrono::steady_clock::now();
+        latencies[i] = chrono::duration<double, micro>(after - before).count();
+        before = after;
+    }
+    chrono::duration<double> elapsed = before - start;
+    allocs = allocations - allocs;
+
+    auto percentile = [&](double fraction) {
+        auto nth = latencies.begin() + min((size_t)(fraction * ops),
+            latencies.size() - 1);
+        nth_element(latencies.begin(), nth, latencies.end());
+        return *nth;
+    };
+    report(name, ops, elapsed.count(), allocs, percentile(0.5),
+        percentile(0.99), percentile(0.999));
+}
+
+// ==== writeJson ==============================================================
+// Writes every result as JSON, one object per line.
+//
+// Return val:
+//      true if successful, otherwise false
+// =============================================================================
+static bool writeJson(const string &file_name) {
+    FILE* file = fopen(file_name.c_str(), "w");
+    if (file == nullptr) {
+        return false;
+    }
+    for (const Result &result : reported) {
+        string name;
+        for (char c : result.name) {
+            if (c == '"' || c == '\\') {
+                name += '\\';
+            }
+            name += c;
+        }
+        fprintf(file, "{\"name\":\"%s\",\"ops\":%ld,\"ops_per_sec\":%.1f,"
+            "\"allocs_per_op\":%.3f", name.c_str(), result.ops,
+            result.ops_per_sec, result.allocs_per_op);
+        if (result.p50 >= 0) {
+            fprintf(file, ",\"p50_us\":%.3f,\"p99_us\":%.3f,"
+                "\"p999_us\":%.3f", result.p50, result.p99, result.p999);
+        }
+        fprintf(file, "}\n");
+    }
+    return fclose(file) == 0;
+}
+
+// ==== readJson ===============================================================
+// Reads results written by writeJson.
+//
+// Return val:
+//      true if the file could be read, otherwise false
+// =============================================================================
+static bool readJson(const string &file_name, vector<Result> &baseline) {
+    FILE* file = fopen(file_name.c_str(), "r");
+    if (file == nullptr) {
+        return false;
+    }
+    auto number = [](const string &line, const string &key) {
+        size_t at = line.find("\"" + key + "\":");
+        return at == string::npos ? -1.0 :
+            strtod(line.c_str() + at + key.size() + 3, nullptr);
+    };
+    char buffer[1024];
+    while (fgets(buffer, sizeof(buffer), file) != nullptr) {
+        string line = buffer;
+        size_t at = line.find("\"name\":\"");
+        if (at == string::npos) {
+            continue;
+        }
+        Result result;
+        for (at += 8; at < line.size() && line[at] != '"'; at++) {
+            at += line[at] == '\\';
+            result.name += line[at];
+        }
+        result.ops = (long)number(line, "ops");
+        result.ops_per_sec = number(line, "ops_per_sec");
+        result.allocs_per_op = number(line, "allocs_per_op");
+        result.p50 = number(line, "p50_us");
+        result.p99 = number(line, "p99_us");
+        result.p999 = number(line, "p999_us");
+        baseline.push_back(result);
+    }
+    fclose(file);
+    return true;
+}
+
+// ==== compare ================================================================
+// Prints every case that's also in the baseline with its change in
+// throughput & p99 latency, marking the ones worse by more than tolerance
+// percent.
+//
+// Return val:
+//      number of regressions
+// =============================================================================
+static int compare(const vector<Result> &baseline, double tolerance) {
+    int regressions = 0;
+    printf("\n%-32s %14s %14s %8s %10s\n", "case", "baseline/sec",
+        "now/sec", "change", "p99 change");
+    for (const Result &result : reported) {
+        auto old = find_if(baseline.begin(), baseline.end(),
+            [&](const Result &r) { return r.name == result.name; });
+        if (old == baseline.end() || old->ops_per_sec <= 0) {
+            continue;
+        }
+        double change = 100.0 * (result.ops_per_sec / old->ops_per_sec - 1);
+        bool regressed = change < -tolerance;
+        printf("%-32s %14.0f %14.0f %7.1f%%", result.name.c_str(),
+            old->ops_per_sec, result.ops_per_sec, change);
+        if (result.p99 > 0 && old->p99 > 0) {
+            double p99_change = 100.0 * (result.p99 / old->p99 - 1);
+            regressed = regressed || p99_change > tolerance;
+            printf(" %9.1f%%", p99_change);
+        }
+        else {
+            printf(" %10s", "");
+        }
+        printf("%s\n", regressed ? "  REGRESSION" : "");
+        regressions += regressed;
+    }
+    printf("%d regressions beyond %.0f%%\n", regressions, tolerance);
+    return regressions;
+}
+
+// ==== benchGrowth ============================================================
+// Creates records in an empty raf until it holds the given number, timing
+// the creates that had to grow the raf separately from the rest.
+// =============================================================================
+static void benchGrowth(long records) {
+    unlink((BENCH_FILE + ".raf").c_str());
+    ral::File raf(BENCH_FILE, unique_ptr<ral::Record>(new BenchRecord()));
+
+    BenchRecord record;
+    chrono::duration<double> growing(0);
+    chrono::duration<double> total(0);
+    int extents = 0;
+    for (long i = 0; i < records; i++) {
+        size_t capacity = raf.getCapacity();
+        auto start = chrono::steady_clock::now();
+        record.id = raf.getNextAvailableId();
+        raf.createRecord(&record);
+        chrono::duration<double> elapsed = chrono::steady_clock::now() -
+            start;
+        total += elapsed;
+        if (raf.getCapacity() != capacity) {
+            growing += elapsed;
+            extents++;
+        }
+    }
+
+    report("createRecord (0 to " + to_string(records) + ")", records,
+        total.count());
+    printf("%-24s %10d extents %11.3f sec growing, capacity %zu\n", "grow",
+        extents, growing.count(), raf.getCapacity());
+    unlink((BENCH_FILE + ".raf").c_str());
+}
+
+// ==== benchStartup ===========================================================
+// Times creating a raf with room for the given number of records & opening
+// it again, sparse and preallocated, in both storage modes.
+// =============================================================================
+static void benchStartup(long records) {
+    for (ral::Storage storage : { ral::Storage::io, ral::Storage::mapped }) {
+        for (bool preallocate : { false, true }) {
+            string mode = string(storage == ral::Storage::io ? "io" :
+                "mapped") + (preallocate ? " prealloc" : " sparse");
+            unlink((BENCH_FILE + ".raf").c_str());
+            ral::Options options;
+            options.initial_capacity = records;
+            options.storage = storage;
+            options.preallocate = preallocate;
+
+            auto start = chrono::steady_clock::now();
+            {
+                ral::File raf(BENCH_FILE,
+                    unique_ptr<ral::Record>(new BenchRecord()), options);
+            }
+            chrono::duration<double> created = chrono::steady_clock::now() -
+                start;
+            start = chrono::steady_clock::now();
+            {
+                ral::File raf(BENCH_FILE,
+                    unique_ptr<ral::Record>(new BenchRecord()), options);
+            }
+            chrono::duration<double> opened = chrono::steady_clock::now() -
+                start;
+            printf("%-24s %10ld slots %10.2f ms create %8.2f ms open\n",
+                mode.c_str(), records, created.count() * 1000,
+                opened.count() * 1000);
+        }
+    }
+    unlink((BENCH_FILE + ".raf").c_str());
+}
+
+// ==== benchAllocation ========================================================
+// Fills a raf to the given number of records, then times closing a random
+// record & opening a new one in its place (the freed id is the only one
+// available) and reserving a block of ids at once.
+// =============================================================================
+static void benchAllocation(long records) {
+    unlink((BENCH_FILE + ".raf").c_str());
+    ral::Options options;
+    options.initial_capacity = records;
+    ral::File raf(BENCH_FILE, unique_ptr<ral::Record>(new BenchRecord()),
+        options);
+
+    vector<int> ids;
+    raf.reserveIds(records, ids);
+
+    BenchRecord record;
+    unsigned seed = 1;
+    timeIt("delete + create (full)", 100000, [&](long) {
+        seed = seed * 1103515245 + 12345;
+        record.id = ids[seed % ids.size()];
+        raf.deleteRecord(&record);
+        record.id = raf.getNextAvailableId();
+        raf.createRecord(&record);
+    });
+
+    ids.clear();
+    auto start = chrono::steady_clock::now();
+    raf.reserveIds(records, ids);
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+    report("reserveIds (per id)", records, elapsed.count());
+    unlink((BENCH_FILE + ".raf").c_str());
+}
+
+// ==== benchCache =============================================================
+// Reads from a raf of the given number of records where 90% of the reads go
+// to 2000 hot records, with & without a record cache.
+// =============================================================================
+static void benchCache(long records, long ops) {
+    for (size_t cache_records : { (size_t)0, (size_t)4096 }) {
+        unlink((BENCH_FILE + ".raf").c_str());
+        ral::Options options;
+        options.initial_capacity = records;
+        options.cache_records = cache_records;
+        ral::File raf(BENCH_FILE, unique_ptr<ral::Record>(new BenchRecord()),
+            options);
+        vector<int> ids;
+        raf.reserveIds(records, ids);
+
+        BenchRecord record;
+        unsigned seed = 1;
+        timeIt("skewed getRecord, cache " + to_string(cache_records), ops,
+            [&](long) {
+            seed = seed * 1103515245 + 12345;
+            size_t pick = seed >> 8;
+            pick = pick % (pick % 10 == 0 ? ids.size() :
+                min(ids.size(), (size_t)2000));
+            raf.getRecord(ids[pick], &record);
+        });
+
+        ral::CacheStats stats = raf.getCacheStats();
+        printf("%-24s %10lu hits %10lu misses %10lu evictions\n", "cache",
+            (unsigned long)stats.hits, (unsigned long)stats.misses,
+            (unsigned long)stats.evictions);
+    }
+    unlink((BENCH_FILE + ".raf").c_str());
+}
+
+// ==== benchBatch ============================================================
+// Reads & updates batches of 10k records of a 100k record raf through the
+// batch API & through a loop of single calls, for contiguous & random ids.
+// =============================================================================
+static void benchBatch() {
+    const long RAF_RECORDS = 100000;
+    const size_t BATCH = 10000;
+    const int ROUNDS = 20;
+
+    unlink((BENCH_FILE + ".raf").c_str());
+    ral::Options options;
+    options.initial_capacity = RAF_RECORDS;
+    ral::File raf(BENCH_FILE, unique_ptr<ral::Record>(new BenchRecord()),
+        options);
+    vector<int> all_ids;
+    raf.reserveIds(RAF_RECORDS, all_ids);
+
+    vector<BenchRecord> records(BATCH);
+    vector<ral::Record*> pointers;
+    for (BenchRecord &record : records) {
+        pointers.push_back(&record);
+    }
+
+    for (bool contiguous : { true, false }) {
+        string order = contiguous ? "contiguous" : "random";
+        vector<int> ids;
+        unsigned seed = 7;
+        for (size_t i = 0; i < BATCH; i++) {
+            seed = seed * 1103515245 + 12345;
+            ids.push_back(contiguous ? all_ids[i] :
+                all_ids[(seed >> 8) % RAF_RECORDS]);
+        }
+
+        timeIt(order + " loop get", ROUNDS * BATCH, [&](long i) {
+            raf.getRecord(ids[i % BATCH], &records[i % BATCH]);
+        });
+        // one batch call per BATCH ops so both report records/sec
+        timeIt(order + " getRecords", ROUNDS * BATCH, [&](long i) {
+            if (i % BATCH == 0) {
+                raf.getRecords(ids, pointers);
+            }
+        });
+
+        for (size_t i = 0; i < BATCH; i++) {
+            records[i].id = ids[i];
+        }
+        timeIt(order + " loop update", ROUNDS * BATCH, [&](long i) {
+            records[i % BATCH].balance = i;
+            raf.updateRecord(&records[i % BATCH]);
+        });
+        timeIt(order + " updateRecords", ROUNDS * BATCH, [&](long i) {
+            if (i % BATCH == 0) {
+                raf.updateRecords(pointers);
+            }
+        });
+    }
+    unlink((BENCH_FILE + ".raf").c_str());
+}
+
+// ==== sign ==================================================================
+// Writes a record's id & balance into its name so a torn or misplaced record
+// can be spotted by checkSigned.
+// =============================================================================
+static void sign(BenchRecord &record) {
+    snprintf(record.name, sizeof(record.name), "%d:%lld", record.id,
+        (long long)record.balance);
+}
+
+// ==== checkSigned ============================================================
+// Return val:
+//      true if the record is the one with the id & was written whole
+// =============================================================================
+static bool checkSigned(const BenchRecord &record, int id) {
+    char expected[sizeof(record.name)];
+    snprintf(expected, sizeof(expected), "%d:%lld", id,
+        (long long)record.balance);
+    return record.id == id && strcmp(record.name, expected) == 0;
+}
+
+// ==== stressConcurrency ======================================================
+// Shares a concurrent raf between 8 threads in several configurations. Each
+// thread increments its own records & reads (singly & in batches, through
+// read views when versioned) everyone else's, checking none is torn, while
+// creating & deleting records past the initial capacity so the raf grows
+// under the readers. At the end, &
+// again after reopening, every counter must match the increments made.
+//
+// Return val:
+//      true if every check passed, otherwise false
+// =============================================================================
+static bool stressConcurrency(long ops) {
+    const int THREADS = 8;
+    const int OWNED = 256;
+
+    struct Config {
+        string name;
+        ral::Storage storage;
+        size_t cache_records;
+        bool journal;
+        bool versioned;         // reads go through read views
+    };
+    const Config configs[] = {
+        { "io", ral::Storage::io, 0, false, false },
+        { "mapped", ral::Storage::mapped, 0, false, false },
+        { "io + write_back cache", ral::Storage::io, 512, false, false },
+        { "mapped + cache + journal", ral::Storage::mapped, 512, true,
+            false },
+        { "packed + cache + journal", ral::Storage::packed, 512, true,
+            false },
+        { "mapped, versioned", ral::Storage::mapped, 0, false, true },
+        { "packed + journal, versioned", ral::Storage::packed, 512, true,
+            true },
+    };
+
+    bool passed = true;
+    for (const Config &config : configs) {
+        unlink((BENCH_FILE + ".raf").c_str());
+        unlink((BENCH_FILE + ".raf.wal").c_str());
+        ral::Options options;
+        options.concurrent = true;
+        options.storage = config.storage;
+        options.cache_records = config.cache_records;
+        options.cache_policy = ral::CachePolicy::write_back;
+        options.journal = config.journal;
+        options.versioned = config.versioned;
+        options.initial_capacity = THREADS * OWNED;
+
+        atomic<long> failures(0);
+        vector<int> ids;
+        vector<long> expected(THREADS * OWNED, 0);
+        {
+            ral::File raf(BENCH_FILE,
+                unique_ptr<ral::Record>(new BenchRecord()), options);
+            raf.reserveIds(THREADS * OWNED, ids);
+            BenchRecord record;
+            for (int id : ids) {
+                record.id = id;
+                sign(record);
+                raf.updateRecord(&record);
+            }
+
+            vector<thread> threads;
+            for (int t = 0; t < THREADS; t++) {
+                threads.emplace_back([&, t]() {
+                    unsigned seed = t + 1;
+                    BenchRecord record;
+                    vector<BenchRecord> batch(16);
+                    vector<ral::Record*> batch_records;
+                    for (BenchRecord &member : batch) {
+                        batch_records.push_back(&member);
+                    }
+
+                    for (long i = 0; i < ops / THREADS; i++) {
+                        seed = seed * 1103515245 + 12345;
+                        size_t pick = (seed >> 8) % ids.size();
+                        switch ((seed >> 4) % 8) {
+                            case 4:
+                            case 5: { // increment one of this thread's
+                                size_t own = t * OWNED + pick % OWNED;
+                                if (!raf.getRecord(ids[own], &record) ||
+                                    !checkSigned(record, ids[own])) {
+                                    failures++;
+                                }
+                                record.balance++;
+                                sign(record);
+                                raf.updateRecord(&record);
+                                expected[own]++;
+                                break;
+                            }
+                            case 6: { // read a batch
+                                vector<int> batch_ids;
+                                for (size_t j = 0; j < batch.size(); j++) {
+                                    batch_ids.push_back(
+                                        ids[(pick + j * 97) % ids.size()]);
+                                }
+                                bool read;
+                                if (config.versioned) {
+                                    uint64_t view = raf.beginRead();
+                                    read = raf.getRecordsAt(view, batch_ids,
+                                        batch_records);
+                                    raf.endRead(view);
+                                }
+                                else {
+                                    read = raf.getRecords(batch_ids,
+                                        batch_records);
+                                }
+                                if (!read) {
+                                    failures++;
+                                }
+                                for (size_t j = 0; j < batch.size(); j++) {
+                                    if (!checkSigned(batch[j],
+                                        batch_ids[j])) {
+                                        failures++;
+                                    }
+                                }
+                                break;
+                            }
+                            case 7: { // create & delete a record
+                                vector<int> taken;
+                                if (raf.reserveIds(1, taken) != 1) {
+                                    failures++;
+                                    break;
+                                }
+                                record.id = taken[0];
+                                record.balance = i;
+                                sign(record);
+                                raf.updateRecord(&record);
+                                BenchRecord check;
+                                if (!raf.getRecord(taken[0], &check) ||
+                                    !checkSigned(check, taken[0])) {
+                                    failures++;
+                                }
+                                raf.deleteRecord(&record);
+                                break;
+                            }
+                            default: { // read anyone's
+                                bool read;
+                                if (config.versioned) {
+                                    uint64_t view = raf.beginRead();
+                                    read = raf.getRecordAt(view, ids[pick],
+                                        &record);
+                                    raf.endRead(view);
+                                }
+                                else {
+                                    read = raf.getRecord(ids[pick], &record);
+                                }
+                                if (!read || !checkSigned(record, ids[pick])) {
+                                    failures++;
+                                }
+                                break;
+                            }
+                        }
+                    }
+                });
+            }
+            for (thread &worker : threads) {
+                worker.join();
+            }
+
+            if (raf.getRecordCount() != ids.size()) {
+                failures++;
+            }
+            for (size_t i = 0; i < ids.size(); i++) {
+                if (!raf.getRecord(ids[i], &record) ||
+                    !checkSigned(record, ids[i]) ||
+                    record.balance != expected[i]) {
+                    failures++;
+                }
+            }
+        }
+
+        // everything must have reached the raf
+        ral::File raf(BENCH_FILE, unique_ptr<ral::Record>(new BenchRecord()),
+            options);
+        BenchRecord record;
+        for (size_t i = 0; i < ids.size(); i++) {
+            if (!raf.getRecord(ids[i], &record) ||
+                !checkSigned(record, ids[i]) ||
+                record.balance != expected[i]) {
+                failures++;
+            }
+        }
+
+        printf("%-24s %s (%ld failures, capacity %zu)\n",
+            ("stress " + config.name).c_str(),
+            failures == 0 ? "ok" : "FAILED", failures.load(),
+            raf.getCapacity());
+        passed = passed && failures == 0;
+    }
+
+    unlink((BENCH_FILE + ".raf").c_str());
+    unlink((BENCH_FILE + ".raf.wal").c_str());
+    return passed;
+}
+
+// ==== stressCrash ============================================================
+// Kills (SIGKILL) a child process that creates, updates & deletes records of
+// a raf from 4 threads, at a random moment, a few times per configuration,
+// then reopens the raf & verifies it. No free id may hold a record, no
+// used id may be missing its record (both only with a journal, since a
+// raf without one sets a create's bit before writing its slot) & every
+// record must be whole.
+//
+// Return val:
+//      true if every check passed, otherwise false
+// =============================================================================
+static bool stressCrash() {
+    const int THREADS = 4;
+    const int ROUNDS = 5;
+
+    struct Config {
+        string name;
+        ral::Storage storage;
+        bool journal;
+        ral::Sync sync;
+    };
+    const Config configs[] = {
+        { "io", ral::Storage::io, false, ral::Sync::none },
+        { "mapped + journal", ral::Storage::mapped, true, ral::Sync::data },
+        { "packed + journal", ral::Storage::packed, true, ral::Sync::none },
+    };
+
+    bool passed = true;
+    unsigned seed = 1;
+    for (const Config &config : configs) {
+        for (string suffix : { ".raf", ".raf.wal", ".raf.dwb" }) {
+            unlink((BENCH_FILE + suffix).c_str());
+        }
+        ral::Options options;
+        options.concurrent = true;
+        options.storage = config.storage;
+        options.cache_records = 512;
+        options.journal = config.journal;
+        options.sync = config.sync;
+
+        long failures = 0;
+        for (int round = 0; round < ROUNDS; round++) {
+            fflush(stdout);
+            pid_t child = fork();
+            if (child == 0) {
+                ral::File raf(BENCH_FILE,
+                    unique_ptr<ral::Record>(new BenchRecord()), options);
+                vector<thread> threads;
+                for (int t = 0; t < THREADS; t++) {
+                    threads.emplace_back([&, t]() {
+                        unsigned seed = t + 1 + round * THREADS;
+                        BenchRecord record;
+                        vector<int> created;
+                        for (long i = 0; ; i++) {
+                            seed = seed * 1103515245 + 12345;
+                            if ((seed >> 8) % 3 > 0 || created.empty()) {
+                                record.id = raf.getNextAvailableId();
+                                record.balance = i;
+                                sign(record);
+                                if (raf.createRecord(&record)) {
+                                    created.push_back(record.id);
+                                }
+                                continue;
+                            }
+                            size_t pick = (seed >> 4) % created.size();
+                            record.id = created[pick];
+                            record.balance = i;
+                            sign(record);
+                            if ((seed >> 12) % 2 == 0) {
+                                raf.updateRecord(&record);
+                                continue;
+                            }
+                            raf.deleteRecord(&record);
+                            created[pick] = created.back();
+                            created.pop_back();
+                        }
+                    });
+                }
+                for (thread &worker : threads) {
+                    worker.join();
+                }
+                _exit(0);
+            }
+            seed = seed * 1103515245 + 12345;
+            usleep(50000 + (seed >> 8) % 200000);
+            kill(child, SIGKILL);
+            waitpid(child, nullptr, 0);
+
+            ral::File raf(BENCH_FILE,
+                unique_ptr<ral::Record>(new BenchRecord()), options);
+            ral::VerifyReport report;
+            if (!raf.verifyFile(report)) {
+                failures++;
+                continue;
+            }
+            failures += report.corrupt.size() + report.orphaned.size();
+            if (config.journal) {
+                failures += report.unwritten.size();
+            }
+            vector<int> ids;
+            raf.getUsedIds(ids);
+            BenchRecord record;
+            for (int id : ids) {
+                if (!raf.getRecord(id, &record) ||
+                    (!checkSigned(record, id) &&
+                    (config.journal || record.id != 0))) {
+                    failures++;
+                }
+            }
+        }
+
+        printf("%-24s %s (%ld failures, %d kills)\n",
+            ("stress crash " + config.name).c_str(),
+            failures == 0 ? "ok" : "FAILED", failures, ROUNDS);
+        passed = passed && failures == 0;
+    }
+
+    for (string suffix : { ".raf", ".raf.wal", ".raf.dwb" }) {
+        unlink((BENCH_FILE + suffix).c_str());
+    }
+    return passed;
+}
+
+// ==== benchScaling ===========================================================
+// Times a 90% getRecord / 10% updateRecord mix over 100k records of a
+// concurrent raf from 1 thread up to one per core.
+// =============================================================================
+static void benchScaling(long ops) {
+    const long RAF_RECORDS = 100000;
+    unsigned cores = max(thread::hardware_concurrency(), 1u);
+
+    for (ral::Storage storage : { ral::Storage::io, ral::Storage::mapped }) {
+        unlink((BENCH_FILE + ".raf").c_str());
+        ral::Options options;
+        options.concurrent = true;
+        options.storage = storage;
+        options.initial_capacity = RAF_RECORDS;
+        ral::File raf(BENCH_FILE, unique_ptr<ral::Record>(new BenchRecord()),
+            options);
+        vector<int> ids;
+        raf.reserveIds(RAF_RECORDS, ids);
+
+        string mode = storage == ral::Storage::io ? "io" : "mapped";
+        for (unsigned threads = 1; threads <= cores;
+            threads = threads == cores ? cores + 1 : min(threads * 2, cores)) {
+            auto start = chrono::steady_clock::now();
+            vector<thread> workers;
+            for (unsigned t = 0; t < threads; t++) {
+                workers.emplace_back([&, t]() {
+                    unsigned seed = t + 1;
+                    BenchRecord record;
+                    for (long i = t; i < ops; i += threads) {
+                        seed = seed * 1103515245 + 12345;
+                        int id = ids[(seed >> 8) % ids.size()];
+                        if ((seed >> 4) % 10 == 0) {
+                            record.id = id;
+                            raf.updateRecord(&record);
+                        }
+                        else {
+                            raf.getRecord(id, &record);
+                        }
+                    }
+                });
+            }
+            for (thread &worker : workers) {
+                worker.join();
+            }
+            chrono::duration<double> elapsed =
+                chrono::steady_clock::now() - start;
+            report(mode + " mix, " + to_string(threads) + " threads", ops,
+                elapsed.count());
+        }
+    }
+    unlink((BENCH_FILE + ".raf").c_str());
+}
+
+// ==== benchDurability ========================================================
+// Times durable updates: fdatasync of the raf per update, a journal commit
+// per update, a journal commit per batch of 100 queued updates & journal
+// commits issued by 8 threads at once (grouped into shared fdatasyncs).
+// =============================================================================
+static void benchDurability(long ops) {
+    const int THREADS = 8;
+    for (bool journaled : { false, true }) {
+        unlink((BENCH_FILE + ".raf").c_str());
+        unlink((BENCH_FILE + ".raf.wal").c_str());
+        ral::Options options;
+        options.journal = journaled;
+        ral::File raf(BENCH_FILE, unique_ptr<ral::Record>(new BenchRecord()),
+            options);
+        vector<int> ids;
+        raf.reserveIds(RECORDS, ids);
+
+        BenchRecord record;
+        string mode = journaled ? "journal" : "in place";
+        timeIt(mode + " update+sync", ops, [&](long i) {
+            record.id = ids[i % RECORDS];
+            raf.updateRecord(&record, ral::Sync::data);
+        });
+
+        if (!journaled) {
+            continue;
+        }
+        timeIt(mode + " update, sync/100", ops, [&](long i) {
+            record.id = ids[i % RECORDS];
+            raf.updateRecord(&record, ral::Sync::none);
+            if (i % 100 == 99) {
+                raf.sync(ral::Sync::data);
+            }
+        });
+    }
+
+    ral::Journal journal(BENCH_FILE + ".wal", sizeof(BenchFields),
+        [](const vector<pair<int, const char*>>&) { return true; },
+        []() { return true; });
+    uint64_t commits = journal.getStats().commits;
+    auto start = chrono::steady_clock::now();
+    vector<thread> threads;
+    for (int t = 0; t < THREADS; t++) {
+        threads.emplace_back([&, t]() {
+            BenchRecord record;
+            char serialized_record[sizeof(BenchFields)];
+            for (long i = t; i < ops; i += THREADS) {
+                record.id = (i % RECORDS + 1) * 10;
+                record.encode(serialized_record);
+                journal.commit(journal.append(record.id, serialized_record));
+            }
+        });
+    }
+    for (thread &worker : threads) {
+        worker.join();
+    }
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+    report("journal commit, 8 threads", ops, elapsed.count());
+    printf("%-24s %10lu fdatasyncs\n", "group commit",
+        (unsigned long)(journal.getStats().commits - commits));
+
+    unlink((BENCH_FILE + ".raf").c_str());
+    unlink((BENCH_FILE + ".raf.wal").c_str());
+    unlink((BENCH_FILE + ".wal").c_str());
+}
+
+// ==== benchPosting ===========================================================
+// Applies postings to 4M balances with Bank::postBalances: once to every
+// balance in order (like posting interest) & once to random balances. A
+// tenth of the postings are withdrawals too large to be applied.
+// =============================================================================
+static void benchPosting() {
+    const size_t BALANCES = 4 << 20;
+    vector<int64_t> balances(BALANCES, 100000);
+    vector<Bank::Posting> postings(BALANCES);
+    vector<Bank::Result> results(BALANCES);
+    srand(7);
+
+    for (bool random : { false, true }) {
+        size_t expected = 0;
+        for (size_t i = 0; i < BALANCES; i++) {
+            postings[i].slot = random ? rand() % BALANCES : i;
+            postings[i].delta = i % 10 == 0 ? -1000000 : (int64_t)(i % 97);
+            expected += i % 10 != 0;
+        }
+
+        auto start = chrono::steady_clock::now();
+        size_t applied = Bank::postBalances(balances.data(), postings.data(),
+            postings.size(), results.data());
+        chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+        report(random ? "postBalances random" : "postBalances in order",
+            postings.size(), elapsed.count());
+        if (applied != expected) {
+            printf("postBalances applied %zu postings, expected %zu\n",
+                applied, expected);
+        }
+    }
+}
+
+// ==== benchColumns ===========================================================
+// Runs the same filtered report (count & sum of the balances in a range) over
+// 1M records twice: by reading every record with getRecords, & by scanning
+// the ral::ColumnStore the raf feeds. Both report records scanned per second.
+// =============================================================================
+static void benchColumns() {
+    const size_t RAF_RECORDS = 1 << 20;
+    const size_t BATCH = 4096;
+    const int64_t LOW = 25000, HIGH = 75000;
+
+    unlink((BENCH_FILE + ".raf").c_str());
+    unlink((BENCH_FILE + ".col").c_str());
+    ral::ColumnStore columns(BENCH_FILE + ".col", [](const char* record,
+        int64_t &value, string &name) {
+        BenchFields fields;
+        memcpy(&fields, record, sizeof(fields));
+        value = fields.balance;
+        name.assign(fields.name, strnlen(fields.name, sizeof(fields.name)));
+        return fields.id != 0;
+    });
+    ral::Options options;
+    options.initial_capacity = RAF_RECORDS;
+    options.projection = &columns;
+    ral::File raf(BENCH_FILE, unique_ptr<ral::Record>(new BenchRecord()),
+        options);
+
+    vector<BenchRecord> records(BATCH);
+    vector<ral::Record*> pointers;
+    for (BenchRecord &record : records) {
+        pointers.push_back(&record);
+    }
+    vector<int> ids;
+    raf.reserveIds(RAF_RECORDS, ids);
+    for (size_t first = 0; first < RAF_RECORDS; first += BATCH) {
+        for (size_t i = 0; i < BATCH; i++) {
+            records[i].id = ids[first + i];
+            records[i].balance = (first + i) * 7919 % 100000;
+            snprintf(records[i].name, sizeof(records[i].name), "holder %zu",
+                first + i);
+        }
+        raf.updateRecords(pointers);
+    }
+
+    size_t expected = 0;
+    int64_t expected_sum = 0;
+    timeIt("report getRecords", RAF_RECORDS, [&](long i) {
+        if (i % BATCH != 0) {
+            return;
+        }
+        vector<int> batch(ids.begin() + i, ids.begin() + i + BATCH);
+        raf.getRecords(batch, pointers);
+        for (const BenchRecord &record : records) {
+            bool match = record.balance >= LOW && record.balance <= HIGH;
+            expected += match;
+            expected_sum += match ? record.balance : 0;
+        }
+    });
+
+    ral::ColumnFilter filter;
+    filter.min_value = LOW;
+    filter.max_value = HIGH;
+    ral::ColumnSummary summary;
+    timeIt("report ColumnStore", RAF_RECORDS, [&](long i) {
+        if (i == 0) {
+            summary = columns.summarize(filter);
+        }
+    });
+    if (summary.count != expected || summary.sum != expected_sum) {
+        printf("ColumnStore matched %zu records (sum %lld), expected %zu "
+            "(sum %lld)\n", summary.count, (long long)summary.sum, expected,
+            (long long)expected_sum);
+    }
+
+    filter.name_prefix = "holder 1";
+    timeIt("report prefix", RAF_RECORDS, [&](long i) {
+        if (i == 0) {
+            summary = columns.summarize(filter);
+        }
+    });
+    unlink((BENCH_FILE + ".raf").c_str());
+    unlink((BENCH_FILE + ".col").c_str());
+}
+
+// ==== benchSweep =============================================================
+// Runs the life of a raf at each size in records: creating that many
+// records, reopening it, random getRecord/updateRecord mixes of 100%, 90%,
+// 50% & 0% reads, then deleting every record in random order. Every
+// operation is timed for the latency percentiles.
+// =============================================================================
+static void benchSweep(const vector<long> &sizes, long ops) {
+    for (long records : sizes) {
+        string size = " @" + to_string(records);
+        unlink((BENCH_FILE + ".raf").c_str());
+        unique_ptr<ral::File> raf(new ral::File(BENCH_FILE,
+            unique_ptr<ral::Record>(new BenchRecord())));
+
+        BenchRecord record;
+        vector<int> ids;
+        timeEach("createRecord" + size, records, [&](long) {
+            record.id = raf->getNextAvailableId();
+            raf->createRecord(&record);
+            ids.push_back(record.id);
+        });
+
+        timeEach("open" + size, 20, [&](long) {
+            raf.reset();
+            raf.reset(new ral::File(BENCH_FILE,
+                unique_ptr<ral::Record>(new BenchRecord())));
+        });
+
+        for (int reads : { 100, 90, 50, 0 }) {
+            unsigned seed = 1;
+            string mix = reads == 100 ? "getRecord" : reads == 0 ?
+                "updateRecord" : "mix " + to_string(reads) + "r/" +
+                to_string(100 - reads) + "w";
+            timeEach(mix + size, ops, [&](long i) {
+                seed = seed * 1103515245 + 12345;
+                int id = ids[(seed >> 8) % ids.size()];
+                if ((long)((seed >> 4) % 100) < reads) {
+                    raf->getRecord(id, &record);
+                }
+                else {
+                    record.id = id;
+                    record.balance = i;
+                    raf->updateRecord(&record);
+                }
+            });
+        }
+
+        unsigned seed = 3;
+        for (size_t i = ids.size(); i > 1; i--) {
+            seed = seed * 1103515245 + 12345;
+            swap(ids[i - 1], ids[(seed >> 8) % i]);
+        }
+        timeEach("deleteRecord" + size, records, [&](long i) {
+            record.id = ids[i];
+            raf->deleteRecord(&record);
+        });
+    }
+    unlink((BENCH_FILE + ".raf").c_str());
+}
+
+// ==== benchBank ==============================================================
+// Drives a Bank through its non-interactive API the way the server does:
+// opening accounts, then random deposits, withdrawals, balance checks &
+// logins, committed every 100 operations, then closing every account. Also
+// times whole-book audits, deposits made while one runs, deposits &
+// transfers committed one at a time & payrolls of 1000 payments, each
+// committed as one transaction.
+// =============================================================================
+static void benchBank(long ops) {
+    const int ACCOUNTS = 10000;
+    const string BANK_FILE = BENCH_FILE + "_bank";
+    auto remove = [&]() {
+        for (string suffix : { ".raf", ".raf.wal", ".raf.dwb", ".idx", ".col",
+            ".key" }) {
+            unlink((BANK_FILE + suffix).c_str());
+        }
+    };
+    remove();
+
+    {
+        Bank bank(BANK_FILE);
+        bank.setDeferredSync(true);
+        vector<int> ids(ACCOUNTS);
+        vector<string> names(ACCOUNTS);
+        int64_t balance;
+        timeEach("Bank openAccount", ACCOUNTS, [&](long i) {
+            names[i] = "holder " + to_string(i);
+            bank.openAccount(names[i], 100000, ids[i], balance);
+            if (i % 100 == 99) {
+                bank.sync();
+            }
+        });
+
+        unsigned seed = 1;
+        auto pick = [&]() {
+            seed = seed * 1103515245 + 12345;
+            return (seed >> 8) % ACCOUNTS;
+        };
+        timeEach("Bank deposit", ops, [&](long i) {
+            bank.deposit(ids[pick()], 100, balance);
+            if (i % 100 == 99) {
+                bank.sync();
+            }
+        });
+        timeEach("Bank withdraw", ops, [&](long i) {
+            bank.withdraw(ids[pick()], 100, balance);
+            if (i % 100 == 99) {
+                bank.sync();
+            }
+        });
+        timeEach("Bank getBalance", ops, [&](long) {
+            bank.getBalance(ids[pick()], balance);
+        });
+        timeEach("Bank checkLogin", ops, [&](long) {
+            size_t account = pick();
+            bank.checkLogin(ids[account], names[account], balance);
+        });
+
+        // deposits while another thread audits the whole book back to back
+        int64_t total;
+        size_t accounts;
+        timeIt("Bank auditBook", 20, [&](long) {
+            bank.auditBook(total, accounts);
+        });
+        atomic<bool> auditing(true);
+        atomic<long> audits(0);
+        thread auditor([&]() {
+            while (auditing) {
+                bank.auditBook(total, accounts);
+                audits++;
+            }
+        });
+        timeEach("Bank deposit, auditing", ops, [&](long i) {
+            bank.deposit(ids[pick()], 100, balance);
+            if (i % 100 == 99) {
+                bank.sync();
+            }
+        });
+        auditing = false;
+        auditor.join();
+        printf("%-24s %10ld audits alongside\n", "Bank auditBook", audits.load());
+
+        bank.setDeferredSync(false);
+        timeEach("Bank deposit+commit", ops / 20, [&](long) {
+            bank.deposit(ids[pick()], 100, balance);
+        });
+        timeEach("Bank transfer+commit", ops / 20, [&](long) {
+            bank.transfer(ids[pick()], ids[pick()], 1, balance);
+        });
+        const size_t PAYEES = 1000;
+        vector<Bank::Payment> payroll;
+        for (size_t i = 1; i <= PAYEES; i++) {
+            payroll.push_back({ ids[i], 1 });
+        }
+        timeIt("Bank payroll payment", ops / 10, [&](long i) {
+            if (i % PAYEES == 0) {
+                bank.transfer(ids[0], payroll, balance);
+            }
+        });
+
+        bank.setDeferredSync(true);
+        timeEach("Bank closeAccount", ACCOUNTS, [&](long i) {
+            bank.closeAccount(ids[i]);
+            if (i % 100 == 99) {
+                bank.sync();
+            }
+        });
+        bank.sync();
+    }
+    remove();
+}
+
+// ==== benchShards ============================================================
+// Splits a Bank of 10000 accounts across 1, 2 & 4 shards & times batches of
+// 1000 random deposits applied (each shard on its worker) & synced, then
+// whole-book audits.
+// =============================================================================
+static void benchShards(long ops) {
+    const int ACCOUNTS = 10000;
+    const long BATCH = 1000;
+    for (size_t count : { 1, 2, 4 }) {
+        vector<string> shard_names;
+        for (size_t i = 0; i < count; i++) {
+            shard_names.push_back(BENCH_FILE + "_shard" + to_string(i));
+        }
+        auto remove = [&]() {
+            for (const string &name : shard_names) {
+                for (string suffix : { ".raf", ".raf.wal", ".raf.dwb",
+                    ".idx", ".col", ".key", ".intents" }) {
+                    unlink((name + suffix).c_str());
+                }
+            }
+        };
+        remove();
+
+        {
+            Bank bank(shard_names);
+            bank.setDeferredSync(true);
+            vector<Bank::Transaction> batch(ACCOUNTS);
+            for (Bank::Transaction &transaction : batch) {
+                transaction.op = Bank::Transaction::Op::create;
+                transaction.amount = 100000;
+                transaction.name = "holder";
+            }
+            bank.applyTransactions(batch);
+            bank.sync();
+            vector<int> ids;
+            for (const Bank::Transaction &transaction : batch) {
+                ids.push_back(transaction.id);
+            }
+
+            string shards = ", " + to_string(count) + " shard" +
+                (count == 1 ? "" : "s");
+            unsigned seed = 1;
+            batch.resize(BATCH);
+            timeIt("Bank apply+sync" + shards, ops, [&](long i) {
+                if (i % BATCH != 0) {
+                    return;
+                }
+                for (Bank::Transaction &transaction : batch) {
+                    seed = seed * 1103515245 + 12345;
+                    transaction.op = Bank::Transaction::Op::deposit;
+                    transaction.id = ids[(seed >> 8) % ACCOUNTS];
+                    transaction.amount = 100;
+                }
+                bank.applyTransactions(batch);
+                bank.sync();
+            });
+            int64_t total;
+            size_t accounts;
+            timeIt("Bank auditBook" + shards, 20, [&](long) {
+                bank.auditBook(total, accounts);
+            });
+        }
+        remove();
+    }
+}
+
+// ==== benchStats =============================================================
+// Times getRecord & updateRecord on 100 records with ral::Stats off, on
+// (sampling the default one in 16) & timing every operation, to show what
+// the instrumentation costs.
+// =============================================================================
+static void benchStats(long ops) {
+    for (ral::Storage storage : { ral::Storage::io, ral::Storage::mapped }) {
+        unlink((BENCH_FILE + ".raf").c_str());
+        ral::Options options;
+        options.storage = storage;
+        ral::File raf(BENCH_FILE, unique_ptr<ral::Record>(new BenchRecord()),
+            options);
+        vector<int> ids;
+        raf.reserveIds(RECORDS, ids);
+
+        string mode = storage == ral::Storage::io ? "io" : "mapped";
+        BenchRecord record;
+        for (uint32_t sampling : { 0u, ral::Stats::DEFAULT_SAMPLING, 1u }) {
+            ral::Stats::setEnabled(sampling != 0);
+            ral::Stats::setSampling(max(sampling, 1u));
+            string stats = sampling == 0 ? "off" : "1/" +
+                to_string(sampling);
+            timeIt(mode + " get, stats " + stats, ops, [&](long i) {
+                raf.getRecord(ids[i % RECORDS], &record);
+            });
+            timeIt(mode + " update, stats " + stats, ops, [&](long i) {
+                record.id = ids[i % RECORDS];
+                raf.updateRecord(&record);
+            });
+        }
+        ral::Stats::setEnabled(true);
+        ral::Stats::setSampling(ral::Stats::DEFAULT_SAMPLING);
+    }
+    unlink((BENCH_FILE + ".raf").c_str());
+}
+
+// ==== benchAsync =============================================================
+// Reads random records of a raf of the given size one at a time with
+// getRecord & 64 at a time with getRecordAsync, then does the same with
+// updates synced with fdatasync. The async cases run through io_uring &
+// again with the Ring's plain I/O fallback.
+// =============================================================================
+static void benchAsync(long records, long ops) {
+    const size_t DEPTH = 64;
+    unlink((BENCH_FILE + ".raf").c_str());
+    ral::File raf(BENCH_FILE, unique_ptr<ral::Record>(new BenchRecord()));
+    vector<int> ids;
+    raf.reserveIds(records, ids);
+    vector<int> order(ops);
+    unsigned seed = 1;
+    for (long i = 0; i < ops; i++) {
+        seed = seed * 1103515245 + 12345;
+        order[i] = ids[(seed >> 8) % ids.size()];
+    }
+
+    BenchRecord record;
+    timeIt("sync get, random", ops, [&](long i) {
+        raf.getRecord(order[i], &record);
+    });
+    long update_ops = max(ops / 20, 1L);
+    timeIt("sync update+fdatasync", update_ops, [&](long i) {
+        record.id = order[i];
+        raf.updateRecord(&record, ral::Sync::data);
+    });
+
+    // each case gets a new thread, so a new Ring
+    for (bool ring : { true, false }) {
+        thread([&]() {
+            ral::Ring::setEnabled(ring);
+            string mode = !ral::Ring::local().usesIoUring() ? "fallback" :
+                "ring";
+            bool failed = false;
+            auto done = [&](bool succeeded) { failed |= !succeeded; };
+            timeIt(mode + " get, depth 64", ops, [&](long i) {
+                if (ral::File::getPendingAsync() == DEPTH) {
+                    ral::File::completeAsync(1);
+                }
+                raf.getRecordAsync(order[i], &record, done);
+            });
+            ral::File::completeAsync(ral::File::getPendingAsync());
+
+            // ids in order, so no record has two writes in flight
+            timeIt(mode + " update+fdatasync, 64", update_ops, [&](long i) {
+                if (ral::File::getPendingAsync() == DEPTH) {
+                    ral::File::completeAsync(1);
+                }
+                record.id = ids[i % ids.size()];
+                raf.updateRecordAsync(&record, ral::Sync::data, done);
+            });
+            ral::File::completeAsync(ral::File::getPendingAsync());
+            if (failed) {
+                printf("%s: an async operation failed\n", mode.c_str());
+            }
+        }).join();
+    }
+    ral::Ring::setEnabled(true);
+    unlink((BENCH_FILE + ".raf").c_str());
+}
+
+// ==== benchCipher ============================================================
+// Times single & batched reads & updates of a 10k record raf in plaintext &
+// encrypted, then seals & opens bare records 1000 at a time with AES-NI &
+// with the portable tables, to show what encryption at rest costs.
+// =============================================================================
+static void benchCipher(long ops) {
+    const long RAF_RECORDS = 10000;
+    const size_t BATCH = 1000;
+    const string KEY(ral::Cipher::KEY_SIZE, 'k');
+
+    for (bool encrypted : { false, true }) {
+        string mode = encrypted ? "sealed" : "plain";
+        unlink((BENCH_FILE + ".raf").c_str());
+        ral::Options options;
+        options.initial_capacity = RAF_RECORDS;
+        options.key = encrypted ? KEY : "";
+        ral::File raf(BENCH_FILE, unique_ptr<ral::Record>(new BenchRecord()),
+            options);
+        vector<int> ids;
+        raf.reserveIds(RAF_RECORDS, ids);
+
+        BenchRecord record;
+        timeIt(mode + " getRecord", ops, [&](long i) {
+            raf.getRecord(ids[i % RAF_RECORDS], &record);
+        });
+        timeIt(mode + " updateRecord", ops, [&](long i) {
+            record.id = ids[i % RAF_RECORDS];
+            record.balance = i;
+            raf.updateRecord(&record);
+        });
+
+        vector<BenchRecord> records(BATCH);
+        vector<ral::Record*> pointers;
+        vector<int> batch_ids(ids.begin(), ids.begin() + BATCH);
+        for (size_t i = 0; i < BATCH; i++) {
+            records[i].id = batch_ids[i];
+            pointers.push_back(&records[i]);
+        }
+        // one batch call per BATCH ops so they report records/sec
+        timeIt(mode + " getRecords", ops, [&](long i) {
+            if (i % BATCH == 0) {
+                raf.getRecords(batch_ids, pointers);
+            }
+        });
+        timeIt(mode + " updateRecords", ops, [&](long i) {
+            if (i % BATCH == 0) {
+                raf.updateRecords(pointers);
+            }
+        });
+    }
+    unlink((BENCH_FILE + ".raf").c_str());
+
+    string plain(BATCH * sizeof(BenchFields), 'p');
+    string sealed(BATCH * (sizeof(BenchFields) + ral::Cipher::OVERHEAD), '\0');
+    vector<uint64_t> associated(BATCH);
+    for (size_t i = 0; i < BATCH; i++) {
+        associated[i] = (i + 1) * 10;
+    }
+    for (bool hardware : { true, false }) {
+        ral::Cipher cipher(KEY, hardware);
+        if (hardware && !cipher.usesHardware()) {
+            printf("no AES-NI, skipping the hardware cipher\n");
+            continue;
+        }
+        string mode = hardware ? "aes-ni" : "tables";
+        timeIt(mode + " seal", ops, [&](long i) {
+            if (i % BATCH == 0) {
+                cipher.sealMany(plain.data(), &sealed[0],
+                    sizeof(BenchFields), associated.data(), BATCH);
+            }
+        });
+        timeIt(mode + " open", ops, [&](long i) {
+            if (i % BATCH == 0) {
+                cipher.openMany(sealed.data(), &plain[0],
+                    sizeof(BenchFields), associated.data(), BATCH);
+            }
+        });
+    }
+}
+
+// ==== benchChecksum ==========================================================
+// Times the CRC-32C of one slot with the crc32 instruction, with the table &
+// a slot at a time out of batches of 1000, then verifies a raf of the given
+// number of records with one thread & with one per CPU.
+// =============================================================================
+static void benchChecksum(long records, long ops) {
+    const size_t BATCH = 1000;
+    const size_t SLOT = sizeof(BenchFields);
+    string slots(BATCH * SLOT, 's');
+    vector<const void*> buffers;
+    vector<uint32_t> crcs(BATCH);
+    for (size_t i = 0; i < BATCH; i++) {
+        buffers.push_back(&slots[i * SLOT]);
+    }
+
+    volatile uint32_t crc;      // keeps the single crcs from being dropped
+    if (ral::crc32cHardware()) {
+        timeIt("crc32c slot", ops, [&](long i) {
+            crc = ral::crc32c(buffers[i % BATCH], SLOT, i);
+        });
+    }
+    else {
+        printf("no SSE4.2, crc32c uses the table\n");
+    }
+    timeIt("crc32c table slot", ops, [&](long i) {
+        crc = ral::crc32cPortable(buffers[i % BATCH], SLOT, i);
+    });
+    timeIt("crc32cMany slot", ops, [&](long i) {
+        if (i % BATCH == 0) {
+            ral::crc32cMany(buffers.data(), SLOT, BATCH, crcs.data());
+        }
+    });
+
+    unlink((BENCH_FILE + ".raf").c_str());
+    ral::Options options;
+    options.initial_capacity = records;
+    ral::File raf(BENCH_FILE, unique_ptr<ral::Record>(new BenchRecord()),
+        options);
+    vector<int> ids;
+    raf.reserveIds(records, ids);
+    vector<BenchRecord> batch(BATCH);
+    vector<ral::Record*> pointers;
+    for (BenchRecord &record : batch) {
+        pointers.push_back(&record);
+    }
+    for (size_t first = 0; first < ids.size(); first += BATCH) {
+        size_t count = min(BATCH, ids.size() - first);
+        for (size_t i = 0; i < count; i++) {
+            batch[i].id = ids[first + i];
+        }
+        pointers.resize(count);
+        raf.updateRecords(pointers);
+    }
+
+    size_t cpus = max(thread::hardware_concurrency(), 1u);
+    for (size_t threads : { (size_t)1, cpus }) {
+        ral::VerifyReport found;
+        auto start = chrono::steady_clock::now();
+        raf.verifyFile(found, false, threads);
+        chrono::duration<double> elapsed = chrono::steady_clock::now() -
+            start;
+        report("verifyFile " + to_string(threads) + " thread" +
+            (threads == 1 ? "" : "s"), found.slots, elapsed.count());
+        if (cpus == 1) {
+            break;
+        }
+    }
+    unlink((BENCH_FILE + ".raf").c_str());
+}
+
+// ==== benchSnapshot ==========================================================
+// Times a full snapshot of a raf of the given number of records, one after
+// 0.1% of them changed, & updates with & without snapshots being taken.
+// =============================================================================
+static void benchSnapshot(long records, long ops) {
+    const size_t BATCH = 1000;
+    const string SNAPSHOT_FILE = BENCH_FILE + "_snapshot";
+    unlink((BENCH_FILE + ".raf").c_str());
+    unlink((SNAPSHOT_FILE + ".raf").c_str());
+    ral::Options options;
+    options.initial_capacity = records;
+    options.concurrent = true;
+    ral::File raf(BENCH_FILE, unique_ptr<ral::Record>(new BenchRecord()),
+        options);
+    vector<int> ids;
+    raf.reserveIds(records, ids);
+    vector<BenchRecord> batch(BATCH);
+    vector<ral::Record*> pointers;
+    for (BenchRecord &record : batch) {
+        pointers.push_back(&record);
+    }
+    for (size_t first = 0; first < ids.size(); first += BATCH) {
+        size_t count = min(BATCH, ids.size() - first);
+        for (size_t i = 0; i < count; i++) {
+            batch[i].id = ids[first + i];
+        }
+        pointers.resize(count);
+        raf.updateRecords(pointers);
+    }
+
+    // a full copy, then one of the 0.1% of slots changed since
+    ral::SnapshotReport found;
+    auto start = chrono::steady_clock::now();
+    raf.beginSnapshot(SNAPSHOT_FILE);
+    raf.endSnapshot(found);
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+    report("snapshot full", records, elapsed.count());
+
+    BenchRecord record;
+    for (long i = 0; i < records / 1000; i++) {
+        record.id = ids[(i * 7919) % ids.size()];
+        raf.updateRecord(&record, ral::Sync::none);
+    }
+    start = chrono::steady_clock::now();
+    raf.beginSnapshot(SNAPSHOT_FILE);
+    raf.endSnapshot(found);
+    elapsed = chrono::steady_clock::now() - start;
+    report("snapshot 0.1% changed", records, elapsed.count());
+
+    // writers while snapshots are taken back to back
+    timeIt("updateRecord no snapshot", ops, [&](long i) {
+        record.id = ids[(i * 7919) % ids.size()];
+        raf.updateRecord(&record, ral::Sync::none);
+    });
+    atomic<bool> writing(true);
+    thread snapshots([&]() {
+        ral::SnapshotReport taken;
+        while (writing) {
+            raf.beginSnapshot(SNAPSHOT_FILE);
+            raf.endSnapshot(taken);
+        }
+    });
+    timeIt("updateRecord during snapshots", ops, [&](long i) {
+        record.id = ids[(i * 7919) % ids.size()];
+        raf.updateRecord(&record, ral::Sync::none);
+    });
+    writing = false;
+    snapshots.join();
+    unlink((BENCH_FILE + ".raf").c_str());
+    unlink((SNAPSHOT_FILE + ".raf").c_str());
+}
+
+// ==== benchPacked ============================================================
+// Fills a raf of the given number of records with short names in fixed
+// slots & packed into pages, printing the bytes each takes on disk, then
+// times random reads & updates of both.
+// =============================================================================
+static void benchPacked(long records, long ops) {
+    const size_t BATCH = 1000;
+    for (ral::Storage storage : { ral::Storage::io, ral::Storage::packed }) {
+        string mode = storage == ral::Storage::io ? "io" : "packed";
+        for (string suffix : { ".raf", ".raf.wal", ".raf.dwb" }) {
+            unlink((BENCH_FILE + suffix).c_str());
+        }
+        ral::Options options;
+        options.storage = storage;
+        options.journal = storage == ral::Storage::packed;
+        options.initial_capacity = records;
+        vector<int> ids;
+        {
+            // closed once filled, so the journal is checkpointed into the
+            // raf before it's measured
+            ral::File raf(BENCH_FILE,
+                unique_ptr<ral::Record>(new BenchRecord()), options);
+            raf.reserveIds(records, ids);
+            vector<BenchRecord> batch(BATCH);
+            vector<ral::Record*> pointers;
+            for (BenchRecord &record : batch) {
+                pointers.push_back(&record);
+            }
+            for (size_t first = 0; first < ids.size(); first += BATCH) {
+                size_t count = min(BATCH, ids.size() - first);
+                for (size_t i = 0; i < count; i++) {
+                    batch[i].id = ids[first + i];
+                    snprintf(batch[i].name, sizeof(batch[i].name),
+                        "holder %zu", first + i);
+                }
+                pointers.resize(count);
+                raf.updateRecords(pointers);
+            }
+            raf.sync(ral::Sync::data);
+        }
+
+        struct stat st;
+        if (stat((BENCH_FILE + ".raf").c_str(), &st) == 0) {
+            printf("%-24s %10ld records %10.2f MB on disk\n",
+                (mode + " size").c_str(), records,
+                st.st_blocks * 512 / 1e6);
+        }
+
+        ral::File raf(BENCH_FILE, unique_ptr<ral::Record>(new BenchRecord()),
+            options);
+        BenchRecord record;
+        timeIt(mode + " random getRecord", ops, [&](long i) {
+            raf.getRecord(ids[(i * 7919) % ids.size()], &record);
+        });
+        timeIt(mode + " random updateRecord", ops, [&](long i) {
+            record.id = ids[(i * 7919) % ids.size()];
+            snprintf(record.name, sizeof(record.name), "holder %ld", i);
+            raf.updateRecord(&record, ral::Sync::none);
+        });
+    }
+    for (string suffix : { ".raf", ".raf.wal", ".raf.dwb" }) {
+        unlink((BENCH_FILE + suffix).c_str());
+    }
+}
+
+// ==== main ===================================================================
+//      Usage: bench [ops per case] [records to grow the raf to]
+//                   [--json file] [--baseline file] [--tolerance percent]
+//      --json writes every result to file as JSON, one object per line.
+//      --baseline compares the results with a file written by --json & exits
+//      with 2 if a case lost more than the tolerance (10% by default) of its
+//      throughput or gained as much p99 latency.
+// =============================================================================
+int main(int argc, char** argv) {
+    vector<string> counts;
+    string json_name, baseline_name;
+    double tolerance = 10;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--json" && i + 1 < argc) {
+            json_name = argv[++i];
+        }
+        else if (arg == "--baseline" && i + 1 < argc) {
+            baseline_name = argv[++i];
+        }
+        else if (arg == "--tolerance" && i + 1 < argc) {
+            tolerance = atof(argv[++i]);
+        }
+        else {
+            counts.push_back(arg);
+        }
+    }
+    long ops = counts.size() > 0 ? atol(counts[0].c_str()) : 200000;
+    long grow_records = counts.size() > 1 ? atol(counts[1].c_str()) : 1000000;
+
+    vector<Result> baseline;
+    if (!baseline_name.empty() && !readJson(baseline_name, baseline)) {
+        printf("Failed to read %s\n", baseline_name.c_str());
+        return 1;
+    }
+
+    for (ral::Storage storage : { ral::Storage::io, ral::Storage::mapped }) {
+        string mode = storage == ral::Storage::io ? "io" : "mapped";
+        unlink((BENCH_FILE + ".raf").c_str());
+        ral::Options options;
+        options.storage = storage;
+        ral::File raf(BENCH_FILE, unique_ptr<ral::Record>(new BenchRecord()),
+            options);
+
+        BenchRecord record;
+        for (int i = 0; i < RECORDS; i++) {
+            record.id = raf.getNextAvailableId();
+            snprintf(record.name, sizeof(record.name), "holder %d", i);
+            raf.createRecord(&record);
+        }
+
+        timeIt(mode + " getRecord", ops, [&](long i) {
+            raf.getRecord((i % RECORDS + 1) * 10, &record);
+        });
+
+        timeIt(mode + " updateRecord", ops, [&](long i) {
+            record.id = (i % RECORDS + 1) * 10;
+            record.balance = i;
+            raf.updateRecord(&record);
+        });
+    }
+
+    unlink((BENCH_FILE + ".raf").c_str());
+
+    {
+        ral::File raf(BENCH_FILE,
+            unique_ptr<ral::Record>(new StreamRecord()));
+        StreamRecord record;
+        vector<int> ids;
+        raf.reserveIds(RECORDS, ids);
+
+        timeIt("stream getRecord", ops, [&](long i) {
+            raf.getRecord(ids[i % RECORDS], &record);
+        });
+
+        timeIt("stream updateRecord", ops, [&](long i) {
+            record.fields.id = ids[i % RECORDS];
+            raf.updateRecord(&record);
+        });
+    }
+    unlink((BENCH_FILE + ".raf").c_str());
+
+    benchGrowth(grow_records);
+    benchStartup(10000000);
+    benchAllocation(grow_records);
+    benchCache(grow_records, ops);
+    benchBatch();
+    benchPosting();
+    benchColumns();
+    benchDurability(ops / 20);
+    benchScaling(ops);
+    vector<long> sizes = { 1000, 100000 };
+    if (grow_records > sizes.back()) {
+        sizes.push_back(grow_records);
+    }
+    benchSweep(sizes, ops);
+    benchStats(ops);
+    benchAsync(min(grow_records, 100000L), ops);
+    benchCipher(ops);
+    benchChecksum(grow_records, ops);
+    benchSnapshot(grow_records, ops);
+    benchPacked(grow_records, ops);
+    benchBank(ops);
+    benchShards(ops);
+    if (!stressConcurrency(ops) || !stressCrash()) {
+        return 1;
+    }
+
+    if (!json_name.empty() && !writeJson(json_name)) {
+        printf("Failed to write %s\n", json_name.c_str());
+        return 1;
+    }
+    if (!baseline.empty() && compare(baseline, tolerance) > 0) {
+        return 2;
+    }
+    return 0;
+}
@@ -0,0 +1,150 @@
+// =============================================================================
+// File: loadtest.cpp
+// =============================================================================
+// Description:
+//      This program measures the throughput & latency of a running Bank
+//      server ("OneNorthBank --serve"). Each connection opens an account,
+//      then sends deposits, withdrawals & balance requests one at a time
+//      (waiting for each response) & finally closes the account.
+//      Usage: loadtest [socket] [connections] [requests per connection]
+// =============================================================================
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "Protocol.h"
+using namespace std;
+using namespace protocol;
+
+// ==== sendAll ================================================================
+// Return val:
+//      true if every byte was sent, otherwise false
+// =============================================================================
+static bool sendAll(int fd, const char* bytes, size_t size) {
+    while (size > 0) {
+        ssize_t n = send(fd, bytes, size, MSG_NOSIGNAL);
+        if (n <= 0) {
+            return false;
+        }
+        bytes += n;
+        size -= n;
+    }
+    return true;
+}
+
+// ==== call ===================================================================
+// Sends one request & waits for its response.
+//
+// Return val:
+//      true if a response was received, otherwise false
+// =============================================================================
+static bool call(int fd, Op op, int64_t amount, const string &name,
+    Response &response) {
+    char frame[sizeof(Request) + 255];
+    Request request;
+    memset(&request, 0, sizeof(request));
+    request.op = (uint8_t)op;
+    request.name_size = name.size();
+    request.amount = amount;
+    memcpy(frame, &request, sizeof(request));
+    memcpy(frame + sizeof(request), name.data(), name.size());
+    if (!sendAll(fd, frame, sizeof(request) + name.size())) {
+        return false;
+    }
+
+    size_t received = 0;
+    while (received < sizeof(response)) {
+        ssize_t n = recv(fd, (char*)&response + received,
+            sizeof(response) - received, 0);
+        if (n <= 0) {
+            return false;
+        }
+        received += n;
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    string socket_path = argc > 1 ? argv[1] : "onb.sock";
+    int connections = argc > 2 ? atoi(argv[2]) : 16;
+    long requests = argc > 3 ? atol(argv[3]) : 10000;
+
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, socket_path.c_str(),
+        sizeof(address.sun_path) - 1);
+
+    vector<vector<double>> latencies(connections);
+    vector<long> errors(connections, 0);
+    vector<thread> clients;
+    auto start = chrono::steady_clock::now();
+    for (int c = 0; c < connections; c++) {
+        clients.emplace_back([&, c]() {
+            int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            Response response;
+            if (fd == -1 ||
+                connect(fd, (sockaddr*)&address, sizeof(address)) == -1 ||
+                !call(fd, Op::open, 100000, "load " + to_string(c),
+                    response) || response.status != 0) {
+                errors[c] = requests;
+                if (fd != -1) {
+                    close(fd);
+                }
+                return;
+            }
+
+            latencies[c].reserve(requests);
+            const Op ops[] = { Op::deposit, Op::withdraw, Op::balance };
+            for (long i = 0; i < requests; i++) {
+                auto sent = chrono::steady_clock::now();
+                if (!call(fd, ops[i % 3], 100, "", response)) {
+                    errors[c] += requests - i;
+                    break;
+                }
+                chrono::duration<double, micro> latency =
+                    chrono::steady_clock::now() - sent;
+                latencies[c].push_back(latency.count());
+                errors[c] += response.status != 0;
+            }
+
+            call(fd, Op::close, 0, "", response);
+            close(fd);
+        });
+    }
+    for (thread &client : clients) {
+        client.join();
+    }
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+
+    vector<double> all;
+    long failed = 0;
+    for (int c = 0; c < connections; c++) {
+        all.insert(all.end(), latencies[c].begin(), latencies[c].end());
+        failed += errors[c];
+    }
+    if (all.empty()) {
+        printf("no responses from %s\n", socket_path.c_str());
+        return 1;
+    }
+    sort(all.begin(), all.end());
+    auto percentile = [&](double p) {
+        return all[min(all.size() - 1, (size_t)(p * all.size()))];
+    };
+
+    printf("%d connections, %zu requests in %.2f sec: %.0f requests/sec\n",
+        connections, all.size(), elapsed.count(), all.size() /
+        elapsed.count());
+    printf("latency usec: p50 %.1f  p99 %.1f  p99.9 %.1f  max %.1f\n",
+        percentile(0.50), percentile(0.99), percentile(0.999), all.back());
+    printf("%ld failed requests\n", failed);
+    return failed == 0 ? 0 : 1;
+}
@@ -1,169 +1,1011 @@
-// =============================================================================
-// File: Bank.h
-// =============================================================================
-// Description:
-//      This header file hosts the delcaration of the Bank class.
-// =============================================================================
-
-#ifndef BANK_H
-#define BANK_H
-
-#include <string>
-#include <iosfwd>
-#include <memory>
-#include "ral.h"
-
-// === Bank ====================================================================
-// This class represents the bank.
-// =============================================================================
-class Bank {
-public:
-    // === Bank ==============================================================
-    // This is the constructor for the Bank class.
-    //
-    // Input:
-    //      ra_file_name [IN]           -- name of the ra file
-    //
-    // No Output.
-    // =============================================================================
-    Bank(std::string ra_file_name);
-
-    // ==== login ============================================================
-    // This function logs a user into the bank by attempting to locate the user's
-    // account.
-    //
-    // Input: None
-    //
-    // Output:
-    //      pointer to account of the user if it was able to be located, otherwise
-    //      nullptr
-    // =============================================================================
-    bool login();
-
-    // ==== createAccount ====================================================
-    // This function creates a new account if there is room for one.
-    //
-    // Input: None
-    //
-    // Output:
-    //      pointer to the account that was created, otherwise nullptr
-    // =============================================================================
-    bool createAccount();
-
-    // === closeAccount ======================================================
-    // This functions closes an account and deletes a record from the raf.
-    //
-    // Input:
-    //      account [IN/OUT]         -- the account that is being closed
-    //
-    // Output:
-    //      true if succeeded in closing the account, otherwise false
-    // =============================================================================
-    bool closeAccount();
-
-    // === displayAccount ====================================================
-    // This function displays the balance of an account.
-    //
-    // Input:
-    //      account [IN]             -- the account to display the balance of
-    //
-    // No Output.
-    // =============================================================================
-    void displayBalance();
-
-    // === withdraw ==========================================================
-    // This function withdraws money from an account.
-    //
-    // Input:
-    //      account [IN/OUT]         -- the account to withdraw from
-    //
-    // No Output.
-    // =============================================================================
-    void adjustBalance(bool is_deposit);
-
-private:
-    // === Account =================================================================
-    // This class represents one account.
-    // =============================================================================
-    class Account : public ral::Record {
-    public:
-        static const int MAX_NAME_SIZE = 100;
-
-        int id;
-        char name[MAX_NAME_SIZE]; // account holder's name (null terminated)
-        float balance;
-
-        // === Account::Account ========================================================
-        // This is the constructor for the Account class.
-        //
-        // Input: None
-        //
-        // Output: None
-        // =============================================================================
-        Account();
-
-        // === Account::reset ==========================================================
-        // This function sets the variables to {0, "UNKNOWN", 0.0}.
-        //
-        // Input: None
-        //
-        // Output: None
-        // =============================================================================
-        void reset();
-
-        // === Account::setName ========================================================
-        // This function sets the name of the account after santiziing it & checking the
-        // length.
-        //
-        // Input:
-        //      name [IN]               -- what to set the account name to
-        //
-        // Output:
-        //      true if name was valid & account was updated, otherwise false
-        // =============================================================================
-        bool setName();
-
-        // === Account::deposit ========================================================
-        // This function deposits an amount to an account.
-        //
-        // Input:
-        //      amount [IN]             -- the amount to deposit
-        //
-        // Output:
-        //      true if the deposit was successful, otherwise false
-        // =============================================================================
-        bool deposit(std::string promptMsg = "How much would you like to deposit? ");
-
-        // === Account::withdraw =======================================================
-        // This function withdraws an amount from an account.
-        //
-        // Input:
-        //      amount [IN]             -- the amount to withdraw
-        //
-        // Output:
-        //      true if the withdrawal was successful, otherwise false
-        // =============================================================================
-        bool withdraw();
-
-        // === Account::getId ==========================================================
-        // This function get the id of the account.
-        //
-        // Input: None
-        //
-        // Output:
-        //      the id of the account
-        // =============================================================================
-        int getId() override;
-
-        size_t getSize() override;
-
-        bool serialize(std::stringstream &ss) override;
-        bool deserialize(std::stringstream &ss) override;
-    };
-
-    ral::File raf;
-    std::unique_ptr<Account> current_account; // TODO: validate logged in?
-    // TODO: logout function?
-};
-
+// =============================================================================
+// File: Bank.h
+// =============================================================================
+// Description:
+//      This header file hosts the delcaration of the Bank class.
+// =============================================================================
+
+#ifndef BANK_H
+#define BANK_H
+
+#include <atomic>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <iosfwd>
+#include <memory>
+#include <shared_mutex>
+#include <vector>
+#include "ColumnStore.h"
+#include "HashIndex.h"
+#include "IntentLog.h"
+#include "Worker.h"
+#include "ral.h"
+
+// === Bank ====================================================================
+// This class represents the bank.
+//
+// The accounts can be split across shards, each a raf of its own (with its
+// journal, key, name index & column store) that can live on its own disk.
+// ral ids are multiples of 10, so an account's id is its id in its shard's
+// raf plus the shard's index: the last digit routes it. A call on one
+// account only touches that account's shard. Whole-book work (syncs,
+// applyTransactions, postInterest, auditBook, reports, rebuilds & backups)
+// is split across the shards' workers, one thread per shard, & runs on all
+// of them at once. New accounts are dealt to the shards in turn. A bank of
+// one shard is the raf it always was.
+// =============================================================================
+class Bank {
+public:
+    static const size_t MAX_SHARDS = 10; // one per last digit of an id
+    // exit code of a process whose bank couldn't be opened (the message
+    // printed before says what failed)
+    static const int EXIT_OPEN_FAILED = 246;
+
+    // === Result ==================================================================
+    // The outcome of a non-interactive Bank operation.
+    // =============================================================================
+    enum class Result : uint8_t {
+        ok,
+        invalid_login,          // no account with that id (& name)
+        invalid_amount,         // $0.00 or less
+        too_much_money,         // the balance would overflow
+        insufficient_funds,     // withdrawing more than the balance
+        name_too_long,
+        no_room,                // the raf can't hold another account
+        failed                  // the raf couldn't be read/written (or the
+                                // bank is halted, see isHalted)
+    };
+
+    // === Transaction =============================================================
+    // One operation of a batch (see applyTransactions).
+    // =============================================================================
+    struct Transaction {
+        enum class Op : uint8_t { create, deposit, withdraw, close };
+
+        Op op;
+        int id;                 // the account (create: set to the new id)
+        int64_t amount;         // in cents (create: opening deposit, or 0)
+        std::string_view name;  // create: the account holder's name
+        Result result;          // set by applyTransactions
+        int64_t balance;        // set by applyTransactions: balance afterwards
+    };
+
+    // === Payment =================================================================
+    // One leg of a transfer (see transfer).
+    // =============================================================================
+    struct Payment {
+        int id;                 // the account paid
+        int64_t amount;         // in cents
+    };
+
+    // === Posting =================================================================
+    // A change to one balance of an array (see postBalances).
+    // =============================================================================
+    struct Posting {
+        uint32_t slot;          // index of the balance
+        int64_t delta;          // cents to add (negative to take)
+    };
+
+    // === Bank ==============================================================
+    // This is the constructor for the Bank class.
+    //
+    // Input:
+    //      ra_file_name [IN]           -- name of the ra file
+    //
+    // No Output.
+    // =============================================================================
+    Bank(std::string ra_file_name);
+
+    // === Bank ==============================================================
+    // This is the constructor for a bank split across shards. A shard must
+    // keep its place in the list, as its index is part of its accounts' ids.
+    //
+    // Input:
+    //      shard_file_names [IN]       -- names of the shards' ra files (1
+    //                                     to MAX_SHARDS)
+    //
+    // No Output.
+    // =============================================================================
+    Bank(const std::vector<std::string> &shard_file_names);
+
+    // ==== getShardCount ====================================================
+    // Output:
+    //      number of shards
+    // =============================================================================
+    size_t getShardCount();
+
+    // ==== isHalted =========================================================
+    // A transfer across shards whose intent may be in the transfer log but
+    // whose parts couldn't all be committed halts the bank: the next open
+    // finishes it (see transactAccounts), so until then no account may be
+    // written & every change fails (Result::failed).
+    //
+    // Output:
+    //      true if the bank is halted, otherwise false
+    // =============================================================================
+    bool isHalted();
+
+    // ==== login ============================================================
+    // This function logs a user into the bank by attempting to locate the user's
+    // account.
+    //
+    // Input: None
+    //
+    // Output:
+    //      pointer to account of the user if it was able to be located, otherwise
+    //      nullptr
+    // =============================================================================
+    bool login();
+
+    // ==== findAccounts =====================================================
+    // This function looks up the accounts held under a name in the name index.
+    // Names are compared after normalizing (see normalizeName).
+    //
+    // Input:
+    //      name [IN]                -- the account holder's name
+    //      ids [OUT]                -- ids of the matching accounts are appended
+    //
+    // Output:
+    //      true if at least one account matched, otherwise false
+    // =============================================================================
+    bool findAccounts(const std::string &name, std::vector<int> &ids);
+
+    // ==== summarizeBalances ================================================
+    // This function aggregates the balances of the accounts in a range whose
+    // normalized name starts with a prefix. It scans the column store, not
+    // the raf.
+    //
+    // Input:
+    //      min_balance [IN]         -- lowest balance wanted (in cents)
+    //      max_balance [IN]         -- highest balance wanted (in cents)
+    //      name_prefix [IN]         -- start of the names wanted ("" for all)
+    //
+    // Output:
+    //      count, sum, min & max of the matching balances
+    // =============================================================================
+    ral::ColumnSummary summarizeBalances(int64_t min_balance,
+        int64_t max_balance, const std::string &name_prefix);
+
+    // ==== selectAccounts ===================================================
+    // This function finds the accounts summarizeBalances would aggregate.
+    //
+    // Input:
+    //      min_balance [IN]         -- lowest balance wanted (in cents)
+    //      max_balance [IN]         -- highest balance wanted (in cents)
+    //      name_prefix [IN]         -- start of the names wanted ("" for all)
+    //      ids [OUT]                -- ids of the matching accounts are
+    //                                  appended in ascending order
+    //
+    // No Output.
+    // =============================================================================
+    void selectAccounts(int64_t min_balance, int64_t max_balance,
+        const std::string &name_prefix, std::vector<int> &ids);
+
+    // ==== topBalances ======================================================
+    // This function ranks the accounts summarizeBalances would aggregate.
+    //
+    // Input:
+    //      min_balance [IN]         -- lowest balance wanted (in cents)
+    //      max_balance [IN]         -- highest balance wanted (in cents)
+    //      name_prefix [IN]         -- start of the names wanted ("" for all)
+    //      k [IN]                   -- number of accounts wanted
+    //      largest [IN]             -- true for the largest balances, false
+    //                                  for the smallest
+    //      accounts [OUT]           -- up to k (id, balance) pairs, best first
+    //
+    // No Output.
+    // =============================================================================
+    void topBalances(int64_t min_balance, int64_t max_balance,
+        const std::string &name_prefix, size_t k, bool largest,
+        std::vector<std::pair<int, int64_t>> &accounts);
+
+    // ==== createAccount ====================================================
+    // This function creates a new account if there is room for one.
+    //
+    // Input: None
+    //
+    // Output:
+    //      pointer to the account that was created, otherwise nullptr
+    // =============================================================================
+    bool createAccount();
+
+    // === closeAccount ======================================================
+    // This functions closes an account and deletes a record from the raf.
+    //
+    // Input:
+    //      account [IN/OUT]         -- the account that is being closed
+    //
+    // Output:
+    //      true if succeeded in closing the account, otherwise false
+    // =============================================================================
+    bool closeAccount();
+
+    // === displayAccount ====================================================
+    // This function displays the balance of an account.
+    //
+    // Input:
+    //      account [IN]             -- the account to display the balance of
+    //
+    // No Output.
+    // =============================================================================
+    void displayBalance();
+
+    // === withdraw ==========================================================
+    // This function withdraws money from an account.
+    //
+    // Input:
+    //      account [IN/OUT]         -- the account to withdraw from
+    //
+    // No Output.
+    // =============================================================================
+    void adjustBalance(bool is_deposit);
+
+    // The functions below don't prompt or print & don't touch the current
+    // account; they work on the account named by id, so callers like the
+    // server can keep their own sessions. Amounts & balances are in cents.
+
+    // ==== openAccount ======================================================
+    // This function creates a new account.
+    //
+    // Input:
+    //      name [IN]                -- the account holder's name
+    //      deposit [IN]             -- opening deposit (0 for none)
+    //      id [OUT]                 -- id of the new account
+    //      balance [OUT]            -- balance of the new account
+    //
+    // Output:
+    //      Result::ok if the account was created
+    // =============================================================================
+    Result openAccount(const std::string &name, int64_t deposit, int &id,
+        int64_t &balance);
+
+    // ==== checkLogin =======================================================
+    // This function checks that an account exists & is held under name.
+    //
+    // Input:
+    //      id [IN]                  -- id of the account
+    //      name [IN]                -- the account holder's name
+    //      balance [OUT]            -- balance of the account
+    //
+    // Output:
+    //      Result::ok if the login is valid
+    // =============================================================================
+    Result checkLogin(int id, const std::string &name, int64_t &balance);
+
+    // ==== getBalance =======================================================
+    // Input:
+    //      id [IN]                  -- id of the account
+    //      balance [OUT]            -- balance of the account
+    //
+    // Output:
+    //      Result::ok if the account exists
+    // =============================================================================
+    Result getBalance(int id, int64_t &balance);
+
+    // ==== getBalances ======================================================
+    // This function reads the balances of many accounts, e.g. for a
+    // statement, all as they were at one moment. It reads through views of
+    // the shards (see ral::File::beginRead & beginReads), so deposits &
+    // transfers made meanwhile neither wait for it nor show up in it.
+    //
+    // Input:
+    //      ids [IN]                 -- ids of the accounts
+    //      balances [OUT]           -- balances[i] is the balance of ids[i]
+    //
+    // Output:
+    //      Result::ok if every account exists
+    // =============================================================================
+    Result getBalances(const std::vector<int> &ids,
+        std::vector<int64_t> &balances);
+
+    // ==== auditBook ========================================================
+    // This function totals the balances of every open account from the
+    // rafs, all as they were at one moment, through views like getBalances,
+    // so it can run while tellers keep working. Each shard is totalled by
+    // its worker.
+    //
+    // Input:
+    //      total [OUT]              -- sum of the balances (in cents)
+    //      accounts [OUT]           -- number of accounts open
+    //
+    // Output:
+    //      Result::ok if every account could be read
+    // =============================================================================
+    Result auditBook(int64_t &total, size_t &accounts);
+
+    // ==== deposit ==========================================================
+    // This function deposits an amount to an account, by the same rules as
+    // the interactive deposit.
+    //
+    // Input:
+    //      id [IN]                  -- id of the account
+    //      amount [IN]              -- the amount to deposit
+    //      balance [OUT]            -- balance of the account afterwards
+    //
+    // Output:
+    //      Result::ok if the deposit was made
+    // =============================================================================
+    Result deposit(int id, int64_t amount, int64_t &balance);
+
+    // ==== withdraw =========================================================
+    // This function withdraws an amount from an account, by the same rules as
+    // the interactive withdrawal.
+    //
+    // Input:
+    //      id [IN]                  -- id of the account
+    //      amount [IN]              -- the amount to withdraw
+    //      balance [OUT]            -- balance of the account afterwards
+    //
+    // Output:
+    //      Result::ok if the withdrawal was made
+    // =============================================================================
+    Result withdraw(int id, int64_t amount, int64_t &balance);
+
+    // ==== transfer =========================================================
+    // This function moves an amount from one account to another. Both
+    // accounts change together or neither does (see the other transfer).
+    //
+    // Input:
+    //      from_id [IN]             -- id of the account paying
+    //      to_id [IN]               -- id of the account paid
+    //      amount [IN]              -- the amount to move
+    //      balance [OUT]            -- balance of the paying account
+    //                                  afterwards
+    //
+    // Output:
+    //      Result::ok if the transfer was made
+    // =============================================================================
+    Result transfer(int from_id, int to_id, int64_t amount,
+        int64_t &balance);
+
+    // ==== transfer =========================================================
+    // This function pays many accounts out of one, e.g. a payroll, as a
+    // single transaction (see ral::File::transactRecords): every account is
+    // read & written once & the batch is committed with one sync, or
+    // nothing changes. The transfer is rejected if the paying account can't
+    // cover the total or any payment is invalid or would overflow its
+    // account. A transfer across shards is a two-phase commit of one
+    // transaction per shard (see transactAccounts).
+    //
+    // Input:
+    //      from_id [IN]             -- id of the account paying
+    //      payments [IN]            -- the accounts paid (an account may be
+    //                                  paid more than once)
+    //      balance [OUT]            -- balance of the paying account
+    //                                  afterwards
+    //
+    // Output:
+    //      Result::ok if every payment was made
+    // =============================================================================
+    Result transfer(int from_id, const std::vector<Payment> &payments,
+        int64_t &balance);
+
+    // ==== closeAccount =====================================================
+    // This function closes an account without asking for confirmation.
+    //
+    // Input:
+    //      id [IN]                  -- id of the account
+    //
+    // Output:
+    //      Result::ok if the account was closed
+    // =============================================================================
+    Result closeAccount(int id);
+
+    // ==== applyTransactions ================================================
+    // This function applies a batch of transactions in order, by the same
+    // rules as the functions above. Every account the batch touches is read
+    // once, its transactions are applied in memory & each changed account is
+    // written once at the end. Each shard applies its accounts'
+    // transactions (in order) on its worker, all shards at once.
+    //
+    // Input:
+    //      transactions [IN/OUT]    -- the batch; result, balance (& id for
+    //                                  creates) are filled in
+    //
+    // No Output.
+    // =============================================================================
+    void applyTransactions(std::vector<Transaction> &transactions);
+
+    // ==== postInterest =====================================================
+    // This function pays interest on & charges a fee to every account, each
+    // shard on its worker. The accounts are read a batch at a time, the
+    // changes are made to the batch with postBalances & each changed account
+    // is written once. An account that can't pay the fee, or whose balance
+    // would overflow, is left unchanged.
+    //
+    // Input:
+    //      rate [IN]                -- interest in basis points (1/100 of a
+    //                                  percent); rounded down to the cent
+    //      fee [IN]                 -- cents taken from every account
+    //      posted [OUT]             -- number of accounts changed
+    //      rejected [OUT]           -- number of accounts left unchanged
+    //
+    // Output:
+    //      true if every account was read & written, otherwise false
+    // =============================================================================
+    bool postInterest(int64_t rate, int64_t fee, size_t &posted,
+        size_t &rejected);
+
+    // ==== postBalances =====================================================
+    // This function applies postings to an array of balances in order. A
+    // posting that would overflow a balance or make it negative is skipped.
+    // The loop has no data-dependent branches, so it runs at the speed of
+    // memory rather than of branch prediction.
+    //
+    // Input:
+    //      balances [IN/OUT]        -- the balances (in cents)
+    //      postings [IN]            -- the changes
+    //      count [IN]               -- number of postings
+    //      results [OUT]            -- count results: ok, too_much_money or
+    //                                  insufficient_funds
+    //
+    // Output:
+    //      number of postings applied
+    // =============================================================================
+    static size_t postBalances(int64_t* balances, const Posting* postings,
+        size_t count, Result* results);
+
+    // ==== setDeferredSync ==================================================
+    // This function chooses whether balance changes are committed one at a
+    // time (the default) or left for sync, so a caller handling many
+    // requests can commit them together before acknowledging any.
+    //
+    // Input:
+    //      deferred [IN]            -- true to leave commits to sync
+    //
+    // No Output.
+    // =============================================================================
+    void setDeferredSync(bool deferred);
+
+    // ==== sync =============================================================
+    // This function commits every change made so far, syncing the shards at
+    // once.
+    //
+    // Input: None
+    //
+    // Output:
+    //      true if successful, otherwise false
+    // =============================================================================
+    bool sync();
+
+    // ==== beginBackup ======================================================
+    // This function starts copying the accounts into a backup raf while the
+    // bank keeps working (see ral::File::beginSnapshot); only the accounts
+    // changed since this Bank's last backup into the same file are copied.
+    // The backup holds every account as it was when the function was
+    // called, sealed with the bank's key, in fixed slots. To restore, copy
+    // it over the raf & remove the raf's .wal & .idx; it's packed on open.
+    // Each shard of a sharded bank is backed up into <file_name>.<index>.
+    //
+    // Input:
+    //      file_name [IN]           -- name of the backup (minus extension)
+    //
+    // Output:
+    //      true if the backup was started, otherwise false
+    // =============================================================================
+    bool beginBackup(const std::string &file_name);
+
+    // ==== isBackupRunning ==================================================
+    // Output:
+    //      true if a backup's accounts are still being copied, otherwise
+    //      false
+    // =============================================================================
+    bool isBackupRunning();
+
+    // ==== finishBackup =====================================================
+    // This function waits for the backup started last to be durable &
+    // prints what it copied.
+    //
+    // Input: None
+    //
+    // Output:
+    //      true if the backup is complete, otherwise false
+    // =============================================================================
+    bool finishBackup();
+
+    // ==== checkAccounts ======================================================
+    // This function checks every slot of the accounts raf against its
+    // checksum & the raf's bitmap against the accounts (see
+    // ral::File::verifyFile) & prints what it found. It runs before a Bank
+    // opens the raf, since a corrupt account stops the Bank from starting.
+    // A repair also closes the ids marked used that never got an account.
+    //
+    // Input:
+    //      ra_file_name [IN]        -- name of the raf (minus extension)
+    //      repair [IN]              -- true to repair what can be
+    //
+    // Output:
+    //      true if every account is sound (after the repair), otherwise false
+    // =============================================================================
+    static bool checkAccounts(const std::string &ra_file_name, bool repair);
+
+private:
+    // === AccountFields ===========================================================
+    // The fields of an account, in the order they are stored in the raf.
+    // =============================================================================
+    struct AccountFields {
+        static const int MAX_NAME_SIZE = 100;
+
+        int id;
+        char name[MAX_NAME_SIZE]; // account holder's name (null terminated)
+        int64_t balance;          // in cents
+    };
+
+    // === Account =================================================================
+    // This class represents one account. It is stored in the raf as a copy of
+    // its AccountFields.
+    // =============================================================================
+    class Account : public ral::PodRecord<AccountFields> {
+    public:
+        // === Account::Account ========================================================
+        // This is the constructor for the Account class.
+        //
+        // Input: None
+        //
+        // Output: None
+        // =============================================================================
+        Account();
+
+        // === Account::reset ==========================================================
+        // This function sets the variables to {0, "UNKNOWN", 0.0}.
+        //
+        // Input: None
+        //
+        // Output: None
+        // =============================================================================
+        void reset();
+
+        // === Account::setName ========================================================
+        // This function sets the name of the account after santiziing it & checking the
+        // length.
+        //
+        // Input:
+        //      name [IN]               -- what to set the account name to
+        //
+        // Output:
+        //      true if name was valid & account was updated, otherwise false
+        // =============================================================================
+        bool setName();
+
+        // === Account::credit =========================================================
+        // This function adds an amount to the balance if it's a valid deposit.
+        //
+        // Input:
+        //      amount [IN]             -- the amount to deposit (in cents)
+        //
+        // Output:
+        //      Result::ok if the balance was updated
+        // =============================================================================
+        Result credit(int64_t amount);
+
+        // === Account::debit ==========================================================
+        // This function takes an amount from the balance if it's a valid
+        // withdrawal.
+        //
+        // Input:
+        //      amount [IN]             -- the amount to withdraw (in cents)
+        //
+        // Output:
+        //      Result::ok if the balance was updated
+        // =============================================================================
+        Result debit(int64_t amount);
+
+        // === Account::deposit ========================================================
+        // This function deposits an amount to an account.
+        //
+        // Input:
+        //      amount [IN]             -- the amount to deposit
+        //
+        // Output:
+        //      true if the deposit was successful, otherwise false
+        // =============================================================================
+        bool deposit(std::string promptMsg = "How much would you like to deposit? ");
+
+        // === Account::withdraw =======================================================
+        // This function withdraws an amount from an account.
+        //
+        // Input:
+        //      amount [IN]             -- the amount to withdraw
+        //
+        // Output:
+        //      true if the withdrawal was successful, otherwise false
+        // =============================================================================
+        bool withdraw();
+
+        // === Account::getId ==========================================================
+        // This function get the id of the account in its shard's raf.
+        //
+        // Input: None
+        //
+        // Output:
+        //      the id of the account, minus its shard's index
+        // =============================================================================
+        int getId() override;
+
+        // === Account::encode =========================================================
+        // This function copies the fields into buffer with every byte after the
+        // name's terminator zeroed, so a packed raf doesn't store what a longer
+        // name left behind.
+        //
+        // Input:
+        //      buffer [OUT]            -- sizeof(AccountFields) bytes
+        //
+        // Output:
+        //      true
+        // =============================================================================
+        bool encode(char* buffer) override;
+    };
+
+    // ==== rafOptions =========================================================
+    // Settings for the accounts raf: a few thousand accounts are active at
+    // once, so they're kept in a record cache, & every balance change is
+    // durable in the journal before it's acknowledged. A raf from before
+    // balances were kept in cents is converted with convertAccount. Every
+    // account is sealed with the bank's key. Accounts are packed into pages
+    // (ral::Storage::packed), so a short name doesn't take the room of the
+    // longest; a raf of fixed slots is packed on open.
+    //
+    // Input:
+    //      columns [IN]             -- the projection kept up to date
+    //      key [IN]                 -- the key from loadKey
+    //
+    // Output:
+    //      the options
+    // =============================================================================
+    static ral::Options rafOptions(ral::Projection* columns,
+        const std::string &key);
+
+    // ==== loadKey ============================================================
+    // This function reads the key the accounts are encrypted with from the
+    // file named by $ONB_KEY_FILE, or <ra_file_name>.key, creating it (mode
+    // 0600) with a random key if it doesn't exist yet.
+    //
+    // Input:
+    //      ra_file_name [IN]        -- name of the raf (minus extension)
+    //
+    // Output:
+    //      the key
+    // =============================================================================
+    static std::string loadKey(const std::string &ra_file_name);
+
+    // ==== extractColumns =====================================================
+    // This function gets the columns of an encoded account: its balance &
+    // normalized name.
+    //
+    // Input:
+    //      record [IN]              -- the encoded account
+    //      balance [OUT]            -- the balance in cents
+    //      name [OUT]               -- the normalized name
+    //
+    // Output:
+    //      true if the record is an account, otherwise false
+    // =============================================================================
+    static bool extractColumns(const char* record, int64_t &balance,
+        std::string &name);
+
+    // ==== convertAccount =====================================================
+    // This function converts an account stored with a float balance in
+    // dollars to one with an int64_t balance in cents.
+    //
+    // Input:
+    //      old_record [IN]          -- the old account
+    //      record [OUT]             -- the converted account
+    //
+    // Output:
+    //      true if the balance could be converted, otherwise false
+    // =============================================================================
+    static bool convertAccount(const char* old_record, char* record);
+
+    // ==== normalizeName ======================================================
+    // This function trims a name, collapses runs of whitespace to one space &
+    // lowercases it so "  Jane  DOE" & "jane doe" index the same.
+    //
+    // Input:
+    //      name [IN]                -- the name to normalize
+    //
+    // Output:
+    //      the normalized name
+    // =============================================================================
+    static std::string normalizeName(const std::string &name);
+
+    // === Shard =================================================================
+    // The accounts whose ids end in one digit: their raf, the column store &
+    // name index fed by it, & the worker that does the bank's whole-book
+    // work on them.
+    // =============================================================================
+    struct Shard {
+        size_t index;             // the last digit of its accounts' ids
+        ral::ColumnStore columns; // balance & normalized name of every
+                                  // account (sealed with the raf's key
+                                  // while closed)
+        ral::File raf;            // (after columns, which it updates)
+        ral::HashIndex names;     // key of a normalized account name -> ids
+        uint8_t name_secret[16];  // keys nameKey (derived from the raf's key)
+        ral::Worker worker;       // (last, so it stops first)
+
+        // === Shard::Shard ============================================================
+        // This is the constructor; it opens the shard's raf & name index.
+        //
+        // Input:
+        //      ra_file_name [IN]       -- name of the ra file
+        //      index [IN]              -- the shard's place in the bank
+        //
+        // Output: None
+        // =============================================================================
+        Shard(const std::string &ra_file_name, size_t index);
+
+    private:
+        // === Shard::Shard ============================================================
+        // This is the constructor the other delegates to, once the key is
+        // loaded (see loadKey).
+        //
+        // Input:
+        //      ra_file_name [IN]       -- name of the ra file
+        //      index [IN]              -- the shard's place in the bank
+        //      key [IN]                -- the key the raf is sealed with
+        //
+        // Output: None
+        // =============================================================================
+        Shard(const std::string &ra_file_name, size_t index,
+            const std::string &key);
+    };
+
+    // ==== nameKey ============================================================
+    // This function hashes a normalized name for a shard's name index with
+    // SipHash, keyed with a secret derived from the shard's key, so the
+    // index shows nothing of the names to whoever doesn't hold the key.
+    //
+    // Input:
+    //      shard [IN]               -- the shard whose index it's for
+    //      name [IN]                -- the normalized name
+    //
+    // Output:
+    //      the key of the name
+    // =============================================================================
+    static uint64_t nameKey(const Shard &shard, const std::string &name);
+
+    // ==== rafId ==============================================================
+    // Input:
+    //      id [IN]                  -- id of an account
+    //
+    // Output:
+    //      the account's id in its shard's raf
+    // =============================================================================
+    static int rafId(int id);
+
+    // ==== findShard ==========================================================
+    // Input:
+    //      id [IN]                  -- id of an account
+    //
+    // Output:
+    //      the shard the id routes to, or nullptr if no account can have it
+    // =============================================================================
+    Shard* findShard(int id);
+
+    // ==== forEachShard =======================================================
+    // This function runs a task for every shard on the shard's worker, all
+    // at once, & waits for them (a bank of one shard runs it on the calling
+    // thread).
+    //
+    // Input:
+    //      task [IN]                -- what to run for each shard
+    //
+    // No Output.
+    // =============================================================================
+    void forEachShard(const std::function<void(Shard &shard)> &task);
+
+    // ==== openAccount ========================================================
+    // This function creates a new account in one shard, like the public
+    // openAccount.
+    //
+    // Input:
+    //      shard [IN]               -- where the account goes
+    //      name [IN]                -- the account holder's name
+    //      deposit [IN]             -- opening deposit (0 for none)
+    //      id [OUT]                 -- id of the new account
+    //      balance [OUT]            -- balance of the new account
+    //
+    // Output:
+    //      Result::ok if the account was created
+    // =============================================================================
+    Result openAccount(Shard &shard, const std::string &name,
+        int64_t deposit, int &id, int64_t &balance);
+
+    // ==== applyShardTransactions =============================================
+    // This function applies a batch of transactions on one shard's accounts
+    // (see applyTransactions). New accounts are opened in the shard.
+    //
+    // Input:
+    //      shard [IN]               -- the shard
+    //      transactions [IN/OUT]    -- the batch
+    //
+    // No Output.
+    // =============================================================================
+    void applyShardTransactions(Shard &shard,
+        std::vector<Transaction> &transactions);
+
+    // ==== transactAccounts ===================================================
+    // This function reads accounts under their locks, lets change edit them
+    // & writes them back (see ral::File::transactRecords). Accounts on many
+    // shards take one transaction per shard, nested in the order of the
+    // shards so concurrent transfers can't deadlock, & committed in two
+    // phases through the transfer log (see ral::IntentLog): a crash between
+    // the shards' commits is finished when the bank is next opened. A
+    // failure once the intent may be in the log halts the bank (see
+    // isHalted) instead.
+    //
+    // Input:
+    //      ids [IN]                 -- ids of the accounts (no repeats)
+    //      accounts [IN/OUT]        -- accounts[i] is read from ids[i]
+    //      change [IN]              -- edits the accounts; false to write
+    //                                  nothing
+    //
+    // Output:
+    //      true if the accounts could be read & written, otherwise false
+    // =============================================================================
+    bool transactAccounts(const std::vector<int> &ids,
+        std::vector<Account> &accounts, const std::function<bool()> &change);
+
+    // ==== halt ===============================================================
+    // This function halts the bank (see isHalted).
+    //
+    // Input:
+    //      reason [IN]              -- what failed, printed
+    //
+    // No Output.
+    // =============================================================================
+    void halt(const char* reason);
+
+    // ==== encodePart =========================================================
+    // This function encodes a shard's part of a transfer for the transfer
+    // log.
+    //
+    // Input:
+    //      shard [IN]               -- index of the shard
+    //      records [IN]             -- the shard's accounts, changed
+    //
+    // Output:
+    //      the part, as redoPart takes it
+    // =============================================================================
+    std::string encodePart(size_t shard,
+        const std::vector<ral::Record*> &records);
+
+    // ==== redoPart ===========================================================
+    // This function writes a shard's part of a transfer a crash interrupted.
+    //
+    // Input:
+    //      part [IN]                -- from encodePart
+    //
+    // Output:
+    //      true if the part was written & synced, otherwise false
+    // =============================================================================
+    bool redoPart(const std::string &part);
+
+    // ==== beginReads =========================================================
+    // This function opens a read view of every shard at the same moment: no
+    // transfer across shards is half written in them.
+    //
+    // Input:
+    //      views [OUT]              -- views[i] is the view of shard i
+    //
+    // No Output.
+    // =============================================================================
+    void beginReads(std::vector<uint64_t> &views);
+
+    // ==== endReads ===========================================================
+    // Input:
+    //      views [IN]               -- from beginReads
+    //
+    // No Output.
+    // =============================================================================
+    void endReads(const std::vector<uint64_t> &views);
+
+    // ==== scanAccounts =======================================================
+    // This function reads every account of a shard's raf, a batch at a time.
+    // An id in use whose slot holds no account (left by a crash while the
+    // account was opened) is released on the way.
+    //
+    // Input:
+    //      shard [IN]               -- the shard
+    //      visit [IN]               -- called with each account, returns
+    //                                  false to fail the scan
+    //
+    // Output:
+    //      true if every account was read & visited, otherwise false
+    // =============================================================================
+    bool scanAccounts(Shard &shard,
+        const std::function<bool(const Account &account)> &visit);
+
+    // ==== rebuildNameIndex ===================================================
+    // This function refills a shard's name index from every account in its
+    // raf. It runs when the index is missing, wasn't closed cleanly or is out
+    // of step with the raf.
+    //
+    // Input:
+    //      shard [IN]               -- the shard
+    //
+    // Output:
+    //      true if the index was rebuilt, otherwise false
+    // =============================================================================
+    bool rebuildNameIndex(Shard &shard);
+
+    // ==== rebuildColumns =====================================================
+    // This function refills a shard's column store from every account in its
+    // raf, like rebuildNameIndex.
+    //
+    // Input:
+    //      shard [IN]               -- the shard
+    //
+    // Output:
+    //      true if the store was rebuilt, otherwise false
+    // =============================================================================
+    bool rebuildColumns(Shard &shard);
+
+    // ==== balanceFilter ======================================================
+    // Input:
+    //      min_balance [IN]         -- lowest balance wanted (in cents)
+    //      max_balance [IN]         -- highest balance wanted (in cents)
+    //      name_prefix [IN]         -- start of the names wanted
+    //
+    // Output:
+    //      the column store filter for them (with the prefix normalized)
+    // =============================================================================
+    static ral::ColumnFilter balanceFilter(int64_t min_balance,
+        int64_t max_balance, const std::string &name_prefix);
+
+    // ==== loadAccount ========================================================
+    // This function reads an open account.
+    //
+    // Input:
+    //      id [IN]                  -- id of the account
+    //      account [OUT]            -- where the account is read to
+    //
+    // Output:
+    //      true if an open account has that id, otherwise false
+    // =============================================================================
+    bool loadAccount(int id, Account &account);
+
+    // ==== viewAccount ========================================================
+    // This function reads an open account like loadAccount, but through a
+    // view of its shard (see ral::File::beginRead), without waiting for
+    // writers.
+    //
+    // Input:
+    //      id [IN]                  -- id of the account
+    //      account [OUT]            -- where the account is read to
+    //
+    // Output:
+    //      true if an open account has that id, otherwise false
+    // =============================================================================
+    bool viewAccount(int id, Account &account);
+
+    // ==== viewAccounts =======================================================
+    // This function reads accounts as they were when views began, without
+    // waiting for writers.
+    //
+    // Input:
+    //      views [IN]               -- from beginReads
+    //      ids [IN]                 -- ids of the accounts
+    //      accounts [OUT]           -- accounts[i] is read from ids[i] (an
+    //                                  id closed at the view reads as id 0)
+    //
+    // Output:
+    //      true if every account could be read, otherwise false
+    // =============================================================================
+    bool viewAccounts(const std::vector<uint64_t> &views,
+        const std::vector<int> &ids, std::vector<Account> &accounts);
+
+    std::vector<std::unique_ptr<Shard>> shards;
+    std::vector<ral::Worker*> workers; // shards[i]->worker
+    std::atomic<size_t> next_shard;    // where the next account is opened
+    std::shared_mutex cut_lock; // shared by transfers across shards while
+                                // they write, exclusive for beginReads
+    std::unique_ptr<ral::IntentLog> intents; // transfers across shards
+                                             // (null with one shard)
+    std::atomic<bool> halted;   // see isHalted
+    std::unique_ptr<Account> current_account; // TODO: validate logged in?
+    // TODO: logout function?
+};
+
 #endif // BANK_H
\ No newline at end of file
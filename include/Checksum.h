@@ -0,0 +1,76 @@
+// =============================================================================
+// File: Checksum.h
+// =============================================================================
+// Description:
+//      This header file hosts the checksum & hash functions of the ral
+//      namespace.
+// =============================================================================
+
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include <cstdint>
+#include <cstddef>
+
+namespace ral {
+    // === crc32c ==============================================================
+    // Computes the CRC-32C (Castagnoli) of a buffer, with the CPU's crc32
+    // instruction when it has SSE4.2 & a lookup table otherwise.
+    //
+    // Parameters:
+    //      data [IN]                   -- bytes to checksum
+    //      size [IN]                   -- number of bytes
+    //      crc [OPT IN]                -- optional: crc of the bytes before
+    //                                      data, to continue a running crc.
+    //                                      defaults to 0
+    //
+    // Return val:
+    //      the crc
+    // =========================================================================
+    uint32_t crc32c(const void* data, size_t size, uint32_t crc = 0);
+
+    // === crc32cMany ==========================================================
+    // crc32c of a batch of buffers of the same size, 4 at a time with
+    // SSE4.2 (much faster than one by one for small buffers).
+    //
+    // Parameters:
+    //      buffers [IN]                -- count buffers of size bytes
+    //      size [IN]                   -- bytes of each buffer
+    //      count [IN]                  -- number of buffers
+    //      crcs [IN/OUT]               -- count crcs to continue from (see
+    //                                      crc32c), replaced by the buffers'
+    //
+    // Return val: None
+    // =========================================================================
+    void crc32cMany(const void* const* buffers, size_t size, size_t count,
+        uint32_t* crcs);
+
+    // === sipHash =============================================================
+    // Computes the SipHash-2-4 of a buffer: a hash keyed with a secret, so
+    // whoever doesn't hold the key can't compute it or tell which inputs
+    // collide.
+    //
+    // Parameters:
+    //      data [IN]                   -- bytes to hash
+    //      size [IN]                   -- number of bytes
+    //      key [IN]                    -- 16 secret bytes
+    //
+    // Return val:
+    //      the hash
+    // =========================================================================
+    uint64_t sipHash(const void* data, size_t size, const uint8_t* key);
+
+    // === crc32cPortable ======================================================
+    // crc32c without the SSE4.2 crc32 instruction, for comparison.
+    // =========================================================================
+    uint32_t crc32cPortable(const void* data, size_t size, uint32_t crc = 0);
+
+    // === crc32cHardware ======================================================
+    // Return val:
+    //      true if crc32c uses the CPU's crc32 instruction (SSE4.2),
+    //      otherwise false
+    // =========================================================================
+    bool crc32cHardware();
+}
+
+#endif // CHECKSUM_H
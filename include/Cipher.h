@@ -1,25 +1,206 @@
-// TODO: want to: encrypt or salt lines of raf with user password
+// =============================================================================
+// File: Cipher.h
+// =============================================================================
+// Description:
+//      This header file hosts the Cipher class of the ral namespace.
+// =============================================================================
 
-// // TODO: incomplete file & documentaiton..
+#ifndef CIPHER_H
+#define CIPHER_H
 
-// bool getLogin() {
-    
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <string>
 
-//     string name;
-//     get(name, NULL, "Enter your name: ");
-//     santize(name);
+namespace ral {
+    using namespace std;
 
-//     if (name == NULL) {
-//         printErrorMsg();
-//         return false;
-//     }
+    // === Cipher ==============================================================
+    // This class seals & opens records with AES-256-GCM. A sealed record is
+    // a 12 byte nonce, the ciphertext (as long as the record) & a 16 byte
+    // tag; the caller's 64 bit associated value (a raf uses the record's
+    // id) is authenticated too, so a sealed record copied to another slot
+    // doesn't open. Every seal takes a fresh nonce: 4 random bytes drawn
+    // when the Cipher is made followed by a 64 bit counter starting at a
+    // random value.
+    //
+    // The key is expanded once in the constructor. With AES-NI & PCLMULQDQ
+    // (checked at run time) the counter blocks of up to 16 records go
+    // through the AES rounds 8 at a time & GHASH folds 4 blocks per
+    // reduction, interleaved across the records; without them a table based
+    // AES & a 4 bit GHASH table are used. Sealing & opening are thread
+    // safe.
+    // =========================================================================
+    class Cipher {
+    public:
+        static const size_t KEY_SIZE = 32;
+        static const size_t NONCE_SIZE = 12;
+        static const size_t TAG_SIZE = 16;
+        static const size_t OVERHEAD = NONCE_SIZE + TAG_SIZE;
 
-//     bool username_exists = !first_run && getLogin();
+    private:
+        static const int ROUNDS = 14;
 
-//     if (first_run || !username_exists) {
-//         return createNewAccount();
-//     }
-//     else {
-//         return validatePassword();
-//     }
-// }
\ No newline at end of file
+        alignas(16) uint8_t round_keys[ROUNDS + 1][16];
+        uint32_t round_words[4 * (ROUNDS + 1)];     // for the table AES
+        alignas(16) uint8_t hash_powers[4][16];     // H^1..H^4 (AES-NI)
+        uint64_t hash_low[16];                      // 4 bit GHASH table
+        uint64_t hash_high[16];
+        bool hardware;
+        uint32_t nonce_prefix;
+        atomic<uint64_t> nonce_counter;
+
+        // ==== nextNonces =====================================================
+        // Parameters:
+        //      count [IN]              -- nonces wanted
+        //
+        // Return val:
+        //      the counter of the first; the rest follow it
+        // =====================================================================
+        uint64_t nextNonces(size_t count);
+
+        // ==== cryptTables ====================================================
+        // Runs AES-GCM over one record with the table AES & GHASH (the
+        // AES-NI version lives in Cipher.cpp): XORs the key stream into it
+        // & computes the tag of the ciphertext (in when opening, out when
+        // sealing).
+        //
+        // Parameters:
+        //      nonce [IN]              -- the record's nonce
+        //      in [IN]                 -- plaintext or ciphertext
+        //      out [OUT]               -- ciphertext or plaintext
+        //      size [IN]               -- bytes of the record
+        //      associated [IN]         -- authenticated with the record
+        //      sealing [IN]            -- true to encrypt, false to decrypt
+        //      tag [OUT]               -- the tag
+        //
+        // Return val: None
+        // =====================================================================
+        void cryptTables(const uint8_t* nonce, const uint8_t* in,
+            uint8_t* out, size_t size, uint64_t associated, bool sealing,
+            uint8_t* tag);
+
+        // ==== cryptMany ======================================================
+        // Runs cryptTables, or its AES-NI version when available, over
+        // records laid out like sealMany's.
+        //
+        // Parameters:
+        //      in [IN]                 -- count records (sealed if opening)
+        //      out [OUT]               -- count records (sealed if sealing)
+        //      size [IN]               -- bytes of each record
+        //      associated [IN]         -- count values, one per record
+        //      count [IN]              -- number of records
+        //      sealing [IN]            -- true to seal, false to open
+        //
+        // Return val:
+        //      true if every tag matched (always when sealing)
+        // =====================================================================
+        bool cryptMany(const char* in, char* out, size_t size,
+            const uint64_t* associated, size_t count, bool sealing);
+
+        // ==== encryptBlock ===================================================
+        // AES-256 of one block with the table implementation.
+        // =====================================================================
+        void encryptBlock(const uint8_t* in, uint8_t* out);
+
+        // ==== multiplyHash ===================================================
+        // x = x * H in GF(2^128), with the 4 bit table.
+        // =====================================================================
+        void multiplyHash(uint8_t* x);
+
+    public:
+        // === Cipher ==========================================================
+        // This is the constructor. Expands the key & the GHASH key.
+        //
+        // Parameters:
+        //      key [IN]                -- KEY_SIZE bytes
+        //      allow_hardware [OPT IN] -- optional: false to always use the
+        //                                  portable code. defaults to true
+        // =====================================================================
+        Cipher(const string &key, bool allow_hardware = true);
+
+        Cipher(const Cipher&) = delete;
+        Cipher& operator=(const Cipher&) = delete;
+
+        // ==== hasHardware ====================================================
+        // Return val:
+        //      true if the CPU has AES-NI & PCLMULQDQ, otherwise false
+        // =====================================================================
+        static bool hasHardware();
+
+        // ==== usesHardware ===================================================
+        // Return val:
+        //      true if this Cipher uses AES-NI, otherwise false
+        // =====================================================================
+        bool usesHardware();
+
+        // ==== deriveKey ======================================================
+        // Derives a key for another use of this Cipher's key (e.g. keying a
+        // hash), by encrypting the purpose followed by a zero counter: seal
+        // never encrypts a counter of 0 & the purpose isn't 0, so the
+        // derived key is never a keystream or GHASH block.
+        //
+        // Parameters:
+        //      purpose [IN]            -- NONCE_SIZE bytes naming the use,
+        //                                  not all zero
+        //      key [OUT]               -- 16 bytes
+        //
+        // Return val: None
+        // =====================================================================
+        void deriveKey(const char* purpose, uint8_t* key);
+
+        // ==== seal ===========================================================
+        // Parameters:
+        //      record [IN]             -- size bytes to encrypt
+        //      sealed [OUT]            -- size + OVERHEAD bytes
+        //      size [IN]               -- bytes of the record
+        //      associated [IN]         -- authenticated with the record
+        //
+        // Return val: None
+        // =====================================================================
+        void seal(const char* record, char* sealed, size_t size,
+            uint64_t associated);
+
+        // ==== open ===========================================================
+        // Parameters:
+        //      sealed [IN]             -- size + OVERHEAD bytes from seal
+        //      record [OUT]            -- the size decrypted bytes
+        //      size [IN]               -- bytes of the record
+        //      associated [IN]         -- what seal was given
+        //
+        // Return val:
+        //      true if the tag matched, otherwise false (record is zeroed)
+        // =====================================================================
+        bool open(const char* sealed, char* record, size_t size,
+            uint64_t associated);
+
+        // ==== sealMany =======================================================
+        // Seals a batch of records, drawing their nonces in one go.
+        //
+        // Parameters:
+        //      records [IN]            -- count records of size bytes, one
+        //                                  after the other
+        //      sealed [OUT]            -- count sealed records, one after the
+        //                                  other
+        //      size [IN]               -- bytes of each record
+        //      associated [IN]         -- count values, one per record
+        //      count [IN]              -- number of records
+        //
+        // Return val: None
+        // =====================================================================
+        void sealMany(const char* records, char* sealed, size_t size,
+            const uint64_t* associated, size_t count);
+
+        // ==== openMany =======================================================
+        // Opens a batch of records laid out like sealMany's.
+        //
+        // Return val:
+        //      true if every tag matched, otherwise false
+        // =====================================================================
+        bool openMany(const char* sealed, char* records, size_t size,
+            const uint64_t* associated, size_t count);
+    };
+}
+
+#endif // CIPHER_H
@@ -0,0 +1,304 @@
+// =============================================================================
+// File: ColumnStore.h
+// =============================================================================
+// Description:
+//      This header file hosts the ColumnStore class of the ral namespace.
+// =============================================================================
+
+#ifndef COLUMN_STORE_H
+#define COLUMN_STORE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+#include "ral.h"
+
+namespace ral {
+    using namespace std;
+
+    // === ColumnFilter ========================================================
+    // Which rows a ColumnStore query looks at: values in [min_value,
+    // max_value] whose name starts with name_prefix.
+    // =========================================================================
+    struct ColumnFilter {
+        int64_t min_value = INT64_MIN;
+        int64_t max_value = INT64_MAX;
+        string name_prefix;
+    };
+
+    // === ColumnSummary =======================================================
+    // Aggregates of the rows a filter matched. sum saturates at the limits
+    // of int64_t; min & max are 0 when nothing matched.
+    // =========================================================================
+    struct ColumnSummary {
+        size_t count = 0;
+        int64_t sum = 0;
+        int64_t min = 0;
+        int64_t max = 0;
+    };
+
+    // === ColumnStore =========================================================
+    // This class keeps a columnar copy of part of every record of a File in
+    // its own memory mapped file, so reports can scan a few packed arrays
+    // instead of reading & decoding whole records. Each slot of the raf has
+    // a row of three columns: the id (0 for an empty slot), one int64 value
+    // & the offset of a name in a heap of names at the end of the file. An
+    // Extractor pulls the value & name out of an encoded record.
+    //
+    // Given to a File as its Options::projection, it's updated by every
+    // write & delete. Like HashIndex it's derived data, marked dirty while
+    // open; a caller that finds it dirty or out of step with the raf rebuilds
+    // it with clear & update. Every member function takes the store's lock,
+    // so it may be shared by a concurrent File.
+    //
+    // A store given a key (that of an encrypted raf) never has its rows on
+    // disk in the clear: they live in an anonymous file while it's open, &
+    // its file only holds an image of them sealed with the key (a Cipher)
+    // while it's closed. The image is read & emptied on open, so a crash
+    // leaves no image & the store is rebuilt.
+    //
+    // Filters on the value are evaluated a whole column at a time without
+    // branches, so the compiler can vectorize them; the name prefix is only
+    // checked for rows whose value matched.
+    // =========================================================================
+    class ColumnStore : public Projection {
+    public:
+        // gets the value & name of an encoded record; false if the record
+        // shouldn't be in the store
+        typedef function<bool(const char* record, int64_t &value,
+            string &name)> Extractor;
+
+    private:
+        // === Header ==========================================================
+        // First page of the store file.
+        // =====================================================================
+        struct Header {
+            char magic[8];
+            uint32_t version;
+            uint32_t clean;         // 1 if closed cleanly
+            uint64_t slots;         // rows in each column
+            uint64_t count;         // rows in use
+            uint64_t heap_size;     // bytes of the name heap in use
+            uint64_t heap_capacity; // bytes of the name heap
+            uint64_t heap_garbage;  // bytes of names no row points to
+        };
+
+        static constexpr size_t MIN_SLOTS = 1024;
+        static constexpr size_t MIN_HEAP = 64 * 1024;
+
+        string file_name;
+        Extractor extract;
+        int fd;
+        char* mapping;
+        size_t mapping_size;
+        Header* header;
+        int32_t* ids;           // column of ids
+        int64_t* values;        // column of values
+        uint32_t* names;        // column of offsets into heap
+        char* heap;             // names, each a length byte then the bytes
+        bool was_clean;
+        string name;            // scratch for extract
+        unique_ptr<Cipher> cipher; // seals the image (null without a key)
+        mutex lock;
+
+        // ==== map ============================================================
+        // Sizes the file for the given columns & heap & maps it.
+        //
+        // Parameters:
+        //      slots [IN]              -- rows in each column
+        //      heap_capacity [IN]      -- bytes of the name heap
+        //
+        // Return val:
+        //      true if successful, otherwise false
+        // =====================================================================
+        bool map(size_t slots, size_t heap_capacity);
+
+        // ==== resize =========================================================
+        // Copies every row into columns of the given size & a heap holding
+        // only the names in use.
+        //
+        // Parameters:
+        //      slots [IN]              -- rows in each column
+        //      heap_needed [IN]        -- free heap bytes wanted afterwards
+        //
+        // Return val:
+        //      true if successful, otherwise false
+        // =====================================================================
+        bool resize(size_t slots, size_t heap_needed);
+
+        // ==== setName ========================================================
+        // Adds a name to the heap & points a row at it, compacting or
+        // growing the heap first if it's full.
+        //
+        // Parameters:
+        //      slot [IN]               -- the row
+        //      name [IN]               -- the name (at most 255 bytes)
+        //
+        // Return val:
+        //      true if successful, otherwise false
+        // =====================================================================
+        bool setName(size_t slot, const string &name);
+
+        // ==== matches ========================================================
+        // Marks the rows whose value is in the filter's range (vectorizable)
+        // then clears the ones whose name lacks the prefix.
+        //
+        // Parameters:
+        //      filter [IN]             -- the filter
+        //      match [OUT]             -- 1 for every matching row
+        //
+        // Return val: None
+        // =====================================================================
+        void matches(const ColumnFilter &filter, vector<uint8_t> &match);
+
+        // ==== eraseRow =======================================================
+        // Empties a row if it's in use, counting its name as garbage.
+        //
+        // Parameters:
+        //      slot [IN]               -- the row
+        //
+        // Return val: None
+        // =====================================================================
+        void eraseRow(size_t slot);
+
+        // ==== loadSealed =====================================================
+        // Copies the rows from the sealed image in the store file (if it
+        // holds one that opens) into the anonymous file, then empties the
+        // store file.
+        //
+        // Parameters: None
+        //
+        // Return val:
+        //      true if the store file could be emptied, otherwise false
+        // =====================================================================
+        bool loadSealed();
+
+        // ==== saveSealed =====================================================
+        // Writes the rows to the store file, sealed, & fdatasyncs them.
+        //
+        // Parameters: None
+        //
+        // Return val:
+        //      true if successful, otherwise false
+        // =====================================================================
+        bool saveSealed();
+
+        // ==== clearRows ======================================================
+        // Empties every row & the heap. The lock must be held.
+        //
+        // Parameters: None
+        //
+        // Return val: None
+        // =====================================================================
+        void clearRows();
+
+    public:
+        // === ColumnStore =====================================================
+        // This is the constructor. It opens (or creates) the store file &
+        // marks it dirty until it's closed.
+        //
+        // Parameters:
+        //      file_name [IN]          -- name of the store file (empty to
+        //                                  keep the store in memory only)
+        //      extract [IN]            -- reads a record's value & name
+        //      key [OPT IN]            -- optional: Cipher::KEY_SIZE bytes to
+        //                                  seal the store file with. defaults
+        //                                  to none (the rows are mapped from
+        //                                  the file)
+        // =====================================================================
+        ColumnStore(string file_name, Extractor extract,
+            const string &key = "");
+
+        // === ~ColumnStore ====================================================
+        // Syncs the store (or writes its sealed image) & marks it clean.
+        // =====================================================================
+        ~ColumnStore();
+
+        ColumnStore(const ColumnStore&) = delete;
+        ColumnStore& operator=(const ColumnStore&) = delete;
+
+        // ==== isOpen =========================================================
+        // Return val:
+        //      true if the store file was opened & mapped, otherwise false
+        // =====================================================================
+        bool isOpen();
+
+        // ==== isCurrent ======================================================
+        // Parameters:
+        //      count [IN]              -- rows the store should hold
+        //
+        // Return val:
+        //      true if the store was closed cleanly with that many rows,
+        //      otherwise false (it must be rebuilt)
+        // =====================================================================
+        bool isCurrent(size_t count);
+
+        // ==== clear ==========================================================
+        // Empties every row.
+        //
+        // Parameters:
+        //      slots [IN]              -- rows about to be filled (the raf's
+        //                                  capacity)
+        //
+        // Return val:
+        //      true if successful, otherwise false
+        // =====================================================================
+        bool clear(size_t slots = 0);
+
+        // ==== update =========================================================
+        // Sets the row of a record from its encoding.
+        // =====================================================================
+        void update(int id, const char* record) override;
+
+        // ==== erase ==========================================================
+        // Empties the row of a deleted record.
+        // =====================================================================
+        void erase(int id) override;
+
+        // ==== summarize ======================================================
+        // Parameters:
+        //      filter [IN]             -- the rows to aggregate
+        //
+        // Return val:
+        //      count, sum, min & max of the matching rows' values
+        // =====================================================================
+        ColumnSummary summarize(const ColumnFilter &filter);
+
+        // ==== select =========================================================
+        // Parameters:
+        //      filter [IN]             -- the rows wanted
+        //      ids [OUT]               -- ids of the matching rows are
+        //                                  appended in ascending order
+        //
+        // Return val: None
+        // =====================================================================
+        void select(const ColumnFilter &filter, vector<int> &ids);
+
+        // ==== top ============================================================
+        // Parameters:
+        //      filter [IN]             -- the rows to rank
+        //      k [IN]                  -- number of rows wanted
+        //      largest [IN]            -- true for the largest values,
+        //                                  false for the smallest
+        //      rows [OUT]              -- up to k (id, value) pairs, best
+        //                                  first
+        //
+        // Return val: None
+        // =====================================================================
+        void top(const ColumnFilter &filter, size_t k, bool largest,
+            vector<pair<int, int64_t>> &rows);
+
+        // ==== getCount =======================================================
+        // Return val:
+        //      rows in use
+        // =====================================================================
+        size_t getCount();
+    };
+}
+
+#endif // COLUMN_STORE_H
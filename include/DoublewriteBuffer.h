@@ -0,0 +1,106 @@
+// =============================================================================
+// File: DoublewriteBuffer.h
+// =============================================================================
+// Description:
+//      This header file hosts the DoublewriteBuffer class of the ral
+//      namespace.
+// =============================================================================
+
+#ifndef DOUBLEWRITE_BUFFER_H
+#define DOUBLEWRITE_BUFFER_H
+
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+#include <string>
+
+namespace ral {
+    using namespace std;
+
+    // === DoublewriteBuffer ===================================================
+    // This class is a file kept next to a packed raf that holds the images
+    // of the pages about to be overwritten in place. A batch of images is
+    // written & fdatasynced before any of its pages is, so a crash that
+    // tears a page leaves an intact image of it here; on open, every page
+    // the raf can't read is put back from its newest image & the file is
+    // emptied. Batches go one after another into a ring of RING_PAGES
+    // images, & the raf is synced each time the ring wraps around, so an
+    // image is only overwritten once its page is on disk.
+    // =========================================================================
+    class DoublewriteBuffer {
+    public:
+        // puts an image back over a page if the page is torn
+        typedef function<bool(uint32_t page, const char* image)> PageRestorer;
+        // syncs the raf
+        typedef function<bool()> RafSyncer;
+
+    private:
+        static const size_t RING_PAGES = 64;
+
+        string file_name;
+        size_t page_size;
+        RafSyncer sync_raf;
+        int fd;
+        uint64_t next_batch;
+        size_t next_entry;              // where the next batch goes
+        string buffer;                  // the batch being written
+        bool failed;
+
+        // ==== recover ========================================================
+        // Hands the newest intact image of each page to restore, syncs the
+        // raf & empties the file.
+        //
+        // Parameters:
+        //      restore [IN]            -- puts an image back
+        //
+        // Return val:
+        //      true if successful, otherwise false
+        // =====================================================================
+        bool recover(const PageRestorer &restore);
+
+    public:
+        // === DoublewriteBuffer ===============================================
+        // This is the constructor. It puts back the pages a crash tore.
+        //
+        // Parameters:
+        //      file_name [IN]          -- name of the file
+        //      page_size [IN]          -- bytes of a page image
+        //      restore [IN]            -- puts an image back over its page
+        //                                  if the page is torn
+        //      sync_raf [IN]           -- syncs the raf
+        // =====================================================================
+        DoublewriteBuffer(string file_name, size_t page_size,
+            PageRestorer restore, RafSyncer sync_raf);
+
+        // === ~DoublewriteBuffer ==============================================
+        // This is the destructor.
+        // =====================================================================
+        ~DoublewriteBuffer();
+
+        DoublewriteBuffer(const DoublewriteBuffer&) = delete;
+        DoublewriteBuffer& operator=(const DoublewriteBuffer&) = delete;
+
+        // ==== isOpen =========================================================
+        // Return val:
+        //      true if the file was opened & recovered, otherwise false
+        // =====================================================================
+        bool isOpen();
+
+        // ==== write ==========================================================
+        // Writes a batch of page images & fdatasyncs them (syncing the raf
+        // first if the ring wraps around).
+        //
+        // Parameters:
+        //      pages [IN]              -- numbers of the pages, each once
+        //      images [IN]             -- count images of page_size bytes,
+        //                                  one after another
+        //      count [IN]              -- number of pages
+        //
+        // Return val:
+        //      true if successful, otherwise false
+        // =====================================================================
+        bool write(const uint32_t* pages, const char* images, size_t count);
+    };
+}
+
+#endif // DOUBLEWRITE_BUFFER_H
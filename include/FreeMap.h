@@ -0,0 +1,156 @@
+// =============================================================================
+// File: FreeMap.h
+// =============================================================================
+// Description:
+//      This header file hosts the FreeMap class of the ral namespace.
+// =============================================================================
+
+#ifndef FREE_MAP_H
+#define FREE_MAP_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+namespace ral {
+    using namespace std;
+
+    // === FreeMap =============================================================
+    // This class tracks which slots of a raf are in use. The bottom level is
+    // a bitmap with one bit per slot (set if used), laid out exactly like the
+    // bitmaps in the raf. Every level above it has one bit per word of the
+    // level below, set if that word still has a free slot, up to a single
+    // top word. Finding, taking & releasing a slot touch one word per level
+    // (log64 of the capacity) using find-first-set.
+    // =========================================================================
+    class FreeMap {
+    private:
+        vector<vector<uint64_t>> levels; // levels[0] is the slot bitmap
+        size_t slots;
+        size_t free_slots;
+
+        // ==== rebuild ========================================================
+        // Recomputes every summary level from the slot bitmap.
+        //
+        // Parameters: None
+        //
+        // Return val: None
+        // =====================================================================
+        void rebuild();
+
+        // ==== markFull =======================================================
+        // Clears the summary bits above a slot bitmap word that just filled.
+        //
+        // Parameters:
+        //      word [IN]               -- index of the word in levels[0]
+        //
+        // Return val: None
+        // =====================================================================
+        void markFull(size_t word);
+
+        // ==== markFree =======================================================
+        // Sets the summary bits above a slot bitmap word that just got a free
+        // slot.
+        //
+        // Parameters:
+        //      word [IN]               -- index of the word in levels[0]
+        //
+        // Return val: None
+        // =====================================================================
+        void markFree(size_t word);
+
+    public:
+        // === FreeMap =========================================================
+        // This is the constructor. The map starts with no slots.
+        // =====================================================================
+        FreeMap();
+
+        // ==== resize =========================================================
+        // Parameters:
+        //      slots [IN]              -- new number of slots (multiple of
+        //                                  64). slots added are free
+        //
+        // Return val: None
+        // =====================================================================
+        void resize(size_t slots);
+
+        // ==== setWords =======================================================
+        // Overwrites part of the slot bitmap, e.g. with a bitmap read from
+        // the raf.
+        //
+        // Parameters:
+        //      first_word [IN]         -- index of the first word to set
+        //      words [IN]              -- the new words
+        //      count [IN]              -- number of words
+        //
+        // Return val: None
+        // =====================================================================
+        void setWords(size_t first_word, const uint64_t* words, size_t count);
+
+        // ==== getWord ========================================================
+        // Parameters:
+        //      word [IN]               -- index of a slot bitmap word
+        //
+        // Return val:
+        //      the word (bit set if the slot is used)
+        // =====================================================================
+        uint64_t getWord(size_t word) const;
+
+        // ==== findFree =======================================================
+        // Parameters:
+        //      slot [OUT]              -- lowest free slot
+        //
+        // Return val:
+        //      true if there was a free slot, otherwise false
+        // =====================================================================
+        bool findFree(size_t &slot) const;
+
+        // ==== reserve ========================================================
+        // Parameters:
+        //      slot [IN]               -- slot to mark as used
+        //
+        // Return val:
+        //      true if the slot was free, otherwise false
+        // =====================================================================
+        bool reserve(size_t slot);
+
+        // ==== reserveBlock ===================================================
+        // Marks the lowest free slots as used, a whole bitmap word at a time.
+        //
+        // Parameters:
+        //      count [IN]              -- number of slots wanted
+        //      reserved [OUT]          -- the slots taken are appended here
+        //
+        // Return val:
+        //      number of slots taken (less than count if the map filled up)
+        // =====================================================================
+        size_t reserveBlock(size_t count, vector<size_t> &reserved);
+
+        // ==== release ========================================================
+        // Parameters:
+        //      slot [IN]               -- slot to mark as free
+        //
+        // Return val: None
+        // =====================================================================
+        void release(size_t slot);
+
+        // ==== isUsed =========================================================
+        // Parameters:
+        //      slot [IN]               -- slot to check
+        //
+        // Return val:
+        //      true if the slot is used, otherwise false
+        // =====================================================================
+        bool isUsed(size_t slot) const;
+
+        // ==== getFreeCount ===================================================
+        // Parameters: None
+        //
+        // Return val:
+        //      number of free slots
+        // =====================================================================
+        size_t getFreeCount() const;
+    };
+}
+
+#endif // FREE_MAP_H
@@ -0,0 +1,176 @@
+// =============================================================================
+// File: HashIndex.h
+// =============================================================================
+// Description:
+//      This header file hosts the HashIndex class of the ral namespace.
+// =============================================================================
+
+#ifndef HASH_INDEX_H
+#define HASH_INDEX_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace ral {
+    using namespace std;
+
+    // === HashIndex ===========================================================
+    // This class is a persistent hash index from 64 bit keys (hashes of
+    // whatever the caller indexes) to record ids, kept in its own memory
+    // mapped file. It is an open addressing table with linear probing that
+    // doubles when half full; a key may map to several ids, so callers check
+    // the records they get back. Deleting shifts back the entries after it,
+    // so there are no tombstones.
+    //
+    // The index is derived data: it's marked dirty while open & clean when
+    // closed, so a caller that finds it dirty (or missing, or out of step
+    // with the raf) after a crash rebuilds it with clear & insert.
+    // =========================================================================
+    class HashIndex {
+    private:
+        // === Header ==========================================================
+        // First page of the index file.
+        // =====================================================================
+        struct Header {
+            char magic[8];
+            uint32_t version;
+            uint32_t clean;     // 1 if closed cleanly
+            uint64_t slots;     // size of the table (a power of 2)
+            uint64_t count;     // ids in the table
+        };
+
+        // === Entry ===========================================================
+        // One slot of the table; id 0 marks an empty slot.
+        // =====================================================================
+        struct Entry {
+            uint64_t key;
+            int32_t id;
+            int32_t unused;
+        };
+
+        static const size_t MIN_SLOTS = 1024;
+
+        string file_name;
+        int fd;
+        char* mapping;
+        size_t mapping_size;
+        Header* header;
+        Entry* table;
+        size_t mask;
+        bool was_clean;
+
+        // ==== map ============================================================
+        // Sizes the file for the given number of slots & maps it.
+        //
+        // Parameters:
+        //      slots [IN]              -- size of the table (a power of 2)
+        //
+        // Return val:
+        //      true if successful, otherwise false
+        // =====================================================================
+        bool map(size_t slots);
+
+        // ==== resize =========================================================
+        // Rehashes every entry into a table of the given size.
+        //
+        // Parameters:
+        //      slots [IN]              -- size of the table (a power of 2)
+        //
+        // Return val:
+        //      true if successful, otherwise false
+        // =====================================================================
+        bool resize(size_t slots);
+
+        // ==== home ===========================================================
+        // Return val:
+        //      the slot where probing for the key starts
+        // =====================================================================
+        size_t home(uint64_t key) const;
+
+    public:
+        // === HashIndex =======================================================
+        // This is the constructor. It opens (or creates) the index file &
+        // marks it dirty until it's closed.
+        //
+        // Parameters:
+        //      file_name [IN]          -- name of the index file
+        // =====================================================================
+        HashIndex(string file_name);
+
+        // === ~HashIndex ======================================================
+        // Syncs the index & marks it clean.
+        // =====================================================================
+        ~HashIndex();
+
+        HashIndex(const HashIndex&) = delete;
+        HashIndex& operator=(const HashIndex&) = delete;
+
+        // ==== isOpen =========================================================
+        // Return val:
+        //      true if the index file was opened & mapped, otherwise false
+        // =====================================================================
+        bool isOpen();
+
+        // ==== isCurrent ======================================================
+        // Parameters:
+        //      count [IN]              -- ids the index should hold
+        //
+        // Return val:
+        //      true if the index was closed cleanly with that many ids,
+        //      otherwise false (it must be rebuilt)
+        // =====================================================================
+        bool isCurrent(size_t count);
+
+        // ==== clear ==========================================================
+        // Removes every entry.
+        //
+        // Parameters:
+        //      expected [IN]           -- ids about to be inserted; sizes the
+        //                                  table so they fit without resizing
+        //
+        // Return val:
+        //      true if successful, otherwise false
+        // =====================================================================
+        bool clear(size_t expected = 0);
+
+        // ==== insert =========================================================
+        // Parameters:
+        //      key [IN]                -- hash of what's indexed
+        //      id [IN]                 -- id of the record
+        //
+        // Return val:
+        //      true if successful, otherwise false
+        // =====================================================================
+        bool insert(uint64_t key, int id);
+
+        // ==== erase ==========================================================
+        // Parameters:
+        //      key [IN]                -- hash of what's indexed
+        //      id [IN]                 -- id of the record
+        //
+        // Return val:
+        //      true if the entry was found & removed, otherwise false
+        // =====================================================================
+        bool erase(uint64_t key, int id);
+
+        // ==== find ===========================================================
+        // Parameters:
+        //      key [IN]                -- hash of what's indexed
+        //      ids [OUT]               -- ids stored under the key are
+        //                                  appended here
+        //
+        // Return val: None
+        // =====================================================================
+        void find(uint64_t key, vector<int> &ids) const;
+
+        // ==== getCount =======================================================
+        // Return val:
+        //      ids in the index
+        // =====================================================================
+        size_t getCount() const;
+    };
+}
+
+#endif // HASH_INDEX_H
@@ -0,0 +1,107 @@
+// =============================================================================
+// File: Ingest.h
+// =============================================================================
+// Description:
+//      This header file hosts the declaration of the Ingest class.
+// =============================================================================
+
+#ifndef INGEST_H
+#define INGEST_H
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "Bank.h"
+
+// === Ingest ==================================================================
+// This class applies a transaction file to a Bank without the menus. The file
+// is CSV, one transaction per line:
+//      op,id,name,amount
+// where op is create, deposit, withdraw or close. create leaves id empty (the
+// new id is reported) & takes an optional opening deposit; close needs only
+// the id. Amounts are in dollars with at most 2 decimal places. Fields
+// aren't quoted, so names can't hold commas. Blank lines, lines starting
+// with # & a header line starting with "op," are skipped.
+//
+// The file is mapped & parsed in place, CHUNK_SIZE transactions at a time;
+// each chunk is applied with Bank::applyTransactions & committed with one
+// sync. A results file gets one line per transaction:
+//      line,status,id,balance
+// where status is ok or the reason the transaction was rejected.
+// =============================================================================
+class Ingest {
+public:
+    // === Ingest ============================================================
+    // This is the constructor for the Ingest class.
+    //
+    // Input:
+    //      bank [IN/OUT]            -- the bank to apply transactions to
+    //
+    // No Output.
+    // =============================================================================
+    Ingest(Bank &bank);
+
+    // ==== run ==============================================================
+    // This function applies every transaction in a file.
+    //
+    // Input:
+    //      file_name [IN]           -- the transaction file
+    //      results_name [IN]        -- where the results are written
+    //
+    // Output:
+    //      true if the whole file was applied (rejected transactions
+    //      included), otherwise false
+    // =============================================================================
+    bool run(const std::string &file_name, const std::string &results_name);
+
+private:
+    // ==== parseLine ========================================================
+    // This function parses one line of the file.
+    //
+    // Input:
+    //      begin [IN]               -- the first character of the line
+    //      end [IN]                 -- one past its last (without the newline)
+    //      transaction [OUT]        -- the transaction on the line
+    //
+    // Output:
+    //      true if the line held a transaction, otherwise false
+    // =============================================================================
+    static bool parseLine(const char* begin, const char* end,
+        Bank::Transaction &transaction);
+
+    // ==== parseId ==========================================================
+    // Input:
+    //      begin [IN]               -- the first character of the field
+    //      end [IN]                 -- one past its last
+    //      id [OUT]                 -- the id
+    //
+    // Output:
+    //      true if the field is a positive id, otherwise false
+    // =============================================================================
+    static bool parseId(const char* begin, const char* end, int &id);
+
+    // ==== applyChunk =======================================================
+    // This function applies the chunk of transactions read so far, commits
+    // it & writes its results.
+    //
+    // Input: None
+    //
+    // Output:
+    //      true if successful, otherwise false
+    // =============================================================================
+    bool applyChunk();
+
+    // large chunks group more updates per account & need fewer syncs (a
+    // chunk takes about 40 bytes per transaction)
+    static const size_t CHUNK_SIZE = 1024 * 1024;
+
+    Bank &bank;
+    FILE* results;
+    std::vector<Bank::Transaction> transactions;
+    std::vector<size_t> lines;   // line number of each transaction
+    std::vector<size_t> rejects; // line numbers that didn't parse
+    size_t applied;
+    size_t rejected;
+};
+
+#endif // INGEST_H
@@ -0,0 +1,135 @@
+// =============================================================================
+// File: IntentLog.h
+// =============================================================================
+// Description:
+//      This header file hosts the IntentLog class of the ral namespace.
+// =============================================================================
+
+#ifndef INTENT_LOG_H
+#define INTENT_LOG_H
+
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace ral {
+    using namespace std;
+
+    // === IntentLog ===========================================================
+    // This class is the coordinator's log of transactions that span many
+    // files (two-phase commit). Once every file has locked & read its part,
+    // begin writes the transaction's intent (what each part writes) &
+    // fdatasyncs it: from then on the transaction happens. Each part is
+    // then committed in its file & marked done with commitPart before the
+    // file lets another write at its records. On open, every part of an
+    // intent not marked done is handed to redo: its file held the part's
+    // records from the intent until the crash, so writing the part again
+    // can't undo anything newer. The file is emptied whenever no
+    // transaction is open.
+    // =========================================================================
+    class IntentLog {
+    public:
+        // writes a part of a transaction a crash interrupted, durably
+        typedef function<bool(uint64_t transaction, const string &part)>
+            PartRedoer;
+
+    private:
+        string file_name;
+        int fd;
+        mutex lock;                     // guards the fields below
+        off_t log_size;
+        uint64_t next_transaction;
+        // transaction -> its parts not done yet
+        unordered_map<uint64_t, size_t> open_parts;
+        string buffer;                  // the entry being written
+        bool failed;
+
+        // ==== recover ========================================================
+        // Hands every part not marked done to redo & empties the file.
+        //
+        // Parameters:
+        //      redo [IN]               -- writes a part again
+        //
+        // Return val:
+        //      true if successful, otherwise false
+        // =====================================================================
+        bool recover(const PartRedoer &redo);
+
+        // ==== append =========================================================
+        // Writes an entry at the end of the file (the caller holds lock).
+        //
+        // Parameters:
+        //      transaction [IN]        -- the transaction
+        //      part [IN]               -- the part done, or the number of
+        //                                  parts of an intent
+        //      data [IN]               -- the parts of an intent (none for a
+        //                                  part done)
+        //      size [IN]               -- bytes of data
+        //
+        // Return val:
+        //      true if successful, otherwise false
+        // =====================================================================
+        bool append(uint64_t transaction, uint32_t part, const char* data,
+            size_t size);
+
+    public:
+        // === IntentLog =======================================================
+        // This is the constructor. It finishes the transactions a crash
+        // interrupted.
+        //
+        // Parameters:
+        //      file_name [IN]          -- name of the file
+        //      redo [IN]               -- writes a part of an interrupted
+        //                                  transaction again
+        // =====================================================================
+        IntentLog(string file_name, PartRedoer redo);
+
+        // === ~IntentLog ======================================================
+        // This is the destructor.
+        // =====================================================================
+        ~IntentLog();
+
+        IntentLog(const IntentLog&) = delete;
+        IntentLog& operator=(const IntentLog&) = delete;
+
+        // ==== isOpen =========================================================
+        // Return val:
+        //      true if the file was opened & recovered, otherwise false
+        // =====================================================================
+        bool isOpen();
+
+        // ==== begin ==========================================================
+        // Writes the intent of a transaction & fdatasyncs it; the caller
+        // holds the records of every part.
+        //
+        // Parameters:
+        //      parts [IN]              -- what each part writes, as redo
+        //                                  gets it back
+        //
+        // Return val:
+        //      the transaction's number if successful, otherwise 0 (& the
+        //      intent may or may not be in the file)
+        // =====================================================================
+        uint64_t begin(const vector<string> &parts);
+
+        // ==== commitPart =====================================================
+        // Marks a part committed in its file & fdatasyncs the mark; the
+        // caller still holds the part's records. The last part closes the
+        // transaction.
+        //
+        // Parameters:
+        //      transaction [IN]        -- from begin
+        //      part [IN]               -- index of the part in begin's parts
+        //
+        // Return val:
+        //      true if successful, otherwise false
+        // =====================================================================
+        bool commitPart(uint64_t transaction, size_t part);
+    };
+}
+
+#endif // INTENT_LOG_H
@@ -0,0 +1,232 @@
+// =============================================================================
+// File: Journal.h
+// =============================================================================
+// Description:
+//      This header file hosts the Journal class of the ral namespace.
+// =============================================================================
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace ral {
+    using namespace std;
+
+    // === JournalStats ========================================================
+    // Counters kept by a Journal since it was opened.
+    // =========================================================================
+    struct JournalStats {
+        uint64_t appends = 0;       // records appended
+        uint64_t commits = 0;       // fdatasyncs of the log
+        uint64_t checkpoints = 0;   // times the log was emptied into the raf
+        uint64_t replayed = 0;      // records replayed when opened
+    };
+
+    // === Journal =============================================================
+    // This class is a write-ahead log of record images kept next to a raf.
+    // Updates are appended to an in memory buffer & become durable when a
+    // commit writes the buffer to the log & fdatasyncs it; commits that
+    // arrive while another is in progress wait for the next one, so
+    // concurrent commits share a single fdatasync. Records stay in the
+    // journal (& are served from it) until a background checkpoint has
+    // written them to the raf & synced it, after which the log is emptied.
+    // On open, a log left behind by a crash is replayed into the raf; the
+    // entries of a group appended together are replayed all or none.
+    // =========================================================================
+    class Journal {
+    public:
+        // writes record images (at most one per id) to their slots in the
+        // raf
+        typedef function<bool(const vector<pair<int, const char*>> &images)>
+            RecordWriter;
+        // syncs the raf
+        typedef function<bool()> RafSyncer;
+
+    private:
+        // === Pending =========================================================
+        // The latest image of a record that isn't in the raf yet.
+        // =====================================================================
+        struct Pending {
+            uint64_t lsn;
+            string record;
+        };
+
+        // log size that forces a checkpoint
+        static constexpr size_t CHECKPOINT_BYTES = 16 << 20;
+        static constexpr int CHECKPOINT_INTERVAL_MS = 100;
+
+        string file_name;
+        size_t record_size;
+        RecordWriter write_records;
+        RafSyncer sync_raf;
+        int fd;
+
+        mutex lock;
+        condition_variable flushed;     // a commit finished
+        condition_variable wake;        // the checkpointer has work
+        string buffer;                  // entries not written to the log yet
+        uint64_t next_lsn;
+        uint64_t durable_lsn;
+        size_t log_size;
+        bool flushing;
+        bool failed;
+        bool stopping;
+        unordered_map<int, Pending> pending;
+        JournalStats stats;
+        thread checkpointer;
+
+        // ==== replay =========================================================
+        // Writes the latest intact image of each record in the log to the
+        // raf, syncs it & empties the log. Stops at the first torn or
+        // corrupt entry.
+        //
+        // Parameters: None
+        //
+        // Return val:
+        //      true if successful, otherwise false
+        // =====================================================================
+        bool replay();
+
+        // ==== flush ==========================================================
+        // Writes the buffer to the log & fdatasyncs it, unless another
+        // thread is already doing so. Called with lock held; releases it
+        // while writing.
+        //
+        // Parameters:
+        //      guard [IN/OUT]          -- the held lock
+        //
+        // Return val:
+        //      true if successful, otherwise false
+        // =====================================================================
+        bool flush(unique_lock<mutex> &guard);
+
+        // ==== checkpoint =====================================================
+        // Writes the records committed to the log into the raf, syncs it &
+        // forgets them; empties the log once nothing newer is in it.
+        //
+        // Parameters:
+        //      force [IN]              -- hold the lock throughout so the log
+        //                                  is guaranteed to be emptied
+        //
+        // Return val:
+        //      true if successful, otherwise false
+        // =====================================================================
+        bool checkpoint(bool force);
+
+        // ==== runCheckpointer ================================================
+        // Body of the background thread.
+        // =====================================================================
+        void runCheckpointer();
+
+    public:
+        // === Journal =========================================================
+        // This is the constructor. It replays a log left by a crash & starts
+        // the background checkpointer.
+        //
+        // Parameters:
+        //      file_name [IN]          -- name of the log
+        //      record_size [IN]        -- size of an encoded record
+        //      write_records [IN]      -- writes images into the raf
+        //      sync_raf [IN]           -- syncs the raf
+        // =====================================================================
+        Journal(string file_name, size_t record_size,
+            RecordWriter write_records, RafSyncer sync_raf);
+
+        // === ~Journal ========================================================
+        // Stops the checkpointer & checkpoints everything.
+        // =====================================================================
+        ~Journal();
+
+        Journal(const Journal&) = delete;
+        Journal& operator=(const Journal&) = delete;
+
+        // ==== isOpen =========================================================
+        // Return val:
+        //      true if the log was opened & replayed, otherwise false
+        // =====================================================================
+        bool isOpen();
+
+        // ==== append =========================================================
+        // Parameters:
+        //      id [IN]                 -- id of the record
+        //      record [IN]             -- the encoded record
+        //
+        // Return val:
+        //      the log sequence number of the entry
+        // =====================================================================
+        uint64_t append(int id, const char* record);
+
+        // ==== appendGroup ====================================================
+        // Appends many entries that are replayed all or none: a crash that
+        // tears the group drops every entry of it.
+        //
+        // Parameters:
+        //      ids [IN]                -- ids of the records
+        //      records [IN]            -- count encoded records, one after
+        //                                  another
+        //      count [IN]              -- number of records
+        //
+        // Return val:
+        //      the log sequence number of the last entry (0 if count is 0)
+        // =====================================================================
+        uint64_t appendGroup(const int* ids, const char* records,
+            size_t count);
+
+        // ==== commit =========================================================
+        // Blocks until the entry with the given lsn (& all before it) is
+        // durable in the log.
+        //
+        // Parameters:
+        //      lsn [IN]                -- from append
+        //
+        // Return val:
+        //      true if successful, otherwise false
+        // =====================================================================
+        bool commit(uint64_t lsn);
+
+        // ==== commitAll ======================================================
+        // Return val:
+        //      true if every entry appended so far is durable, otherwise false
+        // =====================================================================
+        bool commitAll();
+
+        // ==== find ===========================================================
+        // Parameters:
+        //      id [IN]                 -- id of the record
+        //      record [OUT]            -- record_size bytes where the image
+        //                                  is copied to
+        //
+        // Return val:
+        //      true if the journal holds a newer image than the raf,
+        //      otherwise false
+        // =====================================================================
+        bool find(int id, char* record);
+
+        // ==== getImages ======================================================
+        // Parameters:
+        //      images [OUT]            -- id & image of every record the
+        //                                  journal holds a newer image of
+        //                                  than the raf
+        //
+        // Return val: None
+        // =====================================================================
+        void getImages(vector<pair<int, string>> &images);
+
+        // ==== getStats =======================================================
+        // Return val:
+        //      the journal's counters
+        // =====================================================================
+        JournalStats getStats();
+    };
+}
+
+#endif // JOURNAL_H
@@ -0,0 +1,70 @@
+// =============================================================================
+// File: Protocol.h
+// =============================================================================
+// Description:
+//      This header file hosts the protocol namespace: the frames exchanged
+//      between the Bank server & its clients over a Unix domain socket.
+// =============================================================================
+
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <cstdint>
+
+namespace protocol {
+    // === Op ==================================================================
+    // What a request asks for. Every op but open & login needs the session
+    // to be logged in.
+    //      open                    -- create an account (name, amount =
+    //                                  opening deposit) & log in to it
+    //      login                   -- log in to an account (id, name)
+    //      balance                 -- get the balance
+    //      deposit                 -- deposit amount
+    //      withdraw                -- withdraw amount
+    //      close                   -- close the account & log out
+    //      logout                  -- log out
+    //      transfer                -- move amount to the account id
+    // =========================================================================
+    enum class Op : uint8_t {
+        open = 1,
+        login,
+        balance,
+        deposit,
+        withdraw,
+        close,
+        logout,
+        transfer
+    };
+
+    // === Request =============================================================
+    // A request frame is this header followed by name_size bytes of name
+    // (not null terminated). Amounts are in cents.
+    // =========================================================================
+    struct Request {
+        uint8_t op;
+        uint8_t name_size;
+        uint16_t unused;
+        int32_t id;
+        int64_t amount;
+    };
+
+    // === Response ============================================================
+    // One response frame is sent per request, in order. status is a
+    // Bank::Result or one of the statuses below; id & balance (in cents)
+    // describe the session's account.
+    // =========================================================================
+    struct Response {
+        uint8_t status;
+        uint8_t unused[3];
+        int32_t id;
+        int64_t balance;
+    };
+
+    const uint8_t NOT_LOGGED_IN = 100;  // the op needs a login
+    const uint8_t BAD_REQUEST = 101;    // unknown op
+
+    static_assert(sizeof(Request) == 16, "request header must be 16 bytes");
+    static_assert(sizeof(Response) == 16, "response must be 16 bytes");
+}
+
+#endif // PROTOCOL_H
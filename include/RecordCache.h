@@ -0,0 +1,170 @@
+// =============================================================================
+// File: RecordCache.h
+// =============================================================================
+// Description:
+//      This header file hosts the RecordCache class of the ral namespace.
+// =============================================================================
+
+#ifndef RECORD_CACHE_H
+#define RECORD_CACHE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+namespace ral {
+    using namespace std;
+
+    // === CachePolicy =========================================================
+    // When a cached record that was updated reaches the raf.
+    //      write_through           -- immediately
+    //      write_back              -- when it's evicted or the File syncs
+    // =========================================================================
+    enum class CachePolicy { write_through, write_back };
+
+    // === CacheStats ==========================================================
+    // Counters kept by a RecordCache since it was created.
+    // =========================================================================
+    struct CacheStats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t evictions = 0;
+        uint64_t writebacks = 0;    // dirty records written on eviction/sync
+        size_t size = 0;            // records currently cached
+        size_t capacity = 0;        // most records the cache holds
+    };
+
+    // === RecordCache =========================================================
+    // This class is a fixed size LRU cache of encoded records keyed by id.
+    // Every entry & the hash table are allocated up front; looking up,
+    // inserting & evicting don't allocate.
+    // =========================================================================
+    class RecordCache {
+    private:
+        static constexpr int32_t NONE = -1;
+
+        // === Entry ===========================================================
+        // One cached record, linked into the LRU list (head = most recent).
+        // =====================================================================
+        struct Entry {
+            int id;
+            int32_t previous;
+            int32_t next;
+            bool dirty;
+        };
+
+        size_t record_size;
+        vector<Entry> entries;
+        vector<char> records;   // record_size bytes per entry
+        vector<int32_t> table;  // open addressing: entry index or NONE
+        size_t mask;
+        int32_t head;
+        int32_t tail;
+        size_t used;
+        CacheStats stats;
+
+        // ==== findSlot =======================================================
+        // Parameters:
+        //      id [IN]                 -- id to look up
+        //
+        // Return val:
+        //      index in table holding the id, or the empty index where it
+        //      would go
+        // =====================================================================
+        size_t findSlot(int id) const;
+
+        // ==== unlink =========================================================
+        // Removes an entry from the LRU list.
+        // =====================================================================
+        void unlink(int32_t entry);
+
+        // ==== pushFront ======================================================
+        // Makes an entry the most recently used.
+        // =====================================================================
+        void pushFront(int32_t entry);
+
+        // ==== removeFromTable ================================================
+        // Deletes the table slot of an id, shifting back the entries after
+        // it so lookups never need tombstones.
+        // =====================================================================
+        void removeFromTable(size_t slot);
+
+    public:
+        // === RecordCache =====================================================
+        // Parameters:
+        //      capacity [IN]           -- most records the cache holds
+        //      record_size [IN]        -- size of an encoded record
+        // =====================================================================
+        RecordCache(size_t capacity, size_t record_size);
+
+        // ==== find ===========================================================
+        // Looks up a record & makes it the most recently used.
+        //
+        // Parameters:
+        //      id [IN]                 -- id of the record
+        //
+        // Return val:
+        //      the encoded record if cached, otherwise nullptr
+        // =====================================================================
+        const char* find(int id);
+
+        // ==== insert =========================================================
+        // Caches a record (or replaces the cached copy), evicting the least
+        // recently used record if the cache is full.
+        //
+        // Parameters:
+        //      id [IN]                 -- id of the record
+        //      record [IN]             -- the encoded record
+        //      dirty [IN]              -- true if the raf doesn't have it yet
+        //      evicted_id [OUT]        -- id of a dirty record that was
+        //                                  evicted
+        //      evicted_record [OUT]    -- record_size bytes where the evicted
+        //                                  dirty record is copied to
+        //
+        // Return val:
+        //      true if a dirty record was evicted & must be written to the
+        //      raf, otherwise false
+        // =====================================================================
+        bool insert(int id, const char* record, bool dirty, int &evicted_id,
+            char* evicted_record);
+
+        // ==== erase ==========================================================
+        // Drops a record (dirty or not) from the cache.
+        //
+        // Parameters:
+        //      id [IN]                 -- id of the record
+        //
+        // Return val: None
+        // =====================================================================
+        void erase(int id);
+
+        // ==== getDirtyIds ====================================================
+        // Parameters:
+        //      ids [OUT]               -- ids of the dirty records are
+        //                                  appended here
+        //
+        // Return val: None
+        // =====================================================================
+        void getDirtyIds(vector<int> &ids) const;
+
+        // ==== markClean ======================================================
+        // Parameters:
+        //      id [IN]                 -- id of a record that was written to
+        //                                  the raf
+        //
+        // Return val:
+        //      the encoded record if cached, otherwise nullptr
+        // =====================================================================
+        const char* markClean(int id);
+
+        // ==== getStats =======================================================
+        // Parameters: None
+        //
+        // Return val:
+        //      the cache's counters
+        // =====================================================================
+        CacheStats getStats() const;
+    };
+}
+
+#endif // RECORD_CACHE_H
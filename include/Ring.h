@@ -0,0 +1,271 @@
+// =============================================================================
+// File: Ring.h
+// =============================================================================
+// Description:
+//      This header file hosts the Ring class of the ral namespace.
+// =============================================================================
+
+#ifndef RING_H
+#define RING_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+#include <vector>
+#include <sys/types.h>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+namespace ral {
+    using namespace std;
+
+    // === Ring ================================================================
+    // This class queues positioned reads, writes & syncs on an io_uring &
+    // runs a callback for each one as it finishes. The ring is set up with
+    // raw syscalls (no liburing). Operations queue up in the submission ring
+    // & are handed to the kernel together, one io_uring_enter per complete
+    // call, so many reads & writes are in flight for the price of one
+    // syscall.
+    //
+    // When the kernel lacks io_uring (or the ops it needs), it's disabled by
+    // sysctl or seccomp, or setEnabled(false) was called, each operation is
+    // done right away with pread/pwrite/fdatasync instead; its callback
+    // still only runs from complete, so callers see the same behaviour.
+    //
+    // A Ring belongs to one thread (see local) & isn't thread safe. Buffers
+    // must stay valid until the operation's callback has run.
+    // =========================================================================
+    class Ring {
+    public:
+        // gets the bytes transferred (a sync gets 0) or -errno
+        typedef function<void(ssize_t result)> Completion;
+
+        static const unsigned DEFAULT_ENTRIES = 256;
+
+    private:
+        // === Operation =======================================================
+        // An operation in flight; the sqe's user_data points at it.
+        // =====================================================================
+        struct Operation {
+            Completion done;
+            ssize_t result;
+            int pending;            // cqes still to come (2 for write+sync)
+            bool write;
+        };
+
+        // === Finished ========================================================
+        // An operation done without the ring, waiting for complete.
+        // =====================================================================
+        struct Finished {
+            Completion done;
+            ssize_t result;
+        };
+
+        int ring_fd;                // -1 when falling back to plain I/O
+        unsigned entries;
+        void* sq_mapping;
+        size_t sq_mapping_size;
+        void* cq_mapping;
+        size_t cq_mapping_size;
+        io_uring_sqe* sqes;
+        size_t sqes_size;
+        unsigned* sq_head;
+        unsigned* sq_tail;
+        unsigned sq_mask;
+        unsigned* sq_array;
+        unsigned* cq_head;
+        unsigned* cq_tail;
+        unsigned cq_mask;
+        unsigned cq_entries;
+        io_uring_cqe* cqes;
+        unsigned unsubmitted;       // sqes queued since the last enter
+        size_t in_flight;           // cqes the kernel still owes
+        size_t operations;          // ring operations not finished yet
+        vector<Finished> finished;
+        vector<Operation*> spare;   // finished operations, for reuse
+
+        static atomic<bool> enabled;
+
+        // ==== setup ==========================================================
+        // Creates & maps the ring & checks the kernel has the ops needed.
+        //
+        // Parameters: None
+        //
+        // Return val:
+        //      true if successful, otherwise false (& nothing is left open)
+        // =====================================================================
+        bool setup();
+
+        // ==== teardown =======================================================
+        // Unmaps & closes the ring.
+        // =====================================================================
+        void teardown();
+
+        // ==== nextSqe ========================================================
+        // Makes room for count sqes (entering the kernel if the submission
+        // ring is full or the completion ring could overflow).
+        //
+        // Parameters:
+        //      count [IN]              -- sqes that will be queued together
+        //
+        // Return val:
+        //      the first free sqe, zeroed, or nullptr if the kernel
+        //      wouldn't take the queued ones
+        // =====================================================================
+        io_uring_sqe* nextSqe(unsigned count);
+
+        // ==== queue ==========================================================
+        // Publishes the sqe returned by nextSqe.
+        // =====================================================================
+        void queue(io_uring_sqe* sqe);
+
+        // ==== enter ==========================================================
+        // Submits the queued sqes & optionally waits for completions.
+        //
+        // Parameters:
+        //      wait_for [IN]           -- completions to wait for
+        //
+        // Return val:
+        //      true if successful, otherwise false
+        // =====================================================================
+        bool enter(unsigned wait_for);
+
+        // ==== newOperation ===================================================
+        // Parameters:
+        //      done [IN]               -- the callback (moved from)
+        //      pending [IN]            -- cqes the operation will get
+        //      write [IN]              -- true if it writes
+        //
+        // Return val:
+        //      a spare operation or a new one
+        // =====================================================================
+        Operation* newOperation(Completion &done, int pending, bool write);
+
+        // ==== reap ===========================================================
+        // Runs the callbacks of every cqe in the completion ring.
+        //
+        // Return val:
+        //      number of operations finished
+        // =====================================================================
+        size_t reap();
+
+        // ==== runFinished ====================================================
+        // Runs the callbacks of the operations done without the ring.
+        //
+        // Return val:
+        //      number of operations finished
+        // =====================================================================
+        size_t runFinished();
+
+    public:
+        // === Ring ============================================================
+        // This is the constructor. Falls back to plain I/O if an io_uring
+        // can't be set up.
+        //
+        // Parameters:
+        //      entries [OPT IN]        -- optional: size of the submission
+        //                                  ring. defaults to DEFAULT_ENTRIES
+        // =====================================================================
+        Ring(unsigned entries = DEFAULT_ENTRIES);
+
+        // === ~Ring ===========================================================
+        // Waits for every operation in flight (running its callback) &
+        // closes the ring.
+        // =====================================================================
+        ~Ring();
+
+        Ring(const Ring&) = delete;
+        Ring& operator=(const Ring&) = delete;
+
+        // ==== local ==========================================================
+        // Return val:
+        //      the calling thread's ring, created on first use
+        // =====================================================================
+        static Ring& local();
+
+        // ==== setEnabled =====================================================
+        // Whether rings created from now on may use io_uring (the default)
+        // or always fall back to plain I/O.
+        // =====================================================================
+        static void setEnabled(bool enabled);
+
+        // ==== usesIoUring ====================================================
+        // Return val:
+        //      true if operations go through io_uring, false if they fall
+        //      back to plain I/O
+        // =====================================================================
+        bool usesIoUring();
+
+        // ==== read ===========================================================
+        // Queues a read of size bytes at offset.
+        //
+        // Parameters:
+        //      fd [IN]                 -- file to read
+        //      buffer [OUT]            -- where the bytes go
+        //      size [IN]               -- number of bytes
+        //      offset [IN]             -- byte offset in the file
+        //      done [IN]               -- called once the read finishes
+        //
+        // Return val: None
+        // =====================================================================
+        void read(int fd, void* buffer, size_t size, off_t offset,
+            Completion done);
+
+        // ==== write ==========================================================
+        // Queues a write of size bytes at offset, optionally followed by an
+        // fdatasync (data_only) or fsync linked to it, so the sync only
+        // starts once the write is done & is cancelled if the write fails.
+        //
+        // Parameters:
+        //      fd [IN]                 -- file to write
+        //      buffer [IN]             -- bytes to write
+        //      size [IN]               -- number of bytes
+        //      offset [IN]             -- byte offset in the file
+        //      sync [IN]               -- true to sync after the write
+        //      data_only [IN]          -- true for fdatasync, false for fsync
+        //      done [IN]               -- called once the write (& sync)
+        //                                  finish, with the bytes written or
+        //                                  the first error
+        //
+        // Return val: None
+        // =====================================================================
+        void write(int fd, const void* buffer, size_t size, off_t offset,
+            bool sync, bool data_only, Completion done);
+
+        // ==== post ===========================================================
+        // Queues a callback that was finished without any I/O, so it runs
+        // from complete like the others.
+        //
+        // Parameters:
+        //      result [IN]             -- what done is called with
+        //      done [IN]               -- the callback
+        //
+        // Return val: None
+        // =====================================================================
+        void post(ssize_t result, Completion done);
+
+        // ==== complete =======================================================
+        // Submits every queued operation & runs the callbacks of those that
+        // have finished.
+        //
+        // Parameters:
+        //      wait_for [OPT IN]       -- optional: keep waiting until at
+        //                                  least this many have finished (or
+        //                                  none are left). defaults to 0
+        //
+        // Return val:
+        //      number of callbacks run
+        // =====================================================================
+        size_t complete(size_t wait_for = 0);
+
+        // ==== getPending =====================================================
+        // Return val:
+        //      number of operations whose callback hasn't run yet
+        // =====================================================================
+        size_t getPending();
+    };
+}
+
+#endif // RING_H
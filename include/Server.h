@@ -0,0 +1,191 @@
+// =============================================================================
+// File: Server.h
+// =============================================================================
+// Description:
+//      This header file hosts the declaration of the Server class.
+// =============================================================================
+
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <string>
+#include <unordered_map>
+#include "Bank.h"
+#include "Protocol.h"
+
+// === Server ==================================================================
+// This class serves a Bank to many clients at once over a Unix domain socket
+// (see Protocol.h). A single thread waits on epoll for every connection;
+// each connection is a session with its own login, so clients don't share
+// the Bank's current account. Requests that arrive together are handled,
+// their balance changes are committed to the journal with one sync, & only
+// then are the responses sent.
+//
+// SIGUSR1 makes the server print its Stats. Given an export file, it also
+// appends them to it as JSON every interval & when it stops. Given a backup
+// file, SIGUSR2 backs the bank up into it while clients keep being served.
+// =============================================================================
+class Server {
+public:
+    // === Server ============================================================
+    // This is the constructor for the Server class.
+    //
+    // Input:
+    //      bank [IN/OUT]            -- the bank to serve
+    //      socket_path [IN]         -- where the socket is created
+    //
+    // No Output.
+    // =============================================================================
+    Server(Bank &bank, std::string socket_path);
+
+    // === ~Server ===========================================================
+    // This is the destructor. It closes every session & removes the socket.
+    // =============================================================================
+    ~Server();
+
+    Server(const Server&) = delete;
+    Server& operator=(const Server&) = delete;
+
+    // ==== run ==============================================================
+    // This function serves clients until stop is called (or SIGINT/SIGTERM
+    // is received).
+    //
+    // Input: None
+    //
+    // Output:
+    //      true if the server stopped cleanly, otherwise false
+    // =============================================================================
+    bool run();
+
+    // ==== setStatsExport ===================================================
+    // This function makes run append the Stats to a file periodically.
+    //
+    // Input:
+    //      file_name [IN]           -- the file (created if missing)
+    //      interval_ms [IN]         -- time between exports
+    //
+    // No Output.
+    // =============================================================================
+    void setStatsExport(const std::string &file_name, int interval_ms);
+
+    // ==== setBackup ========================================================
+    // This function makes SIGUSR2 start a backup (see Bank::beginBackup).
+    //
+    // Input:
+    //      file_name [IN]           -- name of the backup (minus extension)
+    //
+    // No Output.
+    // =============================================================================
+    void setBackup(const std::string &file_name);
+
+    // ==== stop =============================================================
+    // This function makes run return. It is safe to call from a signal
+    // handler.
+    //
+    // Input: None
+    //
+    // No Output.
+    // =============================================================================
+    static void stop();
+
+private:
+    // === Session =================================================================
+    // The state of one connection.
+    // =============================================================================
+    struct Session {
+        int fd;
+        std::string in;             // bytes received but not handled yet
+        std::string out;            // responses not sent yet
+        int account_id = 0;         // 0 when logged out
+        bool closing = false;       // the client hung up or misbehaved
+        bool rejected = false;      // sent a bad request; ignore the rest
+        bool writing = false;       // waiting for EPOLLOUT
+    };
+
+    // ==== listen ===========================================================
+    // This function creates the socket & the epoll instance.
+    //
+    // Input: None
+    //
+    // Output:
+    //      true if successful, otherwise false
+    // =============================================================================
+    bool listen();
+
+    // ==== acceptSessions ===================================================
+    // This function accepts every pending connection.
+    //
+    // Input: None
+    //
+    // No Output.
+    // =============================================================================
+    void acceptSessions();
+
+    // ==== readSession ======================================================
+    // This function reads what a client sent & handles every complete
+    // request in it.
+    //
+    // Input:
+    //      session [IN/OUT]         -- the session to read
+    //
+    // No Output.
+    // =============================================================================
+    void readSession(Session &session);
+
+    // ==== handleRequest ====================================================
+    // This function applies one request & queues its response.
+    //
+    // Input:
+    //      session [IN/OUT]         -- the session the request came on
+    //      request [IN]             -- the request header
+    //      name [IN]                -- the name that followed the header
+    //
+    // No Output.
+    // =============================================================================
+    void handleRequest(Session &session, const protocol::Request &request,
+        const std::string &name);
+
+    // ==== writeSession =====================================================
+    // This function sends as much of a session's queued responses as the
+    // socket takes, waiting for EPOLLOUT if it doesn't take them all.
+    //
+    // Input:
+    //      session [IN/OUT]         -- the session to write
+    //
+    // Output:
+    //      false if the session should be closed, otherwise true
+    // =============================================================================
+    bool writeSession(Session &session);
+
+    // ==== closeSession =====================================================
+    // Input:
+    //      fd [IN]                  -- the session's socket
+    //
+    // No Output.
+    // =============================================================================
+    void closeSession(int fd);
+
+    // ==== exportStats ======================================================
+    // This function appends the Stats to the export file, if there is one.
+    //
+    // Input: None
+    //
+    // No Output.
+    // =============================================================================
+    void exportStats();
+
+    static const size_t MAX_EVENTS = 256;
+    static const size_t READ_SIZE = 64 * 1024;
+
+    Bank &bank;
+    std::string socket_path;
+    int listen_fd;
+    int epoll_fd;
+    std::unordered_map<int, Session> sessions;
+    std::string stats_file;     // "" for no export
+    int stats_interval_ms;
+    std::string backup_file;    // "" for no backups
+    bool backing_up;            // a backup was started & not finished
+};
+
+#endif // SERVER_H
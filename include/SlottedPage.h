@@ -0,0 +1,183 @@
+// =============================================================================
+// File: SlottedPage.h
+// =============================================================================
+// Description:
+//      This header file hosts the SlottedPage class of the ral namespace.
+// =============================================================================
+
+#ifndef SLOTTED_PAGE_H
+#define SLOTTED_PAGE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+
+namespace ral {
+    using namespace std;
+
+    // === SlottedPage =========================================================
+    // This class lays variable length records out in a page it doesn't own.
+    // The page starts with a count & the start of the record bytes, followed
+    // by a directory of (slot, offset, length) entries growing up; records
+    // are stored at the end & grow down, so the free space is in the middle.
+    // A record that's replaced or erased leaves a hole that's only reclaimed
+    // when the page is compacted, which happens when a record doesn't fit in
+    // the free space otherwise. A page holds at most 64 KiB.
+    // =========================================================================
+    class SlottedPage {
+    private:
+        // === Entry ===========================================================
+        // One directory entry.
+        // =====================================================================
+        struct Entry {
+            uint32_t slot;
+            uint16_t offset;
+            uint16_t length;
+        };
+
+        char* page;
+        size_t size;
+
+        // ==== getStart =======================================================
+        // Parameters: None
+        //
+        // Return val:
+        //      offset of the lowest record byte
+        // =====================================================================
+        size_t getStart() const;
+
+        // ==== setHeader ======================================================
+        // Parameters:
+        //      count [IN]              -- number of directory entries
+        //      start [IN]              -- offset of the lowest record byte
+        //
+        // Return val: None
+        // =====================================================================
+        void setHeader(size_t count, size_t start);
+
+        // ==== getEntry / setEntry ============================================
+        // Parameters:
+        //      index [IN]              -- index in the directory
+        //      entry [IN]              -- the entry to store
+        //
+        // Return val:
+        //      the entry (copied, since the page may not be aligned)
+        // =====================================================================
+        Entry getEntry(size_t index) const;
+        void setEntry(size_t index, const Entry &entry);
+
+        // ==== findIndex ======================================================
+        // Parameters:
+        //      slot [IN]               -- slot to look up
+        //
+        // Return val:
+        //      its index in the directory, or getCount() if it's not there
+        // =====================================================================
+        size_t findIndex(uint32_t slot) const;
+
+    public:
+        static const size_t HEADER_SIZE = 2 * sizeof(uint16_t);
+        static const size_t ENTRY_SIZE = sizeof(Entry);
+
+        // === SlottedPage =====================================================
+        // This is the constructor. The page isn't touched.
+        //
+        // Parameters:
+        //      page [IN/OUT]           -- the bytes of the page
+        //      size [IN]               -- size of the page (at most 64 KiB)
+        // =====================================================================
+        SlottedPage(char* page, size_t size);
+
+        // ==== clear ==========================================================
+        // Empties the page.
+        //
+        // Parameters: None
+        //
+        // Return val: None
+        // =====================================================================
+        void clear();
+
+        // ==== isValid ========================================================
+        // Parameters: None
+        //
+        // Return val:
+        //      true if the directory & every record lie inside the page
+        // =====================================================================
+        bool isValid() const;
+
+        // ==== getCount =======================================================
+        // Parameters: None
+        //
+        // Return val:
+        //      number of records in the page
+        // =====================================================================
+        size_t getCount() const;
+
+        // ==== getFreeSpace ===================================================
+        // Parameters: None
+        //
+        // Return val:
+        //      bytes a new record & its directory entry can take once the
+        //      page is compacted
+        // =====================================================================
+        size_t getFreeSpace() const;
+
+        // ==== find ===========================================================
+        // Parameters:
+        //      slot [IN]               -- slot of the record
+        //      data [OUT]              -- where the record is in the page
+        //      length [OUT]            -- its length
+        //
+        // Return val:
+        //      true if the page holds the slot, otherwise false
+        // =====================================================================
+        bool find(uint32_t slot, const char* &data, size_t &length) const;
+
+        // ==== put ============================================================
+        // Stores a record, replacing the slot's old one, compacting the page
+        // if the free space is too small.
+        //
+        // Parameters:
+        //      slot [IN]               -- slot of the record
+        //      data [IN]               -- the record
+        //      length [IN]             -- its length
+        //
+        // Return val:
+        //      true if the record fit, otherwise false (the old record is
+        //      erased either way)
+        // =====================================================================
+        bool put(uint32_t slot, const char* data, size_t length);
+
+        // ==== erase ==========================================================
+        // Parameters:
+        //      slot [IN]               -- slot of the record to remove
+        //
+        // Return val:
+        //      true if the page held the slot, otherwise false
+        // =====================================================================
+        bool erase(uint32_t slot);
+
+        // ==== retain =========================================================
+        // Erases every record keep returns false for.
+        //
+        // Parameters:
+        //      keep [IN]               -- called with the slot of each record
+        //
+        // Return val:
+        //      number of records erased
+        // =====================================================================
+        size_t retain(const function<bool(uint32_t)> &keep);
+
+        // ==== compact ========================================================
+        // Moves the records together at the end of the page, so all the
+        // free space is in one piece.
+        //
+        // Parameters: None
+        //
+        // Return val: None
+        // =====================================================================
+        void compact();
+    };
+}
+
+#endif // SLOTTED_PAGE_H
@@ -0,0 +1,336 @@
+// =============================================================================
+// File: Stats.h
+// =============================================================================
+// Description:
+//      This header file hosts the Stats & StatTimer classes of the ral
+//      namespace.
+// =============================================================================
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+namespace ral {
+    using namespace std;
+
+    // === IoCounts ============================================================
+    // I/O done by one thread since it started. Bytes copied to or from a
+    // mapped raf count as read or written without a syscall.
+    // =========================================================================
+    struct IoCounts {
+        uint64_t bytes_read = 0;
+        uint64_t bytes_written = 0;
+        uint64_t syscalls = 0;
+    };
+
+    // === MetricStats =========================================================
+    // The totals of one metric over every thread. Latencies are in
+    // nanoseconds & cover the sampled (timed) operations only; buckets[i]
+    // counts those that took between Stats::bucketLow(i) &
+    // Stats::bucketLow(i + 1).
+    // =========================================================================
+    struct MetricStats {
+        string name;
+        uint64_t count = 0;
+        uint64_t failures = 0;          // operations that didn't succeed
+        uint64_t timed = 0;             // operations sampled for latency
+        uint64_t total_ns = 0;
+        uint64_t max_ns = 0;
+        uint64_t bytes_read = 0;
+        uint64_t bytes_written = 0;
+        uint64_t syscalls = 0;
+        vector<uint64_t> buckets;
+
+        // ==== percentile =====================================================
+        // Parameters:
+        //      fraction [IN]           -- e.g. 0.99 for the 99th percentile
+        //
+        // Return val:
+        //      the highest latency in the bucket holding that percentile
+        //      (within 12.5% of the true value), in nanoseconds
+        // =====================================================================
+        uint64_t percentile(double fraction) const;
+    };
+
+    // === Stats ===============================================================
+    // This class keeps a latency histogram & counters for every metric (a
+    // named operation such as "ral.getRecord"). Each thread records into its
+    // own buffer with plain relaxed loads & stores, so recording takes no
+    // lock & no atomic read-modify-write; snapshot adds the buffers up. A
+    // buffer outlives its thread & is reused by the next thread started.
+    //
+    // The histogram is log-linear like an HDR histogram: 8 buckets per power
+    // of two from 8 ns up to ~73 minutes, so any percentile is within 12.5%.
+    //
+    // Counts, failures & I/O are exact. Reading the clock costs more than a
+    // cached getRecord, so only one operation in every getSampling() of a
+    // thread is timed; the percentiles are of that sample.
+    // =========================================================================
+    class Stats {
+    public:
+        static const size_t MAX_METRICS = 64;
+        static const size_t BUCKETS = 328;
+        static const uint64_t UNTIMED = UINT64_MAX; // latency not sampled
+        static const uint32_t DEFAULT_SAMPLING = 16;
+
+        // ==== define =========================================================
+        // Parameters:
+        //      name [IN]               -- name of the metric
+        //
+        // Return val:
+        //      its id (the same for every call with the name)
+        // =====================================================================
+        static size_t define(const string &name);
+
+        // ==== record =========================================================
+        // Adds one operation to a metric, for the calling thread.
+        //
+        // Parameters:
+        //      metric [IN]             -- id from define
+        //      ns [IN]                 -- how long it took, or UNTIMED
+        //      failed [IN]             -- true if it didn't succeed
+        //      io [IN]                 -- I/O it did
+        //
+        // Return val: None
+        // =====================================================================
+        static void record(size_t metric, uint64_t ns, bool failed,
+            const IoCounts &io) {
+            ThreadBuffer* buffer = thread_buffer != nullptr ? thread_buffer :
+                attachThread();
+            Counters &counters = buffer->metrics[metric];
+            add(counters.count, 1);
+            add(counters.failures, failed);
+            add(counters.bytes_read, io.bytes_read);
+            add(counters.bytes_written, io.bytes_written);
+            add(counters.syscalls, io.syscalls);
+            if (ns != UNTIMED) {
+                recordLatency(counters, ns);
+            }
+        }
+
+        // ==== countIo ========================================================
+        // Adds to the calling thread's I/O counts. Called by every read,
+        // write & sync of a raf or journal.
+        // =====================================================================
+        static void countIo(uint64_t bytes_read, uint64_t bytes_written,
+            uint64_t syscalls) {
+            thread_io.bytes_read += bytes_read;
+            thread_io.bytes_written += bytes_written;
+            thread_io.syscalls += syscalls;
+        }
+
+        // ==== getThreadIo ====================================================
+        // Return val:
+        //      the calling thread's I/O counts
+        // =====================================================================
+        static const IoCounts& getThreadIo() {
+            return thread_io;
+        }
+
+        // ==== sample =========================================================
+        // Return val:
+        //      true if the calling thread's next operation should be timed
+        // =====================================================================
+        static bool sample() {
+            if (--thread_countdown != 0) {
+                return false;
+            }
+            thread_countdown = sampling.load(memory_order_relaxed);
+            return true;
+        }
+
+        // ==== setSampling ====================================================
+        // Times one operation in every (per thread); 1 times them all.
+        // The default is DEFAULT_SAMPLING.
+        // =====================================================================
+        static void setSampling(uint32_t every);
+
+        // ==== getSampling ====================================================
+        // Return val:
+        //      one in how many operations is timed
+        // =====================================================================
+        static uint32_t getSampling();
+
+        // ==== setEnabled =====================================================
+        // Turns recording on (the default) or off for every thread.
+        // =====================================================================
+        static void setEnabled(bool enabled);
+
+        // ==== isEnabled ======================================================
+        // Return val:
+        //      true if operations are being recorded, otherwise false
+        // =====================================================================
+        static bool isEnabled() {
+            return enabled.load(memory_order_relaxed);
+        }
+
+        // ==== snapshot =======================================================
+        // Parameters:
+        //      metrics [OUT]           -- every metric that has recorded an
+        //                                  operation, in the order defined
+        //
+        // Return val: None
+        // =====================================================================
+        static void snapshot(vector<MetricStats> &metrics);
+
+        // ==== dump ===========================================================
+        // Writes a table of every metric: count, failures, mean & percentile
+        // latencies in microseconds, & bytes & syscalls per operation.
+        // =====================================================================
+        static void dump(ostream &out);
+
+        // ==== writeJson ======================================================
+        // Appends every metric to a file as one line of JSON, stamped with
+        // the time in seconds since the epoch.
+        //
+        // Return val:
+        //      true if successful, otherwise false
+        // =====================================================================
+        static bool writeJson(FILE* file);
+
+        // ==== appendJson =====================================================
+        // Appends every metric to the named file (created if missing), like
+        // writeJson.
+        //
+        // Parameters:
+        //      file_name [IN]          -- the file
+        //
+        // Return val:
+        //      true if successful, otherwise false
+        // =====================================================================
+        static bool appendJson(const string &file_name);
+
+        // ==== bucketOf =======================================================
+        // Return val:
+        //      the histogram bucket of a latency in nanoseconds
+        // =====================================================================
+        static size_t bucketOf(uint64_t ns);
+
+        // ==== bucketLow ======================================================
+        // Return val:
+        //      the lowest latency in a bucket, in nanoseconds
+        // =====================================================================
+        static uint64_t bucketLow(size_t bucket);
+
+    private:
+        // === Counters ========================================================
+        // One metric's counts in one thread's buffer. Only the owning thread
+        // writes them; snapshot reads them from other threads.
+        // =====================================================================
+        struct Counters {
+            atomic<uint64_t> count;
+            atomic<uint64_t> failures;
+            atomic<uint64_t> timed;
+            atomic<uint64_t> total_ns;
+            atomic<uint64_t> max_ns;
+            atomic<uint64_t> bytes_read;
+            atomic<uint64_t> bytes_written;
+            atomic<uint64_t> syscalls;
+            atomic<uint64_t> buckets[BUCKETS];
+        };
+
+        struct ThreadBuffer {
+            Counters metrics[MAX_METRICS];
+        };
+
+        struct Registry;    // metric names & every thread buffer
+        struct ThreadSlot;  // gives a thread's buffer back when it exits
+
+        static Registry& registry();
+
+        // defined here so other files reach them without a TLS wrapper call
+        inline static thread_local IoCounts thread_io;
+        inline static thread_local uint32_t thread_countdown = 1;
+        inline static thread_local ThreadBuffer* thread_buffer = nullptr;
+        static atomic<bool> enabled;
+        static atomic<uint32_t> sampling;
+
+        // the owner is the only writer, so no read-modify-write is needed
+        static void add(atomic<uint64_t> &counter, uint64_t value) {
+            counter.store(counter.load(memory_order_relaxed) + value,
+                memory_order_relaxed);
+        }
+
+        // ==== attachThread ===================================================
+        // Gives the calling thread a buffer (a new one or one left by a
+        // thread that exited).
+        //
+        // Return val:
+        //      the buffer
+        // =====================================================================
+        static ThreadBuffer* attachThread();
+
+        // ==== recordLatency ==================================================
+        // Adds a sampled latency to a metric's histogram & totals.
+        // =====================================================================
+        static void recordLatency(Counters &counters, uint64_t ns);
+    };
+
+    // === StatTimer ===========================================================
+    // Records one operation to a metric when it goes out of scope: the I/O
+    // the thread did meanwhile &, if it was sampled, the time since it was
+    // constructed. Costs a few stores when Stats is enabled (plus two clock
+    // reads when sampled) & nothing more than a check when it's not.
+    // =========================================================================
+    class StatTimer {
+    public:
+        StatTimer(size_t metric) : metric(metric), failed(false),
+            active(Stats::isEnabled()), timed(active && Stats::sample()) {
+            if (active) {
+                io = Stats::getThreadIo();
+            }
+            if (timed) {
+                start = chrono::steady_clock::now();
+            }
+        }
+
+        ~StatTimer() {
+            if (!active) {
+                return;
+            }
+            uint64_t ns = !timed ? Stats::UNTIMED :
+                chrono::duration_cast<chrono::nanoseconds>(
+                chrono::steady_clock::now() - start).count();
+            const IoCounts &now = Stats::getThreadIo();
+            io.bytes_read = now.bytes_read - io.bytes_read;
+            io.bytes_written = now.bytes_written - io.bytes_written;
+            io.syscalls = now.syscalls - io.syscalls;
+            Stats::record(metric, ns, failed, io);
+        }
+
+        StatTimer(const StatTimer&) = delete;
+        StatTimer& operator=(const StatTimer&) = delete;
+
+        // ==== check ==========================================================
+        // Notes whether the operation succeeded.
+        //
+        // Parameters:
+        //      succeeded [IN]          -- false if it failed
+        //
+        // Return val:
+        //      succeeded
+        // =====================================================================
+        bool check(bool succeeded) {
+            failed = !succeeded;
+            return succeeded;
+        }
+
+    private:
+        size_t metric;
+        bool failed;
+        bool active;
+        bool timed;
+        IoCounts io;
+        chrono::steady_clock::time_point start;
+    };
+}
+
+#endif // STATS_H
@@ -0,0 +1,184 @@
+// =============================================================================
+// File: VersionStore.h
+// =============================================================================
+// Description:
+//      This header file hosts the VersionStore class of the ral namespace.
+// =============================================================================
+
+#ifndef VERSION_STORE_H
+#define VERSION_STORE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace ral {
+    using namespace std;
+
+    // === VersionStats ========================================================
+    // Counters kept by a VersionStore since it was created.
+    // =========================================================================
+    struct VersionStats {
+        uint64_t writes = 0;        // sequence numbers handed out
+        uint64_t views = 0;         // read views begun
+        uint64_t kept = 0;          // old versions kept for views
+        uint64_t collected = 0;     // old versions dropped once unneeded
+        size_t held = 0;            // old versions held now
+        size_t open_views = 0;      // read views not ended yet
+    };
+
+    // === VersionStore ========================================================
+    // This class keeps the old versions of records that read views still
+    // need. Every write (or batch) takes the next sequence number, & a read
+    // view is the sequence of the last write it sees: beginRead waits for
+    // the writes up to it that are still being applied, never for later
+    // ones. A write made while a view is open keeps the image it replaces,
+    // tagged with the write's sequence, before it changes the record; a
+    // view reads the oldest version tagged after it, or the record as it is
+    // when there's none. Versions are dropped once every view older than
+    // their tag has ended.
+    // =========================================================================
+    class VersionStore {
+    private:
+        // === Version =========================================================
+        // An image of a record as it was before the write tagged until.
+        // =====================================================================
+        struct Version {
+            uint64_t until;
+            string record;
+        };
+
+        // === Stripe ==========================================================
+        // The versions of a share of the ids, under a lock of their own.
+        // =====================================================================
+        struct alignas(64) Stripe {
+            mutex lock;
+            unordered_map<int, vector<Version>> versions; // oldest first
+        };
+
+        static const size_t STRIPES = 64;
+        // versions held past those left by the last sweep that force one
+        static const size_t SWEEP_VERSIONS = 4096;
+
+        size_t record_size;
+        unique_ptr<Stripe[]> stripes;
+        atomic<size_t> held;
+        atomic<size_t> open_views;
+
+        mutex lock;                     // guards the rest
+        condition_variable applied;     // a write finished
+        uint64_t last_seq;
+        vector<uint64_t> applying;      // writes not finished, in order
+        size_t waiting;                 // beginRead calls waiting
+        // open read views, oldest first (a view begins at last_seq, so
+        // it goes at the end; the list keeps its room, so reads don't
+        // allocate)
+        vector<uint64_t> views;
+        size_t swept_held;              // held after the last sweep
+        VersionStats stats;
+
+        // ==== sweep ==========================================================
+        // Drops the versions no view needs anymore.
+        //
+        // Parameters:
+        //      oldest [IN]             -- the oldest open view (UINT64_MAX
+        //                                  if there's none)
+        //
+        // Return val: None
+        // =====================================================================
+        void sweep(uint64_t oldest);
+
+    public:
+        // === VersionStore ====================================================
+        // This is the constructor.
+        //
+        // Parameters:
+        //      record_size [IN]        -- size of an encoded record
+        // =====================================================================
+        VersionStore(size_t record_size);
+
+        VersionStore(const VersionStore&) = delete;
+        VersionStore& operator=(const VersionStore&) = delete;
+
+        // ==== beginWrite =====================================================
+        // Called with the records' locks held, before they change.
+        //
+        // Parameters:
+        //      keep [OUT]              -- true if the images the write
+        //                                  replaces must be kept
+        //
+        // Return val:
+        //      the write's sequence number
+        // =====================================================================
+        uint64_t beginWrite(bool &keep);
+
+        // ==== keep ===========================================================
+        // Keeps the image a write replaces, if a view may still need it.
+        //
+        // Parameters:
+        //      id [IN]                 -- id of the record
+        //      seq [IN]                -- the write's sequence number
+        //      record [IN]             -- the encoded record before the
+        //                                  write
+        //
+        // Return val: None
+        // =====================================================================
+        void keep(int id, uint64_t seq, const char* record);
+
+        // ==== endWrite =======================================================
+        // Called once the write is applied (in the cache, the journal or the
+        // raf), so views can see it.
+        //
+        // Parameters:
+        //      seq [IN]                -- from beginWrite
+        //
+        // Return val: None
+        // =====================================================================
+        void endWrite(uint64_t seq);
+
+        // ==== beginRead ======================================================
+        // Parameters: None
+        //
+        // Return val:
+        //      a view of every write applied so far
+        // =====================================================================
+        uint64_t beginRead();
+
+        // ==== endRead ========================================================
+        // Ends a view & drops the versions only it needed.
+        //
+        // Parameters:
+        //      view [IN]               -- from beginRead
+        //
+        // Return val: None
+        // =====================================================================
+        void endRead(uint64_t view);
+
+        // ==== find ===========================================================
+        // Parameters:
+        //      id [IN]                 -- id of the record
+        //      view [IN]               -- from beginRead
+        //      record [OUT]            -- record_size bytes the version is
+        //                                  copied to
+        //
+        // Return val:
+        //      true if the record changed after the view (& record holds it
+        //      as the view sees it), otherwise false
+        // =====================================================================
+        bool find(int id, uint64_t view, char* record);
+
+        // ==== getStats =======================================================
+        // Return val:
+        //      the store's counters
+        // =====================================================================
+        VersionStats getStats();
+    };
+}
+
+#endif // VERSION_STORE_H
@@ -0,0 +1,87 @@
+// =============================================================================
+// File: Worker.h
+// =============================================================================
+// Description:
+//      This header file hosts the Worker class of the ral namespace.
+// =============================================================================
+
+#ifndef WORKER_H
+#define WORKER_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ral {
+    using namespace std;
+
+    // === Worker ==============================================================
+    // This class is a thread of its own that runs the tasks posted to it one
+    // at a time, in the order they were posted. Whatever only the tasks
+    // touch needs no lock. The thread runs until the Worker is destroyed,
+    // after finishing the tasks already posted.
+    // =========================================================================
+    class Worker {
+    private:
+        mutex lock;                     // guards tasks & stopping
+        condition_variable wake;        // a task was posted
+        deque<function<void()>> tasks;
+        bool stopping;
+        thread runner;
+
+        // ==== run ============================================================
+        // Body of the thread.
+        //
+        // Parameters: None
+        //
+        // Return val: None
+        // =====================================================================
+        void run();
+
+    public:
+        // === Worker ==========================================================
+        // This is the constructor; it starts the thread.
+        //
+        // Parameters: None
+        // =====================================================================
+        Worker();
+
+        Worker(const Worker&) = delete;
+        Worker& operator=(const Worker&) = delete;
+
+        // === ~Worker =========================================================
+        // This is the destructor; it runs the tasks left & joins the thread.
+        // =====================================================================
+        ~Worker();
+
+        // ==== post ===========================================================
+        // Queues a task without waiting for it.
+        //
+        // Parameters:
+        //      task [IN]               -- what to run on the thread
+        //
+        // Return val: None
+        // =====================================================================
+        void post(function<void()> task);
+
+        // ==== runAll =========================================================
+        // Runs task(i) on workers[i] for every worker at once & waits for all
+        // of them to finish.
+        //
+        // Parameters:
+        //      workers [IN]            -- the workers
+        //      task [IN]               -- what each worker runs, given its
+        //                                  index
+        //
+        // Return val: None
+        // =====================================================================
+        static void runAll(const vector<Worker*> &workers,
+            const function<void(size_t)> &task);
+    };
+}
+
+#endif // WORKER_H
@@ -10,18 +10,42 @@
 
 #include <string>
 #include <iosfwd>
-#include <fstream>
-#include <bitset>
 #include <memory>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <climits>
+#include <cstdint>
+#include <functional>
+#include <type_traits>
+#include <sys/types.h>
+#include "FreeMap.h"
+#include "RecordCache.h"
+#include "Journal.h"
+#include "Ring.h"
+#include "Cipher.h"
+#include "DoublewriteBuffer.h"
+#include "VersionStore.h"
 
 namespace ral {
     using namespace std;
 
     // === Record ==============================================================
     // This abstract class is the base for records in the random access file.
+    // A record is written to & read from the raf through encode/decode,
+    // which work on a buffer of getSize() bytes owned by the caller (a stack
+    // buffer or the raf's mapping). The stringstream serialize/deserialize
+    // are the original interface; each pair defaults to the other, so a
+    // record overrides whichever pair it prefers (one that overrides
+    // neither fails to encode & decode).
     // =========================================================================
     class Record {
     public:
+        virtual ~Record() = default;
+
         // === getId ===========================================================
         // Parameters: None
         //
@@ -39,6 +63,26 @@ namespace ral {
         // =====================================================================
         virtual size_t getSize() = 0;
 
+        // === encode ==========================================================
+        // Parmeters:
+        //      buffer [OUT]            -- getSize() bytes where the record
+        //                                  will be written to
+        //
+        // Return val:
+        //      true if able to encode, otherwise false
+        // =====================================================================
+        virtual bool encode(char* buffer);
+
+        // === decode ==========================================================
+        // Parmeters:
+        //      buffer [IN]             -- getSize() bytes holding an encoded
+        //                                  record
+        //
+        // Return val:
+        //      true if able to decode, otherwise false
+        // =====================================================================
+        virtual bool decode(const char* buffer);
+
         // === serialize =======================================================
         // Parmeters:
         //      ss [IN/OUT]             -- stream where the serialized record
@@ -47,7 +91,7 @@ namespace ral {
         // Return val:
         //      true if able to serialize, otherwise false
         // =====================================================================
-        virtual bool serialize(stringstream &ss) = 0;
+        virtual bool serialize(stringstream &ss);
 
         // === deserialize =====================================================
         // Parmeters:
@@ -57,23 +101,571 @@ namespace ral {
         // Return val:
         //      true if able to deserialize, otherwise false
         // =====================================================================
-        virtual bool deserialize(stringstream &ss) = 0;
+        virtual bool deserialize(stringstream &ss);
+    };
+
+    // === PodRecord ===========================================================
+    // A record whose fields are the trivially copyable struct T. Encoding &
+    // decoding are a single memcpy of T. The fields are inherited, so a
+    // derived record uses them as its own members; only getId is left to
+    // implement.
+    // =========================================================================
+    template <class T> class PodRecord : public Record, public T {
+        static_assert(is_trivially_copyable<T>::value,
+            "PodRecord fields must be trivially copyable");
+
+    public:
+        // === getSize =========================================================
+        // Return val:
+        //      sizeof(T)
+        // =====================================================================
+        size_t getSize() override;
+
+        // === encode ==========================================================
+        // Copies the fields into buffer.
+        // =====================================================================
+        bool encode(char* buffer) override;
+
+        // === decode ==========================================================
+        // Copies the fields out of buffer.
+        // =====================================================================
+        bool decode(const char* buffer) override;
+    };
+
+    // === Sync ================================================================
+    // How hard a write is pushed towards the disk before returning.
+    //      none                    -- leave it in the page cache
+    //      data                    -- fdatasync (record bytes only)
+    //      full                    -- fsync (record bytes & file metadata)
+    // =========================================================================
+    enum class Sync { none, data, full };
+
+    // === Storage =============================================================
+    // How a File reaches its raf.
+    //      io                      -- pread/pwrite on the file descriptor
+    //      mapped                  -- the whole raf is mapped into memory;
+    //                                  records are copied in/out of the
+    //                                  mapping & msync'd according to Sync
+    //      packed                  -- pread/pwrite, with records packed
+    //                                  into 4 KiB pages instead of fixed
+    //                                  slots (see File); needs a journal
+    // =========================================================================
+    enum class Storage { io, mapped, packed };
+
+    // === RecordConverter =====================================================
+    // Turns a record written by an older version of the record type (see
+    // Options::convert) into the current encoding. Returns false if the old
+    // record can't be represented.
+    // =========================================================================
+    typedef function<bool(const char* old_record, char* record)>
+        RecordConverter;
+
+    // === Projection ==========================================================
+    // Derived data a File keeps in step with its records (see
+    // Options::projection), e.g. a ColumnStore. The File calls it with every
+    // record it's given to write & every id it deletes, under the record's
+    // lock; a projection shared by a concurrent File guards itself.
+    // =========================================================================
+    class Projection {
+    public:
+        virtual ~Projection() = default;
+
+        // === update ==========================================================
+        // Parameters:
+        //      id [IN]                 -- the id of the record
+        //      record [IN]             -- the encoded record being written
+        //
+        // Return val: None
+        // =====================================================================
+        virtual void update(int id, const char* record) = 0;
+
+        // === erase ===========================================================
+        // Parameters:
+        //      id [IN]                 -- the id of the deleted record
+        //
+        // Return val: None
+        // =====================================================================
+        virtual void erase(int id) = 0;
+    };
+
+    // === Options =============================================================
+    // Settings a File is constructed with.
+    //      sync                    -- durability applied to every write
+    //      storage                 -- how the raf is accessed
+    //      initial_capacity        -- number of record slots a new raf starts
+    //                                  with (rounded up to a multiple of 64)
+    //      cache_records           -- size of the LRU record cache (0 turns
+    //                                  it off)
+    //      cache_policy            -- when cached updates reach the raf
+    //      journal                 -- write records through a write-ahead log
+    //                                  (<name>.raf.wal) instead of in place;
+    //                                  required by Storage::packed
+    //      concurrent              -- the File may be used by many threads at
+    //                                  once (see File)
+    //      convert_size            -- size of the records of an older raf
+    //                                  that convert can rewrite (0 for none)
+    //      convert                 -- a raf holding records of convert_size
+    //                                  bytes is rewritten on open, every
+    //                                  record run through convert
+    //      projection              -- told about every write & delete (not
+    //                                  owned; must outlive the File)
+    //      key                     -- Cipher::KEY_SIZE bytes to seal every
+    //                                  record with (empty for plaintext); a
+    //                                  plaintext raf is encrypted on open
+    //      preallocate             -- reserve the disk blocks of new extents
+    //                                  with fallocate instead of leaving them
+    //                                  sparse, so writes can't run out of
+    //                                  space later
+    //      versioned               -- keep the old versions of records that
+    //                                  read views need (see beginRead)
+    // =========================================================================
+    struct Options {
+        Sync sync = Sync::none;
+        Storage storage = Storage::io;
+        size_t initial_capacity = 128;
+        size_t cache_records = 0;
+        CachePolicy cache_policy = CachePolicy::write_through;
+        bool journal = false;
+        bool concurrent = false;
+        size_t convert_size = 0;
+        RecordConverter convert;
+        Projection* projection = nullptr;
+        string key;
+        bool preallocate = false;
+        bool versioned = false;
+    };
+
+    // === VerifyReport ========================================================
+    // What File::verifyFile found; the ids are in ascending order.
+    // =========================================================================
+    struct VerifyReport {
+        size_t slots = 0;           // slots scanned
+        size_t records = 0;         // used ids holding a sound record
+        vector<int> corrupt;        // slots failing their checksum or seal
+        vector<int> unwritten;      // used ids whose slot is empty
+        vector<int> orphaned;       // free ids whose slot holds a record
+        size_t repaired = 0;        // ids & slots fixed by the repair
+    };
+
+    // === SnapshotReport ======================================================
+    // What File::endSnapshot wrote.
+    // =========================================================================
+    struct SnapshotReport {
+        bool full = false;          // every slot was copied, not only those
+                                    // changed since the last snapshot
+        size_t slots = 0;           // slots in the snapshot
+        size_t copied = 0;          // slots written to it
+        size_t preserved = 0;       // of those, images set aside at the cut
+                                    // (from the journal) or by writers
     };
 
     // === File ================================================================
-    // This class controls a random access file of 100 records. Private
-    // functions do not validate that the input is valid.
+    // This class controls a random access file of records. The raf starts
+    // with a versioned header followed by extents; each extent is a bitmap
+    // of the ids in use followed by its records. When every id is taken a
+    // new extent as large as the current capacity is appended, so existing
+    // records never move. The file is opened once in the constructor and
+    // every record is read/written with positioned I/O on that descriptor.
+    // With a journal, updated records are appended to the write-ahead log
+    // first & reach the raf when the journal checkpoints; Sync then controls
+    // when the log is committed. Private functions do not validate that the
+    // input is valid.
+    //
+    // New extents are sparse (or fallocated) & never written: a slot of all
+    // zeros is empty & reads as the dummy record, so creating or growing a
+    // raf costs the same at any capacity, & opening one only reads the
+    // header & the bitmaps. A record that encodes to all zeros therefore
+    // reads back as the dummy record.
+    //
+    // A concurrent File can be shared by threads. Each record is guarded by
+    // one of a fixed set of striped locks, so threads working on different
+    // records rarely wait on each other; the cache & the id bitmap have a
+    // lock each. Extents only ever get appended to a fixed array & the
+    // capacity is published after the header is on disk, so finding a
+    // record takes no lock. Journal commits wait outside the record locks,
+    // so concurrent writers still share fdatasyncs. getNextAvailableId only
+    // suggests an id; concurrent creators should take ids with reserveIds.
+    //
+    // getRecordAsync & updateRecordAsync queue their I/O on the calling
+    // thread's Ring (io_uring, or plain I/O where it's unavailable) & call
+    // back from completeAsync, so one thread keeps many reads & writes in
+    // flight. Only a raf read with pread/pwrite goes through the ring; the
+    // cache, the journal & a mapping are served as the synchronous calls
+    // would. An async read doesn't fill the cache. Callers order their own
+    // async operations on a record: one isn't issued until the previous
+    // write of the record called back, & every callback has run before the
+    // File is destroyed.
+    //
+    // With a key every slot holds its record sealed by a Cipher (AES-256-GCM
+    // with the record's id authenticated too), so a slot is
+    // Cipher::OVERHEAD bytes longer than the record. Records are sealed on
+    // their way to the raf & the journal & opened on their way out; the
+    // cache & the projection see plaintext. Batches are sealed & opened
+    // together. A slot that doesn't open (tampered with, or moved to another
+    // slot) fails the read.
+    //
+    // Every slot ends with a CRC-32C of its contents seeded with its id, &
+    // the header carries one of its own. Reads check them (about 25 ns a
+    // slot with SSE4.2), so a torn or corrupted slot, or one written to the
+    // wrong place, fails the read instead of decoding garbage. verifyFile
+    // checks a whole raf with a few threads & can reconcile its bitmap.
+    //
+    // A snapshot is a copy of the raf as it was at one instant, taken while
+    // the File keeps being written. beginSnapshot marks the instant (the
+    // cut) & a background thread copies the slots; a write to a slot that
+    // hasn't been copied yet first keeps the slot's old image for the
+    // snapshot, so each slot is read once & written once. The File tracks
+    // which slots were written since the last snapshot, so taking the next
+    // one into the same file only copies those. A snapshot is a raf of its
+    // own, opened with the same record type & key.
+    //
+    // A packed raf (Storage::packed) stores each record with its longest
+    // run of zero bytes cut out, so a record padded for its longest value
+    // takes only what it uses. Records live in 4 KiB slotted pages (see
+    // SlottedPage) appended as needed; instead of a slot, each id has the
+    // number of the page holding its record in its extent, kept in memory
+    // too, so finding a record is still one lookup & one page read. A
+    // record is written back into its page, which is compacted if the
+    // record grew; one that no longer fits moves to the page new records
+    // are filling. A page is sealed (with a key) & checksummed as a whole,
+    // so records are sealed with their page instead of on their own; the
+    // journal & snapshots still get sealed slots, & a snapshot of a packed
+    // raf is an unpacked raf (packed again when it's opened as packed).
+    // Pages have locks of their own, so the journal's checkpointer & a
+    // snapshot can read & write them while the File is being used. An
+    // unpacked raf is packed when it's opened with Storage::packed. A page
+    // that holds records is only overwritten once its new image is in the
+    // raf's doublewrite buffer (<name>.raf.dwb, see DoublewriteBuffer), so
+    // a crash that tears it doesn't lose the records it already held, & a
+    // record that moves is only pointed at its new page once that page is
+    // on disk. A packed raf is written through its journal, so pages are
+    // only written (& the doublewrite buffer & the moves synced) once per
+    // checkpoint, however many records it carries, never once per write.
+    //
+    // A versioned File (Options::versioned) serves read views: beginRead
+    // picks the sequence number of the last write applied, & getRecordAt &
+    // getRecordsAt then see every record as it was at that write, without
+    // taking the record locks, however long the view stays open. Each write
+    // (a batch or a transaction is one write) takes the next sequence
+    // number under its records' locks & keeps the images it replaces in a
+    // VersionStore while views older than it are open, so writers never
+    // wait for readers; a reader reads a record as it is & looks for a
+    // version kept since its view, which also catches a slot torn by a
+    // write in progress. beginRead only waits for writes already being
+    // applied, not for their commits. Async updates of a versioned File
+    // are made synchronously.
     // =========================================================================
     class File {
+    public:
+        // told whether an async operation succeeded
+        typedef function<void(bool succeeded)> Completion;
+
     private:
-        static const int MAX_RECORDS = 100; // TODO: move to be adjustable
-        bitset<MAX_RECORDS> available_ids;
+        // === Extent ==========================================================
+        // Where a run of slots lives in the raf. first_slot & slots are
+        // multiples of 64 so every bitmap word belongs to one extent.
+        // =====================================================================
+        struct Extent {
+            uint64_t offset;        // byte offset of the extent's bitmap
+            uint64_t first_slot;    // first slot stored in the extent
+            uint64_t slots;         // number of slots in the extent
+        };
+
+        // === Stripe ==========================================================
+        // One record lock, on its own cache line.
+        // =====================================================================
+        struct alignas(64) Stripe {
+            mutex lock;
+        };
+
+        // === StagedPage ======================================================
+        // A page storePacked is changing in memory, to be written with the
+        // others it changes.
+        // =====================================================================
+        struct StagedPage {
+            uint32_t page;
+            bool held_records;              // on disk, before it was staged
+            bool dirty;                     // changed since it was staged
+        };
+
+        // === PackScratch =====================================================
+        // What storePacked works in, reused from one call to the next (under
+        // fill_lock) so a write allocates nothing once it has grown.
+        // =====================================================================
+        struct PackScratch {
+            string records;                 // packed records, a stride each
+            vector<size_t> lengths;         // of each (0 to remove it)
+            vector<pair<uint32_t, size_t>> order; // home page & record
+            vector<size_t> homeless;        // records for the fill page
+            vector<pair<size_t, uint32_t>> moves; // slot & its new page
+            vector<pair<uint32_t, size_t>> left;  // old page & slot
+            vector<StagedPage> staged;
+            vector<pair<uint32_t, size_t>> index; // page & where it's staged
+            string bodies;                  // of the staged pages
+            vector<uint32_t> pages;         // the dirty ones, when written
+            string images;                  // & their sealed images
+        };
+
+        // === Snapshot ========================================================
+        // A snapshot being copied. pending, preserved & failed are guarded by
+        // snapshot_lock.
+        // =====================================================================
+        struct Snapshot {
+            string file_name;
+            int fd;
+            vector<Extent> extents;         // where the raf's extents go in
+                                            // the snapshot (unpacked)
+            size_t capacity;                // the raf at the cut
+            size_t file_size;
+            string header;                  // written once the rest is
+            vector<uint64_t> used_ids;      // the bitmap at the cut
+            vector<uint64_t> pending;       // slots still to be copied
+            unordered_map<int, string> preserved; // images of slots written
+                                            // since the cut
+            bool failed;
+            SnapshotReport report;
+        };
+
+        static const int MAX_EXTENTS = 64;
+        static const size_t MAX_SLOTS = INT_MAX / 10;
+        static const size_t STRIPES = 1024;
+        static const size_t PAGE_STRIPES = 256;
+        Extent extents[MAX_EXTENTS];    // [0, extent_count) are in use
+        atomic<size_t> extent_count;
+        atomic<size_t> capacity;
+        FreeMap used_ids; // mirrors the bitmaps of the extents
         unique_ptr<Record> dummy_record;
+        string empty_record;            // what an all zero slot reads as
         size_t record_size;
+        size_t payload_size;            // record_size, plus the seal's
+        size_t slot_size;               // payload_size, plus the checksum
+        size_t slot_stride;             // bytes per slot in an extent: the
+                                        // slot, or (packed) its page number
+        size_t convert_size;            // see Options::convert
+        RecordConverter convert;
 
         const string FILE_EXTENSION = ".raf"; // TODO: make static?
         string file_name;
-        fstream file;
+        int fd;
+        atomic<Sync> sync_policy;
+        Storage storage;
+        char* mapping;
+        atomic<size_t> mapping_size;
+        size_t mapping_reserved;
+        unique_ptr<RecordCache> cache;
+        CachePolicy cache_policy;
+        unique_ptr<Journal> journal;
+        Projection* projection;         // see Options::projection
+        bool preallocate;               // see Options::preallocate
+        unique_ptr<Cipher> cipher;      // null without a key
+        unique_ptr<VersionStore> versions; // null unless versioned
+
+        bool concurrent;
+        unique_ptr<Stripe[]> stripes;   // record locks (concurrent only)
+        mutex ids_lock;                 // used_ids, the raf's bitmaps & grow
+        bool replaying;                 // the journal is replayed on open
+        mutex cache_lock;               // cache
+
+        // slots written since the last snapshot, a bit each, per extent
+        unique_ptr<atomic<uint64_t>[]> changed[MAX_EXTENTS];
+        unique_ptr<Snapshot> snapshot;  // null unless one was begun
+        atomic<bool> snapshotting;      // its slots are still being copied
+        mutex snapshot_lock;
+        thread snapshot_thread;
+        string last_snapshot;           // file the last snapshot went to
+        string last_snapshot_header;    // & the header it got
+
+        // Storage::packed only
+        unique_ptr<atomic<uint32_t>[]> page_map[MAX_EXTENTS]; // the page
+                                        // holding each slot (0 for none)
+        size_t page_body_size;          // bytes of a page under its seal
+        unique_ptr<Stripe[]> page_stripes; // page locks (always taken)
+        mutex fill_lock;                // storePacked & the next five
+        uint32_t fill_page;             // where new records go (0 for none)
+        vector<uint32_t> roomy_pages;   // a quarter empty since opening
+        size_t next_page;               // next page never used
+        size_t file_end;                // size of the raf
+        PackScratch pack;
+        unique_ptr<DoublewriteBuffer> doublewrite; // null while converting
+
+        // ==== createFile =====================================================
+        // Writes the header & first extent of a new raf.
+        //
+        // Parameters:
+        //      slots [IN]              -- size of the first extent
+        //
+        // Return val:
+        //      true if successful, otherwise false
+        // =====================================================================
+        bool createFile(size_t slots);
+
+        // ==== loadFile =======================================================
+        // Reads the header & the bitmaps of an existing raf.
+        //
+        // Parameters: None
+        //
+        // Return val:
+        //      true if the raf is valid, otherwise false
+        // =====================================================================
+        bool loadFile();
+
+        // ==== migrateLegacyFile ==============================================
+        // Rewrites a raf in the original layout (a bitset of 100 available
+        // ids followed by 100 records) into the current layout, converting
+        // the records if they're convert_size bytes.
+        //
+        // Parameters: None
+        //
+        // Return val:
+        //      true if the raf was in the legacy layout & was migrated,
+        //      otherwise false
+        // =====================================================================
+        bool migrateLegacyFile();
+
+        // ==== convertFile ====================================================
+        // Rewrites a raf holding records of convert_size bytes, plaintext
+        // records when the File has a key, or slots without checksums
+        // (version 1) into a new raf (one extent of the same capacity) with
+        // every record converted, sealed & checksummed. The new raf
+        // is built next to the old one & renamed over it once it's complete.
+        // A journal left by a crash holds records in the old format, so the
+        // raf isn't converted until the old version has replayed it.
+        //
+        // Parameters: None
+        //
+        // Return val:
+        //      true if the raf was converted, otherwise false
+        // =====================================================================
+        bool convertFile();
+
+        // ==== encodeHeader ===================================================
+        // Parameters:
+        //      extents [IN]            -- the extents to list
+        //      count [IN]              -- number of extents
+        //      packed [IN]             -- true if the raf is packed
+        //
+        // Return val:
+        //      the header of a raf of this File's records with the extents
+        // =====================================================================
+        string encodeHeader(const Extent* extents, size_t count, bool packed);
+
+        // ==== writeHeader ====================================================
+        // Parameters:
+        //      count [IN]              -- number of extents to record
+        //      sync [IN]               -- durability of this write
+        //
+        // Return val:
+        //      true if successful, otherwise false
+        // =====================================================================
+        bool writeHeader(size_t count, Sync sync);
+
+        // ==== grow ===========================================================
+        // Appends a new extent, doubling the capacity.
+        //
+        // Parameters: None
+        //
+        // Return val:
+        //      true if successful, otherwise false
+        // =====================================================================
+        bool grow();
+
+        // ==== grow ===========================================================
+        // Appends a new extent of empty slots (zeros, left sparse unless
+        // preallocating). Existing records aren't touched; the header is
+        // rewritten once the extent is on disk.
+        //
+        // Parameters:
+        //      slots [IN]              -- size of the extent (multiple of 64)
+        //
+        // Return val:
+        //      true if successful, otherwise false
+        // =====================================================================
+        bool grow(size_t slots);
+
+        // ==== findExtent =====================================================
+        // Parameters:
+        //      slot [IN]               -- slot to look up
+        //
+        // Return val:
+        //      the extent holding the slot
+        // =====================================================================
+        const Extent& findExtent(size_t slot);
+
+        // ==== mapFile ========================================================
+        // Maps the raf into memory (Storage::mapped only). Address space for
+        // the largest raf is reserved up front so growing never moves the
+        // mapping.
+        //
+        // Parameters: None
+        //
+        // Return val:
+        //      true if successful, otherwise false
+        // =====================================================================
+        bool mapFile();
+
+        // ==== extendMapping ==================================================
+        // Maps the part of the raf past the current mapping.
+        //
+        // Parameters:
+        //      file_size [IN]          -- new size of the raf
+        //
+        // Return val:
+        //      true if successful, otherwise false
+        // =====================================================================
+        bool extendMapping(size_t file_size);
+
+        // ==== readAt =========================================================
+        // Reads exactly size bytes at offset, retrying short reads, or copies
+        // them out of the mapping.
+        //
+        // Parameters:
+        //      buffer [OUT]            -- where the bytes are written to
+        //      size [IN]               -- number of bytes to read
+        //      offset [IN]             -- byte offset in the raf
+        //
+        // Return val:
+        //      true if all bytes were read, otherwise false
+        // =====================================================================
+        bool readAt(void* buffer, size_t size, off_t offset);
+
+        // ==== writeAt ========================================================
+        // Writes exactly size bytes at offset, retrying short writes, or
+        // copies them into the mapping.
+        //
+        // Parameters:
+        //      buffer [IN]             -- bytes to write
+        //      size [IN]               -- number of bytes to write
+        //      offset [IN]             -- byte offset in the raf
+        //
+        // Return val:
+        //      true if all bytes were written, otherwise false
+        // =====================================================================
+        bool writeAt(const void* buffer, size_t size, off_t offset);
+
+        // ==== syncRange ======================================================
+        // Pushes the bytes at [offset, offset + size) to the disk. With
+        // Storage::mapped only the pages holding the range are msync'd.
+        //
+        // Parameters:
+        //      offset [IN]             -- byte offset in the raf
+        //      size [IN]               -- number of bytes
+        //      sync [IN]               -- how hard to push them
+        //
+        // Return val:
+        //      true if successful, otherwise false
+        // =====================================================================
+        bool syncRange(off_t offset, size_t size, Sync sync);
+
+        // ==== syncRaf ========================================================
+        // Pushes the raf itself (not the journal) to the disk.
+        //
+        // Parameters:
+        //      sync [IN]               -- how hard to push it
+        //
+        // Return val:
+        //      true if successful, otherwise false
+        // =====================================================================
+        bool syncRaf(Sync sync);
 
         // ==== reserveId ======================================================
         // Sets an id to unavailable.
@@ -96,102 +688,993 @@ namespace ral {
         // =====================================================================
         void releaseId(int id);
 
-        // ==== updateFile =====================================================
+        // ==== idWordOffset ===================================================
         // Parameters:
-        //      id [IN]                 -- id of the record to be updated
-        //      record [IN]             -- pointer to the updated record
-        //      update_available_ids [OPT IN]
-        //                              -- optional: boolean indicating whether 
-        //                                  there the set of available_ids needs
-        //                                  to be updated in the RAF. defaults
-        //                                  to false
+        //      word [IN]               -- index of the bitmap word
         //
-        // Return val: None // TODO: bool return?
+        // Return val:
+        //      byte offset of the word in the raf
         // =====================================================================
-        void updateFile(int id, Record* record,
-            bool update_available_ids = false);
+        off_t idWordOffset(size_t word);
 
-        // === calculateOffset =================================================
-        // This function calculates where a record should be in the raf.
+        // ==== writeIdWord ====================================================
+        // Writes one word of the in memory bitmap to its extent in the raf.
         //
         // Parameters:
-        //      id [IN]                 -- the id of the record
-        //      include_available_ids [OPT IN]  
-        //                              -- optional: boolean indicating whether 
-        //                                  the set located at the beginning of
-        //                                  the RAF should be accounted for in
-        //                                  the offset. defaults to true
+        //      word [IN]               -- index of the bitmap word
+        //      sync [IN]               -- durability of this write
         //
         // Return val:
-        //      int representing the offset of the record in bytes
-        // =============================================================================
-        int calculateOffset(int id, bool include_available_ids = true);
+        //      true if successful, otherwise false
+        // =====================================================================
+        bool writeIdWord(size_t word, Sync sync);
 
-    public:
-        // === File ============================================================
-        // This is the constructor. It creates a new raf or loads an existing
-        // raf.
+        // ==== writeIdBits ====================================================
+        // Sets or clears the bits of some ids in the raf's bitmaps, leaving
+        // the other bits of their words as the raf has them (the caller
+        // holds ids_lock).
         //
         // Parameters:
-        //      file_name [VAL]         -- name of the raf (minus extension)
-        //      dummy_record [REF]      -- a dummy record to be given to this
-        //                                  class
+        //      bits [IN]               -- (id, used) pairs; an id's last
+        //                                  pair wins
+        //      replaying [IN]          -- the ids in memory take the bits
+        //                                  too
         //
-        // Return value: None
+        // Return val:
+        //      true if successful, otherwise false
         // =====================================================================
-        File(string file_name, unique_ptr<Record> dummy_record);
+        bool writeIdBits(const vector<pair<int, bool>> &bits, bool replaying);
 
-        // ==== getNextAvailableId =============================================
-        // Parameters: None
+        // ==== writeIdBit =====================================================
+        // Sets or clears one id's bit in the raf's bitmap & syncs it.
         //
-        // Return val:
-        //      int representing the next id if one was available, otherwise -1
+        // Parameters:
+        //      id [IN]                 -- the id
+        //      used [IN]               -- the bit
+        //      sync [IN]               -- durability of this write
+        //
+        // Return val: None
         // =====================================================================
-        int getNextAvailableId();
+        void writeIdBit(int id, bool used, Sync sync);
 
-        // ==== createRecord ===================================================
-        // Adds a new record to the RAF if there is room for one.
+        // ==== slotHoldsRecord ================================================
+        // Tells a slot image holding a record from one holding the dummy
+        // record (a deleted one).
         //
         // Parameters:
-        //      record [IN]             -- pointer to the record to be added
+        //      id [IN]                 -- id of the slot
+        //      slot [IN]               -- the sealed slot image
+        //      held [OUT]              -- true if it holds a record
         //
         // Return val:
-        //      true if the record was added, otherwise false
+        //      true if the image could be opened, otherwise false
         // =====================================================================
-        bool createRecord(Record* record);
+        bool slotHoldsRecord(int id, const char* slot, bool &held);
 
-        // === deleteRecord ====================================================
-        // Deletes a record from the raf if it's up to date.
+        // ==== writeRecord ====================================================
+        // Seals a record (with a key) & writes it to its slot.
         //
         // Parameters:
-        //      record [IN]             -- pointer to the record to be deleted
+        //      id [IN]                 -- id of the record
+        //      serialized_record [IN]  -- the encoded record
+        //      sync [IN]               -- durability of this write
         //
         // Return val:
         //      true if successful, otherwise false
         // =====================================================================
-        bool deleteRecord(Record* record);
+        bool writeRecord(int id, const char* serialized_record, Sync sync);
 
-        // ==== getRecord ======================================================
-        // Attempts to get a record from the RAF.
+        // ==== readSlots ======================================================
+        // Reads slots that are next to each other in one extent. A packed
+        // raf's records are sealed into slots as they're read; a slot whose
+        // page is corrupt reads as a slot failing its checksum.
         //
         // Parameters:
-        //      id [IN]                 -- id of the record to get
-        //      record [IN/OUT]         -- pointer to where the record should
-        //                                  get written to
+        //      first_slot [IN]         -- the first slot
+        //      count [IN]              -- number of slots
+        //      slots [OUT]             -- count * slot_size bytes
         //
         // Return val:
-        //      true if able to get the record, otherwise false
+        //      true if successful, otherwise false
         // =====================================================================
-        bool getRecord(int id, Record* record);
+        bool readSlots(size_t first_slot, size_t count, char* slots);
 
-        // ==== updateRecord ===================================================
+        // ==== writeSlot ======================================================
         // Parameters:
-        //      record [IN]             -- pointer to the updated record
+        //      id [IN]                 -- id of the record
+        //      slot [IN]               -- slot_size bytes from sealRecord
+        //      sync [IN]               -- durability of this write
+        //
+        // Return val:
+        //      true if successful, otherwise false
+        // =====================================================================
+        bool writeSlot(int id, const char* slot, Sync sync);
+
+        // ==== sealRecord =====================================================
+        // Fills a slot: the record (sealed with a key) & its checksum.
+        //
+        // Parameters:
+        //      id [IN]                 -- id of the record
+        //      serialized_record [IN]  -- the encoded record
+        //      slot [OUT]              -- slot_size bytes
         //
         // Return val: None
         // =====================================================================
-        void updateRecord(Record* record);
-    };
-}
+        void sealRecord(int id, const char* serialized_record, char* slot);
+
+        // ==== sealRecords ====================================================
+        // sealRecord for a batch, in place: sealed in one go with a key &
+        // checksummed a few slots at a time.
+        //
+        // Parameters:
+        //      ids [IN]                -- count ids, one per record
+        //      count [IN]              -- number of records
+        //      slots [IN/OUT]          -- count slots, each starting with its
+        //                                  encoded record
+        //
+        // Return val: None
+        // =====================================================================
+        void sealRecords(const uint64_t* ids, size_t count, char* slots);
+
+        // ==== openRecord =====================================================
+        // Parameters:
+        //      id [IN]                 -- id of the record
+        //      slot [IN]               -- what the slot holds
+        //      opened [OUT]            -- record_size bytes, used with a key
+        //
+        // Return val:
+        //      the encoded record: the dummy record if the slot is empty,
+        //      slot without a key, otherwise opened, or nullptr if the
+        //      slot's checksum doesn't match or it doesn't open
+        // =====================================================================
+        const char* openRecord(int id, const char* slot, char* opened);
+
+        // === Transfer =======================================================
+        // One slot to be read into/written from buffer by transfer.
+        // =====================================================================
+        struct Transfer {
+            off_t offset;
+            char* buffer;
+            int id;
+        };
+
+        // ==== transfer =======================================================
+        // Reads or writes many records, sorted by offset. Records in
+        // adjacent slots are coalesced into one preadv/pwritev each; those
+        // of a packed raf take one read (& write) per page.
+        //
+        // Parameters:
+        //      transfers [IN/OUT]      -- the records (sorted in place)
+        //      write [IN]              -- true to write, false to read
+        //
+        // Return val:
+        //      true if successful, otherwise false
+        // =====================================================================
+        bool transfer(vector<Transfer> &transfers, bool write);
+
+        // ==== pageOf =========================================================
+        // Parameters:
+        //      slot [IN]               -- a slot of a packed raf
+        //
+        // Return val:
+        //      the in memory entry of the page holding it (0 for none)
+        // =====================================================================
+        atomic<uint32_t>& pageOf(size_t slot);
+
+        // ==== setPageOf ======================================================
+        // Points a slot at a page, in memory & in its extent.
+        //
+        // Parameters:
+        //      slot [IN]               -- a slot of a packed raf
+        //      page [IN]               -- its new page (0 for none)
+        //
+        // Return val:
+        //      true if successful, otherwise false
+        // =====================================================================
+        bool setPageOf(size_t slot, uint32_t page);
+
+        // ==== lockPage =======================================================
+        // Parameters:
+        //      page [IN]               -- page of a packed raf
+        //
+        // Return val:
+        //      a lock on the page
+        // =====================================================================
+        unique_lock<mutex> lockPage(uint32_t page);
+
+        // ==== readPage =======================================================
+        // Reads a page & opens (with a key) & checks it.
+        //
+        // Parameters:
+        //      page [IN]               -- page number
+        //      body [OUT]              -- page_body_size bytes
+        //      sound [OUT]             -- false if the page is corrupt
+        //
+        // Return val:
+        //      true if the page was read, otherwise false
+        // =====================================================================
+        bool readPage(uint32_t page, char* body, bool &sound);
+
+        // ==== sealPage =======================================================
+        // Seals (with a key) & checksums a page.
+        //
+        // Parameters:
+        //      page [IN]               -- page number
+        //      body [IN]               -- page_body_size bytes
+        //      image [OUT]             -- PAGE_SIZE bytes, as stored
+        //
+        // Return val: None
+        // =====================================================================
+        void sealPage(uint32_t page, const char* body, char* image);
+
+        // ==== restorePage ====================================================
+        // Puts an image from the doublewrite buffer back over its page if
+        // the page can't be read.
+        //
+        // Parameters:
+        //      page [IN]               -- page number
+        //      image [IN]              -- PAGE_SIZE bytes, as stored
+        //      restored [IN/OUT]       -- counts the pages put back
+        //
+        // Return val:
+        //      true if successful, otherwise false
+        // =====================================================================
+        bool restorePage(uint32_t page, const char* image, size_t &restored);
+
+        // ==== stagePage ======================================================
+        // Reads a page into pack (unless it's staged already). The caller
+        // holds fill_lock.
+        //
+        // Parameters:
+        //      page [IN]               -- page number
+        //      staged [OUT]            -- its index in pack.staged
+        //      sound [OUT]             -- false if the page is corrupt (it's
+        //                                  reported & not staged)
+        //
+        // Return val:
+        //      true if the page was read, otherwise false
+        // =====================================================================
+        bool stagePage(uint32_t page, size_t &staged, bool &sound);
+
+        // ==== flushPages =====================================================
+        // Writes the staged pages that changed, through the doublewrite
+        // buffer if any of them held records, & unstages them all. The
+        // caller holds fill_lock.
+        //
+        // Parameters: None
+        //
+        // Return val:
+        //      true if successful, otherwise false
+        // =====================================================================
+        bool flushPages();
+
+        // ==== allocatePage ===================================================
+        // Takes a page never used before, growing the raf a few pages at a
+        // time. The caller holds fill_lock.
+        //
+        // Parameters: None
+        //
+        // Return val:
+        //      the page, or 0 if the raf couldn't grow
+        // =====================================================================
+        uint32_t allocatePage();
+
+        // ==== readPacked =====================================================
+        // Reads records of a packed raf into slots, each page once.
+        //
+        // Parameters:
+        //      transfers [IN]          -- the ids & where their slots go
+        //      count [IN]              -- number of transfers
+        //
+        // Return val:
+        //      true if successful, otherwise false
+        // =====================================================================
+        bool readPacked(const Transfer* transfers, size_t count);
+
+        // ==== storePacked ====================================================
+        // Writes records into their pages, each page once; records that are
+        // new or don't fit their page any more go to the fill page & their
+        // old copies are removed once they're pointed at.
+        //
+        // Parameters:
+        //      records [IN]            -- the ids & their records
+        //      count [IN]              -- number of records
+        //      sealed [IN]             -- true if the buffers are slots from
+        //                                  sealRecord (an all zero one
+        //                                  removes its record), false if
+        //                                  they're plain records
+        //
+        // Return val:
+        //      true if successful, otherwise false
+        // =====================================================================
+        bool storePacked(const Transfer* records, size_t count, bool sealed);
+
+        // ==== writeRecords ===================================================
+        // Encodes & writes validated records for createRecords &
+        // updateRecords.
+        //
+        // Parameters:
+        //      records [IN]            -- the records
+        //      sync [IN]               -- durability of the batch
+        //      allow_write_back [IN]   -- false if the records must reach the
+        //                                  raf even with a write_back cache
+        //      lsn [OUT]               -- journal entry to commit once the
+        //                                  records are unlocked (0 if none)
+        //
+        // Return val:
+        //      true if successful, otherwise false
+        // =====================================================================
+        bool writeRecords(const vector<Record*> &records, Sync sync,
+            bool allow_write_back, uint64_t &lsn);
+
+        // ==== readRecords ====================================================
+        // Reads many records like getRecords. The caller holds their
+        // stripes.
+        //
+        // Parameters:
+        //      ids [IN]                -- ids of the records (valid)
+        //      records [IN/OUT]        -- records[i] receives ids[i]
+        //
+        // Return val:
+        //      true if able to get every record, otherwise false
+        // =====================================================================
+        bool readRecords(const vector<int> &ids,
+            const vector<Record*> &records);
+
+        // ==== cacheRecord ====================================================
+        // Puts a record in the cache, writing any dirty record it evicts
+        // while the cache is still locked. Writers cache a record before
+        // writing it, so an evicted copy never lands after a newer one.
+        //
+        // Parameters:
+        //      id [IN]                 -- id of the record
+        //      serialized_record [IN]  -- the encoded record
+        //      dirty [IN]              -- true if the raf doesn't have it yet
+        //
+        // Return val:
+        //      true if successful, otherwise false
+        // =====================================================================
+        bool cacheRecord(int id, const char* serialized_record, bool dirty);
+
+        // ==== findBuffered ===================================================
+        // Looks for a record in the cache & the journal. The caller holds
+        // the record's lock.
+        //
+        // Parameters:
+        //      id [IN]                 -- id of the record
+        //      serialized_record [OUT] -- the encoded record, if found
+        //
+        // Return val:
+        //      true if found, otherwise false (it's only in the raf)
+        // =====================================================================
+        bool findBuffered(int id, char* serialized_record);
+
+        // ==== flushCache =====================================================
+        // Writes every dirty record in the cache to the raf.
+        //
+        // Parameters: None
+        //
+        // Return val:
+        //      true if successful, otherwise false
+        // =====================================================================
+        bool flushCache();
+
+        // ==== updateFile =====================================================
+        // Writes a record. The caller holds the record's lock.
+        //
+        // Parameters:
+        //      id [IN]                 -- id of the record to be updated
+        //      record [IN]             -- pointer to the updated record
+        //      sync [IN]               -- durability of this write
+        //      update_available_ids [OPT IN]
+        //                              -- optional: boolean indicating whether 
+        //                                  the bitmap word holding the id
+        //                                  needs to be updated in the RAF.
+        //                                  defaults to false
+        //
+        // Return val:
+        //      journal entry to commit once the record is unlocked (0 if
+        //      none)
+        // =====================================================================
+        uint64_t updateFile(int id, Record* record, Sync sync,
+            bool update_available_ids = false);
+
+        // ==== commitJournal ==================================================
+        // Waits for a journal entry from updateFile to be durable.
+        //
+        // Parameters:
+        //      lsn [IN]                -- the entry (0 does nothing)
+        //
+        // Return val: None
+        // =====================================================================
+        void commitJournal(uint64_t lsn);
+
+        // ==== beginWrite =====================================================
+        // Takes the sequence number of a write, keeping the records it
+        // replaces for the open read views. The caller holds the records'
+        // locks & calls this before they change.
+        //
+        // Parameters:
+        //      ids [IN]                -- ids of the records written
+        //      count [IN]              -- number of ids
+        //
+        // Return val:
+        //      the write's sequence number (0 if the File isn't versioned)
+        // =====================================================================
+        uint64_t beginWrite(const int* ids, size_t count);
+
+        // ==== endWrite =======================================================
+        // Parameters:
+        //      seq [IN]                -- from beginWrite, once the records
+        //                                  are in the cache, the journal or
+        //                                  the raf
+        //
+        // Return val: None
+        // =====================================================================
+        void endWrite(uint64_t seq);
+
+        // ==== readCurrent ====================================================
+        // Reads many records as they are from the cache, the journal or the
+        // raf, without taking their locks.
+        //
+        // Parameters:
+        //      ids [IN]                -- ids of the records
+        //      serialized_records [OUT]
+        //                              -- ids.size() * record_size bytes the
+        //                                  encoded records are copied to
+        //      sound [OUT]             -- false for each record that failed
+        //                                  its checksum or seal (e.g. it
+        //                                  was read while being written)
+        //      report [IN]             -- print why a record isn't sound
+        //
+        // Return val:
+        //      true if the raf could be read, otherwise false
+        // =====================================================================
+        bool readCurrent(const vector<int> &ids, char* serialized_records,
+            vector<bool> &sound, bool report);
+
+        // ==== readView =======================================================
+        // Does the work of getRecordAt & getRecordsAt.
+        //
+        // Parameters:
+        //      view [IN]               -- from beginRead
+        //      ids [IN]                -- ids of the records to get
+        //      records [IN/OUT]        -- records[i] receives ids[i]
+        //
+        // Return val:
+        //      true if able to get every record, otherwise false
+        // =====================================================================
+        bool readView(uint64_t view, const vector<int> &ids,
+            const vector<Record*> &records);
+
+        // ==== noteWrite ======================================================
+        // Marks a slot as changed for the next snapshot. While a snapshot is
+        // being copied, a slot it still needs is read & kept for it first.
+        // The caller holds the record's lock & calls this before the slot's
+        // record changes (in the cache, the journal or the raf).
+        //
+        // Parameters:
+        //      id [IN]                 -- id of the record
+        //
+        // Return val: None
+        // =====================================================================
+        void noteWrite(int id);
+
+        // ==== copySnapshot ===================================================
+        // Body of snapshot_thread: copies the pending slots a chunk at a time
+        // without holding any lock while reading or writing, then the
+        // preserved slots, the bitmaps & last the header.
+        //
+        // Parameters: None
+        //
+        // Return val:
+        //      true if successful, otherwise false
+        // =====================================================================
+        bool copySnapshot();
+
+        // ==== guard ==========================================================
+        // Parameters:
+        //      lock [IN]               -- a lock of this File
+        //
+        // Return val:
+        //      the lock held, or an empty guard if the File isn't concurrent
+        // =====================================================================
+        unique_lock<mutex> guard(mutex &lock);
+
+        // ==== lockRecord =====================================================
+        // Parameters:
+        //      id [IN]                 -- id of the record
+        //
+        // Return val:
+        //      the record's stripe held (empty if the File isn't concurrent)
+        // =====================================================================
+        unique_lock<mutex> lockRecord(int id);
+
+        // ==== lockRecords ====================================================
+        // Takes the stripes of many records in ascending order, so batches
+        // can't deadlock with each other.
+        //
+        // Parameters:
+        //      ids [IN]                -- ids of the records
+        //
+        // Return val:
+        //      the stripes held (none if the File isn't concurrent)
+        // =====================================================================
+        vector<unique_lock<mutex>> lockRecords(const vector<int> &ids);
+
+        // === calculateOffset =================================================
+        // This function calculates where a record is in the raf.
+        //
+        // Parameters:
+        //      id [IN]                 -- the id of the record
+        //
+        // Return val:
+        //      the offset of the record in bytes
+        // =============================================================================
+        off_t calculateOffset(int id);
+
+    public:
+        // === File ============================================================
+        // This is the constructor. It creates a new raf or loads an existing
+        // raf, migrating it from the legacy 100 record layout if needed.
+        //
+        // Parameters:
+        //      file_name [VAL]         -- name of the raf (minus extension)
+        //      dummy_record [REF]      -- a dummy record to be given to this
+        //                                  class
+        //      options [OPT IN]        -- optional: see Options
+        //
+        // Return value: None
+        // =====================================================================
+        File(string file_name, unique_ptr<Record> dummy_record,
+            Options options = Options());
+
+        // === ~File ===========================================================
+        // Waits for a snapshot, checkpoints the journal, writes back the
+        // cache, unmaps the raf (if mapped) & closes its file descriptor.
+        // =====================================================================
+        ~File();
+
+        File(const File&) = delete;
+        File& operator=(const File&) = delete;
+
+        // ==== setSyncPolicy ==================================================
+        // Parameters:
+        //      sync_policy [IN]        -- durability applied to every write
+        //                                  that doesn't specify its own
+        //
+        // Return val: None
+        // =====================================================================
+        void setSyncPolicy(Sync sync_policy);
+
+        // ==== sync ===========================================================
+        // Pushes every write made so far to the disk, including records held
+        // back by a write_back cache. Meant for batches of writes made with
+        // Sync::none.
+        //
+        // Parameters:
+        //      sync [OPT IN]           -- optional: data or full. defaults to
+        //                                  full
+        //
+        // Return val:
+        //      true if successful, otherwise false
+        // =====================================================================
+        bool sync(Sync sync = Sync::full);
+
+        // ==== getCacheStats ==================================================
+        // Parameters: None
+        //
+        // Return val:
+        //      the record cache's counters (all 0 without a cache)
+        // =====================================================================
+        CacheStats getCacheStats();
+
+        // ==== getJournalStats ================================================
+        // Parameters: None
+        //
+        // Return val:
+        //      the journal's counters (all 0 without a journal)
+        // =====================================================================
+        JournalStats getJournalStats();
+
+        // ==== getVersionStats ================================================
+        // Parameters: None
+        //
+        // Return val:
+        //      the version store's counters (all 0 unless versioned)
+        // =====================================================================
+        VersionStats getVersionStats();
+
+        // ==== getCapacity ====================================================
+        // Parameters: None
+        //
+        // Return val:
+        //      number of record slots currently in the raf
+        // =====================================================================
+        size_t getCapacity();
+
+        // ==== validId ========================================================
+        // Parameters:
+        //      id [IN]                 -- the id of the record
+        //
+        // Return val:
+        //      true if the id names a slot of the raf, otherwise false
+        // =====================================================================
+        bool validId(int id);
+
+        // ==== getRecordCount =================================================
+        // Parameters: None
+        //
+        // Return val:
+        //      number of ids in use
+        // =====================================================================
+        size_t getRecordCount();
+
+        // ==== getUsedIds =====================================================
+        // Lists the ids in use by walking the bitmap a word at a time.
+        //
+        // Parameters:
+        //      ids [OUT]               -- ids in use are appended here in
+        //                                  ascending order
+        //
+        // Return val: None
+        // =====================================================================
+        void getUsedIds(vector<int> &ids);
+
+        // ==== verifyFile =====================================================
+        // Checks every slot of the raf against its checksum (& opens it with
+        // a key) & the bitmap against the slots, with threads each reading
+        // 1MB of slots at a time. Meant for a raf nothing else is
+        // using yet, e.g. right after opening it. A repair marks free ids
+        // whose slot holds a record as used & empties corrupt slots of
+        // free ids; corrupt records & used ids without a record are only
+        // reported.
+        //
+        // Parameters:
+        //      report [OUT]            -- what was found
+        //      repair [OPT IN]         -- optional: true to repair what can
+        //                                  be. defaults to false
+        //      threads [OPT IN]        -- optional: threads to scan with (0
+        //                                  for one per CPU). defaults to 0
+        //
+        // Return val:
+        //      true if the raf could be read (& repaired), otherwise false
+        // =====================================================================
+        bool verifyFile(VerifyReport &report, bool repair = false,
+            size_t threads = 0);
+
+        // ==== beginSnapshot ==================================================
+        // Takes a snapshot of the raf into another raf while the File keeps
+        // being used. Only the cut holds the File's locks (& flushes a
+        // write_back cache); the slots are copied by a background thread.
+        // When the file holds the last snapshot this File took into it, only
+        // the slots written since are copied; otherwise it's rewritten whole
+        // (sparse, so empty slots cost nothing). Until endSnapshot the file is
+        // incomplete & doesn't open. On a File that isn't concurrent, call it
+        // from the thread using the File; async updates still in flight are
+        // only in the snapshot if they land before their slot is copied.
+        //
+        // Parameters:
+        //      file_name [IN]          -- name of the snapshot (minus
+        //                                  extension)
+        //
+        // Return val:
+        //      true if the snapshot was begun, otherwise false (another one
+        //      is running or the file can't be opened)
+        // =====================================================================
+        bool beginSnapshot(const string &file_name);
+
+        // ==== isSnapshotRunning ==============================================
+        // Return val:
+        //      true if a snapshot's slots are still being copied, otherwise
+        //      false
+        // =====================================================================
+        bool isSnapshotRunning();
+
+        // ==== endSnapshot ====================================================
+        // Waits for the snapshot begun last to be copied & durable.
+        //
+        // Parameters:
+        //      report [OUT]            -- what was written
+        //
+        // Return val:
+        //      true if the snapshot is complete, otherwise false (the next
+        //      snapshot copies every slot)
+        // =====================================================================
+        bool endSnapshot(SnapshotReport &report);
+
+        // ==== getNextAvailableId =============================================
+        // Finds the lowest available id in O(log64 capacity). Grows the raf
+        // if every id is taken.
+        //
+        // Parameters: None
+        //
+        // Return val:
+        //      int representing the next id if one was available, otherwise -1
+        // =====================================================================
+        int getNextAvailableId();
+
+        // ==== reserveIds =====================================================
+        // Takes the lowest available ids in one go, growing the raf as
+        // needed. The reserved slots hold dummy records until they're written
+        // with updateRecord & are released with deleteRecord. Each bitmap
+        // word touched is written once.
+        //
+        // Parameters:
+        //      count [IN]              -- number of ids wanted
+        //      ids [OUT]               -- the ids reserved are appended here
+        //
+        // Return val:
+        //      number of ids reserved (less than count if the raf is full)
+        // =====================================================================
+        size_t reserveIds(size_t count, vector<int> &ids);
+
+        // ==== createRecord ===================================================
+        // Adds a new record to the RAF if there is room for one.
+        //
+        // Parameters:
+        //      record [IN]             -- pointer to the record to be added
+        //
+        // Return val:
+        //      true if the record was added, otherwise false
+        // =====================================================================
+        bool createRecord(Record* record);
+
+        // === deleteRecord ====================================================
+        // Deletes a record from the raf if it's up to date.
+        //
+        // Parameters:
+        //      record [IN]             -- pointer to the record to be deleted
+        //
+        // Return val:
+        //      true if successful, otherwise false
+        // =====================================================================
+        bool deleteRecord(Record* record);
+
+        // ==== getRecord ======================================================
+        // Attempts to get a record from the RAF.
+        //
+        // Parameters:
+        //      id [IN]                 -- id of the record to get
+        //      record [IN/OUT]         -- pointer to where the record should
+        //                                  get written to
+        //
+        // Return val:
+        //      true if able to get the record, otherwise false
+        // =====================================================================
+        bool getRecord(int id, Record* record);
+
+        // ==== getRecords =====================================================
+        // Gets many records at once. Records missing from the cache &
+        // journal are read in offset order, adjacent slots coalesced into
+        // one preadv.
+        //
+        // Parameters:
+        //      ids [IN]                -- ids of the records to get
+        //      records [IN/OUT]        -- records[i] receives ids[i]
+        //
+        // Return val:
+        //      true if able to get every record, otherwise false
+        // =====================================================================
+        bool getRecords(const vector<int> &ids,
+            const vector<Record*> &records);
+
+        // ==== beginRead ======================================================
+        // Opens a read view of a versioned File.
+        //
+        // Parameters: None
+        //
+        // Return val:
+        //      the view, to pass to getRecordAt, getRecordsAt & endRead (0
+        //      if the File isn't versioned)
+        // =====================================================================
+        uint64_t beginRead();
+
+        // ==== endRead ========================================================
+        // Closes a read view; the old versions only it needed are dropped.
+        //
+        // Parameters:
+        //      view [IN]               -- from beginRead
+        //
+        // Return val: None
+        // =====================================================================
+        void endRead(uint64_t view);
+
+        // ==== getRecordAt ====================================================
+        // Gets a record as a read view sees it, without taking its lock.
+        //
+        // Parameters:
+        //      view [IN]               -- from beginRead
+        //      id [IN]                 -- id of the record to get
+        //      record [IN/OUT]         -- where the record is decoded to
+        //
+        // Return val:
+        //      true if able to get the record, otherwise false
+        // =====================================================================
+        bool getRecordAt(uint64_t view, int id, Record* record);
+
+        // ==== getRecordsAt ===================================================
+        // Gets many records as a read view sees them, without taking their
+        // locks. Records read from the raf aren't cached.
+        //
+        // Parameters:
+        //      view [IN]               -- from beginRead
+        //      ids [IN]                -- ids of the records to get
+        //      records [IN/OUT]        -- records[i] receives ids[i]
+        //
+        // Return val:
+        //      true if able to get every record, otherwise false
+        // =====================================================================
+        bool getRecordsAt(uint64_t view, const vector<int> &ids,
+            const vector<Record*> &records);
+
+        // ==== createRecords ==================================================
+        // Adds many new records at once. Each bitmap word touched is written
+        // once & the records are written like updateRecords.
+        //
+        // Parameters:
+        //      records [IN]            -- the records to be added
+        //
+        // Return val:
+        //      true if every record was added, otherwise false (& none were)
+        // =====================================================================
+        bool createRecords(const vector<Record*> &records);
+
+        // ==== updateRecords ==================================================
+        // Writes many records at once, in offset order with adjacent slots
+        // coalesced into one pwritev, & syncs once at the end. With a journal
+        // the records are appended & committed once.
+        //
+        // Parameters:
+        //      records [IN]            -- the updated records (if an id is
+        //                                  repeated the last one wins)
+        //      sync [OPT IN]           -- optional: durability of the batch.
+        //                                  defaults to the file's policy
+        //
+        // Return val:
+        //      true if successful, otherwise false (& some of the records
+        //      may have been written, though not all or not durably)
+        // =====================================================================
+        bool updateRecords(const vector<Record*> &records);
+        bool updateRecords(const vector<Record*> &records, Sync sync);
+
+        // ==== transactRecords ================================================
+        // Reads many records, lets change edit them & writes them all back
+        // as one unit. Their stripes are taken in ascending order (like
+        // every batch's, so transactions can't deadlock) & held throughout,
+        // so no reader sees some of the changes without the rest. With a
+        // journal the records are appended as one group, which a crash
+        // keeps whole or drops, & committed with one fdatasync; without one
+        // they're written like updateRecords & synced once.
+        //
+        // Parameters:
+        //      ids [IN]                -- ids of the records (no repeats)
+        //      records [IN/OUT]        -- records[i] receives ids[i] & is
+        //                                  written back with its changes
+        //      change [IN]             -- edits the records; returns false
+        //                                  to write nothing
+        //      sync [OPT IN]           -- optional: durability of the
+        //                                  transaction. defaults to the
+        //                                  file's policy
+        //
+        // Return val:
+        //      true if the records were read & (unless change declined)
+        //      written, otherwise false (& some of the records may have
+        //      been written, though not all or not durably)
+        // =====================================================================
+        bool transactRecords(const vector<int> &ids,
+            const vector<Record*> &records, const function<bool()> &change);
+        bool transactRecords(const vector<int> &ids,
+            const vector<Record*> &records, const function<bool()> &change,
+            Sync sync);
+
+        // ==== transactRecords ================================================
+        // Like transactRecords, but the records are committed while their
+        // stripes are still held & committed is told the outcome before
+        // they're released, so a transaction across many files can record
+        // each file's part as done before another write sees its records
+        // (see IntentLog).
+        //
+        // Parameters:
+        //      ids [IN]                -- ids of the records (no repeats)
+        //      records [IN/OUT]        -- records[i] receives ids[i] & is
+        //                                  written back with its changes
+        //      change [IN]             -- edits the records; returns false
+        //                                  to write nothing
+        //      sync [IN]               -- durability of the transaction
+        //      committed [IN]          -- told whether the records were
+        //                                  written & committed (only if
+        //                                  change accepted them)
+        //
+        // Return val:
+        //      true if the records were read & (unless change declined)
+        //      written, otherwise false
+        // =====================================================================
+        bool transactRecords(const vector<int> &ids,
+            const vector<Record*> &records, const function<bool()> &change,
+            Sync sync, const function<void(bool)> &committed);
+
+        // ==== updateRecord ===================================================
+        // Parameters:
+        //      record [IN]             -- pointer to the updated record
+        //
+        // Return val: None
+        // =====================================================================
+        void updateRecord(Record* record);
+
+        // ==== updateRecord ===================================================
+        // With a write_back cache an update with Sync::none only reaches the
+        // cache; any other sync writes it through. With a journal the update
+        // is appended to the log & Sync::data/full wait for it to be
+        // committed (sharing the fdatasync with concurrent commits).
+        //
+        // Parameters:
+        //      record [IN]             -- pointer to the updated record
+        //      sync [IN]               -- durability of this write, overriding
+        //                                  the file's policy
+        //
+        // Return val: None
+        // =====================================================================
+        void updateRecord(Record* record, Sync sync);
+
+        // ==== getRecordAsync =================================================
+        // Like getRecord, but a record only in the raf is read through the
+        // calling thread's Ring.
+        //
+        // Parameters:
+        //      id [IN]                 -- id of the record to get
+        //      record [IN/OUT]         -- where the record is decoded to;
+        //                                  must stay valid until done runs
+        //      done [IN]               -- called from completeAsync
+        //
+        // Return val: None
+        // =====================================================================
+        void getRecordAsync(int id, Record* record, Completion done);
+
+        // ==== updateRecordAsync ==============================================
+        // Like updateRecord, but the record is encoded right away & written
+        // through the calling thread's Ring, with Sync::data/full linked
+        // after the write as an fdatasync/fsync. A journal, a mapping,
+        // packed storage, a versioned raf or a write_back cache write it
+        // synchronously with updateRecord (done still runs from
+        // completeAsync). On the async path a record that doesn't encode
+        // & a failed write are reported to done instead of exiting.
+        //
+        // Parameters:
+        //      record [IN]             -- the updated record
+        //      sync [OPT IN]           -- optional: durability of this
+        //                                  write. defaults to the file's
+        //                                  policy
+        //      done [IN]               -- called from completeAsync
+        //
+        // Return val: None
+        // =====================================================================
+        void updateRecordAsync(Record* record, Completion done);
+        void updateRecordAsync(Record* record, Sync sync, Completion done);
+
+        // ==== completeAsync ==================================================
+        // Submits the calling thread's queued async operations & runs the
+        // callbacks of those that finished.
+        //
+        // Parameters:
+        //      wait_for [OPT IN]       -- optional: wait until at least this
+        //                                  many have called back (or none
+        //                                  are left). defaults to 0
+        //
+        // Return val:
+        //      number of callbacks run
+        // =====================================================================
+        static size_t completeAsync(size_t wait_for = 0);
+
+        // ==== getPendingAsync ================================================
+        // Return val:
+        //      number of the calling thread's async operations that haven't
+        //      called back yet
+        // =====================================================================
+        static size_t getPendingAsync();
+    };
+}
+
+#include "ral.tpp"
 
 #endif // RAL_H
\ No newline at end of file
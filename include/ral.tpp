@@ -0,0 +1,22 @@
+// =============================================================================
+// File: ral.tpp
+// =============================================================================
+// Description:
+//      This file is the implementation of the templated classes of the ral
+//      namespace.
+// =============================================================================
+#include <cstring>
+
+template <class T> size_t ral::PodRecord<T>::getSize() {
+    return sizeof(T);
+}
+
+template <class T> bool ral::PodRecord<T>::encode(char* buffer) {
+    memcpy(buffer, static_cast<T*>(this), sizeof(T));
+    return true;
+}
+
+template <class T> bool ral::PodRecord<T>::decode(const char* buffer) {
+    memcpy(static_cast<T*>(this), buffer, sizeof(T));
+    return true;
+}
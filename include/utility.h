@@ -44,6 +44,30 @@ namespace utility {
     // =========================================================================
     template <class T> bool get(T &input, T default_val, string prompt);
 
+    // ==== parseCents ==========================================================
+    // This function parses a dollar amount such as 12, -3.5 or 1024.99 into
+    // cents, exactly.
+    //
+    // Parameters:
+    //      begin [IN]                  -- the first character of the amount
+    //      end [IN]                    -- one past its last
+    //      cents [OUT]                 -- the amount in cents
+    //
+    // Return val:
+    //      true if the text is an amount with at most 2 decimal places that
+    //      fits in an int64_t, otherwise false
+    // =========================================================================
+    bool parseCents(const char* begin, const char* end, int64_t &cents);
+
+    // ==== formatCents =========================================================
+    // Parameters:
+    //      cents [IN]                  -- an amount in cents
+    //
+    // Return val:
+    //      the amount in dollars with 2 decimal places (e.g. 1024.99)
+    // =========================================================================
+    string formatCents(int64_t cents);
+
     // ==== printDateAndTime ===================================================
     // This function prints the date and time.
     //
@@ -1,236 +1,1473 @@
-// =============================================================================
-// File: Bank.cpp
-// =============================================================================
-// Description:
-//      This file implements the Bank class.
-// =============================================================================
-#include <cstring>
-#include <iostream>
-#include <sstream>
-#include <iomanip>
-#include <limits>
-#include "utility.h"
-#include "Bank.h"
-
-using namespace utility;
-
-Bank::Account::Account() {
-    reset();
-}
-
-void Bank::Account::reset() {
-    id = 0;
-    strcpy(name, "UNKNOWN");
-    balance = 0.0;
-}
-
-bool Bank::Account::setName() {
-    // TODO: santize
-    string name;
-    if (!get(name, "Enter your name: ")) {
-        cout << "Failed to get name";
-        return false;
-    }
-
-    if (name.length() + 1 > MAX_NAME_SIZE) {
-        cout << "Name is too long by " << name.length() + 1 - MAX_NAME_SIZE
-            << " characters\n";
-        return false;
-    }
-
-    strcpy(this->name, name.c_str());
-    return true;
-}
-
-bool Bank::Account::deposit(string promptMsg /*= "How much would you like to deposit? "*/) { // TODO: change to double
-    float amount;
-
-    if (!get(amount, promptMsg)) {
-        cout << "Error with input\n"; // TODO: what to display?
-        return false;
-    }
-
-    if (amount <= 0.0) {
-        cout << "Cannot deposit $0.00 or less\n";
-        return false;
-    }
-    if (amount > numeric_limits<float>::max() - balance) {
-        cout << "Too much money! Can only deposit $" << setprecision(2) << fixed
-            << numeric_limits<float>::max() - balance
-            << " more. Please open another account.\n";
-        return false;
-    }
-
-    balance += amount; // TODO: rounding to max when gets too big
-    return true;
-}
-
-bool Bank::Account::withdraw() {
-    float amount;
-
-    if (!get(amount, "How much would you like to withdraw? ")) {
-        cout << "Error with input\n"; // TODO: what to display?
-        return false;
-    }
-
-    if (amount <= 0.0) {
-        cout << "Cannot withdraw $0.00 or less\n";
-        return false;
-    }
-
-    if (balance < amount) {
-        cout << "Cannot withdraw more than your balance";
-        return false;
-    }
-
-    balance -= amount;
-    return true;
-}
-
-int Bank::Account::getId() {
-    return this->id;
-}
-
-size_t Bank::Account::getSize() {
-    return sizeof(id) + sizeof(name) + sizeof(balance);
-}
-
-// TODO: make better
-bool Bank::Account::serialize(stringstream &ss) {
-    if (!ss) {
-        cout << "serialize: buffer error\n";
-        return false;
-    }
-
-    if (ss.tellp() != 0) {
-        cout << "serialize: buffer status error\n";
-    }
-
-    ss.write((char*)&id, sizeof(id));
-    ss.write((char*)name, sizeof(name));
-    ss.write((char*)&balance, sizeof(balance));
-    //ss.read(str, getSize());
-
-    return true;
-}
-
-bool Bank::Account::deserialize(stringstream &ss) {
-    if (!ss) {
-        cout << "deserialize: buffer error\n";
-        return false;
-    }
-
-    if (ss.tellp() != getSize() || ss.tellg() != 0) {
-        cout << "deserialize: buffer status error\n";
-        return false;
-    }
-
-    //ss.write((char*)str, getSize());
-    ss.read((char*)&id, sizeof(id));
-    ss.read((char*)name, sizeof(name));
-    ss.read((char*)&balance, sizeof(balance));
-
-    return true;
-}
-
-Bank::Bank(string ra_file_name) : raf(ra_file_name, 
-    unique_ptr<Bank::Account>(new Bank::Account())) { }
-
-bool Bank::login() {
-    int id;
-    if (!get(id, "Enter your id: ")) {
-        cout << "Failed to get id\n";
-        return false;
-    }
-    Bank::Account login;
-    login.id = id;
-
-    if (!login.setName()){
-        return false;
-    }
-
-    current_account = unique_ptr<Bank::Account>(new Account());
-    if (!raf.getRecord(id, current_account.get())) {
-        cout << "Invalid login\n";
-        return false;
-    }
-
-    if (strcmp(login.name, current_account->name) != 0) {
-        cout << "Invalid login\n";
-        return false;
-    }
-
-    displayBalance();
-    return true;
-}
-
-bool Bank::createAccount() {
-    int id = raf.getNextAvailableId();
-    if (id == -1) {
-        // TODO: display msg here instead of from raf
-        return false;
-    }
-    current_account = unique_ptr<Bank::Account>(new Bank::Account());
-    current_account->id = id;
-
-    if (!current_account->setName()){
-        return false;
-    }
-
-    current_account->deposit("Enter opening deposit amount: ");
-
-    if (!raf.createRecord(current_account.get())) {
-        cout << "Failed to create account\n";
-        return false;
-    }
-    
-    cout << "Your id is: " << current_account->id << endl;
-    displayBalance();
-    return true;
-}
-
-bool Bank::closeAccount() {
-    cout << "This is the account you are about to close:\n" // display record
-        << current_account->id << " " << current_account->name << endl;
-    displayBalance();
-
-    char confirm;
-    if (!get(confirm, 'n',
-        "Are you sure you want to close this account (y/n)? ")) {
-        cout << "Error with input\n";
-    }
-
-    bool closed = false;
-    if (confirm == 'y') {
-        closed = raf.deleteRecord(current_account.get());
-    }
-
-    if (closed) {
-        current_account->reset();
-        return true;
-    }
-
-    cout << "Your account was not closed\n";
-    return false;
-}
-
-void Bank::displayBalance() {
-    cout << "Your balance is: $" << setprecision(2) << fixed
-        << current_account->balance << endl;
-}
-
-void Bank::adjustBalance(bool is_deposit) {
-    bool failed = true;
-
-    if (is_deposit) {
-        failed = current_account->deposit();
-    }
-    else {
-        failed = current_account->withdraw();
-    }
-
-    if (failed) {
-        raf.updateRecord(current_account.get());
-        displayBalance();
-    }
-}
\ No newline at end of file
+// =============================================================================
+// File: Bank.cpp
+// =============================================================================
+// Description:
+//      This file implements the Bank class.
+// =============================================================================
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <unordered_map>
+#include <fcntl.h>
+#include <unistd.h>
+#include "utility.h"
+#include "Bank.h"
+#include "Checksum.h"
+#include "Stats.h"
+
+using namespace utility;
+
+namespace {
+    // latency & I/O of each action (see ral::Stats)
+    const size_t STAT_OPEN_ACCOUNT = ral::Stats::define("bank.openAccount");
+    const size_t STAT_CHECK_LOGIN = ral::Stats::define("bank.checkLogin");
+    const size_t STAT_GET_BALANCE = ral::Stats::define("bank.getBalance");
+    const size_t STAT_DEPOSIT = ral::Stats::define("bank.deposit");
+    const size_t STAT_WITHDRAW = ral::Stats::define("bank.withdraw");
+    const size_t STAT_TRANSFER = ral::Stats::define("bank.transfer");
+    const size_t STAT_GET_BALANCES = ral::Stats::define("bank.getBalances");
+    const size_t STAT_AUDIT_BOOK = ral::Stats::define("bank.auditBook");
+    const size_t STAT_CLOSE_ACCOUNT = ral::Stats::define("bank.closeAccount");
+    const size_t STAT_APPLY_TRANSACTIONS =
+        ral::Stats::define("bank.applyTransactions");
+    const size_t STAT_POST_INTEREST = ral::Stats::define("bank.postInterest");
+    const size_t STAT_SUMMARIZE_BALANCES =
+        ral::Stats::define("bank.summarizeBalances");
+    const size_t STAT_SELECT_ACCOUNTS =
+        ral::Stats::define("bank.selectAccounts");
+    const size_t STAT_TOP_BALANCES = ral::Stats::define("bank.topBalances");
+    const size_t STAT_SYNC = ral::Stats::define("bank.sync");
+
+    // what the name index's secret is derived for (see Cipher::deriveKey)
+    const char NAME_KEY_PURPOSE[ral::Cipher::NONCE_SIZE + 1] = "ONB name key";
+
+    // counts an action that wasn't ok as failed
+    Bank::Result finish(ral::StatTimer &timer, Bank::Result result) {
+        timer.check(result == Bank::Result::ok);
+        return result;
+    }
+}
+
+Bank::Account::Account() {
+    reset();
+}
+
+void Bank::Account::reset() {
+    id = 0;
+    strcpy(name, "UNKNOWN");
+    balance = 0;
+}
+
+bool Bank::Account::setName() {
+    // TODO: santize
+    string name;
+    if (!get(name, "Enter your name: ")) {
+        cout << "Failed to get name";
+        return false;
+    }
+
+    if (name.length() + 1 > MAX_NAME_SIZE) {
+        cout << "Name is too long by " << name.length() + 1 - MAX_NAME_SIZE
+            << " characters\n";
+        return false;
+    }
+
+    strcpy(this->name, name.c_str());
+    return true;
+}
+
+bool Bank::Account::deposit(string promptMsg /*= "How much would you like to deposit? "*/) {
+    string input;
+    int64_t amount;
+
+    if (!get(input, promptMsg) ||
+        !parseCents(input.data(), input.data() + input.size(), amount)) {
+        cout << "Error with input\n"; // TODO: what to display?
+        return false;
+    }
+
+    switch (credit(amount)) {
+        case Result::ok:
+            return true;
+        case Result::invalid_amount:
+            cout << "Cannot deposit $0.00 or less\n";
+            return false;
+        default:
+            cout << "Too much money! Can only deposit $"
+                << formatCents(numeric_limits<int64_t>::max() - balance)
+                << " more. Please open another account.\n";
+            return false;
+    }
+}
+
+Bank::Result Bank::Account::credit(int64_t amount) {
+    if (amount <= 0) {
+        return Result::invalid_amount;
+    }
+    if (amount > numeric_limits<int64_t>::max() - balance) {
+        return Result::too_much_money;
+    }
+
+    balance += amount;
+    return Result::ok;
+}
+
+bool Bank::Account::withdraw() {
+    string input;
+    int64_t amount;
+
+    if (!get(input, "How much would you like to withdraw? ") ||
+        !parseCents(input.data(), input.data() + input.size(), amount)) {
+        cout << "Error with input\n"; // TODO: what to display?
+        return false;
+    }
+
+    switch (debit(amount)) {
+        case Result::ok:
+            return true;
+        case Result::invalid_amount:
+            cout << "Cannot withdraw $0.00 or less\n";
+            return false;
+        default:
+            cout << "Cannot withdraw more than your balance";
+            return false;
+    }
+}
+
+Bank::Result Bank::Account::debit(int64_t amount) {
+    if (amount <= 0) {
+        return Result::invalid_amount;
+    }
+    if (balance < amount) {
+        return Result::insufficient_funds;
+    }
+
+    balance -= amount;
+    return Result::ok;
+}
+
+int Bank::Account::getId() {
+    return rafId(this->id);
+}
+
+bool Bank::Account::encode(char* buffer) {
+    AccountFields fields;
+    memset(&fields, 0, sizeof(fields));
+    fields.id = id;
+    memcpy(fields.name, name, strnlen(name, sizeof(fields.name) - 1));
+    fields.balance = balance;
+    memcpy(buffer, &fields, sizeof(fields));
+    return true;
+}
+
+// === LegacyAccountFields =====================================================
+// An account as stored before balances were kept in cents.
+// =============================================================================
+namespace {
+    struct LegacyAccountFields {
+        int id;
+        char name[100];
+        float balance;
+    };
+}
+
+bool Bank::convertAccount(const char* old_record, char* record) {
+    LegacyAccountFields legacy;
+    memcpy(&legacy, old_record, sizeof(legacy));
+    double cents = nearbyint((double)legacy.balance * 100.0);
+    if (!(cents >= 0.0 && cents < 9.2e18)) {
+        return false; // negative, NaN or too large for int64_t
+    }
+
+    AccountFields fields;
+    memset(&fields, 0, sizeof(fields));
+    fields.id = legacy.id;
+    memcpy(fields.name, legacy.name, sizeof(fields.name));
+    fields.name[sizeof(fields.name) - 1] = '\0';
+    fields.balance = (int64_t)cents;
+    memcpy(record, &fields, sizeof(fields));
+    return true;
+}
+
+ral::Options Bank::rafOptions(ral::Projection* columns,
+    const string &key) {
+    ral::Options options;
+    options.storage = ral::Storage::packed;
+    options.cache_records = 4096;
+    options.journal = true;
+    options.sync = ral::Sync::data;
+    options.convert_size = sizeof(LegacyAccountFields);
+    options.convert = convertAccount;
+    options.projection = columns;
+    options.key = key;
+    // reports read through views on threads of their own (see auditBook)
+    options.concurrent = true;
+    options.versioned = true;
+    return options;
+}
+
+string Bank::loadKey(const string &ra_file_name) {
+    const char* key_file = getenv("ONB_KEY_FILE");
+    string file_name = key_file != nullptr && *key_file != '\0' ? key_file :
+        ra_file_name + ".key";
+
+    string key(ral::Cipher::KEY_SIZE, '\0');
+    int fd = open(file_name.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1 && errno == ENOENT) {
+        // a new key; O_EXCL so two banks starting at once can't both make one
+        random_device random;
+        for (char &c : key) {
+            c = (char)random();
+        }
+        fd = open(file_name.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC,
+            0600);
+        bool written = fd != -1 &&
+            write(fd, key.data(), key.size()) == (ssize_t)key.size() &&
+            fsync(fd) == 0;
+        if (fd != -1) {
+            close(fd);
+        }
+        if (written) {
+            return key;
+        }
+        fd = open(file_name.c_str(), O_RDONLY | O_CLOEXEC);
+    }
+
+    bool read_key = fd != -1 &&
+        read(fd, &key[0], key.size()) == (ssize_t)key.size();
+    if (fd != -1) {
+        close(fd);
+    }
+    if (!read_key) {
+        cout << "Failed to read the key from " << file_name << "\nExiting\n";
+        exit(EXIT_OPEN_FAILED);
+    }
+    return key;
+}
+
+bool Bank::extractColumns(const char* record, int64_t &balance,
+    string &name) {
+    AccountFields fields;
+    memcpy(&fields, record, sizeof(fields));
+    if (fields.id == 0) {
+        return false;
+    }
+    fields.name[sizeof(fields.name) - 1] = '\0';
+    balance = fields.balance;
+    name = normalizeName(fields.name);
+    return true;
+}
+
+Bank::Shard::Shard(const string &ra_file_name, size_t index) :
+    Shard(ra_file_name, index, loadKey(ra_file_name)) {
+}
+
+Bank::Shard::Shard(const string &ra_file_name, size_t index,
+    const string &key) :
+    index(index),
+    columns(ra_file_name + ".col", extractColumns, key),
+    raf(ra_file_name, unique_ptr<Bank::Account>(new Bank::Account()),
+    rafOptions(&columns, key)),
+    names(ra_file_name + ".idx") {
+    ral::Cipher(key).deriveKey(NAME_KEY_PURPOSE, name_secret);
+}
+
+Bank::Bank(string ra_file_name) : Bank(vector<string>(1, ra_file_name)) {
+}
+
+Bank::Bank(const vector<string> &shard_file_names) : next_shard(0),
+    halted(false) {
+    if (shard_file_names.empty() || shard_file_names.size() > MAX_SHARDS) {
+        cout << "A bank has 1 to " << MAX_SHARDS << " shards\nExiting\n";
+        exit(EXIT_OPEN_FAILED);
+    }
+    for (size_t i = 0; i < shard_file_names.size(); i++) {
+        shards.emplace_back(new Shard(shard_file_names[i], i));
+        workers.push_back(&shards.back()->worker);
+    }
+
+    // the shards check (& rebuild) their indexes at once; the first failure
+    // stops the bank
+    vector<const char*> failures(shards.size(), nullptr);
+    forEachShard([&](Shard &shard) {
+        const char* &failure = failures[shard.index];
+        size_t count = shard.raf.getRecordCount();
+        if (!shard.names.isOpen()) {
+            failure = "Failed to open the name index";
+        }
+        else if (!shard.names.isCurrent(count) && !rebuildNameIndex(shard)) {
+            failure = "Failed to rebuild the name index";
+        }
+        else if (!shard.columns.isOpen()) {
+            failure = "Failed to open the column store";
+        }
+        else if (!shard.columns.isCurrent(count) && !rebuildColumns(shard)) {
+            failure = "Failed to rebuild the column store";
+        }
+    });
+    for (const char* failure : failures) {
+        if (failure != nullptr) {
+            cout << failure << "\nExiting\n";
+            exit(EXIT_OPEN_FAILED);
+        }
+    }
+
+    // transfers across shards a crash interrupted are finished (see
+    // transactAccounts)
+    if (shards.size() > 1) {
+        size_t finished = 0;
+        uint64_t last = 0;
+        intents.reset(new ral::IntentLog(shard_file_names[0] + ".intents",
+            [&](uint64_t transaction, const string &part) {
+                finished += transaction != last;
+                last = transaction;
+                return redoPart(part);
+            }));
+        if (!intents->isOpen()) {
+            cout << "Failed to open the transfer log\nExiting\n";
+            exit(EXIT_OPEN_FAILED);
+        }
+        if (finished > 0) {
+            cout << "Finished " << finished << " interrupted transfers\n";
+        }
+    }
+}
+
+size_t Bank::getShardCount() {
+    return shards.size();
+}
+
+bool Bank::isHalted() {
+    return halted;
+}
+
+int Bank::rafId(int id) {
+    return id - id % (int)MAX_SHARDS;
+}
+
+Bank::Shard* Bank::findShard(int id) {
+    if (id <= 0 || (size_t)id % MAX_SHARDS >= shards.size()) {
+        return nullptr;
+    }
+    Shard* shard = shards[id % MAX_SHARDS].get();
+    return shard->raf.validId(rafId(id)) ? shard : nullptr;
+}
+
+void Bank::forEachShard(const function<void(Shard &shard)> &task) {
+    if (shards.size() == 1) {
+        task(*shards[0]);
+        return;
+    }
+    ral::Worker::runAll(workers, [&](size_t i) {
+        task(*shards[i]);
+    });
+}
+
+string Bank::normalizeName(const string &name) {
+    string normalized;
+    bool space = false;
+    for (char c : name) {
+        if (isspace((unsigned char)c)) {
+            space = !normalized.empty();
+            continue;
+        }
+        if (space) {
+            normalized += ' ';
+            space = false;
+        }
+        normalized += tolower((unsigned char)c);
+    }
+    return normalized;
+}
+
+uint64_t Bank::nameKey(const Shard &shard, const string &name) {
+    return ral::sipHash(name.data(), name.size(), shard.name_secret);
+}
+
+bool Bank::scanAccounts(Shard &shard,
+    const function<bool(const Account &account)> &visit) {
+    vector<int> ids;
+    shard.raf.getUsedIds(ids);
+
+    // read the accounts a batch at a time
+    const size_t BATCH = 4096;
+    vector<Account> accounts(BATCH);
+    vector<ral::Record*> records;
+    for (Account &account : accounts) {
+        records.push_back(&account);
+    }
+    for (size_t first = 0; first < ids.size(); first += BATCH) {
+        size_t count = min(BATCH, ids.size() - first);
+        vector<int> batch(ids.begin() + first, ids.begin() + first + count);
+        records.resize(count);
+        if (!shard.raf.getRecords(batch, records)) {
+            return false;
+        }
+        for (size_t i = 0; i < count; i++) {
+            if (accounts[i].id != 0) {
+                if (!visit(accounts[i])) {
+                    return false;
+                }
+                continue;
+            }
+
+            // an id is left without an account by a crash while opening
+            // one (see fsck), so it's released
+            Account account;
+            account.id = batch[i] + (int)shard.index;
+            if (!shard.raf.deleteRecord(&account)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool Bank::rebuildNameIndex(Shard &shard) {
+    if (!shard.names.clear(shard.raf.getRecordCount())) {
+        return false;
+    }
+    return scanAccounts(shard, [&](const Account &account) {
+        return shard.names.insert(
+            nameKey(shard, normalizeName(account.name)), account.id);
+    });
+}
+
+bool Bank::rebuildColumns(Shard &shard) {
+    if (!shard.columns.clear(shard.raf.getCapacity())) {
+        return false;
+    }
+    size_t rows = 0;
+    return scanAccounts(shard, [&](const Account &account) {
+        shard.columns.update(rafId(account.id), (const char*)
+            static_cast<const AccountFields*>(&account));
+        rows++;
+        return true;
+    }) && shard.columns.getCount() == rows;
+}
+
+bool Bank::findAccounts(const string &name, vector<int> &ids) {
+    string normalized = normalizeName(name);
+    vector<int> candidates;
+    for (unique_ptr<Shard> &shard : shards) {
+        shard->names.find(nameKey(*shard, normalized), candidates);
+    }
+
+    // different names can share a key, so check each account
+    Bank::Account account;
+    bool found = false;
+    for (int id : candidates) {
+        if (loadAccount(id, account) &&
+            normalizeName(account.name) == normalized) {
+            ids.push_back(id);
+            found = true;
+        }
+    }
+    return found;
+}
+
+ral::ColumnFilter Bank::balanceFilter(int64_t min_balance,
+    int64_t max_balance, const string &name_prefix) {
+    ral::ColumnFilter filter;
+    filter.min_value = min_balance;
+    filter.max_value = max_balance;
+    filter.name_prefix = normalizeName(name_prefix);
+    return filter;
+}
+
+ral::ColumnSummary Bank::summarizeBalances(int64_t min_balance,
+    int64_t max_balance, const string &name_prefix) {
+    ral::StatTimer timer(STAT_SUMMARIZE_BALANCES);
+    ral::ColumnFilter filter = balanceFilter(min_balance, max_balance,
+        name_prefix);
+    vector<ral::ColumnSummary> summaries(shards.size());
+    forEachShard([&](Shard &shard) {
+        summaries[shard.index] = shard.columns.summarize(filter);
+    });
+
+    ral::ColumnSummary total;
+    for (const ral::ColumnSummary &summary : summaries) {
+        if (summary.count == 0) {
+            continue;
+        }
+        total.min = total.count == 0 ? summary.min :
+            min(total.min, summary.min);
+        total.max = total.count == 0 ? summary.max :
+            max(total.max, summary.max);
+        total.count += summary.count;
+        total.sum += summary.sum;
+    }
+    return total;
+}
+
+void Bank::selectAccounts(int64_t min_balance, int64_t max_balance,
+    const string &name_prefix, vector<int> &ids) {
+    ral::StatTimer timer(STAT_SELECT_ACCOUNTS);
+    ral::ColumnFilter filter = balanceFilter(min_balance, max_balance,
+        name_prefix);
+    vector<vector<int>> selected(shards.size());
+    forEachShard([&](Shard &shard) {
+        shard.columns.select(filter, selected[shard.index]);
+    });
+
+    // the columns hold raf ids
+    size_t first = ids.size();
+    for (size_t i = 0; i < shards.size(); i++) {
+        for (int raf_id : selected[i]) {
+            ids.push_back(raf_id + (int)i);
+        }
+    }
+    sort(ids.begin() + first, ids.end());
+}
+
+void Bank::topBalances(int64_t min_balance, int64_t max_balance,
+    const string &name_prefix, size_t k, bool largest,
+    vector<pair<int, int64_t>> &accounts) {
+    ral::StatTimer timer(STAT_TOP_BALANCES);
+    ral::ColumnFilter filter = balanceFilter(min_balance, max_balance,
+        name_prefix);
+    vector<vector<pair<int, int64_t>>> tops(shards.size());
+    forEachShard([&](Shard &shard) {
+        shard.columns.top(filter, k, largest, tops[shard.index]);
+    });
+
+    // the best k of every shard's best k, ranked like ColumnStore::top
+    vector<pair<int, int64_t>> ranked;
+    for (size_t i = 0; i < shards.size(); i++) {
+        for (const pair<int, int64_t> &account : tops[i]) {
+            ranked.push_back({ account.first + (int)i, account.second });
+        }
+    }
+    sort(ranked.begin(), ranked.end(),
+        [largest](const pair<int, int64_t> &a, const pair<int, int64_t> &b) {
+            if (a.second != b.second) {
+                return largest ? a.second > b.second : a.second < b.second;
+            }
+            return a.first < b.first;
+        });
+    accounts.insert(accounts.end(), ranked.begin(),
+        ranked.begin() + min(k, ranked.size()));
+}
+
+bool Bank::login() {
+    int id;
+    if (!get(id, "Enter your id (0 to find it by name): ")) {
+        cout << "Failed to get id\n";
+        return false;
+    }
+    Bank::Account login;
+
+    if (!login.setName()){
+        return false;
+    }
+
+    if (id == 0) {
+        vector<int> ids;
+        if (!findAccounts(login.name, ids)) {
+            cout << "Invalid login\n";
+            return false;
+        }
+        if (ids.size() > 1 && !get(id, "More than one account has that name. "
+            "Enter your id: ")) {
+            cout << "Failed to get id\n";
+            return false;
+        }
+        if (ids.size() == 1) {
+            id = ids[0];
+        }
+    }
+    login.id = id;
+
+    current_account = unique_ptr<Bank::Account>(new Account());
+    Shard* shard = findShard(id);
+    if (shard == nullptr ||
+        !shard->raf.getRecord(rafId(id), current_account.get())) {
+        cout << "Invalid login\n";
+        return false;
+    }
+
+    if (normalizeName(login.name) != normalizeName(current_account->name)) {
+        cout << "Invalid login\n";
+        return false;
+    }
+
+    displayBalance();
+    return true;
+}
+
+bool Bank::createAccount() {
+    // the account goes to the next shard in turn with room for it
+    Shard* shard = nullptr;
+    int id = -1;
+    for (size_t i = 0; i < shards.size() && id == -1; i++) {
+        shard = shards[next_shard++ % shards.size()].get();
+        id = shard->raf.getNextAvailableId();
+    }
+    if (id == -1) {
+        // TODO: display msg here instead of from raf
+        return false;
+    }
+    id += (int)shard->index;
+    current_account = unique_ptr<Bank::Account>(new Bank::Account());
+    current_account->id = id;
+
+    if (!current_account->setName()){
+        return false;
+    }
+
+    current_account->deposit("Enter opening deposit amount: ");
+
+    if (!shard->raf.createRecord(current_account.get())) {
+        cout << "Failed to create account\n";
+        return false;
+    }
+    if (!shard->names.insert(
+        nameKey(*shard, normalizeName(current_account->name)), id)) {
+        cout << "Failed to index account name\n";
+    }
+    
+    cout << "Your id is: " << current_account->id << endl;
+    displayBalance();
+    return true;
+}
+
+bool Bank::closeAccount() {
+    cout << "This is the account you are about to close:\n" // display record
+        << current_account->id << " " << current_account->name << endl;
+    displayBalance();
+
+    char confirm;
+    if (!get(confirm, 'n',
+        "Are you sure you want to close this account (y/n)? ")) {
+        cout << "Error with input\n";
+    }
+
+    Shard* shard = findShard(current_account->id);
+    bool closed = false;
+    if (confirm == 'y' && shard != nullptr) {
+        closed = shard->raf.deleteRecord(current_account.get());
+    }
+
+    if (closed) {
+        shard->names.erase(
+            nameKey(*shard, normalizeName(current_account->name)),
+            current_account->id);
+        current_account->reset();
+        return true;
+    }
+
+    cout << "Your account was not closed\n";
+    return false;
+}
+
+void Bank::displayBalance() {
+    cout << "Your balance is: $" << formatCents(current_account->balance)
+        << endl;
+}
+
+void Bank::adjustBalance(bool is_deposit) {
+    bool failed = true;
+
+    if (is_deposit) {
+        failed = current_account->deposit();
+    }
+    else {
+        failed = current_account->withdraw();
+    }
+
+    Shard* shard = findShard(current_account->id);
+    if (failed && shard != nullptr) {
+        shard->raf.updateRecord(current_account.get());
+        displayBalance();
+    }
+}
+
+bool Bank::loadAccount(int id, Account &account) {
+    // a closed account's slot holds the dummy account (id 0)
+    Shard* shard = findShard(id);
+    return shard != nullptr && shard->raf.getRecord(rafId(id), &account) &&
+        account.id == id;
+}
+
+bool Bank::viewAccount(int id, Account &account) {
+    // read through a view, so a login never waits for a teller's write
+    Shard* shard = findShard(id);
+    if (shard == nullptr) {
+        return false;
+    }
+    uint64_t view = shard->raf.beginRead();
+    bool read = shard->raf.getRecordAt(view, rafId(id), &account);
+    shard->raf.endRead(view);
+    return read && account.id == id;
+}
+
+bool Bank::viewAccounts(const vector<uint64_t> &views, const vector<int> &ids,
+    vector<Account> &accounts) {
+    // each shard reads its accounts in one batch
+    accounts.resize(ids.size());
+    vector<vector<int>> raf_ids(shards.size());
+    vector<vector<ral::Record*>> records(shards.size());
+    for (size_t i = 0; i < ids.size(); i++) {
+        size_t shard = ids[i] % MAX_SHARDS;
+        raf_ids[shard].push_back(rafId(ids[i]));
+        records[shard].push_back(&accounts[i]);
+    }
+    for (size_t i = 0; i < shards.size(); i++) {
+        if (!raf_ids[i].empty() && !shards[i]->raf.getRecordsAt(views[i],
+            raf_ids[i], records[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void Bank::beginReads(vector<uint64_t> &views) {
+    // a transfer across shards holds cut_lock while it writes, so taking it
+    // puts every transfer wholly in or out of the views
+    unique_lock<shared_mutex> cut_guard(cut_lock);
+    views.clear();
+    for (unique_ptr<Shard> &shard : shards) {
+        views.push_back(shard->raf.beginRead());
+    }
+}
+
+void Bank::endReads(const vector<uint64_t> &views) {
+    for (size_t i = 0; i < shards.size(); i++) {
+        shards[i]->raf.endRead(views[i]);
+    }
+}
+
+Bank::Result Bank::openAccount(const string &name, int64_t deposit, int &id,
+    int64_t &balance) {
+    // the account goes to the next shard in turn with room for it
+    Result result = Result::no_room;
+    for (size_t i = 0; i < shards.size() && result == Result::no_room; i++) {
+        result = openAccount(*shards[next_shard++ % shards.size()], name,
+            deposit, id, balance);
+    }
+    return result;
+}
+
+Bank::Result Bank::openAccount(Shard &shard, const string &name,
+    int64_t deposit, int &id, int64_t &balance) {
+    ral::StatTimer timer(STAT_OPEN_ACCOUNT);
+    if (halted) {
+        return finish(timer, Result::failed);
+    }
+    if (name.length() + 1 > Account::MAX_NAME_SIZE) {
+        return finish(timer, Result::name_too_long);
+    }
+
+    Account account;
+    account.id = shard.raf.getNextAvailableId();
+    if (account.id == -1) {
+        return finish(timer, Result::no_room);
+    }
+    account.id += (int)shard.index;
+    strcpy(account.name, name.c_str());
+    if (deposit != 0) {
+        Result result = account.credit(deposit);
+        if (result != Result::ok) {
+            return finish(timer, result);
+        }
+    }
+
+    if (!shard.raf.createRecord(&account)) {
+        return finish(timer, Result::failed);
+    }
+    shard.names.insert(nameKey(shard, normalizeName(account.name)),
+        account.id);
+
+    id = account.id;
+    balance = account.balance;
+    return finish(timer, Result::ok);
+}
+
+Bank::Result Bank::checkLogin(int id, const string &name,
+    int64_t &balance) {
+    ral::StatTimer timer(STAT_CHECK_LOGIN);
+    Account account;
+    if (!viewAccount(id, account) ||
+        normalizeName(name) != normalizeName(account.name)) {
+        return finish(timer, Result::invalid_login);
+    }
+    balance = account.balance;
+    return finish(timer, Result::ok);
+}
+
+Bank::Result Bank::getBalance(int id, int64_t &balance) {
+    ral::StatTimer timer(STAT_GET_BALANCE);
+    Account account;
+    if (!viewAccount(id, account)) {
+        return finish(timer, Result::invalid_login);
+    }
+    balance = account.balance;
+    return finish(timer, Result::ok);
+}
+
+Bank::Result Bank::getBalances(const vector<int> &ids,
+    vector<int64_t> &balances) {
+    ral::StatTimer timer(STAT_GET_BALANCES);
+    balances.clear();
+    for (int id : ids) {
+        if (findShard(id) == nullptr) {
+            return finish(timer, Result::invalid_login);
+        }
+    }
+
+    vector<uint64_t> views;
+    beginReads(views);
+    vector<Account> accounts;
+    bool read = viewAccounts(views, ids, accounts);
+    endReads(views);
+    if (!read) {
+        return finish(timer, Result::failed);
+    }
+    for (size_t i = 0; i < ids.size(); i++) {
+        // a closed account's slot holds the dummy account (id 0)
+        if (accounts[i].id != ids[i]) {
+            balances.clear();
+            return finish(timer, Result::invalid_login);
+        }
+        balances.push_back(accounts[i].balance);
+    }
+    return finish(timer, Result::ok);
+}
+
+Bank::Result Bank::auditBook(int64_t &total, size_t &accounts) {
+    ral::StatTimer timer(STAT_AUDIT_BOOK);
+    total = 0;
+    accounts = 0;
+
+    // the ids in use aren't versioned, so those listed on either side of
+    // the views' start are read; ids closed at the view read as id 0
+    vector<vector<int>> ids(shards.size());
+    for (size_t i = 0; i < shards.size(); i++) {
+        shards[i]->raf.getUsedIds(ids[i]);
+    }
+    vector<uint64_t> views;
+    beginReads(views);
+
+    vector<int64_t> totals(shards.size(), 0);
+    vector<size_t> counts(shards.size(), 0);
+    vector<uint8_t> read(shards.size(), true);
+    forEachShard([&](Shard &shard) {
+        vector<int> &raf_ids = ids[shard.index];
+        vector<int> later_ids;
+        shard.raf.getUsedIds(later_ids);
+        raf_ids.insert(raf_ids.end(), later_ids.begin(), later_ids.end());
+        sort(raf_ids.begin(), raf_ids.end());
+        raf_ids.erase(unique(raf_ids.begin(), raf_ids.end()), raf_ids.end());
+
+        const size_t BATCH = 4096;
+        vector<Account> batch_accounts(BATCH);
+        vector<ral::Record*> records;
+        for (Account &account : batch_accounts) {
+            records.push_back(&account);
+        }
+        for (size_t first = 0; first < raf_ids.size(); first += BATCH) {
+            size_t count = min(BATCH, raf_ids.size() - first);
+            vector<int> batch(raf_ids.begin() + first,
+                raf_ids.begin() + first + count);
+            records.resize(count);
+            if (!shard.raf.getRecordsAt(views[shard.index], batch, records)) {
+                read[shard.index] = false;
+                return;
+            }
+            for (size_t i = 0; i < count; i++) {
+                if (batch_accounts[i].id == batch[i] + (int)shard.index) {
+                    totals[shard.index] += batch_accounts[i].balance;
+                    counts[shard.index]++;
+                }
+            }
+        }
+    });
+    endReads(views);
+
+    bool read_all = true;
+    for (size_t i = 0; i < shards.size(); i++) {
+        total += totals[i];
+        accounts += counts[i];
+        read_all = read_all && read[i];
+    }
+    return finish(timer, read_all ? Result::ok : Result::failed);
+}
+
+Bank::Result Bank::deposit(int id, int64_t amount, int64_t &balance) {
+    ral::StatTimer timer(STAT_DEPOSIT);
+    if (halted) {
+        return finish(timer, Result::failed);
+    }
+    Account account;
+    if (!loadAccount(id, account)) {
+        return finish(timer, Result::invalid_login);
+    }
+    Result result = account.credit(amount);
+    if (result == Result::ok) {
+        findShard(id)->raf.updateRecord(&account);
+    }
+    balance = account.balance;
+    return finish(timer, result);
+}
+
+Bank::Result Bank::withdraw(int id, int64_t amount, int64_t &balance) {
+    ral::StatTimer timer(STAT_WITHDRAW);
+    if (halted) {
+        return finish(timer, Result::failed);
+    }
+    Account account;
+    if (!loadAccount(id, account)) {
+        return finish(timer, Result::invalid_login);
+    }
+    Result result = account.debit(amount);
+    if (result == Result::ok) {
+        findShard(id)->raf.updateRecord(&account);
+    }
+    balance = account.balance;
+    return finish(timer, result);
+}
+
+Bank::Result Bank::transfer(int from_id, int to_id, int64_t amount,
+    int64_t &balance) {
+    return transfer(from_id, vector<Payment>(1, { to_id, amount }), balance);
+}
+
+Bank::Result Bank::transfer(int from_id, const vector<Payment> &payments,
+    int64_t &balance) {
+    ral::StatTimer timer(STAT_TRANSFER);
+    balance = 0;
+    if (findShard(from_id) == nullptr) {
+        return finish(timer, Result::invalid_login);
+    }
+    if (payments.empty()) {
+        return finish(timer, Result::invalid_amount);
+    }
+
+    // every account is read & written once, however many payments it gets
+    vector<int> ids(1, from_id);
+    unordered_map<int, size_t> slots = { { from_id, 0 } }; // id -> account
+    int64_t total = 0;
+    for (const Payment &payment : payments) {
+        if (findShard(payment.id) == nullptr) {
+            return finish(timer, Result::invalid_login);
+        }
+        if (payment.amount <= 0) {
+            return finish(timer, Result::invalid_amount);
+        }
+        if (payment.amount > numeric_limits<int64_t>::max() - total) {
+            return finish(timer, Result::too_much_money);
+        }
+        total += payment.amount;
+        if (slots.emplace(payment.id, ids.size()).second) {
+            ids.push_back(payment.id);
+        }
+    }
+    vector<Account> accounts(ids.size());
+
+    Result result = Result::ok;
+    bool done = transactAccounts(ids, accounts, [&]() {
+        // a closed account's slot holds the dummy account (id 0)
+        balance = accounts[0].balance;
+        for (size_t i = 0; i < ids.size(); i++) {
+            if (accounts[i].id != ids[i]) {
+                result = Result::invalid_login;
+                return false;
+            }
+        }
+        result = accounts[0].debit(total);
+        for (size_t i = 0; result == Result::ok && i < payments.size();
+            i++) {
+            result = accounts[slots[payments[i].id]].credit(
+                payments[i].amount);
+        }
+        if (result != Result::ok) {
+            return false;
+        }
+        balance = accounts[0].balance;
+        return true;
+    });
+    return finish(timer, done ? result : Result::failed);
+}
+
+bool Bank::transactAccounts(const vector<int> &ids, vector<Account> &accounts,
+    const function<bool()> &change) {
+    // the shards involved, in order, & the accounts of each
+    vector<size_t> involved;
+    vector<vector<int>> raf_ids(shards.size());
+    vector<vector<ral::Record*>> records(shards.size());
+    for (size_t i = 0; i < ids.size(); i++) {
+        size_t shard = ids[i] % MAX_SHARDS;
+        if (raf_ids[shard].empty()) {
+            involved.push_back(shard);
+        }
+        raf_ids[shard].push_back(rafId(ids[i]));
+        records[shard].push_back(&accounts[i]);
+    }
+    sort(involved.begin(), involved.end());
+    if (halted) {
+        return false;
+    }
+    shared_lock<shared_mutex> cut_guard;
+    if (involved.size() > 1) {
+        cut_guard = shared_lock<shared_mutex>(cut_lock);
+    }
+
+    // each shard's transaction runs the next one's inside its change, so
+    // the innermost sees every account & the writes unwind outward. Across
+    // shards that's a two-phase commit: with every account locked & read,
+    // the innermost writes the transfer's intent, & each shard marks its
+    // part done before it lets go of its accounts. Once the intent is
+    // written the transfer must happen, so a shard that can't commit its
+    // part halts the bank (which redoes the part when next opened).
+    bool failed = false;
+    uint64_t transaction = 0;
+    function<bool(size_t)> transact = [&](size_t level) {
+        if (level == involved.size()) {
+            if (!change()) {
+                return false;
+            }
+            if (involved.size() > 1) {
+                vector<string> parts;
+                for (size_t shard : involved) {
+                    parts.push_back(encodePart(shard, records[shard]));
+                }
+                transaction = intents->begin(parts);
+                if (transaction == 0) {
+                    // nothing is written, but the intent may be in the log
+                    halt("Writing the transfer log failed");
+                    failed = true;
+                    return false;
+                }
+            }
+            return true;
+        }
+        size_t shard = involved[level];
+        bool changed = false;
+        function<bool()> inner = [&]() {
+            changed = transact(level + 1) && !failed;
+            return changed;
+        };
+        bool done = involved.size() == 1 ?
+            shards[shard]->raf.transactRecords(raf_ids[shard],
+            records[shard], inner) :
+            shards[shard]->raf.transactRecords(raf_ids[shard],
+            records[shard], inner, ral::Sync::data, [&](bool committed) {
+                if (!committed || !intents->commitPart(transaction, level)) {
+                    halt("Committing a transfer failed");
+                    failed = true;
+                }
+            });
+        if (!done) {
+            failed = true;
+        }
+        return changed && !failed;
+    };
+    transact(0);
+    return !failed;
+}
+
+void Bank::halt(const char* reason) {
+    cout << reason << "; no account is written until the bank is reopened\n";
+    halted = true;
+}
+
+string Bank::encodePart(size_t shard, const vector<ral::Record*> &records) {
+    // the shard's index, then its accounts as the raf encodes them
+    uint32_t index = shard;
+    string part((const char*)&index, sizeof(index));
+    for (ral::Record* record : records) {
+        size_t end = part.size();
+        part.resize(end + record->getSize());
+        record->encode(&part[end]);
+    }
+    return part;
+}
+
+bool Bank::redoPart(const string &part) {
+    uint32_t index;
+    size_t size = Account().getSize();
+    if (part.size() < sizeof(index) ||
+        (part.size() - sizeof(index)) % size != 0) {
+        return false;
+    }
+    memcpy(&index, part.data(), sizeof(index));
+    if (index >= shards.size()) {
+        return false;
+    }
+    vector<Account> accounts((part.size() - sizeof(index)) / size);
+    vector<ral::Record*> records;
+    for (size_t i = 0; i < accounts.size(); i++) {
+        if (!accounts[i].decode(&part[sizeof(index) + i * size])) {
+            return false;
+        }
+        records.push_back(&accounts[i]);
+    }
+    return shards[index]->raf.updateRecords(records, ral::Sync::data);
+}
+
+Bank::Result Bank::closeAccount(int id) {
+    ral::StatTimer timer(STAT_CLOSE_ACCOUNT);
+    if (halted) {
+        return finish(timer, Result::failed);
+    }
+    Account account;
+    if (!loadAccount(id, account)) {
+        return finish(timer, Result::invalid_login);
+    }
+    Shard* shard = findShard(id);
+    if (!shard->raf.deleteRecord(&account)) {
+        return finish(timer, Result::failed);
+    }
+    shard->names.erase(nameKey(*shard, normalizeName(account.name)), id);
+    return finish(timer, Result::ok);
+}
+
+void Bank::applyTransactions(vector<Transaction> &transactions) {
+    ral::StatTimer timer(STAT_APPLY_TRANSACTIONS);
+    if (shards.size() == 1) {
+        applyShardTransactions(*shards[0], transactions);
+        return;
+    }
+
+    // each shard gets its accounts' transactions, in order, & new accounts
+    // are dealt out in turn; an id no shard has is rejected here
+    vector<vector<Transaction>> parts(shards.size());
+    vector<pair<size_t, size_t>> placed(transactions.size()); // shard, index
+    for (size_t i = 0; i < transactions.size(); i++) {
+        Transaction &transaction = transactions[i];
+        bool create = transaction.op == Transaction::Op::create;
+        if (!create && findShard(transaction.id) == nullptr) {
+            transaction.result = Result::invalid_login;
+            transaction.balance = 0;
+            placed[i] = { shards.size(), 0 };
+            continue;
+        }
+        size_t shard = create ? next_shard++ % shards.size() :
+            (size_t)transaction.id % MAX_SHARDS;
+        parts[shard].push_back(transaction);
+        placed[i] = { shard, parts[shard].size() - 1 };
+    }
+    forEachShard([&](Shard &shard) {
+        applyShardTransactions(shard, parts[shard.index]);
+    });
+
+    for (size_t i = 0; i < transactions.size(); i++) {
+        if (placed[i].first < shards.size()) {
+            const Transaction &applied =
+                parts[placed[i].first][placed[i].second];
+            transactions[i].id = applied.id;
+            transactions[i].result = applied.result;
+            transactions[i].balance = applied.balance;
+        }
+    }
+}
+
+void Bank::applyShardTransactions(Shard &shard,
+    vector<Transaction> &transactions) {
+    // read every existing account the batch names in one pass
+    vector<int> ids, raf_ids;
+    unordered_map<int, size_t> slots; // id -> index into accounts
+    for (const Transaction &transaction : transactions) {
+        if (transaction.op != Transaction::Op::create &&
+            findShard(transaction.id) == &shard &&
+            slots.emplace(transaction.id, ids.size()).second) {
+            ids.push_back(transaction.id);
+            raf_ids.push_back(rafId(transaction.id));
+        }
+    }
+    vector<Account> accounts(ids.size());
+    vector<ral::Record*> records;
+    for (Account &account : accounts) {
+        records.push_back(&account);
+    }
+    if (halted || !shard.raf.getRecords(raf_ids, records)) {
+        for (Transaction &transaction : transactions) {
+            transaction.result = Result::failed;
+            transaction.balance = 0;
+        }
+        return;
+    }
+
+    // a closed account's slot holds the dummy account (id 0)
+    vector<bool> open(ids.size()), dirty(ids.size(), false);
+    for (size_t i = 0; i < ids.size(); i++) {
+        open[i] = accounts[i].id == ids[i];
+    }
+
+    for (Transaction &transaction : transactions) {
+        transaction.balance = 0;
+        if (transaction.op == Transaction::Op::create) {
+            int id;
+            transaction.result = openAccount(shard, string(transaction.name),
+                transaction.amount, id, transaction.balance);
+            if (transaction.result != Result::ok) {
+                continue;
+            }
+            transaction.id = id;
+
+            // the new account may reuse the id of one closed in this batch
+            Account account;
+            account.id = id;
+            strcpy(account.name, string(transaction.name).c_str());
+            account.balance = transaction.balance;
+            auto slot = slots.emplace(id, accounts.size());
+            if (slot.second) {
+                accounts.push_back(account);
+                open.push_back(true);
+                dirty.push_back(false);
+            }
+            else {
+                accounts[slot.first->second] = account;
+                open[slot.first->second] = true;
+                dirty[slot.first->second] = false;
+            }
+            continue;
+        }
+
+        auto slot = slots.find(transaction.id);
+        if (slot == slots.end() || !open[slot->second]) {
+            transaction.result = Result::invalid_login;
+            continue;
+        }
+        size_t i = slot->second;
+        Account &account = accounts[i];
+        switch (transaction.op) {
+            case Transaction::Op::deposit:
+                transaction.result = account.credit(transaction.amount);
+                break;
+            case Transaction::Op::withdraw:
+                transaction.result = account.debit(transaction.amount);
+                break;
+            default:
+                transaction.result = closeAccount(transaction.id);
+                if (transaction.result == Result::ok) {
+                    open[i] = false;
+                    dirty[i] = false;
+                    continue;
+                }
+                break;
+        }
+        dirty[i] = dirty[i] || transaction.result == Result::ok;
+        transaction.balance = account.balance;
+    }
+
+    // write each changed account once
+    records.clear();
+    for (size_t i = 0; i < accounts.size(); i++) {
+        if (dirty[i]) {
+            records.push_back(&accounts[i]);
+        }
+    }
+    if (!records.empty() && !shard.raf.updateRecords(records)) {
+        for (Transaction &transaction : transactions) {
+            if (transaction.op != Transaction::Op::create &&
+                transaction.op != Transaction::Op::close) {
+                transaction.result = Result::failed;
+            }
+        }
+    }
+}
+
+size_t Bank::postBalances(int64_t* balances, const Posting* postings,
+    size_t count, Result* results) {
+    size_t applied = 0;
+    for (size_t i = 0; i < count; i++) {
+        int64_t balance = balances[postings[i].slot];
+        int64_t updated;
+        bool overflow = __builtin_add_overflow(balance, postings[i].delta,
+            &updated);
+        bool ok = !overflow & (updated >= 0);
+
+        // selects rather than branches, so a rejected posting costs the same
+        // as an applied one
+        balances[postings[i].slot] = ok ? updated : balance;
+        results[i] = ok ? Result::ok : overflow ? Result::too_much_money :
+            Result::insufficient_funds;
+        applied += ok;
+    }
+    return applied;
+}
+
+bool Bank::postInterest(int64_t rate, int64_t fee, size_t &posted,
+    size_t &rejected) {
+    ral::StatTimer timer(STAT_POST_INTEREST);
+    posted = 0;
+    rejected = 0;
+    if (rate < 0 || fee < 0 || halted) {
+        return timer.check(false);
+    }
+
+    vector<size_t> shard_posted(shards.size(), 0);
+    vector<size_t> shard_rejected(shards.size(), 0);
+    vector<uint8_t> succeeded(shards.size(), true);
+    forEachShard([&](Shard &shard) {
+        vector<int> ids;
+        shard.raf.getUsedIds(ids);
+
+        const size_t BATCH = 64 * 1024;
+        vector<Account> accounts(min(BATCH, ids.size()));
+        vector<ral::Record*> records, changed;
+        for (Account &account : accounts) {
+            records.push_back(&account);
+        }
+        vector<int64_t> balances(accounts.size());
+        vector<Posting> postings(accounts.size());
+        vector<Result> results(accounts.size());
+        for (size_t first = 0; first < ids.size(); first += BATCH) {
+            size_t count = min(BATCH, ids.size() - first);
+            vector<int> batch(ids.begin() + first,
+                ids.begin() + first + count);
+            records.resize(count);
+            if (!shard.raf.getRecords(batch, records)) {
+                succeeded[shard.index] = false;
+                return;
+            }
+
+            // the balances are copied out so the posting loops run over
+            // contiguous int64_ts instead of whole accounts
+            for (size_t i = 0; i < count; i++) {
+                balances[i] = accounts[i].balance;
+            }
+            for (size_t i = 0; i < count; i++) {
+                __int128 delta = (__int128)balances[i] * rate / 10000 - fee;
+                postings[i].slot = i;
+                postings[i].delta = delta > numeric_limits<int64_t>::max() ?
+                    numeric_limits<int64_t>::max() : (int64_t)delta;
+            }
+            postBalances(balances.data(), postings.data(), count,
+                results.data());
+
+            changed.clear();
+            for (size_t i = 0; i < count; i++) {
+                if (balances[i] != accounts[i].balance) {
+                    accounts[i].balance = balances[i];
+                    changed.push_back(&accounts[i]);
+                }
+                shard_rejected[shard.index] += results[i] != Result::ok;
+            }
+            if (!changed.empty() && !shard.raf.updateRecords(changed)) {
+                succeeded[shard.index] = false;
+                return;
+            }
+            shard_posted[shard.index] += changed.size();
+        }
+    });
+
+    bool posted_all = true;
+    for (size_t i = 0; i < shards.size(); i++) {
+        posted += shard_posted[i];
+        rejected += shard_rejected[i];
+        posted_all = posted_all && succeeded[i];
+    }
+    return timer.check(posted_all);
+}
+
+void Bank::setDeferredSync(bool deferred) {
+    for (unique_ptr<Shard> &shard : shards) {
+        shard->raf.setSyncPolicy(deferred ? ral::Sync::none :
+            ral::Sync::data);
+    }
+}
+
+bool Bank::sync() {
+    ral::StatTimer timer(STAT_SYNC);
+    vector<uint8_t> synced(shards.size(), false);
+    forEachShard([&](Shard &shard) {
+        synced[shard.index] = shard.raf.sync(ral::Sync::data);
+    });
+    return timer.check(find(synced.begin(), synced.end(), false) ==
+        synced.end());
+}
+
+bool Bank::beginBackup(const string &file_name) {
+    // the cuts are taken together, so no transfer across shards is half
+    // in the backup
+    unique_lock<shared_mutex> cut_guard(cut_lock);
+    for (size_t i = 0; i < shards.size(); i++) {
+        string shard_file_name = shards.size() == 1 ? file_name :
+            file_name + "." + to_string(i);
+        if (!shards[i]->raf.beginSnapshot(shard_file_name)) {
+            ral::SnapshotReport report;
+            while (i-- > 0) {
+                shards[i]->raf.endSnapshot(report);
+            }
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Bank::isBackupRunning() {
+    for (unique_ptr<Shard> &shard : shards) {
+        if (shard->raf.isSnapshotRunning()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Bank::finishBackup() {
+    bool finished = true;
+    for (unique_ptr<Shard> &shard : shards) {
+        ral::SnapshotReport report;
+        if (!shard->raf.endSnapshot(report)) {
+            finished = false;
+            continue;
+        }
+        cout << "Backed up " << report.slots << " slots, " << report.copied
+            << (report.full ? " copied (full)\n" : " changed since the last "
+            "backup\n");
+    }
+    return finished;
+}
+
+bool Bank::checkAccounts(const string &ra_file_name, bool repair) {
+    // without the column store: only the raf is checked
+    ral::File raf(ra_file_name, unique_ptr<Account>(new Account()),
+        rafOptions(nullptr, loadKey(ra_file_name)));
+    ral::VerifyReport report;
+    if (!raf.verifyFile(report, repair)) {
+        cout << "Checking " << ra_file_name << " failed\n";
+        return false;
+    }
+
+    auto list = [](const string &what, const vector<int> &ids) {
+        if (ids.empty()) {
+            return;
+        }
+        cout << ids.size() << " " << what << ":";
+        for (int id : ids) {
+            cout << " " << id;
+        }
+        cout << "\n";
+    };
+    cout << report.slots << " slots checked, " << report.records
+        << " accounts\n";
+    list("corrupt slots", report.corrupt);
+    list("ids in use without an account", report.unwritten);
+    list("accounts with a free id", report.orphaned);
+    if (!repair) {
+        return report.corrupt.empty() && report.unwritten.empty() &&
+            report.orphaned.empty();
+    }
+
+    // an id is left without an account by a crash while opening one
+    size_t repaired = report.repaired;
+    for (int id : report.unwritten) {
+        Account account;
+        account.id = id;
+        repaired += raf.deleteRecord(&account);
+    }
+    cout << repaired << " repaired\n";
+    if (!raf.verifyFile(report) || !report.unwritten.empty()) {
+        return false;
+    }
+    list("accounts are corrupt & must be restored", report.corrupt);
+    return report.corrupt.empty();
+}
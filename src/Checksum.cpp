@@ -0,0 +1,209 @@
+// =============================================================================
+// File: Checksum.cpp
+// =============================================================================
+// Description:
+//      This file is the implementation of the checksum functions of the ral
+//      namespace. The SSE4.2 code is compiled for that instruction set only
+//      (target attribute) & only called when the CPU has it.
+// =============================================================================
+
+#include <cstring>
+#include "Checksum.h"
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#define CRC_HARDWARE 1
+#define HARDWARE_TARGET __attribute__((target("sse4.2")))
+#endif
+
+namespace {
+    // === Crc32cTable =========================================================
+    // Lookup table for the byte at a time crc, built once.
+    // =========================================================================
+    struct Crc32cTable {
+        uint32_t entries[256];
+
+        Crc32cTable() {
+            for (uint32_t i = 0; i < 256; i++) {
+                uint32_t crc = i;
+                for (int bit = 0; bit < 8; bit++) {
+                    crc = (crc >> 1) ^ (0x82F63B78 & (0 - (crc & 1)));
+                }
+                entries[i] = crc;
+            }
+        }
+    };
+
+    const Crc32cTable TABLE;
+
+    // ==== crcTable ===========================================================
+    // The crc of a buffer a byte at a time; crc is already inverted.
+    // =========================================================================
+    uint32_t crcTable(const uint8_t* bytes, size_t size, uint32_t crc) {
+        for (size_t i = 0; i < size; i++) {
+            crc = TABLE.entries[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+        }
+        return crc;
+    }
+
+#ifdef CRC_HARDWARE
+    // ==== crcHardware ========================================================
+    // The crc of a buffer 8 bytes per crc32 instruction; crc is already
+    // inverted.
+    // =========================================================================
+    HARDWARE_TARGET uint32_t crcHardware(const uint8_t* bytes, size_t size,
+        uint32_t crc) {
+        uint64_t crc64 = crc;
+        for (; size >= 8; bytes += 8, size -= 8) {
+            uint64_t word;
+            memcpy(&word, bytes, sizeof(word));
+            crc64 = _mm_crc32_u64(crc64, word);
+        }
+        crc = (uint32_t)crc64;
+        for (; size > 0; bytes++, size--) {
+            crc = _mm_crc32_u8(crc, *bytes);
+        }
+        return crc;
+    }
+
+    // initialized before main, so the CPU's features are read here first
+    bool hasHardware() {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("sse4.2");
+    }
+
+    const bool HARDWARE = hasHardware();
+
+    // ==== crcHardware4 =======================================================
+    // crcHardware of 4 buffers of the same size at once: crc32 takes 3
+    // cycles but starts one a cycle, so interleaving the buffers hides its
+    // latency.
+    // =========================================================================
+    HARDWARE_TARGET void crcHardware4(const uint8_t* const* buffers,
+        size_t size, uint32_t* crcs) {
+        uint64_t crc0 = crcs[0], crc1 = crcs[1], crc2 = crcs[2],
+            crc3 = crcs[3];
+        size_t offset = 0;
+        for (; offset + 8 <= size; offset += 8) {
+            uint64_t words[4];
+            memcpy(&words[0], buffers[0] + offset, 8);
+            memcpy(&words[1], buffers[1] + offset, 8);
+            memcpy(&words[2], buffers[2] + offset, 8);
+            memcpy(&words[3], buffers[3] + offset, 8);
+            crc0 = _mm_crc32_u64(crc0, words[0]);
+            crc1 = _mm_crc32_u64(crc1, words[1]);
+            crc2 = _mm_crc32_u64(crc2, words[2]);
+            crc3 = _mm_crc32_u64(crc3, words[3]);
+        }
+        crcs[0] = crcHardware(buffers[0] + offset, size - offset,
+            (uint32_t)crc0);
+        crcs[1] = crcHardware(buffers[1] + offset, size - offset,
+            (uint32_t)crc1);
+        crcs[2] = crcHardware(buffers[2] + offset, size - offset,
+            (uint32_t)crc2);
+        crcs[3] = crcHardware(buffers[3] + offset, size - offset,
+            (uint32_t)crc3);
+    }
+#else
+    const bool HARDWARE = false;
+#endif
+}
+
+uint32_t ral::crc32c(const void* data, size_t size, uint32_t crc /*= 0*/) {
+    const uint8_t* bytes = (const uint8_t*)data;
+#ifdef CRC_HARDWARE
+    if (HARDWARE) {
+        return ~crcHardware(bytes, size, ~crc);
+    }
+#endif
+    return ~crcTable(bytes, size, ~crc);
+}
+
+void ral::crc32cMany(const void* const* buffers, size_t size, size_t count,
+    uint32_t* crcs) {
+    const uint8_t* const* bytes = (const uint8_t* const*)buffers;
+    for (size_t i = 0; i < count; i++) {
+        crcs[i] = ~crcs[i];
+    }
+    size_t i = 0;
+#ifdef CRC_HARDWARE
+    if (HARDWARE) {
+        for (; i + 4 <= count; i += 4) {
+            crcHardware4(bytes + i, size, crcs + i);
+        }
+        for (; i < count; i++) {
+            crcs[i] = crcHardware(bytes[i], size, crcs[i]);
+        }
+    }
+#endif
+    for (; i < count; i++) {
+        crcs[i] = crcTable(bytes[i], size, crcs[i]);
+    }
+    for (size_t i = 0; i < count; i++) {
+        crcs[i] = ~crcs[i];
+    }
+}
+
+uint64_t ral::sipHash(const void* data, size_t size, const uint8_t* key) {
+    auto rotate = [](uint64_t x, int bits) {
+        return (x << bits) | (x >> (64 - bits));
+    };
+    uint64_t v[4];
+    auto round = [&]() {
+        v[0] += v[1];
+        v[1] = rotate(v[1], 13) ^ v[0];
+        v[0] = rotate(v[0], 32);
+        v[2] += v[3];
+        v[3] = rotate(v[3], 16) ^ v[2];
+        v[0] += v[3];
+        v[3] = rotate(v[3], 21) ^ v[0];
+        v[2] += v[1];
+        v[1] = rotate(v[1], 17) ^ v[2];
+        v[2] = rotate(v[2], 32);
+    };
+
+    uint64_t k0;
+    uint64_t k1;
+    memcpy(&k0, key, sizeof(k0));
+    memcpy(&k1, key + 8, sizeof(k1));
+    v[0] = k0 ^ 0x736f6d6570736575ull;
+    v[1] = k1 ^ 0x646f72616e646f6dull;
+    v[2] = k0 ^ 0x6c7967656e657261ull;
+    v[3] = k1 ^ 0x7465646279746573ull;
+
+    // 8 bytes (little endian) at a time, then the rest with the size in
+    // the last byte
+    const uint8_t* bytes = (const uint8_t*)data;
+    size_t left = size;
+    for (; left >= 8; bytes += 8, left -= 8) {
+        uint64_t word;
+        memcpy(&word, bytes, sizeof(word));
+        v[3] ^= word;
+        round();
+        round();
+        v[0] ^= word;
+    }
+    uint64_t last = (uint64_t)size << 56;
+    for (size_t i = 0; i < left; i++) {
+        last |= (uint64_t)bytes[i] << (8 * i);
+    }
+    v[3] ^= last;
+    round();
+    round();
+    v[0] ^= last;
+
+    v[2] ^= 0xff;
+    for (int i = 0; i < 4; i++) {
+        round();
+    }
+    return v[0] ^ v[1] ^ v[2] ^ v[3];
+}
+
+uint32_t ral::crc32cPortable(const void* data, size_t size,
+    uint32_t crc /*= 0*/) {
+    return ~crcTable((const uint8_t*)data, size, ~crc);
+}
+
+bool ral::crc32cHardware() {
+    return HARDWARE;
+}
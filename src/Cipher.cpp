@@ -0,0 +1,607 @@
+// =============================================================================
+// File: Cipher.cpp
+// =============================================================================
+// Description:
+//      This file is the implementation of the Cipher class. The AES-NI code
+//      is compiled for those instructions only (target attribute) & only
+//      called when the CPU has them, so the program still runs on CPUs
+//      without them.
+// =============================================================================
+
+#include <algorithm>
+#include <cstring>
+#include <random>
+#include "Cipher.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CIPHER_HARDWARE 1
+#define HARDWARE_TARGET __attribute__((target("aes,pclmul,sse4.1")))
+#endif
+
+using namespace ral;
+
+namespace {
+    const size_t BLOCK = 16;
+    const size_t BATCH = 16;    // records crypted together by cryptMany
+
+    // ==== rotate =============================================================
+    // Rotates a byte left.
+    // =========================================================================
+    uint8_t rotate(uint8_t x, int bits) {
+        return (uint8_t)((x << bits) | (x >> (8 - bits)));
+    }
+
+    // ==== times2 =============================================================
+    // Multiplies a byte by x in AES's GF(2^8).
+    // =========================================================================
+    uint8_t times2(uint8_t x) {
+        return (uint8_t)((x << 1) ^ (x & 0x80 ? 0x1B : 0));
+    }
+
+    // === AesTables ===========================================================
+    // The S-box & the four encryption T-tables, built once.
+    // =========================================================================
+    struct AesTables {
+        uint8_t sbox[256];
+        uint32_t te[4][256];
+
+        AesTables() {
+            // walk the multiplicative group with generator 3 & its inverse
+            uint8_t p = 1, q = 1;
+            do {
+                p = p ^ times2(p);
+                q ^= q << 1;
+                q ^= q << 2;
+                q ^= q << 4;
+                q ^= q & 0x80 ? 0x09 : 0;
+                sbox[p] = q ^ rotate(q, 1) ^ rotate(q, 2) ^ rotate(q, 3) ^
+                    rotate(q, 4) ^ 0x63;
+            } while (p != 1);
+            sbox[0] = 0x63;
+
+            for (int i = 0; i < 256; i++) {
+                uint8_t s = sbox[i];
+                uint8_t s2 = times2(s);
+                uint32_t word = (uint32_t)s2 << 24 | (uint32_t)s << 16 |
+                    (uint32_t)s << 8 | (uint8_t)(s2 ^ s);
+                for (int t = 0; t < 4; t++) {
+                    te[t][i] = word;
+                    word = word >> 8 | word << 24;
+                }
+            }
+        }
+    };
+
+    const AesTables AES;
+
+    // reduction of the 4 bits shifted out by the 4 bit GHASH table
+    const uint16_t LAST4[16] = { 0x0000, 0x1c20, 0x3840, 0x2460, 0x7080,
+        0x6ca0, 0x48c0, 0x54e0, 0xe100, 0xfd20, 0xd940, 0xc560, 0x9180,
+        0x8da0, 0xa9c0, 0xb5e0 };
+
+    uint32_t loadBig32(const uint8_t* bytes) {
+        return (uint32_t)bytes[0] << 24 | (uint32_t)bytes[1] << 16 |
+            (uint32_t)bytes[2] << 8 | bytes[3];
+    }
+
+    void storeBig32(uint8_t* bytes, uint32_t value) {
+        bytes[0] = value >> 24;
+        bytes[1] = value >> 16;
+        bytes[2] = value >> 8;
+        bytes[3] = value;
+    }
+
+    uint64_t loadBig64(const uint8_t* bytes) {
+        return (uint64_t)loadBig32(bytes) << 32 | loadBig32(bytes + 4);
+    }
+
+    void storeBig64(uint8_t* bytes, uint64_t value) {
+        storeBig32(bytes, value >> 32);
+        storeBig32(bytes + 4, (uint32_t)value);
+    }
+
+    // ==== associatedBlock ====================================================
+    // The GHASH block of the associated value: its 8 bytes (little endian)
+    // padded with zeros.
+    // =========================================================================
+    void associatedBlock(uint64_t associated, uint8_t* block) {
+        for (int i = 0; i < 8; i++) {
+            block[i] = associated >> (8 * i);
+            block[8 + i] = 0;
+        }
+    }
+
+    // ==== lengthBlock ========================================================
+    // The last GHASH block: the bit lengths of the associated data & the
+    // ciphertext.
+    // =========================================================================
+    void lengthBlock(size_t size, uint8_t* block) {
+        storeBig64(block, 64);
+        storeBig64(block + 8, (uint64_t)size * 8);
+    }
+
+    // ==== tagsMatch ==========================================================
+    // Compares two tags in constant time.
+    // =========================================================================
+    bool tagsMatch(const uint8_t* a, const uint8_t* b) {
+        uint8_t difference = 0;
+        for (size_t i = 0; i < Cipher::TAG_SIZE; i++) {
+            difference |= a[i] ^ b[i];
+        }
+        return difference == 0;
+    }
+
+#ifdef CIPHER_HARDWARE
+    // ==== clmulWide ==========================================================
+    // The 256 bit carry-less product of two byte reflected field elements.
+    // =========================================================================
+    HARDWARE_TARGET inline void clmulWide(__m128i a, __m128i b, __m128i &low,
+        __m128i &high) {
+        __m128i middle = _mm_xor_si128(_mm_clmulepi64_si128(a, b, 0x10),
+            _mm_clmulepi64_si128(a, b, 0x01));
+        low = _mm_xor_si128(_mm_clmulepi64_si128(a, b, 0x00),
+            _mm_slli_si128(middle, 8));
+        high = _mm_xor_si128(_mm_clmulepi64_si128(a, b, 0x11),
+            _mm_srli_si128(middle, 8));
+    }
+
+    // ==== reduce =============================================================
+    // Shifts a 256 bit product left by one (the reflection) & reduces it
+    // modulo the GCM polynomial (Intel's carry-less multiplication white
+    // paper, algorithm 5).
+    // =========================================================================
+    HARDWARE_TARGET inline __m128i reduce(__m128i low, __m128i high) {
+        __m128i carry_low = _mm_srli_epi32(low, 31);
+        __m128i carry_high = _mm_srli_epi32(high, 31);
+        low = _mm_slli_epi32(low, 1);
+        high = _mm_slli_epi32(high, 1);
+        __m128i across = _mm_srli_si128(carry_low, 12);
+        carry_high = _mm_slli_si128(carry_high, 4);
+        carry_low = _mm_slli_si128(carry_low, 4);
+        low = _mm_or_si128(low, carry_low);
+        high = _mm_or_si128(_mm_or_si128(high, carry_high), across);
+
+        __m128i a = _mm_xor_si128(_mm_xor_si128(_mm_slli_epi32(low, 31),
+            _mm_slli_epi32(low, 30)), _mm_slli_epi32(low, 25));
+        __m128i a_high = _mm_srli_si128(a, 4);
+        low = _mm_xor_si128(low, _mm_slli_si128(a, 12));
+        __m128i b = _mm_xor_si128(_mm_xor_si128(_mm_srli_epi32(low, 1),
+            _mm_srli_epi32(low, 2)), _mm_srli_epi32(low, 7));
+        b = _mm_xor_si128(b, a_high);
+        return _mm_xor_si128(high, _mm_xor_si128(low, b));
+    }
+
+    HARDWARE_TARGET inline __m128i multiply(__m128i a, __m128i b) {
+        __m128i low, high;
+        clmulWide(a, b, low, high);
+        return reduce(low, high);
+    }
+
+    HARDWARE_TARGET inline __m128i byteSwap(__m128i x) {
+        return _mm_shuffle_epi8(x, _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8,
+            9, 10, 11, 12, 13, 14, 15));
+    }
+
+    // ==== hashPowers =========================================================
+    // H, H^2, H^3 & H^4, byte reflected, for folding 4 blocks per reduction.
+    // =========================================================================
+    HARDWARE_TARGET void hashPowers(const uint8_t* hash_key,
+        uint8_t powers[4][16]) {
+        __m128i h = byteSwap(_mm_loadu_si128((const __m128i*)hash_key));
+        __m128i power = h;
+        for (int i = 0; i < 4; i++) {
+            _mm_store_si128((__m128i*)powers[i], power);
+            power = multiply(power, h);
+        }
+    }
+
+    // === HardwareJob =========================================================
+    // One record for cryptHardware.
+    // =========================================================================
+    struct HardwareJob {
+        const uint8_t* nonce;
+        const uint8_t* in;
+        uint8_t* out;
+        uint64_t associated;
+        uint8_t tag[16];
+    };
+
+    // ==== loadBlock ==========================================================
+    // Loads up to 16 bytes, padding with zeros.
+    // =========================================================================
+    HARDWARE_TARGET inline __m128i loadBlock(const uint8_t* bytes,
+        size_t size) {
+        if (size >= BLOCK) {
+            return _mm_loadu_si128((const __m128i*)bytes);
+        }
+        alignas(16) uint8_t block[BLOCK] = { 0 };
+        memcpy(block, bytes, size);
+        return _mm_load_si128((const __m128i*)block);
+    }
+
+    // ==== cryptHardware ======================================================
+    // AES-GCM over up to BATCH records with AES-NI & PCLMULQDQ. The counter
+    // blocks of every record (the first one, J0, masks the tag) are queued
+    // one after another & run through the rounds 8 at a time, so short
+    // records fill the pipeline together. GHASH then folds 4 blocks of a
+    // record per reduction with H^4..H.
+    // =========================================================================
+    HARDWARE_TARGET void cryptHardware(const uint8_t round_keys[15][16],
+        const uint8_t powers[4][16], HardwareJob* jobs, size_t count,
+        size_t size, bool sealing) {
+        __m128i keys[15];
+        for (int i = 0; i < 15; i++) {
+            keys[i] = _mm_load_si128((const __m128i*)round_keys[i]);
+        }
+        size_t blocks = (size + BLOCK - 1) / BLOCK;
+        __m128i masks[BATCH];
+
+        // (record, block) of the next counter block; block 0 is J0
+        size_t record = 0, block = 0;
+        while (record < count) {
+            __m128i counters[8] = {};
+            size_t lane_record[8], lane_block[8];
+            size_t lanes = 0;
+            for (; lanes < 8 && record < count; lanes++) {
+                // the nonce is followed by the record, so 16 bytes are there
+                counters[lanes] = _mm_insert_epi32(_mm_loadu_si128(
+                    (const __m128i*)jobs[record].nonce),
+                    (int)__builtin_bswap32((uint32_t)block + 1), 3);
+                lane_record[lanes] = record;
+                lane_block[lanes] = block;
+                if (++block > blocks) {
+                    block = 0;
+                    record++;
+                }
+            }
+
+            // the rounds on 8 independent blocks keep the AES unit busy; the
+            // lanes are unrolled so the state stays in registers
+            __m128i state[8];
+#pragma GCC unroll 8
+            for (size_t lane = 0; lane < 8; lane++) {
+                state[lane] = _mm_xor_si128(keys[0], counters[lane]);
+            }
+            for (int round = 1; round < 14; round++) {
+#pragma GCC unroll 8
+                for (size_t lane = 0; lane < 8; lane++) {
+                    state[lane] = _mm_aesenc_si128(state[lane], keys[round]);
+                }
+            }
+#pragma GCC unroll 8
+            for (size_t lane = 0; lane < 8; lane++) {
+                state[lane] = _mm_aesenclast_si128(state[lane], keys[14]);
+            }
+
+            for (size_t lane = 0; lane < lanes; lane++) {
+                HardwareJob &job = jobs[lane_record[lane]];
+                if (lane_block[lane] == 0) {
+                    masks[lane_record[lane]] = state[lane];
+                    continue;
+                }
+                size_t offset = (lane_block[lane] - 1) * BLOCK;
+                size_t bytes = min(BLOCK, size - offset);
+                __m128i data = _mm_xor_si128(loadBlock(job.in + offset,
+                    bytes), state[lane]);
+                if (bytes == BLOCK) {
+                    _mm_storeu_si128((__m128i*)(job.out + offset), data);
+                }
+                else {
+                    alignas(16) uint8_t partial[BLOCK];
+                    _mm_store_si128((__m128i*)partial, data);
+                    memcpy(job.out + offset, partial, bytes);
+                }
+            }
+        }
+
+        // GHASH a step at a time across the records, so their chains of
+        // multiplications overlap
+        __m128i h[4];
+        for (int i = 0; i < 4; i++) {
+            h[i] = _mm_load_si128((const __m128i*)powers[i]);
+        }
+        __m128i hashes[BATCH];
+        uint8_t edge[BLOCK];
+        for (size_t r = 0; r < count; r++) {
+            associatedBlock(jobs[r].associated, edge);
+            hashes[r] = multiply(byteSwap(loadBlock(edge, BLOCK)), h[0]);
+        }
+
+        // whole ciphertext blocks 4 at a time: (Y ^ X1)H^4 ^ X2 H^3 ^ ...
+        block = 0;
+        for (; block + 4 <= size / BLOCK; block += 4) {
+            for (size_t r = 0; r < count; r++) {
+                const uint8_t* ciphertext = sealing ? jobs[r].out : jobs[r].in;
+                __m128i low = _mm_setzero_si128(), high = low;
+                for (int i = 0; i < 4; i++) {
+                    __m128i x = byteSwap(_mm_loadu_si128((const __m128i*)(
+                        ciphertext + (block + i) * BLOCK)));
+                    if (i == 0) {
+                        x = _mm_xor_si128(x, hashes[r]);
+                    }
+                    __m128i part_low, part_high;
+                    clmulWide(x, h[3 - i], part_low, part_high);
+                    low = _mm_xor_si128(low, part_low);
+                    high = _mm_xor_si128(high, part_high);
+                }
+                hashes[r] = reduce(low, high);
+            }
+        }
+        for (; block < blocks; block++) {
+            size_t offset = block * BLOCK;
+            for (size_t r = 0; r < count; r++) {
+                const uint8_t* ciphertext = sealing ? jobs[r].out : jobs[r].in;
+                __m128i x = byteSwap(loadBlock(ciphertext + offset,
+                    min(BLOCK, size - offset)));
+                hashes[r] = multiply(_mm_xor_si128(hashes[r], x), h[0]);
+            }
+        }
+
+        lengthBlock(size, edge);
+        __m128i lengths = byteSwap(loadBlock(edge, BLOCK));
+        for (size_t r = 0; r < count; r++) {
+            __m128i hash = multiply(_mm_xor_si128(hashes[r], lengths), h[0]);
+            _mm_storeu_si128((__m128i*)jobs[r].tag,
+                _mm_xor_si128(byteSwap(hash), masks[r]));
+        }
+    }
+#endif
+}
+
+Cipher::Cipher(const string &key, bool allow_hardware /*= true*/) {
+    // AES-256 key expansion (FIPS-197 5.2), kept as bytes for AES-NI &
+    // as big endian words for the tables
+    uint8_t* expanded = &round_keys[0][0];
+    memset(expanded, 0, sizeof(round_keys));
+    size_t key_bytes = key.size() < KEY_SIZE ? key.size() : KEY_SIZE;
+    memcpy(expanded, key.data(), key_bytes);
+    uint8_t rcon = 1;
+    for (size_t i = KEY_SIZE; i < sizeof(round_keys); i += 4) {
+        uint8_t word[4];
+        memcpy(word, expanded + i - 4, 4);
+        if (i % KEY_SIZE == 0) {
+            uint8_t first = word[0];
+            word[0] = AES.sbox[word[1]] ^ rcon;
+            word[1] = AES.sbox[word[2]];
+            word[2] = AES.sbox[word[3]];
+            word[3] = AES.sbox[first];
+            rcon = times2(rcon);
+        }
+        else if (i % KEY_SIZE == 16) {
+            for (int j = 0; j < 4; j++) {
+                word[j] = AES.sbox[word[j]];
+            }
+        }
+        for (int j = 0; j < 4; j++) {
+            expanded[i + j] = expanded[i - KEY_SIZE + j] ^ word[j];
+        }
+    }
+    for (size_t i = 0; i < 4 * (ROUNDS + 1); i++) {
+        round_words[i] = loadBig32(expanded + 4 * i);
+    }
+
+    // GHASH key H = AES(0) & its 4 bit table (as in mbed TLS)
+    uint8_t hash_key[BLOCK] = { 0 };
+    encryptBlock(hash_key, hash_key);
+    uint64_t high = loadBig64(hash_key), low = loadBig64(hash_key + 8);
+    hash_high[0] = hash_low[0] = 0;
+    hash_high[8] = high;
+    hash_low[8] = low;
+    for (int i = 4; i > 0; i >>= 1) {
+        uint64_t carry = (low & 1) * 0xe1000000;
+        low = high << 63 | low >> 1;
+        high = high >> 1 ^ carry << 32;
+        hash_high[i] = high;
+        hash_low[i] = low;
+    }
+    for (int i = 2; i <= 8; i *= 2) {
+        for (int j = 1; j < i; j++) {
+            hash_high[i + j] = hash_high[i] ^ hash_high[j];
+            hash_low[i + j] = hash_low[i] ^ hash_low[j];
+        }
+    }
+
+    hardware = allow_hardware && hasHardware();
+#ifdef CIPHER_HARDWARE
+    if (hardware) {
+        hashPowers(hash_key, hash_powers);
+    }
+#endif
+
+    random_device random;
+    nonce_prefix = random();
+    nonce_counter = (uint64_t)random() << 32 | random();
+}
+
+bool Cipher::hasHardware() {
+#ifdef CIPHER_HARDWARE
+    return __builtin_cpu_supports("aes") && __builtin_cpu_supports("pclmul")
+        && __builtin_cpu_supports("sse4.1");
+#else
+    return false;
+#endif
+}
+
+bool Cipher::usesHardware() {
+    return hardware;
+}
+
+void Cipher::deriveKey(const char* purpose, uint8_t* key) {
+    uint8_t block[16] = { 0 };
+    memcpy(block, purpose, NONCE_SIZE);
+    encryptBlock(block, key);
+}
+
+uint64_t Cipher::nextNonces(size_t count) {
+    return nonce_counter.fetch_add(count, memory_order_relaxed);
+}
+
+void Cipher::encryptBlock(const uint8_t* in, uint8_t* out) {
+    const uint32_t* keys = round_words;
+    uint32_t s0 = loadBig32(in) ^ keys[0];
+    uint32_t s1 = loadBig32(in + 4) ^ keys[1];
+    uint32_t s2 = loadBig32(in + 8) ^ keys[2];
+    uint32_t s3 = loadBig32(in + 12) ^ keys[3];
+    const uint32_t (*te)[256] = AES.te;
+    for (int round = 1; round < ROUNDS; round++) {
+        keys += 4;
+        uint32_t t0 = te[0][s0 >> 24] ^ te[1][s1 >> 16 & 0xff] ^
+            te[2][s2 >> 8 & 0xff] ^ te[3][s3 & 0xff] ^ keys[0];
+        uint32_t t1 = te[0][s1 >> 24] ^ te[1][s2 >> 16 & 0xff] ^
+            te[2][s3 >> 8 & 0xff] ^ te[3][s0 & 0xff] ^ keys[1];
+        uint32_t t2 = te[0][s2 >> 24] ^ te[1][s3 >> 16 & 0xff] ^
+            te[2][s0 >> 8 & 0xff] ^ te[3][s1 & 0xff] ^ keys[2];
+        uint32_t t3 = te[0][s3 >> 24] ^ te[1][s0 >> 16 & 0xff] ^
+            te[2][s1 >> 8 & 0xff] ^ te[3][s2 & 0xff] ^ keys[3];
+        s0 = t0;
+        s1 = t1;
+        s2 = t2;
+        s3 = t3;
+    }
+
+    // the last round has no MixColumns
+    keys += 4;
+    const uint8_t* sbox = AES.sbox;
+    uint32_t state[4] = { s0, s1, s2, s3 };
+    for (int i = 0; i < 4; i++) {
+        uint32_t word = (uint32_t)sbox[state[i] >> 24] << 24 |
+            (uint32_t)sbox[state[(i + 1) % 4] >> 16 & 0xff] << 16 |
+            (uint32_t)sbox[state[(i + 2) % 4] >> 8 & 0xff] << 8 |
+            sbox[state[(i + 3) % 4] & 0xff];
+        storeBig32(out + 4 * i, word ^ keys[i]);
+    }
+}
+
+void Cipher::multiplyHash(uint8_t* x) {
+    uint8_t low_nibble = x[15] & 0xf;
+    uint64_t high = hash_high[low_nibble], low = hash_low[low_nibble];
+    for (int i = 15; i >= 0; i--) {
+        uint8_t nibbles[2] = { (uint8_t)(x[i] & 0xf), (uint8_t)(x[i] >> 4) };
+        for (int n = i == 15 ? 1 : 0; n < 2; n++) {
+            uint8_t remainder = low & 0xf;
+            low = high << 60 | low >> 4;
+            high = high >> 4 ^ (uint64_t)LAST4[remainder] << 48;
+            high ^= hash_high[nibbles[n]];
+            low ^= hash_low[nibbles[n]];
+        }
+    }
+    storeBig64(x, high);
+    storeBig64(x + 8, low);
+}
+
+void Cipher::cryptTables(const uint8_t* nonce, const uint8_t* in,
+    uint8_t* out, size_t size, uint64_t associated, bool sealing,
+    uint8_t* tag) {
+    uint8_t counter[BLOCK], stream[BLOCK], hash[BLOCK];
+    memcpy(counter, nonce, NONCE_SIZE);
+    associatedBlock(associated, hash);
+    multiplyHash(hash);
+
+    for (size_t offset = 0; offset < size; offset += BLOCK) {
+        storeBig32(counter + 12, (uint32_t)(offset / BLOCK + 2));
+        encryptBlock(counter, stream);
+        size_t bytes = min(BLOCK, size - offset);
+        for (size_t i = 0; i < bytes; i++) {
+            uint8_t ciphertext = sealing ? in[offset + i] ^ stream[i] :
+                in[offset + i];
+            out[offset + i] = in[offset + i] ^ stream[i];
+            hash[i] ^= ciphertext;
+        }
+        multiplyHash(hash);
+    }
+
+    uint8_t lengths[BLOCK];
+    lengthBlock(size, lengths);
+    for (size_t i = 0; i < BLOCK; i++) {
+        hash[i] ^= lengths[i];
+    }
+    multiplyHash(hash);
+
+    storeBig32(counter + 12, 1);
+    encryptBlock(counter, stream);
+    for (size_t i = 0; i < BLOCK; i++) {
+        tag[i] = hash[i] ^ stream[i];
+    }
+}
+
+bool Cipher::cryptMany(const char* in, char* out, size_t size,
+    const uint64_t* associated, size_t count, bool sealing) {
+    size_t sealed_size = size + OVERHEAD;
+    size_t in_size = sealing ? size : sealed_size;
+    size_t out_size = sealing ? sealed_size : size;
+    uint64_t nonce = sealing ? nextNonces(count) : 0;
+    bool matched = true;
+
+    for (size_t first = 0; first < count; first += BATCH) {
+        size_t batch = min(BATCH, count - first);
+        uint8_t tags[BATCH][TAG_SIZE];
+        const uint8_t* nonces[BATCH];
+        const uint8_t* inputs[BATCH];
+        uint8_t* outputs[BATCH];
+        for (size_t i = 0; i < batch; i++) {
+            const uint8_t* record = (const uint8_t*)in + (first + i) *
+                in_size;
+            uint8_t* result = (uint8_t*)out + (first + i) * out_size;
+            if (sealing) {
+                storeBig32(result, nonce_prefix);
+                storeBig64(result + 4, nonce + first + i);
+            }
+            nonces[i] = sealing ? result : record;
+            inputs[i] = sealing ? record : record + NONCE_SIZE;
+            outputs[i] = sealing ? result + NONCE_SIZE : result;
+        }
+
+#ifdef CIPHER_HARDWARE
+        if (hardware) {
+            HardwareJob jobs[BATCH];
+            for (size_t i = 0; i < batch; i++) {
+                jobs[i].nonce = nonces[i];
+                jobs[i].in = inputs[i];
+                jobs[i].out = outputs[i];
+                jobs[i].associated = associated[first + i];
+            }
+            cryptHardware(round_keys, hash_powers, jobs, batch, size,
+                sealing);
+            for (size_t i = 0; i < batch; i++) {
+                memcpy(tags[i], jobs[i].tag, TAG_SIZE);
+            }
+        }
+#endif
+        for (size_t i = 0; !hardware && i < batch; i++) {
+            cryptTables(nonces[i], inputs[i], outputs[i], size,
+                associated[first + i], sealing, tags[i]);
+        }
+
+        for (size_t i = 0; i < batch; i++) {
+            if (sealing) {
+                memcpy(outputs[i] + size, tags[i], TAG_SIZE);
+            }
+            else if (!tagsMatch(tags[i], inputs[i] + size)) {
+                memset(outputs[i], 0, size);
+                matched = false;
+            }
+        }
+    }
+    return matched;
+}
+
+void Cipher::seal(const char* record, char* sealed, size_t size,
+    uint64_t associated) {
+    cryptMany(record, sealed, size, &associated, 1, true);
+}
+
+bool Cipher::open(const char* sealed, char* record, size_t size,
+    uint64_t associated) {
+    return cryptMany(sealed, record, size, &associated, 1, false);
+}
+
+void Cipher::sealMany(const char* records, char* sealed, size_t size,
+    const uint64_t* associated, size_t count) {
+    cryptMany(records, sealed, size, associated, count, true);
+}
+
+bool Cipher::openMany(const char* sealed, char* records, size_t size,
+    const uint64_t* associated, size_t count) {
+    return cryptMany(sealed, records, size, associated, count, false);
+}
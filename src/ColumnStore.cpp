@@ -0,0 +1,482 @@
+// =============================================================================
+// File: ColumnStore.cpp
+// =============================================================================
+// Description:
+//      This file is the implementation of the ColumnStore class.
+// =============================================================================
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "ColumnStore.h"
+
+using namespace ral;
+
+namespace {
+    const char MAGIC[8] = { 'O', 'N', 'B', 'C', 'O', 'L', '\0', '\0' };
+    const uint32_t FORMAT_VERSION = 1;
+    const size_t HEADER_SIZE = 4096;
+    const size_t MAX_NAME_SIZE = 255;
+
+    // a sealed image is SEALED_MAGIC & the mapping sealed, authenticated
+    // with the magic too
+    const char SEALED_MAGIC[8] = { 'O', 'N', 'B', 'C', 'O', 'L', 'S', '\0' };
+    const uint64_t SEALED_ASSOCIATED = 0x00534C4F43424E4Full; // "ONBCOLS"
+
+    size_t fileSize(size_t slots, size_t heap_capacity) {
+        return HEADER_SIZE + slots * (sizeof(int32_t) + sizeof(int64_t) +
+            sizeof(uint32_t)) + heap_capacity;
+    }
+
+    // ==== aggregate ==========================================================
+    // Counts, sums & finds the min/max of the values whose row matches, in
+    // one pass without branches. The sum is kept as the sum of the high &
+    // the (unsigned) low 32 bits of each value, neither of which can
+    // overflow, & saturated once at the end.
+    // =========================================================================
+    template <class Match> ColumnSummary aggregate(const int64_t* values,
+        size_t slots, Match match) {
+        size_t count = 0;
+        uint64_t sum_low = 0;
+        int64_t sum_high = 0;
+        int64_t low = INT64_MAX, high = INT64_MIN;
+        for (size_t i = 0; i < slots; i++) {
+            bool m = match(i);
+            int64_t value = values[i];
+            count += m;
+            sum_low += m ? (uint32_t)value : 0;
+            sum_high += m ? value >> 32 : 0;
+            low = min(low, m ? value : INT64_MAX);
+            high = max(high, m ? value : INT64_MIN);
+        }
+
+        ColumnSummary summary;
+        summary.count = count;
+        if (count > 0) {
+            __int128 sum = ((__int128)sum_high << 32) + sum_low;
+            summary.sum = sum > INT64_MAX ? INT64_MAX :
+                sum < INT64_MIN ? INT64_MIN : (int64_t)sum;
+            summary.min = low;
+            summary.max = high;
+        }
+        return summary;
+    }
+}
+
+ColumnStore::ColumnStore(string file_name, Extractor extract,
+    const string &key /*= ""*/) {
+    this->file_name = file_name;
+    this->extract = extract;
+    mapping = nullptr;
+    mapping_size = 0;
+    header = nullptr;
+    was_clean = false;
+    if (!key.empty()) {
+        cipher.reset(new Cipher(key));
+    }
+
+    // without a name the store lives in an anonymous file, so it's built
+    // afresh on every open & never reaches the disk; a sealed store lives
+    // there too, read from its image
+    bool in_memory = file_name.empty() || cipher != nullptr;
+    fd = in_memory ? memfd_create("columns", MFD_CLOEXEC) :
+        open(file_name.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd == -1 || (!file_name.empty() && cipher != nullptr &&
+        !loadSealed())) {
+        return;
+    }
+
+    // anything that isn't a complete store of this version starts over
+    Header existing;
+    struct stat st;
+    bool valid = fstat(fd, &st) == 0 && (size_t)st.st_size >= HEADER_SIZE &&
+        pread(fd, &existing, sizeof(existing), 0) == sizeof(existing) &&
+        memcmp(existing.magic, MAGIC, sizeof(MAGIC)) == 0 &&
+        existing.version == FORMAT_VERSION && existing.slots >= MIN_SLOTS &&
+        existing.slots % MIN_SLOTS == 0 &&
+        existing.heap_size <= existing.heap_capacity &&
+        (size_t)st.st_size == fileSize(existing.slots,
+        existing.heap_capacity);
+
+    if (!(valid ? map(existing.slots, existing.heap_capacity) :
+        map(MIN_SLOTS, MIN_HEAP))) {
+        return;
+    }
+    if (valid) {
+        was_clean = header->clean == 1;
+    }
+    else {
+        memset(mapping, 0, HEADER_SIZE);
+        memcpy(header->magic, MAGIC, sizeof(MAGIC));
+        header->version = FORMAT_VERSION;
+        header->slots = MIN_SLOTS;
+        header->heap_capacity = MIN_HEAP;
+        clearRows();
+    }
+
+    // a crash from here on leaves the store marked dirty
+    header->clean = 0;
+    if (msync(mapping, HEADER_SIZE, MS_SYNC) == -1) {
+        munmap(mapping, mapping_size);
+        mapping = nullptr;
+    }
+}
+
+ColumnStore::~ColumnStore() {
+    if (mapping != nullptr && !file_name.empty() && cipher != nullptr) {
+        // an image torn by a crash doesn't open, so it's never taken for a
+        // clean store
+        header->clean = 1;
+        saveSealed();
+    }
+    else if (mapping != nullptr &&
+        msync(mapping, mapping_size, MS_SYNC) == 0) {
+        // the rows must be on disk before the header says they are
+        header->clean = 1;
+        msync(mapping, HEADER_SIZE, MS_SYNC);
+    }
+    if (mapping != nullptr) {
+        munmap(mapping, mapping_size);
+    }
+    if (fd != -1) {
+        close(fd);
+    }
+}
+
+bool ColumnStore::loadSealed() {
+    int file = open(file_name.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    struct stat st;
+    if (file == -1 || fstat(file, &st) == -1 || fchmod(file, 0600) == -1) {
+        if (file != -1) {
+            close(file);
+        }
+        return false;
+    }
+
+    string sealed(st.st_size, '\0');
+    size_t read_bytes = 0;
+    while (read_bytes < sealed.size()) {
+        ssize_t n = pread(file, &sealed[read_bytes],
+            sealed.size() - read_bytes, read_bytes);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        read_bytes += n;
+    }
+
+    // an image that doesn't open is ignored (the store is rebuilt)
+    if (read_bytes == sealed.size() &&
+        sealed.size() > sizeof(SEALED_MAGIC) + Cipher::OVERHEAD &&
+        memcmp(sealed.data(), SEALED_MAGIC, sizeof(SEALED_MAGIC)) == 0) {
+        size_t size = sealed.size() - sizeof(SEALED_MAGIC) -
+            Cipher::OVERHEAD;
+        string rows(size, '\0');
+        if (cipher->open(&sealed[sizeof(SEALED_MAGIC)], &rows[0], size,
+            SEALED_ASSOCIATED) && ftruncate(fd, size) == 0) {
+            size_t written = 0;
+            while (written < size) {
+                ssize_t n = pwrite(fd, &rows[written], size - written,
+                    written);
+                if (n == -1 && errno == EINTR) {
+                    continue;
+                }
+                if (n <= 0) {
+                    ftruncate(fd, 0);
+                    break;
+                }
+                written += n;
+            }
+        }
+    }
+
+    // once open, the store changes without its image, so a crash must find
+    // none
+    bool emptied = ftruncate(file, 0) == 0 && fdatasync(file) == 0;
+    close(file);
+    return emptied;
+}
+
+bool ColumnStore::saveSealed() {
+    string sealed(sizeof(SEALED_MAGIC) + mapping_size + Cipher::OVERHEAD,
+        '\0');
+    memcpy(&sealed[0], SEALED_MAGIC, sizeof(SEALED_MAGIC));
+    cipher->seal(mapping, &sealed[sizeof(SEALED_MAGIC)], mapping_size,
+        SEALED_ASSOCIATED);
+
+    int file = open(file_name.c_str(),
+        O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (file == -1) {
+        return false;
+    }
+    size_t written = 0;
+    while (written < sealed.size()) {
+        ssize_t n = pwrite(file, &sealed[written], sealed.size() - written,
+            written);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        written += n;
+    }
+    bool saved = written == sealed.size() && fdatasync(file) == 0;
+    close(file);
+    return saved;
+}
+
+bool ColumnStore::map(size_t slots, size_t heap_capacity) {
+    if (mapping != nullptr) {
+        munmap(mapping, mapping_size);
+        mapping = nullptr;
+    }
+
+    size_t size = fileSize(slots, heap_capacity);
+    if (ftruncate(fd, size) == -1) {
+        return false;
+    }
+    void* address = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+        fd, 0);
+    if (address == MAP_FAILED) {
+        return false;
+    }
+
+    mapping = (char*)address;
+    mapping_size = size;
+    header = (Header*)mapping;
+    ids = (int32_t*)(mapping + HEADER_SIZE);
+    values = (int64_t*)(ids + slots);
+    names = (uint32_t*)(values + slots);
+    heap = (char*)(names + slots);
+    return true;
+}
+
+void ColumnStore::clearRows() {
+    memset(ids, 0, header->slots * sizeof(int32_t));
+    header->count = 0;
+    header->heap_size = 0;
+    header->heap_garbage = 0;
+}
+
+bool ColumnStore::resize(size_t slots, size_t heap_needed) {
+    size_t old_slots = header->slots;
+    vector<int32_t> old_ids(ids, ids + old_slots);
+    vector<int64_t> old_values(values, values + old_slots);
+    vector<string> old_names(old_slots);
+    size_t live = 0;
+    for (size_t i = 0; i < old_slots; i++) {
+        if (old_ids[i] != 0) {
+            const char* entry = heap + names[i];
+            old_names[i].assign(entry + 1, (unsigned char)entry[0]);
+            live += 1 + old_names[i].size();
+        }
+    }
+
+    size_t heap_capacity = max(MIN_HEAP, 2 * (live + heap_needed));
+    if (!map(slots, heap_capacity)) {
+        return false;
+    }
+    header->slots = slots;
+    header->heap_capacity = heap_capacity;
+    clearRows();
+    for (size_t i = 0; i < min(old_slots, slots); i++) {
+        if (old_ids[i] != 0) {
+            ids[i] = old_ids[i];
+            values[i] = old_values[i];
+            header->count++;
+            setName(i, old_names[i]);
+        }
+    }
+    return true;
+}
+
+bool ColumnStore::setName(size_t slot, const string &name) {
+    size_t size = min(name.size(), MAX_NAME_SIZE);
+    if (header->heap_size + 1 + size > header->heap_capacity &&
+        !resize(header->slots, 1 + size)) {
+        return false;
+    }
+
+    char* entry = heap + header->heap_size;
+    entry[0] = (char)size;
+    memcpy(entry + 1, name.data(), size);
+    names[slot] = header->heap_size;
+    header->heap_size += 1 + size;
+    return true;
+}
+
+bool ColumnStore::isOpen() {
+    return mapping != nullptr;
+}
+
+bool ColumnStore::isCurrent(size_t count) {
+    lock_guard<mutex> guard(lock);
+    return was_clean && header->count == count;
+}
+
+bool ColumnStore::clear(size_t slots /*= 0*/) {
+    lock_guard<mutex> guard(lock);
+    size_t wanted = max(MIN_SLOTS, (slots + MIN_SLOTS - 1) / MIN_SLOTS *
+        MIN_SLOTS);
+    if (wanted != header->slots) {
+        if (!map(wanted, header->heap_capacity)) {
+            return false;
+        }
+        header->slots = wanted;
+    }
+    clearRows();
+    return true;
+}
+
+void ColumnStore::eraseRow(size_t slot) {
+    if (slot < header->slots && ids[slot] != 0) {
+        header->heap_garbage += 1 + (unsigned char)heap[names[slot]];
+        ids[slot] = 0;
+        header->count--;
+    }
+}
+
+void ColumnStore::update(int id, const char* record) {
+    lock_guard<mutex> guard(lock);
+    int64_t value;
+    size_t slot = id / 10 - 1;
+    if (mapping == nullptr) {
+        return;
+    }
+    if (!extract(record, value, name)) {
+        eraseRow(slot);
+        return;
+    }
+    if (slot >= header->slots) {
+        size_t slots = max(2 * header->slots,
+            (slot + MIN_SLOTS) / MIN_SLOTS * MIN_SLOTS);
+        if (!resize(slots, 0)) {
+            return;
+        }
+    }
+
+    // a row keeps its name unless the record's name changed
+    if (ids[slot] != 0) {
+        const char* entry = heap + names[slot];
+        size_t size = min(name.size(), MAX_NAME_SIZE);
+        if ((unsigned char)entry[0] == size &&
+            memcmp(entry + 1, name.data(), size) == 0) {
+            values[slot] = value;
+            return;
+        }
+        eraseRow(slot);
+    }
+    if (setName(slot, name)) {
+        ids[slot] = id;
+        values[slot] = value;
+        header->count++;
+    }
+}
+
+void ColumnStore::erase(int id) {
+    lock_guard<mutex> guard(lock);
+    if (mapping != nullptr) {
+        eraseRow(id / 10 - 1);
+    }
+}
+
+void ColumnStore::matches(const ColumnFilter &filter,
+    vector<uint8_t> &match) {
+    size_t slots = header->slots;
+    match.resize(slots);
+    int64_t low = filter.min_value, high = filter.max_value;
+    for (size_t i = 0; i < slots; i++) {
+        match[i] = (ids[i] != 0) & (values[i] >= low) & (values[i] <= high);
+    }
+
+    size_t prefix_size = filter.name_prefix.size();
+    if (prefix_size == 0) {
+        return;
+    }
+    for (size_t i = 0; i < slots; i++) {
+        const char* entry = heap + names[i];
+        match[i] = match[i] && (unsigned char)entry[0] >= prefix_size &&
+            memcmp(entry + 1, filter.name_prefix.data(), prefix_size) == 0;
+    }
+}
+
+ColumnSummary ColumnStore::summarize(const ColumnFilter &filter) {
+    lock_guard<mutex> guard(lock);
+    if (mapping == nullptr) {
+        return ColumnSummary();
+    }
+
+    // without a prefix the filter is fused into the aggregate
+    if (filter.name_prefix.empty()) {
+        const int32_t* row_ids = ids;
+        const int64_t* row_values = values;
+        int64_t low = filter.min_value, high = filter.max_value;
+        return aggregate(values, header->slots, [&](size_t i) {
+            return (row_ids[i] != 0) & (row_values[i] >= low) &
+                (row_values[i] <= high);
+        });
+    }
+
+    vector<uint8_t> match;
+    matches(filter, match);
+    return aggregate(values, header->slots, [&](size_t i) {
+        return match[i] != 0;
+    });
+}
+
+void ColumnStore::select(const ColumnFilter &filter, vector<int> &ids) {
+    lock_guard<mutex> guard(lock);
+    if (mapping == nullptr) {
+        return;
+    }
+    vector<uint8_t> match;
+    matches(filter, match);
+    for (size_t i = 0; i < match.size(); i++) {
+        if (match[i]) {
+            ids.push_back(this->ids[i]);
+        }
+    }
+}
+
+void ColumnStore::top(const ColumnFilter &filter, size_t k, bool largest,
+    vector<pair<int, int64_t>> &rows) {
+    vector<pair<int, int64_t>> candidates;
+    {
+        lock_guard<mutex> guard(lock);
+        if (mapping == nullptr) {
+            return;
+        }
+        vector<uint8_t> match;
+        matches(filter, match);
+        for (size_t i = 0; i < match.size(); i++) {
+            if (match[i]) {
+                candidates.push_back({ ids[i], values[i] });
+            }
+        }
+    }
+
+    // best value first, then lowest id
+    auto better = [largest](const pair<int, int64_t> &a,
+        const pair<int, int64_t> &b) {
+        if (a.second != b.second) {
+            return largest ? a.second > b.second : a.second < b.second;
+        }
+        return a.first < b.first;
+    };
+    k = min(k, candidates.size());
+    partial_sort(candidates.begin(), candidates.begin() + k,
+        candidates.end(), better);
+    rows.insert(rows.end(), candidates.begin(), candidates.begin() + k);
+}
+
+size_t ColumnStore::getCount() {
+    lock_guard<mutex> guard(lock);
+    return header->count;
+}
@@ -0,0 +1,167 @@
+// =============================================================================
+// File: DoublewriteBuffer.cpp
+// =============================================================================
+// Description:
+//      This file is the implementation of the DoublewriteBuffer class.
+// =============================================================================
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "Checksum.h"
+#include "DoublewriteBuffer.h"
+#include "Stats.h"
+
+using namespace ral;
+
+namespace {
+    // === EntryHeader =========================================================
+    // Precedes every page image in the file. crc covers the fields after it
+    // & the image. Every image of a batch has the batch's number.
+    // =========================================================================
+    struct EntryHeader {
+        uint32_t magic;
+        uint32_t crc;
+        uint64_t batch;
+        uint32_t page;
+        uint32_t size;
+    };
+
+    const uint32_t ENTRY_MAGIC = 0x44424E4F; // "ONBD"
+
+    uint32_t entryCrc(const EntryHeader &header, const char* image) {
+        uint32_t crc = crc32c(&header.batch, sizeof(header) -
+            offsetof(EntryHeader, batch));
+        return crc32c(image, header.size, crc);
+    }
+}
+
+DoublewriteBuffer::DoublewriteBuffer(string file_name, size_t page_size,
+    PageRestorer restore, RafSyncer sync_raf) {
+    this->file_name = file_name;
+    this->page_size = page_size;
+    this->sync_raf = sync_raf;
+    next_batch = 1;
+    next_entry = 0;
+
+    fd = open(file_name.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    failed = fd == -1 || !recover(restore);
+}
+
+DoublewriteBuffer::~DoublewriteBuffer() {
+    if (fd != -1) {
+        close(fd);
+    }
+}
+
+bool DoublewriteBuffer::isOpen() {
+    return !failed;
+}
+
+bool DoublewriteBuffer::recover(const PageRestorer &restore) {
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        return false;
+    }
+    if (st.st_size == 0) {
+        return true;
+    }
+
+    string images(st.st_size, '\0');
+    size_t read_bytes = 0;
+    while (read_bytes < images.size()) {
+        ssize_t n = pread(fd, &images[read_bytes],
+            images.size() - read_bytes, read_bytes);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        read_bytes += n;
+    }
+
+    // entries are the same size, so a torn one is skipped; a page's newest
+    // intact image is the one of the latest batch
+    unordered_map<uint32_t, pair<uint64_t, const char*>> newest;
+    const size_t ENTRY_SIZE = sizeof(EntryHeader) + page_size;
+    for (size_t offset = 0; offset + ENTRY_SIZE <= images.size();
+        offset += ENTRY_SIZE) {
+        EntryHeader header;
+        memcpy(&header, &images[offset], sizeof(header));
+        const char* image = &images[offset + sizeof(header)];
+        if (header.magic != ENTRY_MAGIC || header.size != page_size ||
+            entryCrc(header, image) != header.crc) {
+            continue;
+        }
+        pair<uint64_t, const char*> &entry = newest[header.page];
+        if (header.batch > entry.first) {
+            entry = make_pair(header.batch, image);
+        }
+    }
+
+    vector<pair<uint32_t, const char*>> pages;
+    for (const auto &entry : newest) {
+        pages.emplace_back(entry.first, entry.second.second);
+    }
+    sort(pages.begin(), pages.end());
+    for (const pair<uint32_t, const char*> &page : pages) {
+        if (!restore(page.first, page.second)) {
+            return false;
+        }
+    }
+    Stats::countIo(0, 0, 2);
+    return sync_raf() && ftruncate(fd, 0) == 0 && fdatasync(fd) == 0;
+}
+
+bool DoublewriteBuffer::write(const uint32_t* pages, const char* images,
+    size_t count) {
+    const size_t ENTRY_SIZE = sizeof(EntryHeader) + page_size;
+    buffer.resize(count * ENTRY_SIZE);
+    for (size_t i = 0; i < count; i++) {
+        EntryHeader header;
+        header.magic = ENTRY_MAGIC;
+        header.batch = next_batch;
+        header.page = pages[i];
+        header.size = page_size;
+        header.crc = entryCrc(header, images + i * page_size);
+        memcpy(&buffer[i * ENTRY_SIZE], &header, sizeof(header));
+        memcpy(&buffer[i * ENTRY_SIZE + sizeof(header)],
+            images + i * page_size, page_size);
+    }
+    next_batch++;
+
+    // the images about to be overwritten must have reached their pages
+    if (next_entry > 0 && next_entry + count > RING_PAGES) {
+        if (!sync_raf()) {
+            return false;
+        }
+        next_entry = 0;
+    }
+    const char* bytes = buffer.data();
+    size_t size = buffer.size();
+    off_t offset = next_entry * ENTRY_SIZE;
+    next_entry += count;
+    while (size > 0) {
+        ssize_t n = pwrite(fd, bytes, size, offset);
+        Stats::countIo(0, n > 0 ? n : 0, 1);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        bytes += n;
+        size -= n;
+        offset += n;
+    }
+    Stats::countIo(0, 0, 1);
+    return fdatasync(fd) == 0;
+}
@@ -0,0 +1,167 @@
+// =============================================================================
+// File: FreeMap.cpp
+// =============================================================================
+// Description:
+//      This file is the implementation of the FreeMap class.
+// =============================================================================
+
+#include "FreeMap.h"
+
+using namespace ral;
+
+FreeMap::FreeMap() {
+    slots = 0;
+    free_slots = 0;
+    levels.resize(1);
+}
+
+void FreeMap::rebuild() {
+    levels.resize(1);
+    free_slots = 0;
+    for (uint64_t word : levels[0]) {
+        free_slots += __builtin_popcountll(~word);
+    }
+
+    // add summary levels until one word covers everything below it
+    while (levels.back().size() > 1) {
+        const vector<uint64_t> &below = levels.back();
+        bool bottom = levels.size() == 1;
+        vector<uint64_t> summary((below.size() + 63) / 64, 0);
+        for (size_t i = 0; i < below.size(); i++) {
+            if (bottom ? ~below[i] != 0 : below[i] != 0) {
+                summary[i / 64] |= (uint64_t)1 << (i % 64);
+            }
+        }
+        levels.push_back(move(summary));
+    }
+}
+
+void FreeMap::markFull(size_t word) {
+    for (size_t level = 1; level < levels.size(); level++) {
+        uint64_t &summary = levels[level][word / 64];
+        summary &= ~((uint64_t)1 << (word % 64));
+        if (summary != 0) {
+            return; // the level above still sees a free slot here
+        }
+        word /= 64;
+    }
+}
+
+void FreeMap::markFree(size_t word) {
+    for (size_t level = 1; level < levels.size(); level++) {
+        uint64_t &summary = levels[level][word / 64];
+        bool was_empty = summary == 0;
+        summary |= (uint64_t)1 << (word % 64);
+        if (!was_empty) {
+            return; // the level above already knew
+        }
+        word /= 64;
+    }
+}
+
+void FreeMap::resize(size_t slots) {
+    this->slots = slots;
+    levels[0].resize(slots / 64, 0);
+    rebuild();
+}
+
+void FreeMap::setWords(size_t first_word, const uint64_t* words,
+    size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        uint64_t &word = levels[0][first_word + i];
+        bool had_free = ~word != 0;
+        free_slots += __builtin_popcountll(word) -
+            __builtin_popcountll(words[i]);
+        word = words[i];
+
+        if (had_free && ~word == 0) {
+            markFull(first_word + i);
+        }
+        else if (!had_free && ~word != 0) {
+            markFree(first_word + i);
+        }
+    }
+}
+
+uint64_t FreeMap::getWord(size_t word) const {
+    return levels[0][word];
+}
+
+bool FreeMap::findFree(size_t &slot) const {
+    if (free_slots == 0) {
+        return false;
+    }
+
+    // follow the lowest set summary bit down to the slot bitmap
+    size_t word = 0;
+    for (size_t level = levels.size() - 1; level > 0; level--) {
+        word = word * 64 + __builtin_ctzll(levels[level][word]);
+    }
+
+    slot = word * 64 + __builtin_ctzll(~levels[0][word]);
+    return true;
+}
+
+bool FreeMap::reserve(size_t slot) {
+    uint64_t &word = levels[0][slot / 64];
+    uint64_t bit = (uint64_t)1 << (slot % 64);
+    if (word & bit) {
+        return false;
+    }
+
+    word |= bit;
+    free_slots--;
+    if (~word == 0) {
+        markFull(slot / 64);
+    }
+    return true;
+}
+
+size_t FreeMap::reserveBlock(size_t count, vector<size_t> &reserved) {
+    size_t taken = 0;
+    size_t slot;
+    while (taken < count && findFree(slot)) {
+        size_t index = slot / 64;
+        uint64_t &word = levels[0][index];
+        uint64_t free_bits = ~word;
+
+        // take the free bits of this word, lowest first
+        while (free_bits != 0 && taken < count) {
+            int bit = __builtin_ctzll(free_bits);
+            free_bits &= free_bits - 1;
+            word |= (uint64_t)1 << bit;
+            reserved.push_back(index * 64 + bit);
+            taken++;
+            free_slots--;
+        }
+
+        if (~word == 0) {
+            markFull(index);
+        }
+    }
+
+    return taken;
+}
+
+void FreeMap::release(size_t slot) {
+    uint64_t &word = levels[0][slot / 64];
+    uint64_t bit = (uint64_t)1 << (slot % 64);
+    if (!(word & bit)) {
+        return;
+    }
+
+    bool was_full = ~word == 0;
+    word &= ~bit;
+    free_slots++;
+    if (was_full) {
+        markFree(slot / 64);
+    }
+}
+
+bool FreeMap::isUsed(size_t slot) const {
+    return levels[0][slot / 64] & ((uint64_t)1 << (slot % 64));
+}
+
+size_t FreeMap::getFreeCount() const {
+    return free_slots;
+}
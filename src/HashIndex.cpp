@@ -0,0 +1,216 @@
+// =============================================================================
+// File: HashIndex.cpp
+// =============================================================================
+// Description:
+//      This file is the implementation of the HashIndex class.
+// =============================================================================
+
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "HashIndex.h"
+
+using namespace ral;
+
+namespace {
+    const char MAGIC[8] = { 'O', 'N', 'B', 'I', 'D', 'X', '\0', '\0' };
+    // 2: the keys are secret (see Bank::nameKey), so an index of 1 is
+    // rebuilt
+    const uint32_t FORMAT_VERSION = 2;
+    const size_t HEADER_SIZE = 4096;
+}
+
+HashIndex::HashIndex(string file_name) {
+    this->file_name = file_name;
+    mapping = nullptr;
+    mapping_size = 0;
+    header = nullptr;
+    table = nullptr;
+    mask = 0;
+    was_clean = false;
+
+    // the keys can tell which entries share a name, so only the owner
+    // reads the file (one made 0644 by an older version included)
+    fd = open(file_name.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd == -1 || fchmod(fd, 0600) == -1) {
+        return;
+    }
+
+    // anything that isn't a complete index of this version starts over
+    Header existing;
+    struct stat st;
+    bool valid = fstat(fd, &st) == 0 && (size_t)st.st_size >= HEADER_SIZE &&
+        pread(fd, &existing, sizeof(existing), 0) == sizeof(existing) &&
+        memcmp(existing.magic, MAGIC, sizeof(MAGIC)) == 0 &&
+        existing.version == FORMAT_VERSION && existing.slots >= MIN_SLOTS &&
+        (existing.slots & (existing.slots - 1)) == 0 &&
+        (size_t)st.st_size == HEADER_SIZE + existing.slots * sizeof(Entry);
+
+    if (!map(valid ? existing.slots : MIN_SLOTS)) {
+        return;
+    }
+    if (valid) {
+        was_clean = header->clean == 1;
+    }
+    else {
+        memset(mapping, 0, mapping_size);
+        memcpy(header->magic, MAGIC, sizeof(MAGIC));
+        header->version = FORMAT_VERSION;
+        header->slots = MIN_SLOTS;
+        header->count = 0;
+    }
+
+    // a crash from here on leaves the index marked dirty
+    header->clean = 0;
+    if (msync(mapping, HEADER_SIZE, MS_SYNC) == -1) {
+        munmap(mapping, mapping_size);
+        mapping = nullptr;
+    }
+}
+
+HashIndex::~HashIndex() {
+    if (mapping != nullptr) {
+        // the entries must be on disk before the header says they are
+        if (msync(mapping, mapping_size, MS_SYNC) == 0) {
+            header->clean = 1;
+            msync(mapping, HEADER_SIZE, MS_SYNC);
+        }
+        munmap(mapping, mapping_size);
+    }
+    if (fd != -1) {
+        close(fd);
+    }
+}
+
+bool HashIndex::map(size_t slots) {
+    if (mapping != nullptr) {
+        munmap(mapping, mapping_size);
+        mapping = nullptr;
+    }
+
+    size_t size = HEADER_SIZE + slots * sizeof(Entry);
+    if (ftruncate(fd, size) == -1) {
+        return false;
+    }
+    void* address = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+        fd, 0);
+    if (address == MAP_FAILED) {
+        return false;
+    }
+
+    mapping = (char*)address;
+    mapping_size = size;
+    header = (Header*)mapping;
+    table = (Entry*)(mapping + HEADER_SIZE);
+    mask = slots - 1;
+    return true;
+}
+
+bool HashIndex::resize(size_t slots) {
+    vector<Entry> entries;
+    entries.reserve(header->count);
+    for (size_t i = 0; i <= mask; i++) {
+        if (table[i].id != 0) {
+            entries.push_back(table[i]);
+        }
+    }
+
+    if (!map(slots)) {
+        return false;
+    }
+    memset(table, 0, slots * sizeof(Entry));
+    header->slots = slots;
+    header->count = 0;
+    for (const Entry &entry : entries) {
+        insert(entry.key, entry.id);
+    }
+    return true;
+}
+
+size_t HashIndex::home(uint64_t key) const {
+    // mix so keys that are close together don't form one long probe run
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdull;
+    key ^= key >> 33;
+    return key & mask;
+}
+
+bool HashIndex::isOpen() {
+    return mapping != nullptr;
+}
+
+bool HashIndex::isCurrent(size_t count) {
+    return was_clean && header->count == count;
+}
+
+bool HashIndex::clear(size_t expected /*= 0*/) {
+    size_t slots = MIN_SLOTS;
+    while (slots < expected * 2) {
+        slots *= 2;
+    }
+    if (slots != mask + 1 && !map(slots)) {
+        return false;
+    }
+    memset(table, 0, slots * sizeof(Entry));
+    header->slots = slots;
+    header->count = 0;
+    return true;
+}
+
+bool HashIndex::insert(uint64_t key, int id) {
+    // keep the table at most half full
+    if ((header->count + 1) * 2 > mask + 1 && !resize((mask + 1) * 2)) {
+        return false;
+    }
+
+    size_t slot = home(key);
+    while (table[slot].id != 0) {
+        slot = (slot + 1) & mask;
+    }
+    table[slot].key = key;
+    table[slot].id = id;
+    header->count++;
+    return true;
+}
+
+bool HashIndex::erase(uint64_t key, int id) {
+    size_t slot = home(key);
+    while (table[slot].id != 0 &&
+        (table[slot].key != key || table[slot].id != id)) {
+        slot = (slot + 1) & mask;
+    }
+    if (table[slot].id == 0) {
+        return false;
+    }
+
+    table[slot].id = 0;
+    header->count--;
+
+    // shift back later entries of the probe run that could live at slot
+    size_t next = (slot + 1) & mask;
+    while (table[next].id != 0) {
+        size_t next_home = home(table[next].key);
+        if (((next - next_home) & mask) >= ((next - slot) & mask)) {
+            table[slot] = table[next];
+            table[next].id = 0;
+            slot = next;
+        }
+        next = (next + 1) & mask;
+    }
+    return true;
+}
+
+void HashIndex::find(uint64_t key, vector<int> &ids) const {
+    for (size_t slot = home(key); table[slot].id != 0;
+        slot = (slot + 1) & mask) {
+        if (table[slot].key == key) {
+            ids.push_back(table[slot].id);
+        }
+    }
+}
+
+size_t HashIndex::getCount() const {
+    return header->count;
+}
@@ -0,0 +1,227 @@
+// =============================================================================
+// File: Ingest.cpp
+// =============================================================================
+// Description:
+//      This file implements the Ingest class.
+// =============================================================================
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "Ingest.h"
+#include "utility.h"
+
+using namespace std;
+using namespace utility;
+
+namespace {
+    // indexed by Bank::Result
+    const char* const STATUSES[] = { "ok", "invalid_login", "invalid_amount",
+        "too_much_money", "insufficient_funds", "name_too_long", "no_room",
+        "failed" };
+
+    // ==== nextField ==========================================================
+    // Returns the end of the field starting at begin & moves begin past it.
+    // =============================================================================
+    const char* nextField(const char* &begin, const char* end) {
+        const char* comma = (const char*)memchr(begin, ',', end - begin);
+        begin = comma == nullptr ? end : comma + 1;
+        return comma == nullptr ? end : comma;
+    }
+
+    bool matches(const char* begin, const char* end, const char* word) {
+        size_t size = strlen(word);
+        return (size_t)(end - begin) == size && memcmp(begin, word, size) == 0;
+    }
+}
+
+Ingest::Ingest(Bank &bank) : bank(bank) {
+    results = nullptr;
+    applied = 0;
+    rejected = 0;
+}
+
+bool Ingest::parseId(const char* begin, const char* end, int &id) {
+    if (begin == end || end - begin > 9) {
+        return false;
+    }
+    id = 0;
+    for (const char* c = begin; c < end; c++) {
+        if (*c < '0' || *c > '9') {
+            return false;
+        }
+        id = id * 10 + (*c - '0');
+    }
+    return id > 0;
+}
+
+bool Ingest::parseLine(const char* begin, const char* end,
+    Bank::Transaction &transaction) {
+    const char* op_begin = begin;
+    const char* op_end = nextField(begin, end);
+    const char* id_begin = begin;
+    const char* id_end = nextField(begin, end);
+    const char* name_begin = begin;
+    const char* name_end = nextField(begin, end);
+    const char* amount_begin = begin;
+    const char* amount_end = nextField(begin, end);
+    if (begin != end) {
+        return false; // more than 4 fields
+    }
+
+    transaction.id = 0;
+    transaction.amount = 0;
+    transaction.name = string_view();
+    if (matches(op_begin, op_end, "create")) {
+        transaction.op = Bank::Transaction::Op::create;
+        transaction.name = string_view(name_begin, name_end - name_begin);
+        return id_begin == id_end && name_begin != name_end &&
+            (amount_begin == amount_end ||
+            parseCents(amount_begin, amount_end, transaction.amount));
+    }
+    if (matches(op_begin, op_end, "deposit")) {
+        transaction.op = Bank::Transaction::Op::deposit;
+    }
+    else if (matches(op_begin, op_end, "withdraw")) {
+        transaction.op = Bank::Transaction::Op::withdraw;
+    }
+    else if (matches(op_begin, op_end, "close")) {
+        transaction.op = Bank::Transaction::Op::close;
+        return parseId(id_begin, id_end, transaction.id) &&
+            amount_begin == amount_end;
+    }
+    else {
+        return false;
+    }
+    return parseId(id_begin, id_end, transaction.id) &&
+        parseCents(amount_begin, amount_end, transaction.amount);
+}
+
+bool Ingest::run(const string &file_name, const string &results_name) {
+    int fd = open(file_name.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        cout << "Failed to open " << file_name << endl;
+        if (fd != -1) {
+            close(fd);
+        }
+        return false;
+    }
+    size_t size = st.st_size;
+    const char* data = nullptr;
+    if (size > 0) {
+        void* address = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (address == MAP_FAILED) {
+            cout << "Failed to map " << file_name << endl;
+            close(fd);
+            return false;
+        }
+        data = (const char*)address;
+        madvise(address, size, MADV_SEQUENTIAL);
+    }
+    close(fd);
+
+    results = fopen(results_name.c_str(), "w");
+    if (results == nullptr) {
+        cout << "Failed to create " << results_name << endl;
+        if (data != nullptr) {
+            munmap((void*)data, size);
+        }
+        return false;
+    }
+    setvbuf(results, nullptr, _IOFBF, 1 << 20);
+
+    // every change is committed once per chunk, before its results are written
+    auto start = chrono::steady_clock::now();
+    bank.setDeferredSync(true);
+    transactions.reserve(CHUNK_SIZE);
+    lines.reserve(CHUNK_SIZE);
+    bool healthy = true;
+    size_t line = 0;
+    const char* end = data + size;
+    for (const char* begin = data; begin < end && healthy; ) {
+        const char* newline = (const char*)memchr(begin, '\n', end - begin);
+        const char* line_end = newline == nullptr ? end : newline;
+        const char* next = newline == nullptr ? end : newline + 1;
+        if (line_end > begin && line_end[-1] == '\r') {
+            line_end--;
+        }
+        line++;
+
+        bool skip = line_end == begin || *begin == '#' || (line == 1 &&
+            line_end - begin >= 3 && memcmp(begin, "op,", 3) == 0);
+        if (!skip) {
+            Bank::Transaction transaction;
+            if (parseLine(begin, line_end, transaction)) {
+                transactions.push_back(transaction);
+                lines.push_back(line);
+            }
+            else {
+                rejects.push_back(line);
+            }
+            if (transactions.size() + rejects.size() == CHUNK_SIZE) {
+                healthy = applyChunk();
+            }
+        }
+        begin = next;
+    }
+    healthy = healthy && applyChunk();
+    bank.setDeferredSync(false);
+
+    if (data != nullptr) {
+        munmap((void*)data, size);
+    }
+    healthy = fclose(results) == 0 && healthy;
+    results = nullptr;
+
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+    cout << applied << " transactions applied, " << rejected
+        << " rejected in " << elapsed.count() << " sec (results in "
+        << results_name << ")\n";
+    return healthy;
+}
+
+bool Ingest::applyChunk() {
+    bank.applyTransactions(transactions);
+    if (!bank.sync()) {
+        cout << "Committing transactions failed\n";
+        return false;
+    }
+
+    // results go out in line order: merge the applied & unparsed lines
+    char buffer[96];
+    size_t r = 0;
+    for (size_t t = 0; t <= transactions.size(); t++) {
+        size_t line = t < transactions.size() ? lines[t] : SIZE_MAX;
+        for (; r < rejects.size() && rejects[r] < line; r++) {
+            fprintf(results, "%zu,malformed,,\n", rejects[r]);
+            rejected++;
+        }
+        if (t == transactions.size()) {
+            break;
+        }
+
+        const Bank::Transaction &transaction = transactions[t];
+        int length;
+        if (transaction.result == Bank::Result::ok) {
+            length = snprintf(buffer, sizeof(buffer), "%zu,ok,%d,%s\n", line,
+                transaction.id, formatCents(transaction.balance).c_str());
+            applied++;
+        }
+        else {
+            length = snprintf(buffer, sizeof(buffer), "%zu,%s,%d,\n", line,
+                STATUSES[(size_t)transaction.result], transaction.id);
+            rejected++;
+        }
+        fwrite(buffer, 1, length, results);
+    }
+
+    transactions.clear();
+    lines.clear();
+    rejects.clear();
+    return ferror(results) == 0;
+}
@@ -0,0 +1,218 @@
+// =============================================================================
+// File: IntentLog.cpp
+// =============================================================================
+// Description:
+//      This file is the implementation of the IntentLog class.
+// =============================================================================
+
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <utility>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "Checksum.h"
+#include "IntentLog.h"
+#include "Stats.h"
+
+using namespace ral;
+
+namespace {
+    // === EntryHeader =========================================================
+    // Precedes every entry of the log: an intent (its parts, each a size &
+    // its bytes) or a part done (no data). crc covers the fields after it &
+    // the data.
+    // =========================================================================
+    struct EntryHeader {
+        uint32_t magic;
+        uint32_t crc;
+        uint64_t transaction;
+        uint32_t part;
+        uint32_t size;
+    };
+
+    const uint32_t INTENT_MAGIC = 0x54424E4F; // "ONBT"
+    const uint32_t DONE_MAGIC = 0x43424E4F;   // "ONBC"
+
+    uint32_t entryCrc(const EntryHeader &header, const char* data) {
+        uint32_t crc = crc32c(&header.transaction, sizeof(header) -
+            offsetof(EntryHeader, transaction));
+        return crc32c(data, header.size, crc);
+    }
+}
+
+IntentLog::IntentLog(string file_name, PartRedoer redo) {
+    this->file_name = file_name;
+    log_size = 0;
+    next_transaction = 1;
+
+    fd = open(file_name.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    failed = fd == -1 || !recover(redo);
+}
+
+IntentLog::~IntentLog() {
+    if (fd != -1) {
+        close(fd);
+    }
+}
+
+bool IntentLog::isOpen() {
+    return !failed;
+}
+
+bool IntentLog::recover(const PartRedoer &redo) {
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        return false;
+    }
+    if (st.st_size == 0) {
+        return true;
+    }
+
+    string log(st.st_size, '\0');
+    size_t read_bytes = 0;
+    while (read_bytes < log.size()) {
+        ssize_t n = pread(fd, &log[read_bytes], log.size() - read_bytes,
+            read_bytes);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        read_bytes += n;
+    }
+
+    // an entry is only acknowledged once it & all before it are synced, so
+    // the log ends at the first torn one
+    vector<pair<uint64_t, vector<string>>> intents;
+    unordered_map<uint64_t, size_t> found; // transaction -> index in intents
+    size_t offset = 0;
+    while (offset + sizeof(EntryHeader) <= log.size()) {
+        EntryHeader header;
+        memcpy(&header, &log[offset], sizeof(header));
+        const char* data = &log[offset + sizeof(header)];
+        if ((header.magic != INTENT_MAGIC && header.magic != DONE_MAGIC) ||
+            header.size > log.size() - offset - sizeof(header) ||
+            entryCrc(header, data) != header.crc) {
+            break;
+        }
+        offset += sizeof(header) + header.size;
+
+        if (header.magic == INTENT_MAGIC) {
+            vector<string> parts;
+            size_t at = 0;
+            for (uint32_t i = 0; i < header.part &&
+                at + sizeof(uint32_t) <= header.size; i++) {
+                uint32_t size;
+                memcpy(&size, data + at, sizeof(size));
+                if (size > header.size - at - sizeof(size)) {
+                    break;
+                }
+                parts.emplace_back(data + at + sizeof(size), size);
+                at += sizeof(size) + size;
+            }
+            found[header.transaction] = intents.size();
+            intents.emplace_back(header.transaction, parts);
+            continue;
+        }
+        auto intent = found.find(header.transaction);
+        if (intent != found.end() &&
+            header.part < intents[intent->second].second.size()) {
+            // a part done needs no redo
+            intents[intent->second].second[header.part].clear();
+        }
+    }
+
+    for (const pair<uint64_t, vector<string>> &intent : intents) {
+        for (const string &part : intent.second) {
+            if (!part.empty() && !redo(intent.first, part)) {
+                return false;
+            }
+        }
+    }
+    Stats::countIo(0, 0, 1);
+    return ftruncate(fd, 0) == 0 && fdatasync(fd) == 0;
+}
+
+bool IntentLog::append(uint64_t transaction, uint32_t part,
+    const char* data, size_t size) {
+    EntryHeader header;
+    header.magic = data == nullptr ? DONE_MAGIC : INTENT_MAGIC;
+    header.transaction = transaction;
+    header.part = part;
+    header.size = size;
+    header.crc = entryCrc(header, data);
+    buffer.assign((const char*)&header, sizeof(header));
+    buffer.append(data == nullptr ? "" : data, size);
+
+    const char* bytes = buffer.data();
+    size_t left = buffer.size();
+    off_t offset = log_size;
+    while (left > 0) {
+        ssize_t n = pwrite(fd, bytes, left, offset);
+        Stats::countIo(0, n > 0 ? n : 0, 1);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        bytes += n;
+        left -= n;
+        offset += n;
+    }
+    log_size = offset;
+    return true;
+}
+
+uint64_t IntentLog::begin(const vector<string> &parts) {
+    string data;
+    for (const string &part : parts) {
+        uint32_t size = part.size();
+        data.append((const char*)&size, sizeof(size));
+        data.append(part);
+    }
+
+    uint64_t transaction;
+    {
+        lock_guard<mutex> guard(lock);
+        transaction = next_transaction++;
+        if (!append(transaction, parts.size(), data.data(), data.size())) {
+            return 0;
+        }
+        open_parts[transaction] = parts.size();
+    }
+    // synced outside the lock, so concurrent transactions share syncs
+    Stats::countIo(0, 0, 1);
+    return fdatasync(fd) == 0 ? transaction : 0;
+}
+
+bool IntentLog::commitPart(uint64_t transaction, size_t part) {
+    {
+        lock_guard<mutex> guard(lock);
+        if (!append(transaction, part, nullptr, 0)) {
+            return false;
+        }
+    }
+    Stats::countIo(0, 0, 1);
+    if (fdatasync(fd) != 0) {
+        return false;
+    }
+
+    // every entry left is synced & every part of its intent done, so the
+    // file can be emptied (the next entry's sync makes that stick)
+    lock_guard<mutex> guard(lock);
+    auto left = open_parts.find(transaction);
+    if (left != open_parts.end() && --left->second == 0) {
+        open_parts.erase(left);
+    }
+    if (open_parts.empty() && log_size > 0) {
+        if (ftruncate(fd, 0) != 0) {
+            return false;
+        }
+        log_size = 0;
+    }
+    return true;
+}
@@ -0,0 +1,348 @@
+// =============================================================================
+// File: Journal.cpp
+// =============================================================================
+// Description:
+//      This file is the implementation of the Journal class.
+// =============================================================================
+
+#include <cerrno>
+#include <cstddef>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "Checksum.h"
+#include "Journal.h"
+#include "Stats.h"
+
+using namespace ral;
+
+namespace {
+    // === EntryHeader =========================================================
+    // Precedes every record image in the log. crc covers the fields after it
+    // & the image. Every entry of a group but the last has GROUP_MAGIC.
+    // =========================================================================
+    struct EntryHeader {
+        uint32_t magic;
+        uint32_t crc;
+        uint64_t lsn;
+        int32_t id;
+        uint32_t size;
+    };
+
+    const uint32_t ENTRY_MAGIC = 0x4A424E4F; // "ONBJ"
+    const uint32_t GROUP_MAGIC = 0x47424E4F; // "ONBG"
+
+    uint32_t entryCrc(const EntryHeader &header, const char* record) {
+        uint32_t crc = crc32c(&header.lsn, sizeof(header) -
+            offsetof(EntryHeader, lsn));
+        return crc32c(record, header.size, crc);
+    }
+
+    bool writeAll(int fd, const char* bytes, size_t size, off_t offset) {
+        while (size > 0) {
+            ssize_t n = pwrite(fd, bytes, size, offset);
+            Stats::countIo(0, n > 0 ? n : 0, 1);
+            if (n == -1 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                return false;
+            }
+            bytes += n;
+            size -= n;
+            offset += n;
+        }
+        return true;
+    }
+}
+
+Journal::Journal(string file_name, size_t record_size,
+    RecordWriter write_records, RafSyncer sync_raf) {
+    this->file_name = file_name;
+    this->record_size = record_size;
+    this->write_records = write_records;
+    this->sync_raf = sync_raf;
+    next_lsn = 1;
+    durable_lsn = 0;
+    log_size = 0;
+    flushing = false;
+    failed = false;
+    stopping = false;
+
+    fd = open(file_name.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd == -1 || !replay()) {
+        failed = true;
+        return;
+    }
+
+    checkpointer = thread(&Journal::runCheckpointer, this);
+}
+
+Journal::~Journal() {
+    if (checkpointer.joinable()) {
+        {
+            lock_guard<mutex> guard(lock);
+            stopping = true;
+        }
+        wake.notify_all();
+        checkpointer.join();
+
+        if (!checkpoint(true)) {
+            cout << "Checkpointing " << file_name << " failed\n";
+        }
+    }
+    if (fd != -1) {
+        close(fd);
+    }
+}
+
+bool Journal::isOpen() {
+    return !failed;
+}
+
+bool Journal::replay() {
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        return false;
+    }
+    if (st.st_size == 0) {
+        return true;
+    }
+
+    string log(st.st_size, '\0');
+    size_t read_bytes = 0;
+    while (read_bytes < log.size()) {
+        ssize_t n = pread(fd, &log[read_bytes], log.size() - read_bytes,
+            read_bytes);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        read_bytes += n;
+    }
+
+    // the latest intact image of each record is written; a torn tail was
+    // never committed, & neither was a group it cuts short
+    unordered_map<int, const char*> latest;
+    vector<pair<int, const char*>> group;
+    size_t offset = 0;
+    uint64_t last_lsn = 0;
+    while (offset + sizeof(EntryHeader) <= log.size()) {
+        EntryHeader header;
+        memcpy(&header, &log[offset], sizeof(header));
+        const char* record = &log[offset + sizeof(header)];
+        if ((header.magic != ENTRY_MAGIC && header.magic != GROUP_MAGIC) ||
+            header.size != record_size ||
+            offset + sizeof(header) + header.size > log.size() ||
+            header.lsn <= last_lsn || entryCrc(header, record) != header.crc) {
+            break;
+        }
+
+        group.emplace_back(header.id, record);
+        if (header.magic == ENTRY_MAGIC) {
+            for (const pair<int, const char*> &entry : group) {
+                latest[entry.first] = entry.second;
+            }
+            stats.replayed += group.size();
+            group.clear();
+        }
+        last_lsn = header.lsn;
+        offset += sizeof(header) + header.size;
+    }
+
+    vector<pair<int, const char*>> images(latest.begin(), latest.end());
+    if ((!images.empty() && !write_records(images)) || !sync_raf() ||
+        ftruncate(fd, 0) == -1 || fdatasync(fd) == -1) {
+        return false;
+    }
+
+    if (stats.replayed > 0) {
+        cout << "Replayed " << stats.replayed << " records from " << file_name
+            << endl;
+    }
+    return true;
+}
+
+uint64_t Journal::append(int id, const char* record) {
+    return appendGroup(&id, record, 1);
+}
+
+uint64_t Journal::appendGroup(const int* ids, const char* records,
+    size_t count) {
+    // the group goes into the buffer in one piece, so a commit writes all
+    // of it or none
+    lock_guard<mutex> guard(lock);
+    EntryHeader header;
+    header.lsn = 0;
+    for (size_t i = 0; i < count; i++) {
+        const char* record = records + i * record_size;
+        header.magic = i + 1 == count ? ENTRY_MAGIC : GROUP_MAGIC;
+        header.lsn = next_lsn++;
+        header.id = ids[i];
+        header.size = record_size;
+        header.crc = entryCrc(header, record);
+
+        buffer.append((const char*)&header, sizeof(header));
+        buffer.append(record, record_size);
+
+        Pending &image = pending[ids[i]];
+        image.lsn = header.lsn;
+        image.record.assign(record, record_size);
+        stats.appends++;
+    }
+
+    if (log_size + buffer.size() > CHECKPOINT_BYTES) {
+        wake.notify_one();
+    }
+    return header.lsn;
+}
+
+bool Journal::flush(unique_lock<mutex> &guard) {
+    if (flushing) {
+        // the next commit will pick up whatever was appended meanwhile
+        flushed.wait(guard);
+        return !failed;
+    }
+    if (buffer.empty() || failed) {
+        return !failed;
+    }
+
+    flushing = true;
+    string batch;
+    batch.swap(buffer);
+    uint64_t last_lsn = next_lsn - 1;
+    off_t offset = log_size;
+
+    guard.unlock();
+    bool written = writeAll(fd, batch.data(), batch.size(), offset) &&
+        fdatasync(fd) == 0;
+    Stats::countIo(0, 0, 1);
+    guard.lock();
+
+    flushing = false;
+    if (written) {
+        durable_lsn = last_lsn;
+        log_size = offset + batch.size();
+        stats.commits++;
+    }
+    else {
+        failed = true;
+    }
+    flushed.notify_all();
+    return written;
+}
+
+bool Journal::commit(uint64_t lsn) {
+    unique_lock<mutex> guard(lock);
+    while (durable_lsn < lsn && !failed) {
+        if (!flush(guard)) {
+            return false;
+        }
+    }
+    return !failed;
+}
+
+bool Journal::commitAll() {
+    uint64_t lsn;
+    {
+        lock_guard<mutex> guard(lock);
+        lsn = next_lsn - 1;
+    }
+    return commit(lsn);
+}
+
+bool Journal::find(int id, char* record) {
+    lock_guard<mutex> guard(lock);
+    auto image = pending.find(id);
+    if (image == pending.end()) {
+        return false;
+    }
+    memcpy(record, image->second.record.data(), record_size);
+    return true;
+}
+
+void Journal::getImages(vector<pair<int, string>> &images) {
+    lock_guard<mutex> guard(lock);
+    for (const auto &image : pending) {
+        images.emplace_back(image.first, image.second.record);
+    }
+}
+
+bool Journal::checkpoint(bool force) {
+    unique_lock<mutex> guard(lock);
+    while ((flushing || !buffer.empty()) && !failed) {
+        if (!flush(guard)) {
+            return false;
+        }
+    }
+    if (failed) {
+        return false;
+    }
+    if (!pending.empty()) {
+        // every pending image is durable in the log now
+        vector<pair<int, Pending>> images(pending.begin(), pending.end());
+        if (!force) {
+            guard.unlock();
+        }
+
+        vector<pair<int, const char*>> records;
+        for (const auto &image : images) {
+            records.emplace_back(image.first, image.second.record.data());
+        }
+        bool written = write_records(records) && sync_raf();
+
+        if (!force) {
+            guard.lock();
+        }
+        if (!written) {
+            return false;
+        }
+
+        // forget the images that weren't replaced while they were written
+        for (const auto &image : images) {
+            auto current = pending.find(image.first);
+            if (current != pending.end() &&
+                current->second.lsn == image.second.lsn) {
+                pending.erase(current);
+            }
+        }
+    }
+
+    // the log can be emptied once nothing in it still needs it
+    if (pending.empty() && buffer.empty() && !flushing && log_size > 0) {
+        if (ftruncate(fd, 0) == -1) {
+            failed = true;
+            return false;
+        }
+        log_size = 0;
+        stats.checkpoints++;
+    }
+    return true;
+}
+
+void Journal::runCheckpointer() {
+    unique_lock<mutex> guard(lock);
+    while (!stopping) {
+        wake.wait_for(guard, chrono::milliseconds(CHECKPOINT_INTERVAL_MS));
+        if (stopping || (pending.empty() && log_size == 0)) {
+            continue;
+        }
+
+        bool force = log_size + buffer.size() > CHECKPOINT_BYTES;
+        guard.unlock();
+        if (!checkpoint(force)) {
+            cout << "Checkpointing " << file_name << " failed\n";
+        }
+        guard.lock();
+    }
+}
+
+JournalStats Journal::getStats() {
+    lock_guard<mutex> guard(lock);
+    return stats;
+}
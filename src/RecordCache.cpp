@@ -0,0 +1,198 @@
+// =============================================================================
+// File: RecordCache.cpp
+// =============================================================================
+// Description:
+//      This file is the implementation of the RecordCache class.
+// =============================================================================
+
+#include <cstring>
+#include "RecordCache.h"
+
+using namespace ral;
+
+RecordCache::RecordCache(size_t capacity, size_t record_size) {
+    this->record_size = record_size;
+    entries.resize(capacity);
+    records.resize(capacity * record_size);
+
+    // keep the table at most half full
+    size_t table_size = 2;
+    while (table_size < capacity * 2) {
+        table_size *= 2;
+    }
+    table.assign(table_size, NONE);
+    mask = table_size - 1;
+
+    head = NONE;
+    tail = NONE;
+    used = 0;
+    stats.capacity = capacity;
+}
+
+size_t RecordCache::findSlot(int id) const {
+    size_t slot = ((uint32_t)id * 2654435761u) & mask;
+    while (table[slot] != NONE && entries[table[slot]].id != id) {
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+void RecordCache::unlink(int32_t entry) {
+    Entry &e = entries[entry];
+    if (e.previous != NONE) {
+        entries[e.previous].next = e.next;
+    }
+    else {
+        head = e.next;
+    }
+    if (e.next != NONE) {
+        entries[e.next].previous = e.previous;
+    }
+    else {
+        tail = e.previous;
+    }
+}
+
+void RecordCache::pushFront(int32_t entry) {
+    Entry &e = entries[entry];
+    e.previous = NONE;
+    e.next = head;
+    if (head != NONE) {
+        entries[head].previous = entry;
+    }
+    head = entry;
+    if (tail == NONE) {
+        tail = entry;
+    }
+}
+
+void RecordCache::removeFromTable(size_t slot) {
+    table[slot] = NONE;
+
+    // shift back later entries of the probe run that could live at slot
+    size_t next = (slot + 1) & mask;
+    while (table[next] != NONE) {
+        size_t home = ((uint32_t)entries[table[next]].id * 2654435761u) &
+            mask;
+        if (((next - home) & mask) >= ((next - slot) & mask)) {
+            table[slot] = table[next];
+            table[next] = NONE;
+            slot = next;
+        }
+        next = (next + 1) & mask;
+    }
+}
+
+const char* RecordCache::find(int id) {
+    int32_t entry = table[findSlot(id)];
+    if (entry == NONE) {
+        stats.misses++;
+        return nullptr;
+    }
+
+    stats.hits++;
+    if (entry != head) {
+        unlink(entry);
+        pushFront(entry);
+    }
+    return &records[entry * record_size];
+}
+
+bool RecordCache::insert(int id, const char* record, bool dirty,
+    int &evicted_id, char* evicted_record) {
+    if (entries.empty()) {
+        return false;
+    }
+
+    bool evicted_dirty = false;
+    size_t slot = findSlot(id);
+    int32_t entry = table[slot];
+
+    if (entry != NONE) {
+        unlink(entry); // the new copy replaces the old, dirty or not
+    }
+    else if (used < entries.size()) {
+        entry = used++;
+        table[slot] = entry;
+    }
+    else {
+        // reuse the least recently used entry
+        entry = tail;
+        unlink(entry);
+        stats.evictions++;
+        if (entries[entry].dirty) {
+            evicted_dirty = true;
+            evicted_id = entries[entry].id;
+            memcpy(evicted_record, &records[entry * record_size],
+                record_size);
+            stats.writebacks++;
+        }
+        removeFromTable(findSlot(entries[entry].id));
+        table[findSlot(id)] = entry;
+    }
+
+    entries[entry].id = id;
+    entries[entry].dirty = dirty;
+    memcpy(&records[entry * record_size], record, record_size);
+    pushFront(entry);
+    return evicted_dirty;
+}
+
+void RecordCache::erase(int id) {
+    size_t slot = findSlot(id);
+    int32_t entry = table[slot];
+    if (entry == NONE) {
+        return;
+    }
+
+    unlink(entry);
+    removeFromTable(slot);
+
+    // keep entries [0, used) packed by moving the last entry into the hole
+    int32_t last = --used;
+    if (entry != last) {
+        table[findSlot(entries[last].id)] = entry;
+        unlink(last);
+        entries[entry] = entries[last];
+        memcpy(&records[entry * record_size], &records[last * record_size],
+            record_size);
+
+        // put it back where it was in the LRU order
+        Entry &e = entries[entry];
+        if (e.previous != NONE) {
+            entries[e.previous].next = entry;
+        }
+        else {
+            head = entry;
+        }
+        if (e.next != NONE) {
+            entries[e.next].previous = entry;
+        }
+        else {
+            tail = entry;
+        }
+    }
+}
+
+void RecordCache::getDirtyIds(vector<int> &ids) const {
+    for (size_t i = 0; i < used; i++) {
+        if (entries[i].dirty) {
+            ids.push_back(entries[i].id);
+        }
+    }
+}
+
+const char* RecordCache::markClean(int id) {
+    int32_t entry = table[findSlot(id)];
+    if (entry == NONE) {
+        return nullptr;
+    }
+    entries[entry].dirty = false;
+    return &records[entry * record_size];
+}
+
+CacheStats RecordCache::getStats() const {
+    CacheStats current = stats;
+    current.size = used;
+    return current;
+}
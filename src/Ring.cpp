@@ -0,0 +1,387 @@
+// =============================================================================
+// File: Ring.cpp
+// =============================================================================
+// Description:
+//      This file is the implementation of the Ring class.
+// =============================================================================
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "Ring.h"
+#include "Stats.h"
+
+using namespace ral;
+
+namespace {
+    // the user_data of the sync linked after a write is tagged in bit 0
+    const uint64_t SYNC_TAG = 1;
+
+    int setupRing(unsigned entries, io_uring_params* params) {
+        return syscall(__NR_io_uring_setup, entries, params);
+    }
+
+    int enterRing(int ring_fd, unsigned to_submit, unsigned min_complete,
+        unsigned flags) {
+        return syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete,
+            flags, nullptr, 0);
+    }
+
+    int registerRing(int ring_fd, unsigned opcode, void* arg,
+        unsigned count) {
+        return syscall(__NR_io_uring_register, ring_fd, opcode, arg, count);
+    }
+
+    // pread/pwrite all of size bytes, retrying short transfers; the bytes
+    // moved (short only at end of file) or -errno
+    ssize_t transferAll(int fd, char* buffer, size_t size, off_t offset,
+        bool write) {
+        size_t moved = 0;
+        while (moved < size) {
+            ssize_t n = write ? pwrite(fd, buffer + moved, size - moved,
+                offset + moved) : pread(fd, buffer + moved, size - moved,
+                offset + moved);
+            Stats::countIo(write ? 0 : max(n, (ssize_t)0),
+                write ? max(n, (ssize_t)0) : 0, 1);
+            if (n == -1 && errno == EINTR) {
+                continue;
+            }
+            if (n == -1) {
+                return -errno;
+            }
+            if (n == 0) {
+                break;
+            }
+            moved += n;
+        }
+        return moved;
+    }
+}
+
+atomic<bool> Ring::enabled(true);
+
+Ring::Ring(unsigned entries /*= DEFAULT_ENTRIES*/) {
+    this->entries = entries;
+    ring_fd = -1;
+    sq_mapping = nullptr;
+    cq_mapping = nullptr;
+    sqes = nullptr;
+    unsubmitted = 0;
+    in_flight = 0;
+    operations = 0;
+    if (enabled.load(memory_order_relaxed) && !setup()) {
+        ring_fd = -1;
+    }
+}
+
+Ring::~Ring() {
+    while (getPending() > 0 && complete(getPending()) > 0) {
+    }
+    teardown();
+    for (Operation* operation : spare) {
+        delete operation;
+    }
+}
+
+Ring& Ring::local() {
+    static thread_local Ring ring;
+    return ring;
+}
+
+void Ring::setEnabled(bool enabled) {
+    Ring::enabled.store(enabled, memory_order_relaxed);
+}
+
+bool Ring::usesIoUring() {
+    return ring_fd != -1;
+}
+
+bool Ring::setup() {
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ring_fd = setupRing(entries, &params);
+    if (ring_fd == -1) {
+        return false; // ENOSYS, EPERM (disabled), ENOMEM...
+    }
+
+    // kernels before 5.6 don't have IORING_OP_READ/WRITE
+    size_t probe_size = sizeof(io_uring_probe) +
+        256 * sizeof(io_uring_probe_op);
+    unique_ptr<char[]> probe_bytes(new char[probe_size]());
+    io_uring_probe* probe = (io_uring_probe*)probe_bytes.get();
+    if (registerRing(ring_fd, IORING_REGISTER_PROBE, probe, 256) == -1) {
+        teardown();
+        return false;
+    }
+    for (unsigned op : { IORING_OP_READ, IORING_OP_WRITE, IORING_OP_FSYNC }) {
+        if (op > probe->last_op ||
+            !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+            teardown();
+            return false;
+        }
+    }
+
+    sq_mapping_size = params.sq_off.array + params.sq_entries *
+        sizeof(unsigned);
+    cq_mapping_size = params.cq_off.cqes + params.cq_entries *
+        sizeof(io_uring_cqe);
+    bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single) {
+        sq_mapping_size = cq_mapping_size = max(sq_mapping_size,
+            cq_mapping_size);
+    }
+    sq_mapping = mmap(nullptr, sq_mapping_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+    if (sq_mapping == MAP_FAILED) {
+        sq_mapping = nullptr;
+        teardown();
+        return false;
+    }
+    cq_mapping = single ? sq_mapping : mmap(nullptr, cq_mapping_size,
+        PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd,
+        IORING_OFF_CQ_RING);
+    if (cq_mapping == MAP_FAILED) {
+        cq_mapping = nullptr;
+        teardown();
+        return false;
+    }
+    sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    void* sqes_mapping = mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+    if (sqes_mapping == MAP_FAILED) {
+        teardown();
+        return false;
+    }
+    sqes = (io_uring_sqe*)sqes_mapping;
+
+    char* sq = (char*)sq_mapping;
+    char* cq = (char*)cq_mapping;
+    entries = params.sq_entries;
+    sq_head = (unsigned*)(sq + params.sq_off.head);
+    sq_tail = (unsigned*)(sq + params.sq_off.tail);
+    sq_mask = *(unsigned*)(sq + params.sq_off.ring_mask);
+    sq_array = (unsigned*)(sq + params.sq_off.array);
+    cq_head = (unsigned*)(cq + params.cq_off.head);
+    cq_tail = (unsigned*)(cq + params.cq_off.tail);
+    cq_mask = *(unsigned*)(cq + params.cq_off.ring_mask);
+    cq_entries = params.cq_entries;
+    cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+    return true;
+}
+
+void Ring::teardown() {
+    if (sqes != nullptr) {
+        munmap(sqes, sqes_size);
+        sqes = nullptr;
+    }
+    if (cq_mapping != nullptr && cq_mapping != sq_mapping) {
+        munmap(cq_mapping, cq_mapping_size);
+    }
+    cq_mapping = nullptr;
+    if (sq_mapping != nullptr) {
+        munmap(sq_mapping, sq_mapping_size);
+        sq_mapping = nullptr;
+    }
+    if (ring_fd != -1) {
+        close(ring_fd);
+        ring_fd = -1;
+    }
+}
+
+io_uring_sqe* Ring::nextSqe(unsigned count) {
+    // the kernel only copies sqes out on enter, & a full completion ring
+    // would drop (or on older kernels lose) cqes
+    while (*sq_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) + count >
+        entries || in_flight + unsubmitted + count > cq_entries) {
+        if (!enter(unsubmitted > 0 ? 0 : 1)) {
+            return nullptr;
+        }
+        reap();
+    }
+
+    io_uring_sqe* sqe = &sqes[*sq_tail & sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+void Ring::queue(io_uring_sqe* sqe) {
+    unsigned tail = *sq_tail;
+    sq_array[tail & sq_mask] = sqe - sqes;
+    __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+    unsubmitted++;
+}
+
+bool Ring::enter(unsigned wait_for) {
+    unsigned flags = wait_for > 0 ? IORING_ENTER_GETEVENTS : 0;
+    while (true) {
+        int submitted = enterRing(ring_fd, unsubmitted, wait_for, flags);
+        Stats::countIo(0, 0, 1);
+        if (submitted == -1 && errno == EINTR) {
+            continue;
+        }
+        if (submitted == -1) {
+            return false;
+        }
+        unsubmitted -= submitted;
+        in_flight += submitted;
+        if (unsubmitted == 0 || submitted == 0) {
+            return unsubmitted == 0;
+        }
+    }
+}
+
+size_t Ring::reap() {
+    size_t count = 0;
+    unsigned head;
+    // callbacks may queue (& so reap) more, so the head is read each time
+    while ((head = *cq_head) != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) {
+        const io_uring_cqe &cqe = cqes[head & cq_mask];
+        bool is_sync = cqe.user_data & SYNC_TAG;
+        Operation* operation = (Operation*)(cqe.user_data & ~SYNC_TAG);
+        ssize_t result = cqe.res;
+        __atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+        in_flight--;
+
+        // a write's byte count is its result unless it or its sync failed
+        if (result < 0 && operation->result >= 0) {
+            operation->result = result;
+        }
+        else if (!is_sync && result >= 0 && operation->result >= 0) {
+            operation->result = result;
+            Stats::countIo(operation->write ? 0 : result,
+                operation->write ? result : 0, 0);
+        }
+        if (--operation->pending == 0) {
+            // done may queue another operation, which can reuse this one
+            Completion done = move(operation->done);
+            result = operation->result;
+            spare.push_back(operation);
+            operations--;
+            done(result);
+            count++;
+        }
+    }
+    return count;
+}
+
+size_t Ring::runFinished() {
+    size_t count = 0;
+    // callbacks may queue more operations, so take the list first
+    while (!finished.empty()) {
+        vector<Finished> ready;
+        ready.swap(finished);
+        for (Finished &operation : ready) {
+            operation.done(operation.result);
+            count++;
+        }
+    }
+    return count;
+}
+
+void Ring::read(int fd, void* buffer, size_t size, off_t offset,
+    Completion done) {
+    io_uring_sqe* sqe = ring_fd == -1 ? nullptr : nextSqe(1);
+    if (sqe == nullptr) {
+        post(transferAll(fd, (char*)buffer, size, offset, false), done);
+        return;
+    }
+
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)buffer;
+    sqe->len = size;
+    sqe->off = offset;
+    sqe->user_data = (uint64_t)newOperation(done, 1, false);
+    queue(sqe);
+    operations++;
+}
+
+void Ring::write(int fd, const void* buffer, size_t size, off_t offset,
+    bool sync, bool data_only, Completion done) {
+    io_uring_sqe* sqe = ring_fd == -1 ? nullptr : nextSqe(sync ? 2 : 1);
+    if (sqe == nullptr) {
+        ssize_t result = transferAll(fd, (char*)buffer, size, offset, true);
+        if (result >= 0 && sync) {
+            Stats::countIo(0, 0, 1);
+            if ((data_only ? fdatasync(fd) : fsync(fd)) == -1) {
+                result = -errno;
+            }
+        }
+        post(result, done);
+        return;
+    }
+
+    Operation* operation = newOperation(done, sync ? 2 : 1, true);
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)buffer;
+    sqe->len = size;
+    sqe->off = offset;
+    sqe->flags = sync ? IOSQE_IO_LINK : 0;
+    sqe->user_data = (uint64_t)operation;
+    queue(sqe);
+    if (sync) {
+        sqe = &sqes[*sq_tail & sq_mask];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_FSYNC;
+        sqe->fd = fd;
+        sqe->fsync_flags = data_only ? IORING_FSYNC_DATASYNC : 0;
+        sqe->user_data = (uint64_t)operation | SYNC_TAG;
+        queue(sqe);
+    }
+    operations++;
+}
+
+Ring::Operation* Ring::newOperation(Completion &done, int pending,
+    bool write) {
+    Operation* operation;
+    if (spare.empty()) {
+        operation = new Operation();
+    }
+    else {
+        operation = spare.back();
+        spare.pop_back();
+    }
+    operation->done = move(done);
+    operation->result = 0;
+    operation->pending = pending;
+    operation->write = write;
+    return operation;
+}
+
+void Ring::post(ssize_t result, Completion done) {
+    finished.push_back({ move(done), result });
+}
+
+size_t Ring::complete(size_t wait_for /*= 0*/) {
+    size_t count = runFinished();
+    if (ring_fd == -1) {
+        return count;
+    }
+
+    while (true) {
+        count += reap();
+        size_t wanted = count < wait_for ? wait_for - count : 0;
+        wanted = min(wanted, operations);
+        if (unsubmitted == 0 && wanted == 0) {
+            break;
+        }
+        if (!enter(min(wanted, in_flight + unsubmitted))) {
+            break;
+        }
+        if (wanted == 0) {
+            count += reap();
+            break;
+        }
+    }
+    return count + runFinished();
+}
+
+size_t Ring::getPending() {
+    return operations + finished.size();
+}
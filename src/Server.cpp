@@ -0,0 +1,368 @@
+// =============================================================================
+// File: Server.cpp
+// =============================================================================
+// Description:
+//      This file implements the Server class.
+// =============================================================================
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "Server.h"
+#include "Stats.h"
+
+using namespace std;
+using namespace protocol;
+
+namespace {
+    volatile sig_atomic_t stopping = 0;
+    volatile sig_atomic_t dumping = 0;
+    volatile sig_atomic_t backup_requested = 0;
+
+    // a signal can land just before epoll_wait, so don't wait forever
+    const int WAIT_MS = 500;
+
+    void onSignal(int) {
+        Server::stop();
+    }
+
+    void onDumpSignal(int) {
+        dumping = 1;
+    }
+
+    void onBackupSignal(int) {
+        backup_requested = 1;
+    }
+}
+
+Server::Server(Bank &bank, string socket_path) : bank(bank) {
+    this->socket_path = socket_path;
+    listen_fd = -1;
+    epoll_fd = -1;
+    stats_interval_ms = 0;
+    backing_up = false;
+}
+
+Server::~Server() {
+    for (auto &session : sessions) {
+        close(session.first);
+    }
+    if (epoll_fd != -1) {
+        close(epoll_fd);
+    }
+    if (listen_fd != -1) {
+        close(listen_fd);
+        unlink(socket_path.c_str());
+    }
+}
+
+void Server::setStatsExport(const string &file_name, int interval_ms) {
+    stats_file = file_name;
+    stats_interval_ms = interval_ms;
+}
+
+void Server::setBackup(const string &file_name) {
+    backup_file = file_name;
+}
+
+void Server::exportStats() {
+    if (!stats_file.empty() && !ral::Stats::appendJson(stats_file)) {
+        cout << "Failed to export stats to " << stats_file << endl;
+    }
+}
+
+void Server::stop() {
+    stopping = 1;
+}
+
+bool Server::listen() {
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (socket_path.length() >= sizeof(address.sun_path)) {
+        cout << "Socket path is too long\n";
+        return false;
+    }
+    strcpy(address.sun_path, socket_path.c_str());
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listen_fd == -1) {
+        return false;
+    }
+    unlink(socket_path.c_str()); // left behind by a server that crashed
+    if (bind(listen_fd, (sockaddr*)&address, sizeof(address)) == -1 ||
+        ::listen(listen_fd, SOMAXCONN) == -1) {
+        close(listen_fd);
+        listen_fd = -1;
+        return false;
+    }
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    epoll_event event;
+    event.events = EPOLLIN;
+    event.data.fd = listen_fd;
+    return epoll_fd != -1 &&
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &event) == 0;
+}
+
+bool Server::run() {
+    if (!listen()) {
+        cout << "Failed to listen on " << socket_path << endl;
+        return false;
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = onSignal;
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+    action.sa_handler = onDumpSignal;
+    sigaction(SIGUSR1, &action, nullptr);
+    if (!backup_file.empty()) {
+        action.sa_handler = onBackupSignal;
+        sigaction(SIGUSR2, &action, nullptr);
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    // balance changes are committed together once per round, before any of
+    // the round's responses are sent
+    bank.setDeferredSync(true);
+    cout << "Serving on " << socket_path << endl;
+
+    epoll_event events[MAX_EVENTS];
+    vector<int> ready;
+    bool healthy = true;
+    auto next_export = chrono::steady_clock::now() +
+        chrono::milliseconds(stats_interval_ms);
+    while (!stopping && healthy) {
+        if (dumping) {
+            dumping = 0;
+            ral::Stats::dump(cout);
+        }
+        // the accounts are copied by another thread between rounds
+        if (backup_requested && !backing_up) {
+            backup_requested = 0;
+            backing_up = bank.beginBackup(backup_file);
+        }
+        if (backing_up && !bank.isBackupRunning()) {
+            backing_up = false;
+            bank.finishBackup();
+        }
+        auto now = chrono::steady_clock::now();
+        if (!stats_file.empty() && now >= next_export) {
+            exportStats();
+            next_export = now + chrono::milliseconds(stats_interval_ms);
+        }
+
+        int count = epoll_wait(epoll_fd, events, MAX_EVENTS, WAIT_MS);
+        if (count == -1 && errno != EINTR) {
+            healthy = false;
+            break;
+        }
+
+        ready.clear();
+        for (int i = 0; i < count; i++) {
+            int fd = events[i].data.fd;
+            if (fd == listen_fd) {
+                acceptSessions();
+                continue;
+            }
+
+            auto found = sessions.find(fd);
+            if (found == sessions.end()) {
+                continue;
+            }
+            Session &session = found->second;
+            if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                readSession(session);
+            }
+            ready.push_back(fd);
+        }
+
+        if (!bank.sync()) {
+            cout << "Committing balance changes failed\n";
+            healthy = false;
+            break;
+        }
+
+        for (int fd : ready) {
+            auto found = sessions.find(fd);
+            if (found != sessions.end() && (!writeSession(found->second) ||
+                (found->second.closing && found->second.out.empty()))) {
+                closeSession(fd);
+            }
+        }
+    }
+
+    if (backing_up) {
+        bank.finishBackup();
+    }
+    bank.setDeferredSync(false);
+    exportStats();
+    cout << "Server stopped\n";
+    return healthy && bank.sync();
+}
+
+void Server::acceptSessions() {
+    while (true) {
+        int fd = accept4(listen_fd, nullptr, nullptr,
+            SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd == -1) {
+            return; // EAGAIN once the backlog is empty
+        }
+
+        epoll_event event;
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1) {
+            close(fd);
+            continue;
+        }
+        sessions[fd].fd = fd;
+    }
+}
+
+void Server::readSession(Session &session) {
+    char buffer[READ_SIZE];
+    while (true) {
+        ssize_t n = read(session.fd, buffer, sizeof(buffer));
+        if (n > 0) {
+            session.in.append(buffer, n);
+            continue;
+        }
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n == 0 || errno != EAGAIN) {
+            session.closing = true;
+        }
+        break;
+    }
+
+    // handle every complete frame; a partial one waits for the next read
+    size_t offset = 0;
+    while (!session.rejected &&
+        session.in.size() - offset >= sizeof(Request)) {
+        Request request;
+        memcpy(&request, session.in.data() + offset, sizeof(request));
+        size_t frame_size = sizeof(request) + request.name_size;
+        if (session.in.size() - offset < frame_size) {
+            break;
+        }
+
+        string name(session.in.data() + offset + sizeof(request),
+            request.name_size);
+        handleRequest(session, request, name);
+        offset += frame_size;
+    }
+    session.in.erase(0, offset);
+}
+
+void Server::handleRequest(Session &session, const Request &request,
+    const string &name) {
+    Response response;
+    memset(&response, 0, sizeof(response));
+    int64_t balance = 0;
+    int64_t amount = request.amount;
+    Op op = (Op)request.op;
+
+    Bank::Result result = Bank::Result::ok;
+    if (op != Op::open && op != Op::login && session.account_id == 0) {
+        response.status = NOT_LOGGED_IN;
+    }
+    else {
+        switch (op) {
+            case Op::open: {
+                int id;
+                result = bank.openAccount(name, amount, id, balance);
+                if (result == Bank::Result::ok) {
+                    session.account_id = id;
+                }
+                break;
+            }
+            case Op::login:
+                result = bank.checkLogin(request.id, name, balance);
+                session.account_id = result == Bank::Result::ok ?
+                    request.id : 0;
+                break;
+            case Op::balance:
+                result = bank.getBalance(session.account_id, balance);
+                break;
+            case Op::deposit:
+                result = bank.deposit(session.account_id, amount, balance);
+                break;
+            case Op::withdraw:
+                result = bank.withdraw(session.account_id, amount, balance);
+                break;
+            case Op::transfer:
+                result = bank.transfer(session.account_id, request.id,
+                    amount, balance);
+                break;
+            case Op::close:
+                result = bank.closeAccount(session.account_id);
+                session.account_id = 0;
+                break;
+            case Op::logout:
+                session.account_id = 0;
+                break;
+            default:
+                response.status = BAD_REQUEST;
+                session.rejected = true;
+                session.closing = true;
+                break;
+        }
+        if (response.status == 0) {
+            response.status = (uint8_t)result;
+        }
+    }
+
+    response.id = session.account_id;
+    response.balance = balance;
+    session.out.append((const char*)&response, sizeof(response));
+}
+
+bool Server::writeSession(Session &session) {
+    size_t sent = 0;
+    while (sent < session.out.size()) {
+        ssize_t n = send(session.fd, session.out.data() + sent,
+            session.out.size() - sent, MSG_NOSIGNAL);
+        if (n > 0) {
+            sent += n;
+            continue;
+        }
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n == -1 && errno == EAGAIN) {
+            break;
+        }
+        return false;
+    }
+    session.out.erase(0, sent);
+
+    // only ask for EPOLLOUT while there's something left to send
+    bool writing = !session.out.empty();
+    if (writing != session.writing) {
+        epoll_event event;
+        event.events = EPOLLIN | (writing ? (uint32_t)EPOLLOUT : 0u);
+        event.data.fd = session.fd;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, session.fd, &event) == -1) {
+            return false;
+        }
+        session.writing = writing;
+    }
+    return true;
+}
+
+void Server::closeSession(int fd) {
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+    close(fd);
+    sessions.erase(fd);
+}
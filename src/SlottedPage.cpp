@@ -0,0 +1,152 @@
+// =============================================================================
+// File: SlottedPage.cpp
+// =============================================================================
+// Description:
+//      This file is the implementation of the SlottedPage class.
+// =============================================================================
+
+#include <cstring>
+#include "SlottedPage.h"
+
+using namespace ral;
+
+SlottedPage::SlottedPage(char* page, size_t size) {
+    this->page = page;
+    this->size = size;
+}
+
+size_t SlottedPage::getCount() const {
+    uint16_t count;
+    memcpy(&count, page, sizeof(count));
+    return count;
+}
+
+size_t SlottedPage::getStart() const {
+    uint16_t start;
+    memcpy(&start, page + sizeof(uint16_t), sizeof(start));
+    return start == 0 ? size : start; // 0 stands for 64 KiB
+}
+
+void SlottedPage::setHeader(size_t count, size_t start) {
+    uint16_t values[2] = { (uint16_t)count, (uint16_t)start };
+    memcpy(page, values, sizeof(values));
+}
+
+SlottedPage::Entry SlottedPage::getEntry(size_t index) const {
+    Entry entry;
+    memcpy(&entry, page + HEADER_SIZE + index * ENTRY_SIZE, ENTRY_SIZE);
+    return entry;
+}
+
+void SlottedPage::setEntry(size_t index, const Entry &entry) {
+    memcpy(page + HEADER_SIZE + index * ENTRY_SIZE, &entry, ENTRY_SIZE);
+}
+
+size_t SlottedPage::findIndex(uint32_t slot) const {
+    size_t count = getCount();
+    for (size_t i = 0; i < count; i++) {
+        if (getEntry(i).slot == slot) {
+            return i;
+        }
+    }
+    return count;
+}
+
+void SlottedPage::clear() {
+    setHeader(0, size);
+}
+
+bool SlottedPage::isValid() const {
+    size_t count = getCount();
+    size_t start = getStart();
+    if (HEADER_SIZE + count * ENTRY_SIZE > start || start > size) {
+        return false;
+    }
+    for (size_t i = 0; i < count; i++) {
+        Entry entry = getEntry(i);
+        if (entry.offset < start || entry.offset + entry.length > size) {
+            return false;
+        }
+    }
+    return true;
+}
+
+size_t SlottedPage::getFreeSpace() const {
+    size_t count = getCount();
+    size_t used = HEADER_SIZE + count * ENTRY_SIZE;
+    for (size_t i = 0; i < count; i++) {
+        used += getEntry(i).length;
+    }
+    return size - used;
+}
+
+bool SlottedPage::find(uint32_t slot, const char* &data,
+    size_t &length) const {
+    size_t index = findIndex(slot);
+    if (index == getCount()) {
+        return false;
+    }
+    Entry entry = getEntry(index);
+    data = page + entry.offset;
+    length = entry.length;
+    return true;
+}
+
+bool SlottedPage::put(uint32_t slot, const char* data, size_t length) {
+    erase(slot);
+    size_t count = getCount();
+    if (length + ENTRY_SIZE > getFreeSpace()) {
+        return false;
+    }
+    if (getStart() - (HEADER_SIZE + count * ENTRY_SIZE) <
+        length + ENTRY_SIZE) {
+        compact();
+    }
+
+    size_t start = getStart() - length;
+    memcpy(page + start, data, length);
+    setEntry(count, { slot, (uint16_t)start, (uint16_t)length });
+    setHeader(count + 1, start);
+    return true;
+}
+
+bool SlottedPage::erase(uint32_t slot) {
+    // the last entry takes the erased one's place; its bytes stay as a hole
+    size_t count = getCount();
+    size_t index = findIndex(slot);
+    if (index == count) {
+        return false;
+    }
+    setEntry(index, getEntry(count - 1));
+    setHeader(count - 1, count == 1 ? size : getStart());
+    return true;
+}
+
+size_t SlottedPage::retain(const function<bool(uint32_t)> &keep) {
+    size_t erased = 0;
+    for (size_t i = getCount(); i-- > 0;) {
+        uint32_t slot = getEntry(i).slot;
+        if (!keep(slot)) {
+            erase(slot);
+            erased++;
+        }
+    }
+    return erased;
+}
+
+void SlottedPage::compact() {
+    // the records are copied out (onto the stack, since a page is at most
+    // 64 KiB) & laid back down from the end of the page
+    size_t count = getCount();
+    char records[size];
+    size_t start = size;
+    for (size_t i = 0; i < count; i++) {
+        Entry entry = getEntry(i);
+        start -= entry.length;
+        memcpy(&records[start], page + entry.offset, entry.length);
+        entry.offset = (uint16_t)start;
+        setEntry(i, entry);
+    }
+    memcpy(page + start, &records[start], size - start);
+    setHeader(count, start);
+}
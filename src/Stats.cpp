@@ -0,0 +1,220 @@
+// =============================================================================
+// File: Stats.cpp
+// =============================================================================
+// Description:
+//      This file is the implementation of the Stats class.
+// =============================================================================
+
+#include <cinttypes>
+#include <ctime>
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include "Stats.h"
+
+using namespace ral;
+
+// === Stats::Registry =========================================================
+// The metric names & every thread buffer ever handed out.
+// =============================================================================
+struct Stats::Registry {
+    mutex lock;
+    vector<string> names;
+    vector<unique_ptr<ThreadBuffer>> buffers;
+    vector<ThreadBuffer*> unused;       // buffers whose thread has exited
+};
+
+// === Stats::ThreadSlot =======================================================
+// Gives the thread's buffer back to the registry when the thread exits.
+// =============================================================================
+struct Stats::ThreadSlot {
+    ~ThreadSlot() {
+        if (thread_buffer != nullptr) {
+            Registry &shared = registry();
+            lock_guard<mutex> guard(shared.lock);
+            shared.unused.push_back(thread_buffer);
+            thread_buffer = nullptr;
+        }
+    }
+};
+
+namespace {
+    double micros(uint64_t ns) {
+        return ns / 1000.0;
+    }
+}
+
+atomic<bool> Stats::enabled(true);
+atomic<uint32_t> Stats::sampling(Stats::DEFAULT_SAMPLING);
+
+uint64_t MetricStats::percentile(double fraction) const {
+    uint64_t rank = (uint64_t)(fraction * timed);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < buckets.size(); i++) {
+        seen += buckets[i];
+        if (seen > rank) {
+            uint64_t high = i + 1 < Stats::BUCKETS ?
+                Stats::bucketLow(i + 1) - 1 : max_ns;
+            return min(high, max_ns);
+        }
+    }
+    return max_ns;
+}
+
+Stats::Registry& Stats::registry() {
+    static Registry instance;
+    return instance;
+}
+
+Stats::ThreadBuffer* Stats::attachThread() {
+    static thread_local ThreadSlot slot; // constructed once per thread
+    Registry &shared = registry();
+    lock_guard<mutex> guard(shared.lock);
+    if (shared.unused.empty()) {
+        shared.buffers.emplace_back(new ThreadBuffer());
+        thread_buffer = shared.buffers.back().get();
+    }
+    else {
+        thread_buffer = shared.unused.back();
+        shared.unused.pop_back();
+    }
+    return thread_buffer;
+}
+
+size_t Stats::define(const string &name) {
+    Registry &shared = registry();
+    lock_guard<mutex> guard(shared.lock);
+    for (size_t i = 0; i < shared.names.size(); i++) {
+        if (shared.names[i] == name) {
+            return i;
+        }
+    }
+    if (shared.names.size() == MAX_METRICS) {
+        return MAX_METRICS - 1; // shares the last metric rather than failing
+    }
+    shared.names.push_back(name);
+    return shared.names.size() - 1;
+}
+
+void Stats::recordLatency(Counters &counters, uint64_t ns) {
+    add(counters.timed, 1);
+    add(counters.total_ns, ns);
+    if (ns > counters.max_ns.load(memory_order_relaxed)) {
+        counters.max_ns.store(ns, memory_order_relaxed);
+    }
+    add(counters.buckets[bucketOf(ns)], 1);
+}
+
+void Stats::setSampling(uint32_t every) {
+    sampling.store(max(every, 1u), memory_order_relaxed);
+}
+
+uint32_t Stats::getSampling() {
+    return sampling.load(memory_order_relaxed);
+}
+
+void Stats::setEnabled(bool enabled) {
+    Stats::enabled.store(enabled, memory_order_relaxed);
+}
+
+size_t Stats::bucketOf(uint64_t ns) {
+    if (ns < 8) {
+        return ns;
+    }
+    int shift = 63 - __builtin_clzll(ns) - 3;
+    return min((size_t)(shift + 1) * 8 + ((ns >> shift) & 7), BUCKETS - 1);
+}
+
+uint64_t Stats::bucketLow(size_t bucket) {
+    if (bucket < 8) {
+        return bucket;
+    }
+    return (8 + bucket % 8) << (bucket / 8 - 1);
+}
+
+void Stats::snapshot(vector<MetricStats> &metrics) {
+    Registry &shared = registry();
+    lock_guard<mutex> guard(shared.lock);
+    for (size_t m = 0; m < shared.names.size(); m++) {
+        MetricStats stats;
+        stats.name = shared.names[m];
+        stats.buckets.assign(BUCKETS, 0);
+        for (const unique_ptr<ThreadBuffer> &buffer : shared.buffers) {
+            const Counters &counters = buffer->metrics[m];
+            stats.count += counters.count.load(memory_order_relaxed);
+            stats.failures += counters.failures.load(memory_order_relaxed);
+            stats.timed += counters.timed.load(memory_order_relaxed);
+            stats.total_ns += counters.total_ns.load(memory_order_relaxed);
+            stats.max_ns = max(stats.max_ns,
+                counters.max_ns.load(memory_order_relaxed));
+            stats.bytes_read += counters.bytes_read.load(memory_order_relaxed);
+            stats.bytes_written +=
+                counters.bytes_written.load(memory_order_relaxed);
+            stats.syscalls += counters.syscalls.load(memory_order_relaxed);
+            for (size_t b = 0; b < BUCKETS; b++) {
+                stats.buckets[b] +=
+                    counters.buckets[b].load(memory_order_relaxed);
+            }
+        }
+        if (stats.count > 0) {
+            metrics.push_back(move(stats));
+        }
+    }
+}
+
+void Stats::dump(ostream &out) {
+    vector<MetricStats> metrics;
+    snapshot(metrics);
+
+    char line[256];
+    snprintf(line, sizeof(line), "%-24s %10s %8s %9s %9s %9s %9s %9s %9s "
+        "%9s %7s\n", "metric", "count", "failed", "mean us", "p50 us",
+        "p99 us", "p99.9 us", "max us", "read/op", "write/op", "sys/op");
+    out << line;
+    for (const MetricStats &stats : metrics) {
+        double count = stats.count;
+        double timed = max(stats.timed, (uint64_t)1);
+        snprintf(line, sizeof(line), "%-24s %10" PRIu64 " %8" PRIu64
+            " %9.2f %9.2f %9.2f %9.2f %9.2f %9.0f %9.0f %7.2f\n",
+            stats.name.c_str(), stats.count, stats.failures,
+            micros(stats.total_ns) / timed, micros(stats.percentile(0.5)),
+            micros(stats.percentile(0.99)), micros(stats.percentile(0.999)),
+            micros(stats.max_ns), stats.bytes_read / count,
+            stats.bytes_written / count, stats.syscalls / count);
+        out << line;
+    }
+    out.flush();
+}
+
+bool Stats::writeJson(FILE* file) {
+    vector<MetricStats> metrics;
+    snapshot(metrics);
+
+    fprintf(file, "{\"time\":%lld,\"metrics\":{", (long long)time(nullptr));
+    for (size_t i = 0; i < metrics.size(); i++) {
+        const MetricStats &stats = metrics[i];
+        fprintf(file, "%s\"%s\":{\"count\":%" PRIu64 ",\"failures\":%" PRIu64
+            ",\"timed\":%" PRIu64 ",\"mean_us\":%.3f,\"p50_us\":%.3f,"
+            "\"p90_us\":%.3f,\"p99_us\":%.3f,\"p999_us\":%.3f,\"max_us\":%.3f,"
+            "\"bytes_read\":%" PRIu64 ",\"bytes_written\":%" PRIu64
+            ",\"syscalls\":%" PRIu64 "}", i == 0 ? "" : ",",
+            stats.name.c_str(), stats.count, stats.failures, stats.timed,
+            micros(stats.total_ns) / max(stats.timed, (uint64_t)1),
+            micros(stats.percentile(0.5)), micros(stats.percentile(0.9)),
+            micros(stats.percentile(0.99)), micros(stats.percentile(0.999)),
+            micros(stats.max_ns), stats.bytes_read, stats.bytes_written,
+            stats.syscalls);
+    }
+    fprintf(file, "}}\n");
+    return fflush(file) == 0 && ferror(file) == 0;
+}
+
+bool Stats::appendJson(const string &file_name) {
+    FILE* file = fopen(file_name.c_str(), "a");
+    bool appended = file != nullptr && writeJson(file);
+    if (file != nullptr) {
+        appended = fclose(file) == 0 && appended;
+    }
+    return appended;
+}
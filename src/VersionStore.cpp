@@ -0,0 +1,136 @@
+// =============================================================================
+// File: VersionStore.cpp
+// =============================================================================
+// Description:
+//      This file is the implementation of the VersionStore class.
+// =============================================================================
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include "VersionStore.h"
+
+using namespace ral;
+
+VersionStore::VersionStore(size_t record_size) :
+    stripes(new Stripe[STRIPES]), held(0), open_views(0) {
+    this->record_size = record_size;
+    last_seq = 0;
+    waiting = 0;
+    swept_held = 0;
+}
+
+uint64_t VersionStore::beginWrite(bool &keep) {
+    lock_guard<mutex> guard(lock);
+    uint64_t seq = ++last_seq;
+    applying.push_back(seq);
+    keep = !views.empty();
+    stats.writes++;
+    return seq;
+}
+
+void VersionStore::keep(int id, uint64_t seq, const char* record) {
+    // once every view is gone no view can need it: a new one sees the write
+    if (open_views == 0) {
+        return;
+    }
+    Stripe &stripe = stripes[(size_t)id % STRIPES];
+    lock_guard<mutex> guard(stripe.lock);
+    vector<Version> &versions = stripe.versions[id];
+    if (!versions.empty() && versions.back().until == seq) {
+        return; // a batch writing the id twice keeps the first image
+    }
+    versions.push_back({ seq, string(record, record_size) });
+    held++;
+}
+
+void VersionStore::endWrite(uint64_t seq) {
+    lock_guard<mutex> guard(lock);
+    applying.erase(std::find(applying.begin(), applying.end(), seq));
+    if (waiting > 0) {
+        applied.notify_all();
+    }
+}
+
+uint64_t VersionStore::beginRead() {
+    // writes begun before the view must be in it, & those after keep what
+    // they replace, since they see the view
+    unique_lock<mutex> guard(lock);
+    uint64_t view = last_seq;
+    views.push_back(view);
+    open_views++;
+    stats.views++;
+    waiting++;
+    applied.wait(guard, [this, view]() {
+        return applying.empty() || applying.front() > view;
+    });
+    waiting--;
+    return view;
+}
+
+void VersionStore::endRead(uint64_t view) {
+    uint64_t oldest;
+    {
+        lock_guard<mutex> guard(lock);
+        views.erase(lower_bound(views.begin(), views.end(), view));
+        open_views--;
+        if (held == 0 ||
+            (!views.empty() && held < swept_held + SWEEP_VERSIONS)) {
+            return;
+        }
+        oldest = views.empty() ? UINT64_MAX : views.front();
+    }
+    sweep(oldest);
+}
+
+void VersionStore::sweep(uint64_t oldest) {
+    // views begun since oldest was taken are newer than every version held,
+    // so they need none of them
+    size_t collected = 0;
+    for (size_t i = 0; i < STRIPES; i++) {
+        lock_guard<mutex> guard(stripes[i].lock);
+        auto &versions = stripes[i].versions;
+        for (auto chain = versions.begin(); chain != versions.end();) {
+            size_t unneeded = 0;
+            while (unneeded < chain->second.size() &&
+                chain->second[unneeded].until <= oldest) {
+                unneeded++;
+            }
+            chain->second.erase(chain->second.begin(),
+                chain->second.begin() + unneeded);
+            collected += unneeded;
+            chain = chain->second.empty() ? versions.erase(chain) :
+                next(chain);
+        }
+    }
+    held -= collected;
+
+    lock_guard<mutex> guard(lock);
+    stats.collected += collected;
+    swept_held = held;
+}
+
+bool VersionStore::find(int id, uint64_t view, char* record) {
+    Stripe &stripe = stripes[(size_t)id % STRIPES];
+    lock_guard<mutex> guard(stripe.lock);
+    auto chain = stripe.versions.find(id);
+    if (chain == stripe.versions.end()) {
+        return false;
+    }
+    for (const Version &version : chain->second) {
+        if (version.until > view) {
+            memcpy(record, version.record.data(), record_size);
+            return true;
+        }
+    }
+    return false;
+}
+
+VersionStats VersionStore::getStats() {
+    lock_guard<mutex> guard(lock);
+    VersionStats current = stats;
+    current.held = held;
+    current.open_views = open_views;
+    current.kept = stats.collected + held;
+    return current;
+}
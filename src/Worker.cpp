@@ -0,0 +1,63 @@
+// =============================================================================
+// File: Worker.cpp
+// =============================================================================
+// Description:
+//      This file is the implementation of the Worker class.
+// =============================================================================
+
+#include "Worker.h"
+
+using namespace ral;
+
+Worker::Worker() : stopping(false), runner(&Worker::run, this) {
+}
+
+Worker::~Worker() {
+    {
+        lock_guard<mutex> guard(lock);
+        stopping = true;
+    }
+    wake.notify_one();
+    runner.join();
+}
+
+void Worker::post(function<void()> task) {
+    {
+        lock_guard<mutex> guard(lock);
+        tasks.push_back(move(task));
+    }
+    wake.notify_one();
+}
+
+void Worker::run() {
+    unique_lock<mutex> guard(lock);
+    while (true) {
+        wake.wait(guard, [this]() { return stopping || !tasks.empty(); });
+        if (tasks.empty()) {
+            return; // stopping, with nothing left to run
+        }
+        function<void()> task = move(tasks.front());
+        tasks.pop_front();
+        guard.unlock();
+        task();
+        guard.lock();
+    }
+}
+
+void Worker::runAll(const vector<Worker*> &workers,
+    const function<void(size_t)> &task) {
+    mutex done_lock;
+    condition_variable done;
+    size_t left = workers.size();
+    for (size_t i = 0; i < workers.size(); i++) {
+        workers[i]->post([&, i]() {
+            task(i);
+            lock_guard<mutex> guard(done_lock);
+            if (--left == 0) {
+                done.notify_one();
+            }
+        });
+    }
+    unique_lock<mutex> guard(done_lock);
+    done.wait(guard, [&]() { return left == 0; });
+}
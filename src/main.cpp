@@ -3,11 +3,45 @@
 // =============================================================================
 // Description:
 //      This program is for bank accounts. It uses a random access file.
+//      Usage: OneNorthBank [--stats file] [mode]
+//                                           -- append latency & I/O stats to
+//                                              file as JSON on exit (& every
+//                                              10 sec with --serve)
+//             OneNorthBank                  -- interactive
+//             OneNorthBank --serve [socket] -- serve clients over a socket
+//             OneNorthBank --ingest file [results]
+//                                           -- apply a transaction file
+//             OneNorthBank --post-interest rate [fee]
+//                                           -- pay rate basis points of
+//                                              interest to & take fee cents
+//                                              from every account
+//             OneNorthBank --report min max [prefix]
+//                                           -- summarize & rank the accounts
+//                                              with a balance in [min, max]
+//                                              dollars & a name starting
+//                                              with prefix
+//             OneNorthBank --backup [file]  -- copy the accounts into file
+//                                              (accounts.backup by default)
+//             OneNorthBank --fsck [--repair]
+//                                           -- check every account against
+//                                              its checksum & the free ids
+//                                              against the accounts, &
+//                                              repair what can be
+//      With --serve, SIGUSR2 backs up into accounts.backup.
+//      $ONB_SHARDS splits the accounts across shards: the names of their
+//      rafs (minus extension), comma separated, e.g. /disk1/a,/disk2/a.
 // =============================================================================
 
+#include <cstdlib>
 #include <iostream>
 #include <memory>
+#include <string>
+#include <utility>
+#include <vector>
 #include "Bank.h"
+#include "Ingest.h"
+#include "Server.h"
+#include "Stats.h"
 #include "utility.h"
 using namespace std;
 using namespace utility;
@@ -15,6 +49,10 @@ using namespace utility;
 // global variable
 static const string BANK_NAME = "One North Bank";
 static const string RAF_NAME = "accounts";
+static const string SOCKET_PATH = "onb.sock";
+static const string BACKUP_NAME = RAF_NAME + ".backup";
+static const int STATS_INTERVAL_MS = 10000;
+static string stats_file;
 // static const enum loginOptions = { // TODO: this..
 //     quit = 0,
 //     create_account = 1,
@@ -22,15 +60,83 @@ static const string RAF_NAME = "accounts";
 // };
 
 // function prototypes
-int main();
+int main(int argc, char** argv);
 void promptMenu(Bank &bank);
 int loginRequested();
+void exportStats();
+vector<string> shardNames();
 
 // ==== main ===================================================================
 //
 // =============================================================================
-int main() {
-    Bank bank(RAF_NAME);
+int main(int argc, char** argv) {
+    if (argc > 2 && string(argv[1]) == "--stats") {
+        // written after the bank is closed, so its last syncs are counted
+        stats_file = argv[2];
+        atexit(exportStats);
+        argc -= 2;
+        argv += 2;
+    }
+    if (argc > 1 && string(argv[1]) == "--fsck") {
+        // before the bank opens the raf: a corrupt account stops it
+        bool repair = argc > 2 && string(argv[2]) == "--repair";
+        bool sound = true;
+        for (const string &shard_name : shardNames()) {
+            sound = Bank::checkAccounts(shard_name, repair) && sound;
+        }
+        return sound ? 0 : 1;
+    }
+    Bank bank(shardNames());
+
+    if (argc > 1 && string(argv[1]) == "--serve") {
+        Server server(bank, argc > 2 ? argv[2] : SOCKET_PATH);
+        if (!stats_file.empty()) {
+            server.setStatsExport(stats_file, STATS_INTERVAL_MS);
+        }
+        server.setBackup(BACKUP_NAME);
+        return server.run() ? 0 : 1;
+    }
+    if (argc > 1 && string(argv[1]) == "--backup") {
+        return bank.beginBackup(argc > 2 ? argv[2] : BACKUP_NAME) &&
+            bank.finishBackup() ? 0 : 1;
+    }
+    if (argc > 2 && string(argv[1]) == "--ingest") {
+        Ingest ingest(bank);
+        return ingest.run(argv[2], argc > 3 ? argv[3] :
+            string(argv[2]) + ".results") ? 0 : 1;
+    }
+    if (argc > 2 && string(argv[1]) == "--post-interest") {
+        size_t posted, rejected;
+        bool posted_all = bank.postInterest(atoll(argv[2]),
+            argc > 3 ? atoll(argv[3]) : 0, posted, rejected);
+        cout << posted << " accounts changed, " << rejected << " rejected\n";
+        return posted_all ? 0 : 1;
+    }
+    if (argc > 3 && string(argv[1]) == "--report") {
+        int64_t min_balance, max_balance;
+        string min_text = argv[2], max_text = argv[3];
+        if (!parseCents(min_text.data(), min_text.data() + min_text.size(),
+            min_balance) || !parseCents(max_text.data(), max_text.data() +
+            max_text.size(), max_balance)) {
+            cout << "Balances must be in dollars, e.g. 100.50\n";
+            return 1;
+        }
+        string prefix = argc > 4 ? argv[4] : "";
+        ral::ColumnSummary summary = bank.summarizeBalances(min_balance,
+            max_balance, prefix);
+        cout << summary.count << " accounts, total $"
+            << formatCents(summary.sum) << ", min $"
+            << formatCents(summary.min) << ", max $"
+            << formatCents(summary.max) << "\n";
+
+        vector<pair<int, int64_t>> largest;
+        bank.topBalances(min_balance, max_balance, prefix, 10, true, largest);
+        for (const pair<int, int64_t> &account : largest) {
+            cout << "    " << account.first << ": $"
+                << formatCents(account.second) << "\n";
+        }
+        return 0;
+    }
 
     int selection;
     bool logged_in = false;
@@ -132,4 +238,40 @@ int loginRequested() {
     }
 
     return selection;
+}
+
+// ==== exportStats ============================================================
+// Appends the stats to the file given with --stats.
+// =============================================================================
+void exportStats() {
+    if (!ral::Stats::appendJson(stats_file)) {
+        cout << "Failed to export stats to " << stats_file << endl;
+    }
+}
+
+// ==== shardNames =============================================================
+// The rafs the accounts are split across: those named in $ONB_SHARDS, or
+// just accounts.
+// =============================================================================
+vector<string> shardNames() {
+    const char* shards = getenv("ONB_SHARDS");
+    vector<string> names;
+    string name;
+    for (const char* c = shards != nullptr ? shards : ""; ; c++) {
+        if (*c != ',' && *c != '\0') {
+            name += *c;
+            continue;
+        }
+        if (!name.empty()) {
+            names.push_back(name);
+        }
+        name.clear();
+        if (*c == '\0') {
+            break;
+        }
+    }
+    if (names.empty()) {
+        names.push_back(RAF_NAME);
+    }
+    return names;
 }
\ No newline at end of file
@@ -6,204 +6,3168 @@
 // =============================================================================
 
 #include <iostream>
-#include <fstream>
+#include <map>
 #include <sstream>
+#include <bitset>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <thread>
 #include "ral.h"
-//#include "Cipher.h" // TODO
+#include "Checksum.h"
+#include "SlottedPage.h"
+#include "Stats.h"
 // TODO: validating/santizing input
 
 using namespace ral;
 
-File::File(string file_name, 
-    unique_ptr<Record> dummy_record) {
+namespace {
+    const size_t KEY_CHECK_SIZE = 16;
+    const uint64_t KEY_CHECK_ID = UINT64_MAX; // never a record id
+
+    // === Header ==============================================================
+    // The first HEADER_SIZE bytes of a raf. An encrypted raf's key_check is
+    // KEY_CHECK_SIZE zeros sealed with its key, so a wrong key is caught on
+    // open; rafs from before encryption have zeros here. record_size is the
+    // size of a slot. Version 1 rafs have no checksums (crc is 0). packed
+    // took what used to be padding at the end, so older rafs have 0 there.
+    // =========================================================================
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t extent_count;
+        uint64_t record_size;
+        uint64_t capacity;
+        struct {
+            uint64_t offset;
+            uint64_t first_slot;
+            uint64_t slots;
+        } extents[64];
+        uint32_t encrypted;     // 1 if the slots are sealed
+        uint32_t crc;           // of the header with crc = 0
+        char key_check[KEY_CHECK_SIZE + Cipher::OVERHEAD];
+        uint32_t packed;        // 1 if the records are packed into pages
+    };
+
+    const char MAGIC[8] = { 'O', 'N', 'B', 'R', 'A', 'F', '\0', '\0' };
+    const uint32_t FORMAT_VERSION = 2;
+    const uint32_t UNCHECKED_VERSION = 1;   // slots without checksums
+    const size_t CHECKSUM_SIZE = sizeof(uint32_t);
+    const size_t HEADER_SIZE = 4096;
+    const size_t PAGE_SIZE = 4096;
+    const size_t LEGACY_RECORDS = 100;
+    const size_t LEGACY_HEADER_SIZE = sizeof(bitset<LEGACY_RECORDS>);
+    const size_t CHUNK_BYTES = 1 << 20; // rafs are converted 1MB at a time
+    const uint64_t PAGE_ASSOCIATED = 1ull << 62; // | page number; not an id
+    const size_t FILL_PAGES = 16;       // packed rafs grow 16 pages at a time
+    const size_t RUN_SIZE = 2 * sizeof(uint16_t);
+
+    static_assert(sizeof(Header) <= HEADER_SIZE, "raf header too large");
+    static_assert(sizeof(Header) == 1624, "raf header layout changed");
+
+    // latency & I/O of each public operation (see Stats)
+    const size_t STAT_OPEN = Stats::define("ral.open");
+    const size_t STAT_GET_RECORD = Stats::define("ral.getRecord");
+    const size_t STAT_GET_RECORDS = Stats::define("ral.getRecords");
+    const size_t STAT_CREATE_RECORD = Stats::define("ral.createRecord");
+    const size_t STAT_CREATE_RECORDS = Stats::define("ral.createRecords");
+    const size_t STAT_UPDATE_RECORD = Stats::define("ral.updateRecord");
+    const size_t STAT_UPDATE_RECORDS = Stats::define("ral.updateRecords");
+    const size_t STAT_TRANSACT_RECORDS = Stats::define("ral.transactRecords");
+    const size_t STAT_GET_RECORD_AT = Stats::define("ral.getRecordAt");
+    const size_t STAT_GET_RECORDS_AT = Stats::define("ral.getRecordsAt");
+    const size_t STAT_DELETE_RECORD = Stats::define("ral.deleteRecord");
+    const size_t STAT_RESERVE_IDS = Stats::define("ral.reserveIds");
+    const size_t STAT_SYNC = Stats::define("ral.sync");
+    const size_t STAT_GET_RECORD_ASYNC = Stats::define("ral.getRecordAsync");
+    const size_t STAT_UPDATE_RECORD_ASYNC =
+        Stats::define("ral.updateRecordAsync");
+    const size_t STAT_BEGIN_SNAPSHOT = Stats::define("ral.beginSnapshot");
+
+    // true if the header's key_check opens with the cipher's key
+    bool keyMatches(Cipher &cipher, const Header &header) {
+        char check[KEY_CHECK_SIZE];
+        return cipher.open(header.key_check, check, KEY_CHECK_SIZE,
+            KEY_CHECK_ID);
+    }
+
+    // the header's checksum
+    uint32_t headerCrc(Header header) {
+        header.crc = 0;
+        return crc32c(&header, sizeof(header));
+    }
+
+    // a slot ends with the checksum of its payload, seeded with the id so
+    // a slot written to the wrong place doesn't match
+    void stampSlot(int id, char* slot, size_t payload_size) {
+        uint32_t crc = crc32c(slot, payload_size, (uint32_t)id);
+        memcpy(slot + payload_size, &crc, sizeof(crc));
+    }
+
+    bool slotMatches(int id, const char* slot, size_t payload_size) {
+        uint32_t crc;
+        memcpy(&crc, slot + payload_size, sizeof(crc));
+        return crc == crc32c(slot, payload_size, (uint32_t)id);
+    }
+
+    // what a slot of a packed raf reads as when its page is corrupt: one
+    // whose checksum doesn't match
+    void spoilSlot(int id, char* slot, size_t payload_size) {
+        memset(slot, 0xff, payload_size);
+        stampSlot(id, slot, payload_size);
+        slot[payload_size] ^= 1;
+    }
+
+    // a packed record is the record with its longest run of zeros cut out:
+    // the run's offset & length, then the bytes before & after it. packed
+    // has room for RUN_SIZE + size bytes; the packed length is returned
+    size_t packRecord(const char* record, size_t size, char* packed) {
+        size_t run = 0;
+        size_t run_length = 0;
+        for (size_t i = 0; i < size;) {
+            size_t end = i;
+            while (end < size && record[end] == 0) {
+                end++;
+            }
+            if (end - i > run_length) {
+                run = i;
+                run_length = end - i;
+            }
+            i = end + 1;
+        }
+
+        uint16_t header[2] = { (uint16_t)run, (uint16_t)run_length };
+        memcpy(packed, header, RUN_SIZE);
+        memcpy(packed + RUN_SIZE, record, run);
+        memcpy(packed + RUN_SIZE + run, record + run + run_length,
+            size - run - run_length);
+        return RUN_SIZE + size - run_length;
+    }
+
+    bool unpackRecord(const char* packed, size_t length, char* record,
+        size_t size) {
+        uint16_t header[2];
+        if (length < RUN_SIZE) {
+            return false;
+        }
+        memcpy(header, packed, RUN_SIZE);
+        size_t run = header[0];
+        size_t run_length = header[1];
+        if (run + run_length > size || length - RUN_SIZE != size - run_length) {
+            return false;
+        }
+        memcpy(record, packed + RUN_SIZE, run);
+        memset(record + run, 0, run_length);
+        memcpy(record + run + run_length, packed + RUN_SIZE + run,
+            size - run - run_length);
+        return true;
+    }
+
+    // true if a slot is empty (never written since its extent was added)
+    bool allZero(const char* bytes, size_t size) {
+        for (size_t i = 0; i < size; i++) {
+            if (bytes[i] != 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    size_t roundUp(size_t bytes, size_t multiple) {
+        return (bytes + multiple - 1) / multiple * multiple;
+    }
+
+    // preadv/pwritev all of iov, retrying short transfers
+    bool transferAll(int fd, iovec* iov, int count, off_t offset,
+        bool write) {
+        while (count > 0) {
+            ssize_t n = write ? pwritev(fd, iov, count, offset) :
+                preadv(fd, iov, count, offset);
+            size_t moved = n > 0 ? n : 0;
+            Stats::countIo(write ? 0 : moved, write ? moved : 0, 1);
+            if (n == -1 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                return false;
+            }
+            offset += n;
+            while (count > 0 && (size_t)n >= iov->iov_len) {
+                n -= iov->iov_len;
+                iov++;
+                count--;
+            }
+            if (count > 0) {
+                iov->iov_base = (char*)iov->iov_base + n;
+                iov->iov_len -= n;
+            }
+        }
+        return true;
+    }
+
+    // the record whose default encode/decode or serialize/deserialize is
+    // running on this thread; the other default of the pair finding it
+    // there means the record overrides neither
+    thread_local const Record* defaulting = nullptr;
+
+    // pwrite all of buffer to another file
+    bool writeAll(int fd, const void* buffer, size_t size, off_t offset) {
+        iovec iov = { (void*)buffer, size };
+        return size == 0 || transferAll(fd, &iov, 1, offset, true);
+    }
+}
+
+bool Record::encode(char* buffer) {
+    // a record that overrides neither pair comes back here through
+    // serialize & fails instead of recursing
+    if (defaulting == this) {
+        return false;
+    }
+    const Record* outer = defaulting;
+    defaulting = this;
+    stringstream ss;
+    bool serialized = serialize(ss) && ss.tellp() == (streamoff)getSize() &&
+        ss;
+    defaulting = outer;
+    if (!serialized) {
+        return false;
+    }
+    ss.read(buffer, getSize());
+    return (bool)ss;
+}
+
+bool Record::decode(const char* buffer) {
+    if (defaulting == this) {
+        return false;
+    }
+    const Record* outer = defaulting;
+    defaulting = this;
+    stringstream ss;
+    ss.write(buffer, getSize());
+    bool deserialized = deserialize(ss);
+    defaulting = outer;
+    return deserialized;
+}
+
+bool Record::serialize(stringstream &ss) {
+    if (defaulting == this) {
+        return false;
+    }
+    const Record* outer = defaulting;
+    defaulting = this;
+    // a thread's buffer is kept from call to call
+    static thread_local string buffer;
+    buffer.resize(getSize());
+    bool encoded = encode(&buffer[0]);
+    defaulting = outer;
+    if (!encoded) {
+        return false;
+    }
+    ss.write(buffer.data(), buffer.size());
+    return (bool)ss;
+}
+
+bool Record::deserialize(stringstream &ss) {
+    if (defaulting == this) {
+        return false;
+    }
+    static thread_local string buffer;
+    buffer.resize(getSize());
+    ss.read(&buffer[0], buffer.size());
+    if (!ss) {
+        return false;
+    }
+    const Record* outer = defaulting;
+    defaulting = this;
+    bool decoded = decode(buffer.data());
+    defaulting = outer;
+    return decoded;
+}
+
+File::File(string file_name, unique_ptr<Record> dummy_record,
+    Options options /*= Options()*/) {
+    StatTimer timer(STAT_OPEN);
     this->file_name = file_name + FILE_EXTENSION;
     this->dummy_record = move(dummy_record);
+    sync_policy = options.sync;
+    storage = options.storage;
+    mapping = nullptr;
+    mapping_size = 0;
+    mapping_reserved = 0;
+    extent_count = 0;
+    capacity = 0;
+    snapshotting = false;
+    replaying = false;
     record_size = this->dummy_record->getSize();
+    if (!options.key.empty()) {
+        if (options.key.size() != Cipher::KEY_SIZE) {
+            cout << "Key must be " << Cipher::KEY_SIZE << " bytes\nExiting\n";
+            exit(-10); // TODO: change to something better than -10
+        }
+        cipher.reset(new Cipher(options.key));
+    }
+    payload_size = record_size + (cipher != nullptr ? Cipher::OVERHEAD : 0);
+    slot_size = payload_size + CHECKSUM_SIZE;
+    slot_stride = storage == Storage::packed ? sizeof(uint32_t) : slot_size;
+    page_body_size = PAGE_SIZE - CHECKSUM_SIZE -
+        (cipher != nullptr ? Cipher::OVERHEAD : 0);
+    fill_page = 0;
+    next_page = 0;
+    file_end = 0;
+    if (storage == Storage::packed) {
+        if (SlottedPage::HEADER_SIZE + SlottedPage::ENTRY_SIZE + RUN_SIZE +
+            record_size > page_body_size) {
+            cout << "Records are too large to pack\nExiting\n";
+            exit(-10); // TODO: change to something better than -10
+        }
+        // a write syncs the doublewrite buffer & the pages a record moves
+        // to, so writes reach the pages a checkpoint at a time
+        if (!options.journal) {
+            cout << "Packed storage needs a journal\nExiting\n";
+            exit(-10); // TODO: change to something better than -10
+        }
+        page_stripes.reset(new Stripe[PAGE_STRIPES]);
+    }
+    empty_record.assign(record_size, '\0');
+    if (!this->dummy_record->encode(&empty_record[0])) {
+        cout << "Error with serializing record\nExiting\n";
+        exit(-10); // TODO: change to something better?
+    }
+    convert_size = options.convert ? options.convert_size : 0;
+    convert = options.convert;
+    projection = options.projection;
+    preallocate = options.preallocate;
+    cache_policy = options.cache_policy;
+    concurrent = options.concurrent;
+    if (concurrent) {
+        stripes.reset(new Stripe[STRIPES]);
+    }
+    if (options.cache_records > 0) {
+        cache.reset(new RecordCache(options.cache_records, record_size));
+    }
+    if (options.versioned) {
+        versions.reset(new VersionStore(record_size));
+    }
 
-    if (fstream(this->file_name)) { // file already exists
-        // TODO: not validating the input here
-        file.open(this->file_name, ios::in | ios::binary);
-        file.read((char*)&available_ids, sizeof(available_ids));
-        file.close();
-        return;
+    fd = open(this->file_name.c_str(), O_RDWR | O_CLOEXEC);
+    if (fd != -1) { // file already exists
+        if (!loadFile() && !(migrateLegacyFile() && loadFile()) &&
+            !(convertFile() && loadFile())) {
+            cout << "Error reading file\nExiting\n";
+            exit(-10); // TODO: change to something better than -10
+        }
+    }
+    else {
+        fd = open(this->file_name.c_str(), O_RDWR | O_CREAT | O_CLOEXEC,
+            0644);
+        if (fd == -1) {
+            cout << "Error opening file\nExiting\n";
+            exit(-10); // TODO: change to something better than -10
+        }
+
+        size_t slots = roundUp(max(options.initial_capacity, (size_t)1), 64);
+        if (!createFile(min(slots, MAX_SLOTS / 64 * 64))) {
+            cout << "Error writing file\nExiting\n";
+            exit(-10); // TODO: change to something better?
+        }
+    }
+
+    if (storage == Storage::packed) {
+        // pages a crash tore while they were overwritten are put back
+        // before anything reads them (the journal's replay included)
+        size_t restored = 0;
+        doublewrite.reset(new DoublewriteBuffer(this->file_name + ".dwb",
+            PAGE_SIZE,
+            [this, &restored](uint32_t page, const char* image) {
+                return restorePage(page, image, restored);
+            },
+            [this]() { return syncRaf(Sync::data); }));
+        if (!doublewrite->isOpen()) {
+            cout << "Error opening doublewrite buffer\nExiting\n";
+            exit(-10); // TODO: change to something better than -10
+        }
+        if (restored > 0) {
+            cout << "Restored " << restored << " torn pages of "
+                << this->file_name << endl;
+        }
+    }
+
+    if (storage == Storage::mapped && !mapFile()) {
+        cout << "Error mapping file\nExiting\n";
+        exit(-10); // TODO: change to something better than -10
+    }
+
+    if (options.journal) {
+        // the checkpointer writes without record locks: a reader holding a
+        // record's lock either finds it in the journal or, if it isn't
+        // there, can't see it added & written until the lock is released.
+        // Images go through transfer, so a run of adjacent slots (or the
+        // records of one page) take one write. A create or delete reaches
+        // the raf's bitmap only with its image, so the bitmap & the slots
+        // agree whenever the journal is cut short; while the journal is
+        // replayed the ids in memory follow the images too
+        replaying = true;
+        journal.reset(new Journal(this->file_name + ".wal", slot_size,
+            [this](const vector<pair<int, const char*>> &images) {
+                vector<Transfer> transfers;
+                vector<pair<int, bool>> bits;
+                for (const pair<int, const char*> &image : images) {
+                    if (!validId(image.first)) {
+                        return false;
+                    }
+                    transfers.push_back({ calculateOffset(image.first),
+                        (char*)image.second, image.first });
+                    bool held;
+                    if (slotHoldsRecord(image.first, image.second, held)) {
+                        bits.emplace_back(image.first, held);
+                    }
+                }
+                if (!transfer(transfers, true)) {
+                    return false;
+                }
+                unique_lock<mutex> ids_guard = guard(ids_lock);
+                return writeIdBits(bits, replaying);
+            },
+            [this]() { return syncRaf(Sync::data); }));
+        replaying = false;
+        if (!journal->isOpen()) {
+            cout << "Error opening journal\nExiting\n";
+            exit(-10); // TODO: change to something better than -10
+        }
+    }
+}
+
+File::~File() {
+    SnapshotReport report;
+    if (snapshot != nullptr && !endSnapshot(report)) {
+        cout << "Taking a snapshot failed\n";
+    }
+    journal.reset();
+    if (!flushCache()) {
+        cout << "Writing cached records failed\n";
+    }
+    if (mapping != nullptr) {
+        munmap(mapping, mapping_reserved);
+    }
+    if (fd != -1) {
+        close(fd);
+    }
+}
+
+bool File::createFile(size_t slots) {
+    extent_count = 0;
+    used_ids.resize(0);
+    capacity = 0;
+    fill_page = 0;
+
+    return ftruncate(fd, HEADER_SIZE) == 0 && writeHeader(0, Sync::none) &&
+        grow(slots) && syncRaf(Sync::full);
+}
+
+bool File::loadFile() {
+    Header header;
+    if (!readAt(&header, sizeof(header), 0) ||
+        memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0) {
+        return false;
+    }
+
+    if (header.version != FORMAT_VERSION &&
+        header.version != UNCHECKED_VERSION) {
+        cout << "Unsupported raf version " << header.version << endl;
+        return false;
+    }
+    if (header.version == FORMAT_VERSION && header.crc != headerCrc(header)) {
+        cout << "Raf header is corrupt\n";
+        return false;
+    }
+    if (header.encrypted != 0 && cipher == nullptr) {
+        cout << "Raf is encrypted & no key was given\n";
+        return false;
+    }
+    if (header.encrypted != 0 && !keyMatches(*cipher, header)) {
+        cout << "Wrong key for the raf\n";
+        return false;
+    }
+    if (header.version == UNCHECKED_VERSION) {
+        return false; // convertFile adds the checksums
+    }
+    if (header.packed != 0 && storage != Storage::packed) {
+        cout << "Raf is packed; open it with Storage::packed\n";
+        return false;
+    }
+    if (header.packed == 0 && storage == Storage::packed) {
+        return false; // convertFile packs it
+    }
+    if (header.record_size != slot_size) {
+        size_t old_size = header.record_size - CHECKSUM_SIZE -
+            (header.encrypted != 0 ? Cipher::OVERHEAD : 0);
+        if ((convert_size != 0 && old_size == convert_size) ||
+            (header.encrypted == 0 && old_size == record_size)) {
+            return false; // convertFile rewrites it
+        }
+        cout << "Raf holds records of " << old_size << " bytes, expected "
+            << record_size << endl;
+        return false;
+    }
+    if (header.extent_count == 0 || header.extent_count > MAX_EXTENTS) {
+        cout << "Raf header is corrupt\n";
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        return false;
+    }
+
+    // the extents must tile the ids & lie inside the file
+    size_t next_slot = 0;
+    for (uint32_t i = 0; i < header.extent_count; i++) {
+        Extent extent = { header.extents[i].offset,
+            header.extents[i].first_slot, header.extents[i].slots };
+        if (extent.first_slot != next_slot || extent.slots == 0 ||
+            extent.slots % 64 != 0 || extent.offset % PAGE_SIZE != 0 ||
+            extent.offset + roundUp(extent.slots / 8, PAGE_SIZE) +
+            extent.slots * slot_stride > (size_t)st.st_size) {
+            cout << "Raf header is corrupt\n";
+            return false;
+        }
+        extents[i] = extent;
+        changed[i].reset(new atomic<uint64_t>[extent.slots / 64]());
+        next_slot += extent.slots;
+    }
+    if (next_slot != header.capacity || next_slot > MAX_SLOTS) {
+        cout << "Raf header is corrupt\n";
+        return false;
+    }
+
+    extent_count = header.extent_count;
+    capacity = next_slot;
+    used_ids.resize(capacity);
+    for (size_t i = 0; i < extent_count; i++) {
+        const Extent &extent = extents[i];
+        vector<uint64_t> words(extent.slots / 64);
+        if (!readAt(words.data(), extent.slots / 8, extent.offset)) {
+            return false;
+        }
+        used_ids.setWords(extent.first_slot / 64, words.data(), words.size());
+    }
+
+    // a packed raf's page numbers are kept in memory; new pages go after
+    // whatever is in the file
+    for (size_t i = 0; storage == Storage::packed && i < extent_count; i++) {
+        const Extent &extent = extents[i];
+        vector<uint32_t> pages(extent.slots);
+        if (!readAt(pages.data(), extent.slots * sizeof(uint32_t),
+            extent.offset + roundUp(extent.slots / 8, PAGE_SIZE))) {
+            return false;
+        }
+        page_map[i].reset(new atomic<uint32_t>[extent.slots]);
+        for (size_t j = 0; j < extent.slots; j++) {
+            page_map[i][j].store(pages[j], memory_order_relaxed);
+        }
+    }
+    file_end = roundUp(st.st_size, PAGE_SIZE);
+    next_page = file_end / PAGE_SIZE;
+    fill_page = 0;
+
+    return true;
+}
+
+bool File::migrateLegacyFile() {
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        return false;
+    }
+    size_t legacy_record_size = record_size;
+    if ((size_t)st.st_size !=
+        LEGACY_HEADER_SIZE + LEGACY_RECORDS * record_size) {
+        legacy_record_size = convert_size;
+    }
+    size_t legacy_size = LEGACY_HEADER_SIZE +
+        LEGACY_RECORDS * legacy_record_size;
+    if (legacy_record_size == 0 || (size_t)st.st_size != legacy_size) {
+        return false;
+    }
+
+    string legacy(legacy_size, '\0');
+    if (!readAt(&legacy[0], legacy_size, 0)) {
+        return false;
+    }
+    bitset<LEGACY_RECORDS> available_ids;
+    memcpy(&available_ids, legacy.data(), LEGACY_HEADER_SIZE);
+
+    // build the new raf next to the old one & swap it in once it's complete
+    string new_name = file_name + ".tmp";
+    int legacy_fd = fd;
+    fd = open(new_name.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        fd = legacy_fd;
+        return false;
+    }
+
+    bool migrated = createFile(roundUp(LEGACY_RECORDS, 64));
+    char converted[record_size];
+    for (size_t slot = 0; migrated && slot < LEGACY_RECORDS; slot++) {
+        if (available_ids[slot]) {
+            continue;
+        }
+        int id = (slot + 1) * 10;
+        reserveId(id);
+        const char* record =
+            &legacy[LEGACY_HEADER_SIZE + slot * legacy_record_size];
+        if (legacy_record_size != record_size) {
+            migrated = convert(record, converted);
+            record = converted;
+        }
+        migrated = migrated && writeRecord(id, record, Sync::none);
+    }
+    for (size_t word = 0; word < capacity / 64; word++) {
+        migrated = migrated && writeIdWord(word, Sync::none);
+    }
+    migrated = migrated && syncRaf(Sync::full) &&
+        rename(new_name.c_str(), file_name.c_str()) == 0;
+
+    if (!migrated) {
+        close(fd);
+        unlink(new_name.c_str());
+        fd = legacy_fd;
+        return false;
+    }
+
+    close(legacy_fd);
+    cout << "Migrated " << file_name << " to raf version " << FORMAT_VERSION
+        << endl;
+    return true;
+}
+
+bool File::convertFile() {
+    Header header;
+    if (!readAt(&header, sizeof(header), 0) ||
+        memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 ||
+        (header.version != FORMAT_VERSION &&
+        header.version != UNCHECKED_VERSION) || header.extent_count == 0 ||
+        header.extent_count > MAX_EXTENTS || header.capacity > MAX_SLOTS) {
+        return false;
+    }
+
+    // an old raf of convert_size records is converted; a raf of this size
+    // is only sealed (if plaintext), checksummed (if version 1) & packed
+    // (if the File is)
+    bool old_checked = header.version == FORMAT_VERSION;
+    bool old_sealed = header.encrypted != 0;
+    if (old_checked && header.packed != 0) {
+        return false; // only unpacked rafs are read here
+    }
+    if ((old_checked && header.crc != headerCrc(header)) ||
+        (old_sealed && (cipher == nullptr || !keyMatches(*cipher, header)))) {
+        return false;
+    }
+    size_t old_slot_size = header.record_size;
+    size_t old_payload_size = old_slot_size - (old_checked ? CHECKSUM_SIZE : 0);
+    size_t old_size = old_payload_size - (old_sealed ? Cipher::OVERHEAD : 0);
+    bool resize = convert_size != 0 && old_size == convert_size;
+    bool repack = storage == Storage::packed;
+    if (!resize && !(old_size == record_size && (repack || !old_checked ||
+        (!old_sealed && cipher != nullptr)))) {
+        return false;
+    }
+
+    struct stat st;
+    if (stat((file_name + ".wal").c_str(), &st) == 0 && st.st_size > 0) {
+        cout << "Replay " << file_name << ".wal with the previous version "
+            "before converting " << file_name << endl;
+        return false;
+    }
+
+    string new_name = file_name + ".tmp";
+    int old_fd = fd;
+    fd = open(new_name.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        fd = old_fd;
+        return false;
+    }
+
+    // copy each old extent a chunk of slots at a time; the new raf keeps
+    // the slots in the same order in one extent
+    const size_t CHUNK_SLOTS = max(CHUNK_BYTES / max(slot_size, old_slot_size),
+        (size_t)1);
+    string dummy(record_size, '\0');
+    bool converted = createFile(header.capacity) &&
+        dummy_record->encode(&dummy[0]);
+    string old_slots, old_records, new_slots;
+    vector<uint64_t> ids;
+    vector<Transfer> transfers;
+    for (uint32_t i = 0; converted && i < header.extent_count; i++) {
+        const auto &extent = header.extents[i];
+        vector<uint64_t> words(extent.slots / 64);
+        converted = extent.slots % 64 == 0 &&
+            extent.first_slot + extent.slots <= header.capacity &&
+            pread(old_fd, words.data(), extent.slots / 8, extent.offset) ==
+            (ssize_t)(extent.slots / 8);
+        off_t old_offset = extent.offset + roundUp(extent.slots / 8, PAGE_SIZE);
+
+        for (size_t first = 0; converted && first < extent.slots;
+            first += CHUNK_SLOTS) {
+            size_t count = min(CHUNK_SLOTS, extent.slots - first);
+            old_slots.resize(count * old_slot_size);
+            old_records.resize(old_size);
+            new_slots.assign(count * slot_size, '\0');
+            ids.resize(count);
+            transfers.clear();
+            for (size_t j = 0; j < count; j++) {
+                ids[j] = (extent.first_slot + first + j + 1) * 10;
+            }
+            converted = pread(old_fd, &old_slots[0], old_slots.size(),
+                old_offset + first * old_slot_size) ==
+                (ssize_t)old_slots.size();
+            for (size_t j = 0; converted && j < count; j++) {
+                size_t slot = first + j;
+                char* record = &new_slots[j * slot_size];
+                const char* old_record = &old_slots[j * old_slot_size];
+                bool used = words[slot / 64] >> (slot % 64) & 1;
+                if (used) {
+                    used_ids.reserve(extent.first_slot + slot);
+                }
+                if (!used || allZero(old_record, old_slot_size)) {
+                    memcpy(record, dummy.data(), record_size);
+                    if (!repack) {
+                        transfers.push_back({ 0, record, (int)ids[j] });
+                    }
+                    continue;
+                }
+                transfers.push_back({ 0, record, (int)ids[j] });
+                if (old_checked &&
+                    !slotMatches((int)ids[j], old_record, old_payload_size)) {
+                    cout << "Record " << ids[j] << " failed its checksum\n";
+                    converted = false;
+                    break;
+                }
+                if (old_sealed) {
+                    converted = cipher->open(old_record, &old_records[0],
+                        old_size, ids[j]);
+                    old_record = old_records.data();
+                }
+                if (resize) {
+                    converted = convert(old_record, record);
+                }
+                else {
+                    memcpy(record, old_record, record_size);
+                }
+
+                // a record is encoded again as it's packed, so its type can
+                // zero the bytes it doesn't use (the dummy is put back after)
+                if (repack) {
+                    converted = converted && dummy_record->decode(record) &&
+                        dummy_record->encode(record);
+                }
+            }
+            if (converted) {
+                sealRecords(ids.data(), count, &new_slots[0]);
+            }
+            for (Transfer &slot : transfers) {
+                slot.offset = calculateOffset(slot.id);
+            }
+            converted = converted && transfer(transfers, true);
+        }
+    }
+    converted = dummy_record->decode(empty_record.data()) && converted;
+    for (size_t word = 0; converted && word < capacity / 64; word++) {
+        converted = writeIdWord(word, Sync::none);
+    }
+    converted = converted && syncRaf(Sync::full) &&
+        rename(new_name.c_str(), file_name.c_str()) == 0;
+
+    if (!converted) {
+        cout << "Converting " << file_name << " failed\n";
+        close(fd);
+        unlink(new_name.c_str());
+        fd = old_fd;
+        return false;
+    }
+
+    close(old_fd);
+    if (resize) {
+        cout << "Converted " << file_name << " from " << convert_size
+            << " to " << record_size << " byte records\n";
+    }
+    if (!old_sealed && cipher != nullptr) {
+        cout << "Encrypted " << file_name << endl;
+    }
+    if (!old_checked) {
+        cout << "Added checksums to " << file_name << endl;
+    }
+    if (repack) {
+        cout << "Packed " << file_name << " into pages\n";
+    }
+    return true;
+}
+
+string File::encodeHeader(const Extent* extents, size_t count, bool packed) {
+    Header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = FORMAT_VERSION;
+    header.extent_count = count;
+    header.record_size = slot_size;
+    header.packed = packed ? 1 : 0;
+    header.capacity = count == 0 ? 0 :
+        extents[count - 1].first_slot + extents[count - 1].slots;
+    for (size_t i = 0; i < count; i++) {
+        header.extents[i].offset = extents[i].offset;
+        header.extents[i].first_slot = extents[i].first_slot;
+        header.extents[i].slots = extents[i].slots;
+    }
+    if (cipher != nullptr) {
+        const char zeros[KEY_CHECK_SIZE] = { 0 };
+        header.encrypted = 1;
+        cipher->seal(zeros, header.key_check, KEY_CHECK_SIZE, KEY_CHECK_ID);
+    }
+    header.crc = headerCrc(header);
+    return string((const char*)&header, sizeof(header));
+}
+
+bool File::writeHeader(size_t count, Sync sync) {
+    string header = encodeHeader(extents, count, storage == Storage::packed);
+    return writeAt(header.data(), header.size(), 0) &&
+        syncRange(0, header.size(), sync);
+}
+
+bool File::grow() {
+    // double the capacity without going over the largest id
+    size_t current = capacity;
+    size_t slots = min(current, (MAX_SLOTS - current) / 64 * 64);
+    if (slots == 0 || extent_count == MAX_EXTENTS) {
+        return false;
+    }
+    return grow(slots);
+}
+
+bool File::grow(size_t slots) {
+    // a packed raf's extents go after its pages
+    bool packed = storage == Storage::packed;
+    unique_lock<mutex> fill_guard = packed ? unique_lock<mutex>(fill_lock) :
+        unique_lock<mutex>();
+    Extent extent;
+    size_t count = extent_count;
+    extent.offset = HEADER_SIZE;
+    if (count > 0 && packed) {
+        extent.offset = file_end;
+    }
+    else if (count > 0) {
+        const Extent &last = extents[count - 1];
+        extent.offset = last.offset + roundUp(last.slots / 8, PAGE_SIZE) +
+            roundUp(last.slots * slot_stride, PAGE_SIZE);
+    }
+    extent.first_slot = capacity;
+    extent.slots = slots;
+
+    // the extent is zeros: its bitmap has no ids used & its slots are
+    // empty (or in no page), so nothing needs writing
+    size_t records_offset = extent.offset + roundUp(slots / 8, PAGE_SIZE);
+    size_t file_size = records_offset + roundUp(slots * slot_stride,
+        PAGE_SIZE);
+
+    // anything an interrupted grow left past the last extent goes first
+    Stats::countIo(0, 0, 2);
+    if (ftruncate(fd, extent.offset) == -1 ||
+        ftruncate(fd, file_size) == -1) {
+        return false;
+    }
+    if (preallocate) {
+        // file systems without fallocate leave the extent sparse
+        Stats::countIo(0, 0, 1);
+        if (fallocate(fd, 0, extent.offset, file_size - extent.offset) ==
+            -1 && errno != EOPNOTSUPP) {
+            return false;
+        }
+    }
+    if (mapping != nullptr && !extendMapping(file_size)) {
+        return false;
+    }
+
+    // the new size must be on disk before the header points past it
+    Stats::countIo(0, 0, 1);
+    if (fdatasync(fd) == -1) {
+        return false;
+    }
+
+    // readers only look at extents below extent_count & ids below capacity,
+    // so the new extent becomes visible once both are bumped
+    extents[count] = extent;
+    changed[count].reset(new atomic<uint64_t>[slots / 64]());
+    if (packed) {
+        page_map[count].reset(new atomic<uint32_t>[slots]());
+        file_end = file_size;
+        next_page = file_size / PAGE_SIZE;
+    }
+    if (!writeHeader(count + 1, Sync::full)) {
+        return false;
+    }
+    used_ids.resize(capacity + slots);
+    extent_count = count + 1;
+    capacity += slots;
+
+    return true;
+}
+
+const File::Extent& File::findExtent(size_t slot) {
+    // extents are sorted by first_slot; find the last one starting <= slot
+    size_t low = 0;
+    size_t high = extent_count;
+    while (high - low > 1) {
+        size_t middle = (low + high) / 2;
+        if (extents[middle].first_slot <= slot) {
+            low = middle;
+        }
+        else {
+            high = middle;
+        }
+    }
+    return extents[low];
+}
+
+bool File::mapFile() {
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        return false;
+    }
+
+    // reserve room for the largest raf so the mapping never has to move
+    mapping_reserved = roundUp(HEADER_SIZE + MAX_SLOTS / 8 +
+        MAX_SLOTS * slot_size + 2 * MAX_EXTENTS * PAGE_SIZE, PAGE_SIZE);
+    void* address = mmap(nullptr, mapping_reserved, PROT_NONE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (address == MAP_FAILED) {
+        mapping_reserved = 0;
+        return false;
+    }
+
+    mapping = (char*)address;
+    mapping_size = 0;
+    if (!extendMapping(st.st_size)) {
+        munmap(mapping, mapping_reserved);
+        mapping = nullptr;
+        return false;
+    }
+    return true;
+}
+
+bool File::extendMapping(size_t file_size) {
+    if (file_size <= mapping_size) {
+        return true;
+    }
+    if (file_size > mapping_reserved) {
+        return false;
+    }
+
+    void* address = mmap(mapping + mapping_size, file_size - mapping_size,
+        PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, mapping_size);
+    if (address == MAP_FAILED) {
+        return false;
+    }
+
+    mapping_size = file_size;
+    return true;
+}
+
+bool File::readAt(void* buffer, size_t size, off_t offset) {
+    if (mapping != nullptr) {
+        if ((size_t)offset + size > mapping_size) {
+            return false;
+        }
+        memcpy(buffer, mapping + offset, size);
+        Stats::countIo(size, 0, 0);
+        return true;
+    }
+
+    char* bytes = (char*)buffer;
+    while (size > 0) {
+        ssize_t n = pread(fd, bytes, size, offset);
+        Stats::countIo(max(n, (ssize_t)0), 0, 1);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        bytes += n;
+        size -= n;
+        offset += n;
+    }
+    return true;
+}
+
+bool File::writeAt(const void* buffer, size_t size, off_t offset) {
+    if (mapping != nullptr) {
+        if ((size_t)offset + size > mapping_size) {
+            return false;
+        }
+        memcpy(mapping + offset, buffer, size);
+        Stats::countIo(0, size, 0);
+        return true;
+    }
+
+    const char* bytes = (const char*)buffer;
+    while (size > 0) {
+        ssize_t n = pwrite(fd, bytes, size, offset);
+        Stats::countIo(0, max(n, (ssize_t)0), 1);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        bytes += n;
+        size -= n;
+        offset += n;
+    }
+    return true;
+}
+
+void File::setSyncPolicy(Sync sync_policy) {
+    this->sync_policy = sync_policy;
+}
+
+unique_lock<mutex> File::guard(mutex &lock) {
+    return concurrent ? unique_lock<mutex>(lock) : unique_lock<mutex>();
+}
+
+unique_lock<mutex> File::lockRecord(int id) {
+    if (!concurrent) {
+        return unique_lock<mutex>();
+    }
+    return unique_lock<mutex>(stripes[(id / 10 - 1) % STRIPES].lock);
+}
+
+vector<unique_lock<mutex>> File::lockRecords(const vector<int> &ids) {
+    vector<unique_lock<mutex>> guards;
+    if (!concurrent) {
+        return guards;
+    }
+
+    vector<size_t> indexes;
+    for (int id : ids) {
+        indexes.push_back((id / 10 - 1) % STRIPES);
+    }
+    sort(indexes.begin(), indexes.end());
+    indexes.erase(unique(indexes.begin(), indexes.end()), indexes.end());
+    for (size_t index : indexes) {
+        guards.emplace_back(stripes[index].lock);
+    }
+    return guards;
+}
+
+bool File::syncRange(off_t offset, size_t size, Sync sync) {
+    if (mapping == nullptr || sync == Sync::none) {
+        return syncRaf(sync);
+    }
+
+    // msync wants a page aligned start
+    off_t page_size = sysconf(_SC_PAGESIZE);
+    off_t start = offset - offset % page_size;
+    Stats::countIo(0, 0, sync == Sync::data ? 1 : 2);
+    if (msync(mapping + start, size + (offset - start), MS_SYNC) == -1) {
+        return false;
+    }
+    return sync == Sync::data || fsync(fd) == 0;
+}
+
+bool File::sync(Sync sync /*= Sync::full*/) {
+    StatTimer timer(STAT_SYNC);
+    if (!flushCache()) {
+        return timer.check(false);
+    }
+    if (journal != nullptr) {
+        return timer.check(sync == Sync::none || journal->commitAll());
+    }
+    return timer.check(syncRaf(sync));
+}
+
+bool File::syncRaf(Sync sync) {
+    Stats::countIo(0, 0, (sync != Sync::none) * (1 + (mapping != nullptr)));
+    if (mapping != nullptr && sync != Sync::none &&
+        msync(mapping, mapping_size, MS_SYNC) == -1) {
+        return false;
+    }
+
+    switch (sync) {
+        case Sync::none:
+            return true;
+        case Sync::data:
+            return fdatasync(fd) == 0;
+        case Sync::full:
+        default:
+            return fsync(fd) == 0;
+    }
+}
+
+JournalStats File::getJournalStats() {
+    return journal == nullptr ? JournalStats() : journal->getStats();
+}
+
+VersionStats File::getVersionStats() {
+    return versions == nullptr ? VersionStats() : versions->getStats();
+}
+
+CacheStats File::getCacheStats() {
+    unique_lock<mutex> cache_guard = guard(cache_lock);
+    return cache == nullptr ? CacheStats() : cache->getStats();
+}
+
+size_t File::getCapacity() {
+    return capacity;
+}
+
+size_t File::getRecordCount() {
+    unique_lock<mutex> ids_guard = guard(ids_lock);
+    return capacity - used_ids.getFreeCount();
+}
+
+void File::getUsedIds(vector<int> &ids) {
+    unique_lock<mutex> ids_guard = guard(ids_lock);
+    for (size_t word = 0; word < capacity / 64; word++) {
+        uint64_t bits = used_ids.getWord(word);
+        while (bits != 0) {
+            int bit = __builtin_ctzll(bits);
+            bits &= bits - 1;
+            ids.push_back((word * 64 + bit + 1) * 10);
+        }
+    }
+}
+
+bool File::verifyFile(VerifyReport &report, bool repair /*= false*/,
+    size_t threads /*= 0*/) {
+    report = VerifyReport();
+    if (!flushCache()) {
+        return false;
+    }
+    if (threads == 0) {
+        threads = max(thread::hardware_concurrency(), 1u);
+    }
+
+    // the extents are cut into chunks of whole bitmap words, which the
+    // threads take in turn & check into reports of their own
+    struct Chunk {
+        size_t first_slot;
+        size_t slots;
+    };
+    const size_t CHUNK_SLOTS = max(CHUNK_BYTES / slot_size / 64, (size_t)1) *
+        64;
+    vector<Chunk> chunks;
+    for (size_t i = 0; i < extent_count; i++) {
+        const Extent &extent = extents[i];
+        for (size_t first = 0; first < extent.slots; first += CHUNK_SLOTS) {
+            chunks.push_back({ extent.first_slot + first,
+                min(CHUNK_SLOTS, extent.slots - first) });
+        }
+    }
+
+    atomic<size_t> next_chunk(0);
+    atomic<bool> read_failed(false);
+    vector<VerifyReport> reports(min(threads, max(chunks.size(),
+        (size_t)1)));
+    auto scan = [&](VerifyReport &found) {
+        string slots;
+        vector<const void*> payloads(CHUNK_SLOTS);
+        vector<uint32_t> crcs(CHUNK_SLOTS);
+        char opened[record_size];
+        size_t index;
+        while (!read_failed && (index = next_chunk++) < chunks.size()) {
+            const Chunk &chunk = chunks[index];
+            slots.resize(chunk.slots * slot_size);
+            if (!readSlots(chunk.first_slot, chunk.slots, &slots[0])) {
+                read_failed = true;
+                break;
+            }
+            for (size_t j = 0; j < chunk.slots; j++) {
+                payloads[j] = &slots[j * slot_size];
+                crcs[j] = (chunk.first_slot + j + 1) * 10;
+            }
+            crc32cMany(payloads.data(), payload_size, chunk.slots,
+                crcs.data());
+
+            for (size_t j = 0; j < chunk.slots; j++) {
+                size_t slot_index = chunk.first_slot + j;
+                int id = (slot_index + 1) * 10;
+                const char* slot = &slots[j * slot_size];
+                bool used = used_ids.isUsed(slot_index);
+                uint32_t crc;
+                memcpy(&crc, slot + payload_size, sizeof(crc));
+                found.slots++;
+                if (allZero(slot, slot_size)) {
+                    if (used) {
+                        found.unwritten.push_back(id);
+                    }
+                    continue;
+                }
+                if (crc != crcs[j] || (cipher != nullptr &&
+                    !cipher->open(slot, opened, record_size, id))) {
+                    found.corrupt.push_back(id);
+                    continue;
+                }
+                const char* record = cipher != nullptr ? opened : slot;
+                if (used) {
+                    found.records++;
+                }
+                else if (memcmp(record, empty_record.data(), record_size) !=
+                    0) {
+                    found.orphaned.push_back(id);
+                }
+            }
+        }
+    };
+    vector<thread> workers;
+    for (size_t i = 1; i < reports.size(); i++) {
+        workers.emplace_back(scan, ref(reports[i]));
+    }
+    scan(reports[0]);
+    for (thread &worker : workers) {
+        worker.join();
+    }
+    if (read_failed) {
+        cout << "Error reading file\n";
+        return false;
+    }
+
+    for (const VerifyReport &found : reports) {
+        report.slots += found.slots;
+        report.records += found.records;
+        report.corrupt.insert(report.corrupt.end(), found.corrupt.begin(),
+            found.corrupt.end());
+        report.unwritten.insert(report.unwritten.end(),
+            found.unwritten.begin(), found.unwritten.end());
+        report.orphaned.insert(report.orphaned.end(), found.orphaned.begin(),
+            found.orphaned.end());
+    }
+    sort(report.corrupt.begin(), report.corrupt.end());
+    sort(report.unwritten.begin(), report.unwritten.end());
+    sort(report.orphaned.begin(), report.orphaned.end());
+    if (!repair) {
+        return true;
+    }
+
+    // orphaned records get their ids back; a corrupt slot of a free id is
+    // emptied (it reads as the dummy record again)
+    vector<size_t> words;
+    for (int id : report.orphaned) {
+        reserveId(id);
+        words.push_back((id / 10 - 1) / 64);
+        report.repaired++;
+    }
+    const string empty(slot_size, '\0');
+    for (int id : report.corrupt) {
+        if (used_ids.isUsed(id / 10 - 1)) {
+            continue;
+        }
+        noteWrite(id);
+        if (!writeSlot(id, empty.data(), Sync::none)) {
+            cout << "Writing file failed\n";
+            return false;
+        }
+        report.repaired++;
+    }
+    words.erase(unique(words.begin(), words.end()), words.end());
+    for (size_t word : words) {
+        if (!writeIdWord(word, Sync::none)) {
+            cout << "Writing file failed\n";
+            return false;
+        }
+    }
+    if (report.repaired > 0 && !syncRaf(Sync::full)) {
+        cout << "Writing file failed\n";
+        return false;
+    }
+    return true;
+}
+
+uint64_t File::beginWrite(const int* ids, size_t count) {
+    if (versions == nullptr) {
+        return 0;
+    }
+    bool keep;
+    uint64_t seq = versions->beginWrite(keep);
+    if (!keep) {
+        return seq;
+    }
+
+    // the records are locked, so what's read is what the write replaces
+    vector<int> replaced(ids, ids + count);
+    string images(count * record_size, '\0');
+    vector<bool> sound;
+    if (!readCurrent(replaced, &images[0], sound, true)) {
+        cout << "Error reading file\n";
+        return seq;
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (sound[i]) {
+            versions->keep(ids[i], seq, &images[i * record_size]);
+        }
+    }
+    return seq;
+}
+
+void File::endWrite(uint64_t seq) {
+    if (versions != nullptr) {
+        versions->endWrite(seq);
+    }
+}
+
+bool File::readCurrent(const vector<int> &ids, char* serialized_records,
+    vector<bool> &sound, bool report) {
+    // cached records are plain; the rest are slots from the journal or the
+    // raf, checked one at a time since a view reads few of them
+    // (into a thread's scratch, kept from call to call so views don't
+    // allocate)
+    static thread_local string slots;
+    static thread_local vector<size_t> sealed;
+    static thread_local vector<Transfer> transfers;
+    sound.assign(ids.size(), true);
+    slots.assign(ids.size() * slot_size, '\0');
+    sealed.clear();
+    transfers.clear();
+    unique_lock<mutex> cache_guard = guard(cache_lock);
+    for (size_t i = 0; i < ids.size(); i++) {
+        char* slot = &slots[i * slot_size];
+        const char* cached = cache == nullptr ? nullptr : cache->find(ids[i]);
+        if (cached != nullptr) {
+            memcpy(serialized_records + i * record_size, cached,
+                record_size);
+            continue;
+        }
+        sealed.push_back(i);
+        if (journal == nullptr || !journal->find(ids[i], slot)) {
+            transfers.push_back({ calculateOffset(ids[i]), slot, ids[i] });
+        }
+    }
+    cache_guard = unique_lock<mutex>();
+
+    if (!transfer(transfers, false)) {
+        return false;
+    }
+    for (size_t i : sealed) {
+        const char* slot = &slots[i * slot_size];
+        char* serialized_record = serialized_records + i * record_size;
+        if (allZero(slot, slot_size)) {
+            memcpy(serialized_record, empty_record.data(), record_size);
+        }
+        else if (!slotMatches(ids[i], slot, payload_size)) {
+            sound[i] = false;
+            if (report) {
+                cout << "Record " << ids[i] << " failed its checksum\n";
+            }
+        }
+        else if (cipher == nullptr) {
+            memcpy(serialized_record, slot, record_size);
+        }
+        else if (!cipher->open(slot, serialized_record, record_size,
+            ids[i])) {
+            sound[i] = false;
+            if (report) {
+                cout << "Record " << ids[i] << " failed authentication\n";
+            }
+        }
+    }
+    return true;
+}
+
+void File::noteWrite(int id) {
+    size_t slot = id / 10 - 1;
+    size_t index = &findExtent(slot) - extents;
+    size_t bit = slot - extents[index].first_slot;
+    changed[index][bit / 64].fetch_or(1ull << bit % 64,
+        memory_order_relaxed);
+    if (!snapshotting) {
+        return;
+    }
+
+    // a slot still pending holds what it held at the cut: writers that
+    // changed it since took it off pending
+    lock_guard<mutex> snapshot_guard(snapshot_lock);
+    if (!snapshotting || slot >= snapshot->capacity ||
+        (snapshot->pending[slot / 64] >> slot % 64 & 1) == 0) {
+        return;
+    }
+    string image(slot_size, '\0');
+    if (!readSlots(slot, 1, &image[0])) {
+        snapshot->failed = true;
+    }
+    snapshot->pending[slot / 64] &= ~(1ull << slot % 64);
+    snapshot->preserved.emplace(id, move(image));
+}
+
+bool File::beginSnapshot(const string &file_name) {
+    StatTimer timer(STAT_BEGIN_SNAPSHOT);
+    if (snapshot != nullptr) {
+        cout << "A snapshot is already being taken\n";
+        return timer.check(false);
+    }
+    unique_ptr<Snapshot> target(new Snapshot());
+    target->file_name = file_name + FILE_EXTENSION;
+    target->failed = false;
+    if (target->file_name == this->file_name) {
+        cout << "A raf can't be its own snapshot\n";
+        return timer.check(false);
+    }
+    target->fd = open(target->file_name.c_str(), O_RDWR | O_CREAT |
+        O_CLOEXEC, 0644);
+    if (target->fd == -1) {
+        cout << "Error opening " << target->file_name << endl;
+        return timer.check(false);
+    }
+
+    // only the snapshot this File last took into the file is brought up to
+    // date; its header is wiped first so it doesn't open half updated
+    bool full = target->file_name != last_snapshot;
+    if (!full) {
+        string header(last_snapshot_header.size(), '\0');
+        full = pread(target->fd, &header[0], header.size(), 0) !=
+            (ssize_t)header.size() || header != last_snapshot_header;
+    }
+    const string wiped(last_snapshot_header.size(), '\0');
+    if (full ? ftruncate(target->fd, 0) == -1 : !writeAll(target->fd,
+        wiped.data(), wiped.size(), 0) || fdatasync(target->fd) == -1) {
+        cout << "Error writing " << target->file_name << endl;
+        close(target->fd);
+        return timer.check(false);
+    }
+    target->report.full = full;
+
+    {
+        // the cut: no record is being written while every stripe is held
+        vector<unique_lock<mutex>> record_guards;
+        for (size_t i = 0; concurrent && i < STRIPES; i++) {
+            record_guards.emplace_back(stripes[i].lock);
+        }
+        if (!flushCache()) {
+            cout << "Writing cached records failed\n";
+            close(target->fd);
+            return timer.check(false);
+        }
+        unique_lock<mutex> ids_guard = guard(ids_lock);
+
+        // a packed raf's snapshot is laid out like an unpacked raf
+        target->extents.assign(extents, extents + extent_count);
+        target->capacity = capacity;
+        size_t file_size = HEADER_SIZE;
+        for (Extent &extent : target->extents) {
+            if (storage == Storage::packed) {
+                extent.offset = file_size;
+            }
+            file_size = extent.offset + roundUp(extent.slots / 8, PAGE_SIZE) +
+                roundUp(extent.slots * slot_size, PAGE_SIZE);
+        }
+        target->file_size = file_size;
+        target->header = encodeHeader(target->extents.data(),
+            target->extents.size(), false);
+        target->report.slots = target->capacity;
+        target->used_ids.resize(target->capacity / 64);
+        target->pending.resize(target->capacity / 64);
+        for (size_t i = 0; i < target->extents.size(); i++) {
+            size_t first_word = extents[i].first_slot / 64;
+            for (size_t word = 0; word < extents[i].slots / 64; word++) {
+                target->used_ids[first_word + word] =
+                    used_ids.getWord(first_word + word);
+                uint64_t written = changed[i][word].exchange(0,
+                    memory_order_relaxed);
+                target->pending[first_word + word] = full ? ~0ull : written;
+            }
+        }
+
+        // records the journal hasn't checkpointed yet are newer than their
+        // slots
+        vector<pair<int, string>> images;
+        if (journal != nullptr) {
+            journal->getImages(images);
+        }
+        for (pair<int, string> &image : images) {
+            size_t slot = image.first / 10 - 1;
+            if (slot < target->capacity) {
+                target->pending[slot / 64] &= ~(1ull << slot % 64);
+                target->preserved[image.first] = move(image.second);
+            }
+        }
+
+        snapshot = move(target);
+        snapshotting = true;
+    }
+
+    snapshot_thread = thread([this]() {
+        bool copied = copySnapshot();
+        lock_guard<mutex> snapshot_guard(snapshot_lock);
+        snapshot->failed = snapshot->failed || !copied;
+        snapshotting = false;
+    });
+    return true;
+}
+
+bool File::copySnapshot() {
+    Snapshot &target = *snapshot;
+    if (ftruncate(target.fd, target.file_size) == -1) {
+        return false;
+    }
+
+    // each chunk's pending slots are read with one call, then the ones no
+    // writer preserved meanwhile are taken off pending & written out
+    const size_t CHUNK_SLOTS = max(CHUNK_BYTES / slot_size / 64, (size_t)1) *
+        64;
+    string slots;
+    vector<uint64_t> words(CHUNK_SLOTS / 64);
+    for (size_t i = 0; i < target.extents.size(); i++) {
+        const Extent &extent = target.extents[i];
+        off_t records_offset = extent.offset +
+            roundUp(extent.slots / 8, PAGE_SIZE);
+        for (size_t first = 0; first < extent.slots; first += CHUNK_SLOTS) {
+            size_t first_word = (extent.first_slot + first) / 64;
+            size_t word_count = min(CHUNK_SLOTS, extent.slots - first) / 64;
+            {
+                lock_guard<mutex> snapshot_guard(snapshot_lock);
+                copy(&target.pending[first_word],
+                    &target.pending[first_word + word_count], words.begin());
+            }
+            size_t low = SIZE_MAX, high = 0;
+            for (size_t w = 0; w < word_count; w++) {
+                if (words[w] != 0) {
+                    low = min(low, w * 64 + __builtin_ctzll(words[w]));
+                    high = w * 64 + 63 - __builtin_clzll(words[w]);
+                }
+            }
+            if (low == SIZE_MAX) {
+                continue;
+            }
+
+            // runs of pending slots less than a page apart are read together
+            // (a packed raf's in one go, which reads each page once)
+            slots.resize((high - low + 1) * slot_size);
+            off_t offset = records_offset + (first + low) * slot_size;
+            auto marked = [&](size_t j) {
+                return (words[j / 64] >> j % 64 & 1) != 0;
+            };
+            const size_t GAP_SLOTS = storage == Storage::packed ? CHUNK_SLOTS :
+                max(PAGE_SIZE / slot_size, (size_t)1);
+            for (size_t j = low; j <= high;) {
+                size_t end = j + 1;
+                size_t gap = 0;
+                for (size_t k = end; k <= high && gap < GAP_SLOTS; k++) {
+                    gap = marked(k) ? 0 : gap + 1;
+                    end = marked(k) ? k + 1 : end;
+                }
+                if (!readSlots(extent.first_slot + first + j, end - j,
+                    &slots[(j - low) * slot_size])) {
+                    return false;
+                }
+                j = end;
+                while (j <= high && !marked(j)) {
+                    j++;
+                }
+            }
+            {
+                lock_guard<mutex> snapshot_guard(snapshot_lock);
+                for (size_t w = 0; w < word_count; w++) {
+                    words[w] &= target.pending[first_word + w];
+                    target.pending[first_word + w] &= ~words[w];
+                }
+            }
+
+            // runs of taken slots are written with one call each; a full
+            // snapshot leaves empty slots as holes
+            auto taken = [&](size_t j) {
+                return marked(j) && !(target.report.full &&
+                    allZero(&slots[(j - low) * slot_size], slot_size));
+            };
+            for (size_t j = low; j <= high; j++) {
+                if (!taken(j)) {
+                    continue;
+                }
+                size_t end = j + 1;
+                while (end <= high && taken(end)) {
+                    end++;
+                }
+                if (!writeAll(target.fd, &slots[(j - low) * slot_size],
+                    (end - j) * slot_size, offset + (j - low) * slot_size)) {
+                    return false;
+                }
+                target.report.copied += end - j;
+                j = end;
+            }
+        }
+    }
+
+    // nothing is pending any more, so no writer adds to preserved
+    unordered_map<int, string> preserved;
+    {
+        lock_guard<mutex> snapshot_guard(snapshot_lock);
+        preserved.swap(target.preserved);
+    }
+    vector<int> ids;
+    for (const auto &image : preserved) {
+        ids.push_back(image.first);
+    }
+    sort(ids.begin(), ids.end());
+    size_t i = 0;
+    for (int id : ids) {
+        size_t slot = id / 10 - 1;
+        while (slot >= target.extents[i].first_slot +
+            target.extents[i].slots) {
+            i++;
+        }
+        const Extent &extent = target.extents[i];
+        off_t offset = extent.offset + roundUp(extent.slots / 8, PAGE_SIZE) +
+            (slot - extent.first_slot) * slot_size;
+        if (!writeAll(target.fd, preserved[id].data(), slot_size, offset)) {
+            return false;
+        }
+    }
+    target.report.copied += ids.size();
+    target.report.preserved = ids.size();
+
+    // the header goes last, once everything it points at is durable
+    for (const Extent &extent : target.extents) {
+        if (!writeAll(target.fd, &target.used_ids[extent.first_slot / 64],
+            extent.slots / 8, extent.offset)) {
+            return false;
+        }
+    }
+    Stats::countIo(0, 0, 2);
+    return fdatasync(target.fd) == 0 && writeAll(target.fd,
+        target.header.data(), target.header.size(), 0) &&
+        fsync(target.fd) == 0;
+}
+
+bool File::isSnapshotRunning() {
+    return snapshotting;
+}
+
+bool File::endSnapshot(SnapshotReport &report) {
+    report = SnapshotReport();
+    if (snapshot == nullptr) {
+        return false;
+    }
+    snapshot_thread.join();
+
+    bool succeeded = !snapshot->failed && close(snapshot->fd) == 0;
+    report = snapshot->report;
+    if (succeeded) {
+        last_snapshot = snapshot->file_name;
+        last_snapshot_header = snapshot->header;
+    }
+    else {
+        // the slots it didn't copy are no longer marked as changed
+        cout << "Taking a snapshot into " << snapshot->file_name
+            << " failed\n";
+        last_snapshot.clear();
+        if (snapshot->failed) {
+            close(snapshot->fd);
+        }
+    }
+    lock_guard<mutex> snapshot_guard(snapshot_lock);
+    snapshot.reset();
+    return succeeded;
+}
+
+bool File::validId(int id) {
+    return id >= 10 && id % 10 == 0 && (size_t)(id / 10 - 1) < capacity;
+}
+
+bool File::reserveId(int id) {
+    return used_ids.reserve(id / 10 - 1);
+}
+
+void File::releaseId(int id) {
+    used_ids.release(id / 10 - 1);
+}
+
+int File::getNextAvailableId() {
+    unique_lock<mutex> ids_guard = guard(ids_lock);
+    size_t slot;
+    if (!used_ids.findFree(slot)) {
+        if (!grow() || !used_ids.findFree(slot)) {
+            cout << "No available ids\n";
+            return -1;
+        }
+    }
+
+    return (slot + 1) * 10;
+}
+
+size_t File::reserveIds(size_t count, vector<int> &ids) {
+    StatTimer timer(STAT_RESERVE_IDS);
+    unique_lock<mutex> ids_guard = guard(ids_lock);
+    vector<size_t> slots;
+    while (used_ids.reserveBlock(count - slots.size(), slots) <
+        count - slots.size()) {
+        if (!grow()) {
+            cout << "No available ids\n";
+            break;
+        }
+    }
+
+    // with a journal the bits reach the raf with the records' images
+    vector<pair<int, bool>> bits;
+    for (size_t slot : slots) {
+        ids.push_back((slot + 1) * 10);
+        bits.emplace_back(ids.back(), true);
+    }
+    if (journal == nullptr && !writeIdBits(bits, false)) {
+        cout << "Writing file failed\n";
+        exit(-10); // TODO: code/msg better than -10?
+    }
+    ids_guard = unique_lock<mutex>();
+
+    if (!slots.empty() && journal == nullptr && !syncRaf(sync_policy)) {
+        cout << "Writing file failed\n";
+        exit(-10); // TODO: code/msg better than -10?
+    }
+    timer.check(slots.size() == count);
+    return slots.size();
+}
+
+off_t File::idWordOffset(size_t word) {
+    const Extent &extent = findExtent(word * 64);
+    return extent.offset + (word - extent.first_slot / 64) * sizeof(uint64_t);
+}
+
+bool File::writeIdBits(const vector<pair<int, bool>> &bits,
+    bool replaying) {
+    // each word is read from the raf, changed & written back once, so bits
+    // of other ids still in flight stay as the raf has them
+    map<size_t, uint64_t> words;
+    for (const pair<int, bool> &bit : bits) {
+        size_t slot = bit.first / 10 - 1;
+        auto word = words.find(slot / 64);
+        if (word == words.end()) {
+            uint64_t value;
+            if (!readAt(&value, sizeof(value), idWordOffset(slot / 64))) {
+                return false;
+            }
+            word = words.emplace(slot / 64, value).first;
+        }
+        uint64_t mask = (uint64_t)1 << (slot % 64);
+        word->second = bit.second ? word->second | mask : word->second & ~mask;
+    }
+    for (const pair<const size_t, uint64_t> &word : words) {
+        if (!writeAt(&word.second, sizeof(word.second),
+            idWordOffset(word.first))) {
+            return false;
+        }
+        if (replaying) {
+            used_ids.setWords(word.first, &word.second, 1);
+        }
+    }
+    return true;
+}
+
+bool File::slotHoldsRecord(int id, const char* slot, bool &held) {
+    // a deleted record's slot holds the dummy record
+    if (allZero(slot, slot_size)) {
+        held = false;
+        return true;
+    }
+    if (!slotMatches(id, slot, payload_size)) {
+        return false;
+    }
+    if (cipher == nullptr) {
+        held = memcmp(slot, empty_record.data(), record_size) != 0;
+        return true;
+    }
+    static thread_local string record;
+    record.resize(record_size);
+    if (!cipher->open(slot, &record[0], record_size, id)) {
+        return false;
+    }
+    held = record != empty_record;
+    return true;
+}
+
+bool File::writeIdWord(size_t word, Sync sync) {
+    off_t word_offset = idWordOffset(word);
+    uint64_t value = used_ids.getWord(word);
+    return writeAt(&value, sizeof(value), word_offset) &&
+        syncRange(word_offset, sizeof(value), sync);
+}
+
+bool File::writeRecord(int id, const char* serialized_record, Sync sync) {
+    if (storage == Storage::packed) {
+        // sealed with its page instead
+        Transfer record = { 0, (char*)serialized_record, id };
+        return storePacked(&record, 1, false) && syncRaf(sync);
+    }
+    char slot[slot_size];
+    sealRecord(id, serialized_record, slot);
+    return writeSlot(id, slot, sync);
+}
+
+bool File::readSlots(size_t first_slot, size_t count, char* slots) {
+    if (storage != Storage::packed) {
+        return readAt(slots, count * slot_size,
+            calculateOffset((first_slot + 1) * 10));
+    }
+    // a thread's list is kept from call to call, so reads don't allocate
+    static thread_local vector<Transfer> transfers;
+    transfers.clear();
+    for (size_t j = 0; j < count; j++) {
+        transfers.push_back({ 0, slots + j * slot_size,
+            (int)((first_slot + j + 1) * 10) });
+    }
+    return readPacked(transfers.data(), transfers.size());
+}
+
+bool File::writeSlot(int id, const char* slot, Sync sync) {
+    if (storage == Storage::packed) {
+        Transfer record = { 0, (char*)slot, id };
+        return storePacked(&record, 1, true) && syncRaf(sync);
+    }
+    off_t byte_offset = calculateOffset(id);
+    return writeAt(slot, slot_size, byte_offset) &&
+        syncRange(byte_offset, slot_size, sync);
+}
+
+void File::sealRecord(int id, const char* serialized_record, char* slot) {
+    if (cipher != nullptr) {
+        cipher->seal(serialized_record, slot, record_size, id);
+    }
+    else {
+        memcpy(slot, serialized_record, record_size);
+    }
+    stampSlot(id, slot, payload_size);
+}
+
+void File::sealRecords(const uint64_t* ids, size_t count, char* slots) {
+    // sealMany takes & gives packed records, so the sealed ones are spread
+    // back out to their slots back to front
+    if (cipher != nullptr) {
+        string packed(count * record_size, '\0');
+        for (size_t i = 0; i < count; i++) {
+            memcpy(&packed[i * record_size], slots + i * slot_size,
+                record_size);
+        }
+        cipher->sealMany(packed.data(), slots, record_size, ids, count);
+        for (size_t i = count; i-- > 0;) {
+            memmove(slots + i * slot_size, slots + i * payload_size,
+                payload_size);
+        }
+    }
+
+    vector<const void*> payloads(count);
+    vector<uint32_t> crcs(count);
+    for (size_t i = 0; i < count; i++) {
+        payloads[i] = slots + i * slot_size;
+        crcs[i] = (uint32_t)ids[i];
+    }
+    crc32cMany(payloads.data(), payload_size, count, crcs.data());
+    for (size_t i = 0; i < count; i++) {
+        memcpy(slots + i * slot_size + payload_size, &crcs[i],
+            sizeof(crcs[i]));
+    }
+}
+
+const char* File::openRecord(int id, const char* slot, char* opened) {
+    if (allZero(slot, slot_size)) {
+        return empty_record.data();
+    }
+    if (!slotMatches(id, slot, payload_size)) {
+        cout << "Record " << id << " failed its checksum\n";
+        return nullptr;
+    }
+    if (cipher == nullptr) {
+        return slot;
+    }
+    if (!cipher->open(slot, opened, record_size, id)) {
+        cout << "Record " << id << " failed authentication\n";
+        return nullptr;
+    }
+    return opened;
+}
+
+bool File::transfer(vector<Transfer> &transfers, bool write) {
+    stable_sort(transfers.begin(), transfers.end(),
+        [](const Transfer &a, const Transfer &b) {
+            return a.offset < b.offset;
+        });
+
+    if (storage == Storage::packed && !write) {
+        return readPacked(transfers.data(), transfers.size());
+    }
+    if (storage == Storage::packed) {
+        return storePacked(transfers.data(), transfers.size(), true);
+    }
+
+    if (mapping != nullptr) {
+        for (const Transfer &record : transfers) {
+            if (!(write ? writeAt(record.buffer, slot_size, record.offset) :
+                readAt(record.buffer, slot_size, record.offset))) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // one call per run of adjacent slots (up to IOV_MAX records)
+    iovec iov[IOV_MAX];
+    size_t first = 0;
+    while (first < transfers.size()) {
+        int count = 0;
+        do {
+            iov[count].iov_base = transfers[first + count].buffer;
+            iov[count].iov_len = slot_size;
+            count++;
+        } while (first + count < transfers.size() && count < IOV_MAX &&
+            transfers[first + count].offset ==
+            transfers[first + count - 1].offset + (off_t)slot_size);
+
+        if (!transferAll(fd, iov, count, transfers[first].offset, write)) {
+            return false;
+        }
+        first += count;
+    }
+    return true;
+}
+
+atomic<uint32_t>& File::pageOf(size_t slot) {
+    const Extent &extent = findExtent(slot);
+    return page_map[&extent - extents][slot - extent.first_slot];
+}
+
+bool File::setPageOf(size_t slot, uint32_t page) {
+    pageOf(slot).store(page);
+    return writeAt(&page, sizeof(page), calculateOffset((slot + 1) * 10));
+}
+
+unique_lock<mutex> File::lockPage(uint32_t page) {
+    return unique_lock<mutex>(page_stripes[page % PAGE_STRIPES].lock);
+}
+
+bool File::readPage(uint32_t page, char* body, bool &sound) {
+    char stored[PAGE_SIZE];
+    if (!readAt(stored, PAGE_SIZE, (off_t)page * PAGE_SIZE)) {
+        return false;
+    }
+
+    // a page that was taken but never written is empty
+    sound = true;
+    if (allZero(stored, PAGE_SIZE)) {
+        memset(body, 0, page_body_size);
+        return true;
+    }
+    sound = slotMatches((int)page, stored, PAGE_SIZE - CHECKSUM_SIZE);
+    if (sound && cipher != nullptr) {
+        sound = cipher->open(stored, body, page_body_size,
+            PAGE_ASSOCIATED | page);
+    }
+    else if (sound) {
+        memcpy(body, stored, page_body_size);
+    }
+    sound = sound && SlottedPage(body, page_body_size).isValid();
+    return true;
+}
+
+void File::sealPage(uint32_t page, const char* body, char* image) {
+    if (cipher != nullptr) {
+        cipher->seal(body, image, page_body_size, PAGE_ASSOCIATED | page);
+    }
+    else {
+        memcpy(image, body, page_body_size);
+    }
+    stampSlot((int)page, image, PAGE_SIZE - CHECKSUM_SIZE);
+}
+
+bool File::restorePage(uint32_t page, const char* image, size_t &restored) {
+    // only a page of this raf (not the header or an extent) whose image is
+    // its own is put back, & only if it can't be read
+    if (page == 0 || ((size_t)page + 1) * PAGE_SIZE > file_end ||
+        !slotMatches((int)page, image, PAGE_SIZE - CHECKSUM_SIZE)) {
+        return true;
+    }
+    size_t offset = (size_t)page * PAGE_SIZE;
+    for (size_t i = 0; i < extent_count; i++) {
+        const Extent &extent = extents[i];
+        if (offset >= extent.offset && offset < extent.offset +
+            roundUp(extent.slots / 8, PAGE_SIZE) +
+            roundUp(extent.slots * slot_stride, PAGE_SIZE)) {
+            return true;
+        }
+    }
+
+    char body[PAGE_SIZE];
+    bool sound;
+    if (!readPage(page, body, sound)) {
+        return false;
+    }
+    if (sound) {
+        return true;
+    }
+    restored++;
+    return writeAt(image, PAGE_SIZE, offset);
+}
+
+bool File::stagePage(uint32_t page, size_t &staged, bool &sound) {
+    PackScratch &scratch = pack;
+    auto found = lower_bound(scratch.index.begin(), scratch.index.end(),
+        make_pair(page, (size_t)0));
+    if (found != scratch.index.end() && found->first == page) {
+        staged = found->second;
+        sound = true;
+        return true;
+    }
+
+    staged = scratch.staged.size();
+    scratch.bodies.resize((staged + 1) * page_body_size);
+    char* body = &scratch.bodies[staged * page_body_size];
+    {
+        unique_lock<mutex> page_guard = lockPage(page);
+        if (!readPage(page, body, sound)) {
+            return false;
+        }
+    }
+    if (!sound) {
+        cout << "Page " << page << " failed its checksum\n";
+        scratch.bodies.resize(staged * page_body_size);
+        return true;
+    }
+    bool held_records = SlottedPage(body, page_body_size).getCount() > 0;
+    scratch.staged.push_back({ page, held_records, false });
+    scratch.index.insert(found, make_pair(page, staged));
+    return true;
+}
+
+bool File::flushPages() {
+    PackScratch &scratch = pack;
+    scratch.pages.clear();
+    scratch.images.resize(scratch.staged.size() * PAGE_SIZE);
+    bool held_records = false;
+    for (size_t i = 0; i < scratch.staged.size(); i++) {
+        const StagedPage &staged = scratch.staged[i];
+        if (staged.dirty) {
+            sealPage(staged.page, &scratch.bodies[i * page_body_size],
+                &scratch.images[scratch.pages.size() * PAGE_SIZE]);
+            scratch.pages.push_back(staged.page);
+            held_records = held_records || staged.held_records;
+        }
+    }
+    scratch.staged.clear();
+    scratch.index.clear();
+    if (scratch.pages.empty()) {
+        return true;
+    }
+
+    // pages that held nothing lose nothing if they're torn; the others go
+    // to the doublewrite buffer first
+    if (held_records && doublewrite != nullptr &&
+        !doublewrite->write(scratch.pages.data(), scratch.images.data(),
+        scratch.pages.size())) {
+        return false;
+    }
+    for (size_t i = 0; i < scratch.pages.size(); i++) {
+        uint32_t page = scratch.pages[i];
+        unique_lock<mutex> page_guard = lockPage(page);
+        if (!writeAt(&scratch.images[i * PAGE_SIZE], PAGE_SIZE,
+            (off_t)page * PAGE_SIZE)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+uint32_t File::allocatePage() {
+    if (next_page >= UINT32_MAX) {
+        return 0;
+    }
+    if (next_page * PAGE_SIZE == file_end) {
+        Stats::countIo(0, 0, 1);
+        if (ftruncate(fd, file_end + FILL_PAGES * PAGE_SIZE) == -1) {
+            return 0;
+        }
+        file_end += FILL_PAGES * PAGE_SIZE;
+    }
+    return (uint32_t)next_page++;
+}
+
+bool File::readPacked(const Transfer* transfers, size_t count) {
+    // records are read a page at a time; one that moved to another page
+    // before its page was locked is looked up again. A thread's lists are
+    // kept from call to call, so reads don't allocate
+    static thread_local vector<pair<uint32_t, size_t>> order;
+    static thread_local vector<pair<uint32_t, size_t>> moved;
+    order.clear();
+    for (size_t i = 0; i < count; i++) {
+        order.emplace_back(0, i);
+    }
+    char body[PAGE_SIZE];
+    char record[record_size];
+    while (!order.empty()) {
+        for (pair<uint32_t, size_t> &entry : order) {
+            entry.first = pageOf(transfers[entry.second].id / 10 - 1);
+        }
+        sort(order.begin(), order.end());
+
+        moved.clear();
+        for (size_t first = 0; first < order.size();) {
+            uint32_t page = order[first].first;
+            size_t end = first + 1;
+            while (end < order.size() && order[end].first == page) {
+                end++;
+            }
+            unique_lock<mutex> page_guard;
+            bool sound = true;
+            if (page != 0) {
+                page_guard = lockPage(page);
+                if (!readPage(page, body, sound)) {
+                    return false;
+                }
+            }
+            SlottedPage view(body, page_body_size);
+            for (size_t k = first; k < end; k++) {
+                const Transfer &slot = transfers[order[k].second];
+                size_t index = slot.id / 10 - 1;
+                const char* data;
+                size_t length;
+                if (pageOf(index) != page) {
+                    moved.push_back(order[k]);
+                }
+                else if (page == 0) {
+                    memset(slot.buffer, 0, slot_size);
+                }
+                else if (sound && view.find(index, data, length) &&
+                    unpackRecord(data, length, record, record_size)) {
+                    sealRecord(slot.id, record, slot.buffer);
+                }
+                else {
+                    spoilSlot(slot.id, slot.buffer, payload_size);
+                }
+            }
+            first = end;
+        }
+        order.swap(moved);
+    }
+    return true;
+}
+
+bool File::storePacked(const Transfer* records, size_t count, bool sealed) {
+    // one write at a time, so no record moves under it & the pages it
+    // changes are kept in memory until they're written together
+    lock_guard<mutex> fill_guard(fill_lock);
+    PackScratch &scratch = pack;
+    scratch.staged.clear();
+    scratch.index.clear();
+    scratch.homeless.clear();
+    scratch.moves.clear();
+    scratch.left.clear();
+
+    const size_t STRIDE = RUN_SIZE + record_size;
+    scratch.records.resize(count * STRIDE);
+    scratch.lengths.resize(count);
+    char opened[record_size];
+    for (size_t i = 0; i < count; i++) {
+        const char* record = records[i].buffer;
+        if (sealed && allZero(record, slot_size)) {
+            scratch.lengths[i] = 0;
+            continue;
+        }
+        if (sealed &&
+            (record = openRecord(records[i].id, record, opened)) == nullptr) {
+            return false;
+        }
+        scratch.lengths[i] = packRecord(record, record_size,
+            &scratch.records[i * STRIDE]);
+    }
+
+    const size_t ROOMY = page_body_size / 4;
+    auto pointedAt = [this](uint32_t page) {
+        return [this, page](uint32_t slot) {
+            return slot < capacity && pageOf(slot) == page;
+        };
+    };
+
+    // records go back into their pages, a page at a time. The page is
+    // compacted if it has to be; a record that doesn't fit stays where it
+    // is until its new copy is pointed at. Copies left behind by a move a
+    // crash cut short are dropped
+    scratch.order.clear();
+    for (size_t i = 0; i < count; i++) {
+        scratch.order.emplace_back(pageOf(records[i].id / 10 - 1), i);
+    }
+    sort(scratch.order.begin(), scratch.order.end());
+    for (size_t first = 0; first < scratch.order.size();) {
+        uint32_t page = scratch.order[first].first;
+        size_t end = first + 1;
+        while (end < scratch.order.size() &&
+            scratch.order[end].first == page) {
+            end++;
+        }
+        size_t staged = 0;
+        bool sound = false;
+        if (page != 0 && !stagePage(page, staged, sound)) {
+            return false;
+        }
+        SlottedPage view(sound ? &scratch.bodies[staged * page_body_size] :
+            nullptr, page_body_size);
+        bool dirty = sound && view.retain(pointedAt(page)) > 0;
+        bool was_roomy = sound && view.getFreeSpace() >= ROOMY;
+        for (size_t k = first; k < end; k++) {
+            size_t i = scratch.order[k].second;
+            size_t slot = records[i].id / 10 - 1;
+            size_t length = scratch.lengths[i];
+            const char* data;
+            size_t old_length;
+            if (length == 0) {
+                dirty = (sound && view.erase(slot)) || dirty;
+                if (page != 0 && !setPageOf(slot, 0)) {
+                    return false;
+                }
+                continue;
+            }
+            size_t room = !sound ? 0 : view.getFreeSpace() +
+                (view.find(slot, data, old_length) ?
+                old_length + SlottedPage::ENTRY_SIZE : 0);
+            if (room < length + SlottedPage::ENTRY_SIZE) {
+                scratch.homeless.push_back(i);
+                continue;
+            }
+            view.put(slot, &scratch.records[i * STRIDE], length);
+            dirty = true;
+        }
+        if (sound) {
+            scratch.staged[staged].dirty = scratch.staged[staged].dirty ||
+                dirty;
+        }
+        if (sound && !was_roomy && view.getFreeSpace() >= ROOMY) {
+            roomy_pages.push_back(page);
+        }
+        first = end;
     }
 
-    available_ids.set();
-    file.open(this->file_name, ios::out | ios::binary);
-    if (file.fail()) {
-        cout << "Error opening file\nExiting\n";
-        exit(-10); // TODO: change to something better than -10
+    // the rest fill the fill page, & a new one whenever it's full: a page
+    // that got roomy since the raf was opened, or else one never used
+    size_t next = 0;
+    while (next < scratch.homeless.size()) {
+        bool reused = fill_page == 0 && !roomy_pages.empty();
+        if (reused) {
+            fill_page = roomy_pages.back();
+            roomy_pages.pop_back();
+        }
+        else if (fill_page == 0 && (fill_page = allocatePage()) == 0) {
+            return false;
+        }
+        uint32_t page = fill_page;
+        fill_page = 0;
+        size_t staged;
+        bool sound;
+        if (!stagePage(page, staged, sound)) {
+            return false;
+        }
+        if (!sound) {
+            continue;
+        }
+        SlottedPage view(&scratch.bodies[staged * page_body_size],
+            page_body_size);
+        bool dirty = view.retain(pointedAt(page)) > 0;
+        if (reused && view.getFreeSpace() < ROOMY) {
+            scratch.staged[staged].dirty = scratch.staged[staged].dirty ||
+                dirty;
+            continue; // filled up again since it got roomy
+        }
+        size_t placed = next;
+        for (; placed < scratch.homeless.size(); placed++) {
+            size_t i = scratch.homeless[placed];
+            size_t slot = records[i].id / 10 - 1;
+            size_t length = scratch.lengths[i];
+            const char* data;
+            size_t old_length;
+            size_t room = view.getFreeSpace() + (view.find(slot, data,
+                old_length) ? old_length + SlottedPage::ENTRY_SIZE : 0);
+            if (room < length + SlottedPage::ENTRY_SIZE) {
+                break;
+            }
+            view.put(slot, &scratch.records[i * STRIDE], length);
+            dirty = true;
+        }
+        scratch.staged[staged].dirty = scratch.staged[staged].dirty || dirty;
+        for (; next < placed; next++) {
+            scratch.moves.emplace_back(
+                records[scratch.homeless[next]].id / 10 - 1, page);
+        }
+        if (placed == scratch.homeless.size()) {
+            fill_page = page;
+        }
     }
 
-    // add the available ids set at beginning of the file
-    file.write((char*)&available_ids, sizeof(available_ids));
-
-    // initialize the raf with dummy records
-    stringstream ss;
-    if (!this->dummy_record->serialize(ss)) {
-        cout << "Error with serializing record\nExiting\n";
-        file.close();
-        exit(-10); // TODO: change to something better?
+    // the pages are written, & the records that moved are pointed at their
+    // new pages only once those are on disk; their old copies go once the
+    // new page numbers are on disk too
+    if (!flushPages()) {
+        return false;
     }
-    if (ss.tellp() != record_size) {
-        file.close();
-        cout << "Error serializing records\nExiting\n";
-        exit(-10); // TODO: change to something better?
+    if (scratch.moves.empty()) {
+        return true;
     }
-    if (!ss) {
-        file.close(); // TODO: file.close repeatedly...
-        cout << "Error serializing status\nExiting\n";
-        exit(-10); // TODO: change to something better?
+    if (!syncRaf(Sync::data)) {
+        return false;
     }
-
-    char record[record_size];
-    ss.seekg(0, ios::beg);
-    ss.read(record, record_size);
-    for (int i = 0; i < MAX_RECORDS; i++) {
-        file.write(record, record_size);
+    for (const pair<size_t, uint32_t> &move : scratch.moves) {
+        uint32_t old = pageOf(move.first);
+        if (!setPageOf(move.first, move.second)) {
+            return false;
+        }
+        if (old != 0 && old != move.second) {
+            scratch.left.emplace_back(old, move.first);
+        }
     }
-
-    file.close();
-}
-
-bool File::reserveId(int id) {
-    id = id/10 -1;
-    if (!available_ids[id]) {
+    if (scratch.left.empty()) {
+        return true;
+    }
+    if (!syncRaf(Sync::data)) {
         return false;
     }
 
-    available_ids.set(id, false);
-    return true;
+    sort(scratch.left.begin(), scratch.left.end());
+    for (size_t first = 0; first < scratch.left.size();) {
+        uint32_t page = scratch.left[first].first;
+        while (first < scratch.left.size() &&
+            scratch.left[first].first == page) {
+            first++;
+        }
+        size_t staged;
+        bool sound;
+        if (!stagePage(page, staged, sound)) {
+            return false;
+        }
+        if (!sound) {
+            continue;
+        }
+        SlottedPage view(&scratch.bodies[staged * page_body_size],
+            page_body_size);
+        bool was_roomy = view.getFreeSpace() >= ROOMY;
+        scratch.staged[staged].dirty = view.retain(pointedAt(page)) > 0;
+        if (!was_roomy && view.getFreeSpace() >= ROOMY) {
+            roomy_pages.push_back(page);
+        }
+    }
+    return flushPages();
 }
 
-void File::releaseId(int id) {
-    available_ids.set(id/10 - 1, true);
+bool File::cacheRecord(int id, const char* serialized_record, bool dirty) {
+    unique_lock<mutex> cache_guard = guard(cache_lock);
+    int evicted_id;
+    char evicted_record[record_size];
+    return !cache->insert(id, serialized_record, dirty, evicted_id,
+        evicted_record) || writeRecord(evicted_id, evicted_record, Sync::none);
 }
 
-int File::getNextAvailableId() {
-    if (available_ids.none()) {
-        cout << "No available ids\n";
-        return -1;
+bool File::flushCache() {
+    if (cache == nullptr || cache_policy != CachePolicy::write_back) {
+        return true;
     }
 
-    int id;
-    for (id = 0; id < MAX_RECORDS; id++) {
-        if (available_ids[id]) {
-            break;
+    unique_lock<mutex> cache_guard = guard(cache_lock);
+    vector<int> dirty_ids;
+    cache->getDirtyIds(dirty_ids);
+    for (int id : dirty_ids) {
+        if (!writeRecord(id, cache->markClean(id), Sync::none)) {
+            return false;
         }
     }
-
-    return (id + 1) * 10;
+    return true;
 }
 
-void File::updateFile(int id, Record* record,
+uint64_t File::updateFile(int id, Record* record, Sync sync,
     bool update_available_ids /*= false*/) {
-    file.open(file_name, ios::out | ios::in | ios::binary);
-
-    if (file.fail()) {
-        cout << "Opening file failed\n";
-        exit(-10); // TODO: code/msg better than -10?
+    // with a journal the id's bit reaches the raf with the image; without
+    // one a create's bit is set before its slot is written & a delete's
+    // cleared after, so a crash can only leave an id used by no record
+    bool releasing = record == dummy_record.get();
+    bool write_bit = update_available_ids && journal == nullptr;
+    if (write_bit && !releasing) {
+        writeIdBit(id, true, sync);
     }
 
-    if (update_available_ids) {
-        file.write((char*)&available_ids, sizeof(available_ids));
-    }
-    else {
-        file.seekp(sizeof(available_ids), ios::beg);
+    if (record->getSize() != record_size) {
+        cout << "Error serializing records\nExiting\n";
+        exit(-10); // TODO: change to something better?
     }
+    noteWrite(id);
+    uint64_t seq = beginWrite(&id, 1);
 
-    int byte_offset = calculateOffset(id, false);
-    file.seekp(byte_offset, ios::cur);
-
-    stringstream ss; // TODO: same as constructor..
-    if (!record->serialize(ss)) {
+    // mapped rafs without a cache, journal or key are encoded in place (&
+    // checksummed there), otherwise through a stack buffer
+    off_t byte_offset = calculateOffset(id);
+    bool in_place = mapping != nullptr && cache == nullptr &&
+        journal == nullptr && cipher == nullptr;
+    char buffer[in_place ? 1 : record_size];
+    char* serialized_record = in_place ? mapping + byte_offset : buffer;
+    if (!record->encode(serialized_record)) {
         cout << "Error with serializing record\nExiting\n";
-        file.close();
         exit(-10); // TODO: change to something better?
     }
-    if (ss.tellp() != record_size) {
-        file.close();
-        cout << "Error serializing records\nExiting\n";
-        exit(-10); // TODO: change to something better?
+    if (projection != nullptr) {
+        // only deleteRecord writes the dummy record
+        if (record == dummy_record.get()) {
+            projection->erase(id);
+        }
+        else {
+            projection->update(id, serialized_record);
+        }
     }
-    if (!ss) {
-        file.close(); // TODO: file.close repeatedly...
-        cout << "Error serializing status\nExiting\n";
-        exit(-10); // TODO: change to something better?
+
+    // a write_back cache holds on to plain updates until they're evicted;
+    // a journal logs every update & checkpoints it into the raf later
+    bool write_back = cache != nullptr && journal == nullptr &&
+        cache_policy == CachePolicy::write_back &&
+        !update_available_ids && sync == Sync::none;
+    bool written = cache == nullptr ||
+        cacheRecord(id, serialized_record, write_back);
+    uint64_t lsn = 0;
+    if (journal != nullptr) {
+        char slot[slot_size];
+        sealRecord(id, serialized_record, slot);
+        lsn = journal->append(id, slot);
+        lsn = sync == Sync::none ? 0 : lsn;
+    }
+    else if (written && !write_back && in_place) {
+        stampSlot(id, serialized_record, payload_size);
+        written = syncRange(byte_offset, slot_size, sync);
+    }
+    else if (written && !write_back) {
+        written = writeRecord(id, serialized_record, sync);
     }
 
-    char serialized_record[record_size];
-    ss.seekg(0, ios::beg);
-    ss.read(serialized_record, record_size);
-    file.write(serialized_record, record_size);
-    file.close();
+    if (!written) {
+        cout << "Writing file failed\n";
+        exit(-10); // TODO: code/msg better than -10?
+    }
+    if (write_bit && releasing) {
+        writeIdBit(id, false, sync);
+    }
+    endWrite(seq);
+    return lsn;
 }
 
-int File::calculateOffset(int id,
-    bool include_available_ids /*= true*/) {
+void File::writeIdBit(int id, bool used, Sync sync) {
+    bool written;
+    {
+        unique_lock<mutex> ids_guard = guard(ids_lock);
+        written = writeIdBits(vector<pair<int, bool>>(1, { id, used }),
+            false);
+    }
+    if (!written || !syncRange(idWordOffset((id / 10 - 1) / 64),
+        sizeof(uint64_t), sync)) {
+        cout << "Writing file failed\n";
+        exit(-10); // TODO: code/msg better than -10?
+    }
+}
 
-    int offset = (id/10 - 1) * record_size;
-    if (include_available_ids) {
-        offset += sizeof(available_ids);
+void File::commitJournal(uint64_t lsn) {
+    if (lsn != 0 && !journal->commit(lsn)) {
+        cout << "Writing file failed\n";
+        exit(-10); // TODO: code/msg better than -10?
     }
-    return offset;
+}
+
+off_t File::calculateOffset(int id) {
+    size_t slot = id / 10 - 1;
+    const Extent &extent = findExtent(slot);
+    return extent.offset + roundUp(extent.slots / 8, PAGE_SIZE) +
+        (slot - extent.first_slot) * slot_stride;
 }
 
 bool File::createRecord(Record* record) {
-    // TODO: validate record->getId
+    StatTimer timer(STAT_CREATE_RECORD);
     int id = record->getId();
+    if (!validId(id)) {
+        return timer.check(false); // TODO: print msg?
+    }
 
-    if (!reserveId(id)) {
-        return false; // TODO: print msg?
+    {
+        unique_lock<mutex> ids_guard = guard(ids_lock);
+        if (!reserveId(id)) {
+            return timer.check(false);
+        }
     }
 
-    updateFile(id, record, true);
+    uint64_t lsn;
+    {
+        unique_lock<mutex> record_guard = lockRecord(id);
+        lsn = updateFile(id, record, sync_policy, true);
+    }
+    commitJournal(lsn);
 
     return true;
 }
 
 bool File::deleteRecord(Record* record) { // TODO: password?
-    // TODO: validate record->getId
+    StatTimer timer(STAT_DELETE_RECORD);
     int id = record->getId();
+    if (!validId(id)) {
+        return timer.check(false);
+    }
 
     // TODO: this..later
     // if (getRecord(id) != record) {
     //     return false;
     // }
 
-    releaseId(id);
-    updateFile(id, dummy_record.get(), true);
+    // the id can be taken again once released, but the new record waits
+    // for this record's lock before it's written
+    uint64_t lsn;
+    {
+        unique_lock<mutex> record_guard = lockRecord(id);
+        {
+            unique_lock<mutex> ids_guard = guard(ids_lock);
+            releaseId(id);
+        }
+        lsn = updateFile(id, dummy_record.get(), sync_policy, true);
+        if (cache != nullptr) {
+            unique_lock<mutex> cache_guard = guard(cache_lock);
+            cache->erase(id);
+        }
+    }
+    commitJournal(lsn);
 
     return true;
 }
 
 bool File::getRecord(int id, Record* record) {
-    if (id < 10 || id > MAX_RECORDS * 10 || id % 10 != 0) {
+    StatTimer timer(STAT_GET_RECORD);
+    if (!validId(id)) {
         //cout << "Invalid id\n";
-        return false;
-    } // TODO: move this validation
+        return timer.check(false);
+    }
+
+    if (record->getSize() != record_size) {
+        cout << "Error with deserializing\n";
+        return timer.check(false);
+    }
 
-    int byte_offset = calculateOffset(id);
+    unique_lock<mutex> record_guard = lockRecord(id);
+    if (cache != nullptr) {
+        unique_lock<mutex> cache_guard = guard(cache_lock);
+        const char* cached = cache->find(id);
+        if (cached != nullptr) {
+            return timer.check(record->decode(cached));
+        }
+    }
 
-    //unique_ptr<T> record(new T());
-    file.open(file_name, ios::in | ios::binary);
-    file.seekg(byte_offset, ios::beg);
+    off_t byte_offset = calculateOffset(id);
 
-    char serialized_record[record_size];
-    file.read(serialized_record, record_size);
-    file.close();
+    // records not checkpointed yet come from the journal; otherwise mapped
+    // rafs are decoded (or opened) in place & the rest through a stack
+    // buffer
+    bool journaled = journal != nullptr;
+    char buffer[mapping == nullptr || journaled ? slot_size : 1];
+    journaled = journaled && journal->find(id, buffer);
+    const char* slot = mapping == nullptr || journaled ? buffer :
+        mapping + byte_offset;
+    if (mapping == nullptr && !journaled &&
+        !readSlots(id / 10 - 1, 1, buffer)) {
+        cout << "Error reading file\n";
+        return timer.check(false);
+    }
+    if (mapping != nullptr && !journaled) {
+        Stats::countIo(slot_size, 0, 0);
+    }
 
-    stringstream ss;
-    ss.write(serialized_record, record_size);
-    if (!record->deserialize(ss)) {
+    char opened[cipher != nullptr ? record_size : 1];
+    const char* serialized_record = openRecord(id, slot, opened);
+    if (serialized_record == nullptr) {
+        return timer.check(false);
+    }
+    if (!record->decode(serialized_record)) {
         cout << "Error with deserializing\n";
+        return timer.check(false);
+    }
+
+    if (cache != nullptr && !cacheRecord(id, serialized_record, false)) {
+        cout << "Writing file failed\n";
+        return timer.check(false);
+    }
+    return true;
+}
+
+bool File::getRecords(const vector<int> &ids,
+    const vector<Record*> &records) {
+    StatTimer timer(STAT_GET_RECORDS);
+    if (ids.size() != records.size()) {
+        return timer.check(false);
+    }
+    for (size_t i = 0; i < ids.size(); i++) {
+        if (!validId(ids[i]) || records[i]->getSize() != record_size) {
+            return timer.check(false);
+        }
+    }
+
+    vector<unique_lock<mutex>> record_guards = lockRecords(ids);
+    return timer.check(readRecords(ids, records));
+}
+
+bool File::readRecords(const vector<int> &ids,
+    const vector<Record*> &records) {
+    // serve what the cache holds; the other slots come from the journal or
+    // are read in one pass, then checked together. Each record is decoded
+    // where it ends up: its slot, the dummy record or (with a key) where
+    // the batch was opened
+    string slots(ids.size() * slot_size, '\0');
+    vector<const char*> serialized_records(ids.size());
+    vector<bool> from_raf(ids.size(), false);
+    vector<Transfer> transfers;
+    unique_lock<mutex> cache_guard = guard(cache_lock);
+    for (size_t i = 0; i < ids.size(); i++) {
+        char* slot = &slots[i * slot_size];
+        const char* cached = cache == nullptr ? nullptr : cache->find(ids[i]);
+        if (cached != nullptr) {
+            memcpy(slot, cached, record_size);
+            serialized_records[i] = slot;
+        }
+        else if (journal == nullptr || !journal->find(ids[i], slot)) {
+            transfers.push_back({ calculateOffset(ids[i]), slot, ids[i] });
+            from_raf[i] = true;
+        }
+    }
+    cache_guard = unique_lock<mutex>();
+
+    if (!transfer(transfers, false)) {
+        cout << "Error reading file\n";
+        return false;
+    }
+
+    // empty slots read as the dummy record; the rest are checksummed a few
+    // at a time
+    vector<size_t> indexes;
+    vector<const void*> payloads;
+    vector<uint32_t> crcs;
+    for (size_t i = 0; i < ids.size(); i++) {
+        const char* slot = &slots[i * slot_size];
+        if (serialized_records[i] != nullptr) {
+            continue;
+        }
+        if (allZero(slot, slot_size)) {
+            serialized_records[i] = empty_record.data();
+            continue;
+        }
+        indexes.push_back(i);
+        payloads.push_back(slot);
+        crcs.push_back((uint32_t)ids[i]);
+    }
+    crc32cMany(payloads.data(), payload_size, payloads.size(), crcs.data());
+    for (size_t k = 0; k < indexes.size(); k++) {
+        uint32_t crc;
+        memcpy(&crc, &slots[indexes[k] * slot_size + payload_size],
+            sizeof(crc));
+        if (crc != crcs[k]) {
+            cout << "Record " << ids[indexes[k]] << " failed its checksum\n";
+            return false;
+        }
+        serialized_records[indexes[k]] = &slots[indexes[k] * slot_size];
+    }
+
+    // sealed records are packed & opened in one go
+    string opened;
+    if (cipher != nullptr && !indexes.empty()) {
+        size_t count = indexes.size();
+        string sealed(count * payload_size, '\0');
+        vector<uint64_t> associated;
+        for (size_t k = 0; k < count; k++) {
+            memcpy(&sealed[k * payload_size], payloads[k], payload_size);
+            associated.push_back(ids[indexes[k]]);
+        }
+        opened.resize(count * record_size);
+        if (!cipher->openMany(sealed.data(), &opened[0], record_size,
+            associated.data(), count)) {
+            cout << "Records failed authentication\n";
+            return false;
+        }
+        for (size_t k = 0; k < count; k++) {
+            serialized_records[indexes[k]] = &opened[k * record_size];
+        }
+    }
+
+    for (size_t i = 0; i < ids.size(); i++) {
+        const char* serialized_record = serialized_records[i];
+        if (!records[i]->decode(serialized_record)) {
+            cout << "Error with deserializing\n";
+            return false;
+        }
+        if (from_raf[i] && cache != nullptr &&
+            !cacheRecord(ids[i], serialized_record, false)) {
+            cout << "Writing file failed\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+uint64_t File::beginRead() {
+    return versions == nullptr ? 0 : versions->beginRead();
+}
+
+void File::endRead(uint64_t view) {
+    if (versions != nullptr) {
+        versions->endRead(view);
+    }
+}
+
+bool File::getRecordAt(uint64_t view, int id, Record* record) {
+    StatTimer timer(STAT_GET_RECORD_AT);
+    static thread_local vector<int> ids(1);
+    static thread_local vector<Record*> records(1);
+    ids[0] = id;
+    records[0] = record;
+    return timer.check(readView(view, ids, records));
+}
+
+bool File::getRecordsAt(uint64_t view, const vector<int> &ids,
+    const vector<Record*> &records) {
+    StatTimer timer(STAT_GET_RECORDS_AT);
+    return timer.check(readView(view, ids, records));
+}
+
+bool File::readView(uint64_t view, const vector<int> &ids,
+    const vector<Record*> &records) {
+    if (versions == nullptr) {
+        cout << "The file isn't versioned\n";
+        return false;
+    }
+    if (ids.size() != records.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < ids.size(); i++) {
+        if (!validId(ids[i]) || records[i]->getSize() != record_size) {
+            return false;
+        }
+    }
+
+    // the records are read as they are, then those written since the view
+    // (or torn by a write in progress) are replaced by the versions kept
+    // for it; a write that kept none began after the record was read
+    static thread_local string serialized_records;
+    static thread_local vector<bool> sound;
+    serialized_records.assign(ids.size() * record_size, '\0');
+    if (!readCurrent(ids, &serialized_records[0], sound, false)) {
+        cout << "Error reading file\n";
         return false;
     }
+    for (size_t i = 0; i < ids.size(); i++) {
+        char* serialized_record = &serialized_records[i * record_size];
+        if (versions->find(ids[i], view, serialized_record) || sound[i]) {
+            continue;
+        }
+
+        // not torn by a write: read it again while no write can start
+        unique_lock<mutex> record_guard = lockRecord(ids[i]);
+        vector<bool> again;
+        if (!versions->find(ids[i], view, serialized_record) &&
+            (!readCurrent(vector<int>(1, ids[i]), serialized_record, again,
+            true) || !again[0])) {
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < ids.size(); i++) {
+        if (!records[i]->decode(&serialized_records[i * record_size])) {
+            cout << "Error with deserializing\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+bool File::createRecords(const vector<Record*> &records) {
+    StatTimer timer(STAT_CREATE_RECORDS);
+    for (Record* record : records) {
+        if (!validId(record->getId()) || record->getSize() != record_size) {
+            return timer.check(false);
+        }
+    }
+
+    unique_lock<mutex> ids_guard = guard(ids_lock);
+    vector<int> reserved;
+    for (Record* record : records) {
+        if (!reserveId(record->getId())) {
+            for (int id : reserved) {
+                releaseId(id);
+            }
+            return timer.check(false);
+        }
+        reserved.push_back(record->getId());
+    }
+
+    // without a journal the bits go first & the records' sync covers
+    // them; with one they reach the raf with the images
+    vector<pair<int, bool>> bits;
+    for (int id : reserved) {
+        bits.emplace_back(id, true);
+    }
+    if (journal == nullptr && !writeIdBits(bits, false)) {
+        cout << "Writing file failed\n";
+        exit(-10); // TODO: code/msg better than -10?
+    }
+    ids_guard = unique_lock<mutex>();
+
+    uint64_t lsn;
+    bool written = true;
+    {
+        vector<unique_lock<mutex>> record_guards = lockRecords(reserved);
+        written = written && writeRecords(records, sync_policy, false, lsn);
+    }
+    if (!written) {
+        cout << "Writing file failed\n";
+        exit(-10); // TODO: code/msg better than -10?
+    }
+    commitJournal(lsn);
     return true;
 }
 
+bool File::updateRecords(const vector<Record*> &records) {
+    return updateRecords(records, sync_policy);
+}
+
+bool File::updateRecords(const vector<Record*> &records, Sync sync) {
+    StatTimer timer(STAT_UPDATE_RECORDS);
+    for (Record* record : records) {
+        if (!validId(record->getId()) || record->getSize() != record_size) {
+            return timer.check(false);
+        }
+    }
+
+    vector<int> ids;
+    for (Record* record : records) {
+        ids.push_back(record->getId());
+    }
+
+    uint64_t lsn;
+    bool written;
+    {
+        vector<unique_lock<mutex>> record_guards = lockRecords(ids);
+        written = writeRecords(records, sync, true, lsn);
+    }
+    written = written && (lsn == 0 || journal->commit(lsn));
+    if (!written) {
+        cout << "Writing file failed\n";
+    }
+    return timer.check(written);
+}
+
+bool File::transactRecords(const vector<int> &ids,
+    const vector<Record*> &records, const function<bool()> &change) {
+    return transactRecords(ids, records, change, sync_policy);
+}
+
+bool File::transactRecords(const vector<int> &ids,
+    const vector<Record*> &records, const function<bool()> &change,
+    Sync sync) {
+    return transactRecords(ids, records, change, sync, nullptr);
+}
+
+bool File::transactRecords(const vector<int> &ids,
+    const vector<Record*> &records, const function<bool()> &change,
+    Sync sync, const function<void(bool)> &committed) {
+    StatTimer timer(STAT_TRANSACT_RECORDS);
+    if (ids.size() != records.size()) {
+        return timer.check(false);
+    }
+    vector<int> sorted(ids);
+    sort(sorted.begin(), sorted.end());
+    if (adjacent_find(sorted.begin(), sorted.end()) != sorted.end()) {
+        return timer.check(false);
+    }
+    for (size_t i = 0; i < ids.size(); i++) {
+        if (!validId(ids[i]) || records[i]->getSize() != record_size) {
+            return timer.check(false);
+        }
+    }
+
+    // the stripes are held from the read until the records are written, so
+    // no other thread sees some of the changes without the rest
+    uint64_t lsn;
+    bool written;
+    {
+        vector<unique_lock<mutex>> record_guards = lockRecords(ids);
+        if (!readRecords(ids, records)) {
+            return timer.check(false);
+        }
+        if (!change()) {
+            return true;
+        }
+        written = true;
+        for (size_t i = 0; i < ids.size(); i++) {
+            written = written && records[i]->getId() == ids[i];
+        }
+        if (!written && committed == nullptr) {
+            return timer.check(false);
+        }
+        written = written && writeRecords(records, sync, true, lsn);
+
+        // a coordinator learns the outcome before another write can see
+        // the records (so the commit can't share a later write's sync)
+        if (committed != nullptr) {
+            written = written && (lsn == 0 || journal->commit(lsn));
+            lsn = 0;
+            committed(written);
+        }
+    }
+    written = written && (lsn == 0 || journal->commit(lsn));
+    if (!written) {
+        cout << "Writing file failed\n";
+    }
+    return timer.check(written);
+}
+
+bool File::writeRecords(const vector<Record*> &records, Sync sync,
+    bool allow_write_back, uint64_t &lsn) {
+    lsn = 0;
+    vector<int> ids;
+    for (Record* record : records) {
+        ids.push_back(record->getId());
+        noteWrite(ids.back());
+    }
+    uint64_t seq = beginWrite(ids.data(), ids.size());
+    // each record is encoded at the start of its slot
+    string slots(records.size() * slot_size, '\0');
+    for (size_t i = 0; i < records.size(); i++) {
+        if (!records[i]->encode(&slots[i * slot_size])) {
+            cout << "Error with serializing record\n";
+            endWrite(seq);
+            return false;
+        }
+    }
+
+    // a write_back cache takes the batch as its write; otherwise the cache
+    // & projection only take it once it's written
+    bool write_back = allow_write_back && cache != nullptr &&
+        journal == nullptr && cache_policy == CachePolicy::write_back &&
+        sync == Sync::none;
+    bool written = true;
+    for (size_t i = 0; written && write_back && i < records.size(); i++) {
+        written = cacheRecord(records[i]->getId(), &slots[i * slot_size],
+            true);
+    }
+
+    // the batch is sealed (with a key) & checksummed on its way out, so the
+    // cache & projection are given a copy of it as encoded
+    string encoded;
+    if (!write_back) {
+        if (cipher != nullptr && (cache != nullptr || projection != nullptr)) {
+            encoded = slots;
+        }
+        vector<uint64_t> ids;
+        for (Record* record : records) {
+            ids.push_back(record->getId());
+        }
+        sealRecords(ids.data(), records.size(), &slots[0]);
+    }
+
+    if (journal != nullptr) {
+        // one group, so a crash keeps the whole batch or none of it
+        lsn = journal->appendGroup(ids.data(), slots.data(), records.size());
+        lsn = sync == Sync::none ? 0 : lsn;
+    }
+    else if (written && !write_back) {
+        // when an id repeats only its last record is written
+        vector<Transfer> transfers;
+        for (size_t i = 0; i < records.size(); i++) {
+            transfers.push_back({ calculateOffset(records[i]->getId()),
+                &slots[i * slot_size], records[i]->getId() });
+        }
+        stable_sort(transfers.begin(), transfers.end(),
+            [](const Transfer &a, const Transfer &b) {
+                return a.offset < b.offset;
+            });
+        vector<Transfer> latest;
+        for (size_t i = 0; i < transfers.size(); i++) {
+            if (i + 1 == transfers.size() ||
+                transfers[i + 1].offset != transfers[i].offset) {
+                latest.push_back(transfers[i]);
+            }
+        }
+        written = transfer(latest, true) && syncRaf(sync);
+    }
+
+    const char* plain = encoded.empty() ? slots.data() : encoded.data();
+    if (!write_back && cache != nullptr) {
+        // a failed write may have left some slots newer than their cached
+        // copies, so those are dropped
+        for (size_t i = 0; i < records.size(); i++) {
+            if (written) {
+                written = cacheRecord(records[i]->getId(),
+                    plain + i * slot_size, false);
+                continue;
+            }
+            unique_lock<mutex> cache_guard = guard(cache_lock);
+            cache->erase(records[i]->getId());
+        }
+    }
+    for (size_t i = 0; written && projection != nullptr &&
+        i < records.size(); i++) {
+        projection->update(records[i]->getId(), plain + i * slot_size);
+    }
+    endWrite(seq);
+    return written;
+}
+
 void File::updateRecord(Record* record) {
-    // TODO: validate id?
+    updateRecord(record, sync_policy);
+}
+
+void File::updateRecord(Record* record, Sync sync) {
+    StatTimer timer(STAT_UPDATE_RECORD);
+    int id = record->getId();
+    if (!validId(id)) {
+        cout << "Invalid id\n";
+        timer.check(false);
+        return;
+    }
+
+    uint64_t lsn;
+    {
+        unique_lock<mutex> record_guard = lockRecord(id);
+        lsn = updateFile(id, record, sync);
+    }
+    commitJournal(lsn);
+}
+
+bool File::findBuffered(int id, char* serialized_record) {
+    if (cache != nullptr) {
+        unique_lock<mutex> cache_guard = guard(cache_lock);
+        const char* cached = cache->find(id);
+        if (cached != nullptr) {
+            memcpy(serialized_record, cached, record_size);
+            return true;
+        }
+    }
+    return journal != nullptr && journal->find(id, serialized_record);
+}
+
+void File::getRecordAsync(int id, Record* record, Completion done) {
+    StatTimer timer(STAT_GET_RECORD_ASYNC);
+    Ring &ring = Ring::local();
+    if (!validId(id) || record->getSize() != record_size) {
+        timer.check(false);
+        ring.post(-EINVAL, [done](ssize_t) { done(false); });
+        return;
+    }
+
+    // a mapping needs no I/O to wait for; sealed journal entries & pages
+    // are opened by getRecord
+    if (mapping != nullptr || storage == Storage::packed ||
+        (journal != nullptr && cipher != nullptr)) {
+        bool found = getRecord(id, record);
+        ring.post(0, [done, found](ssize_t) { done(found); });
+        return;
+    }
+
+    char* buffer = new char[slot_size];
+    bool buffered;
+    {
+        unique_lock<mutex> record_guard = lockRecord(id);
+        buffered = findBuffered(id, buffer);
+    }
+    if (buffered) {
+        bool decoded = record->decode(buffer);
+        delete[] buffer;
+        ring.post(0, [done, decoded](ssize_t) { done(decoded); });
+        return;
+    }
+
+    // the callback captures one pointer, so std::function needn't allocate
+    struct Read {
+        File* file;
+        int id;
+        Record* record;
+        Completion done;
+        unique_ptr<char[]> buffer;
+    };
+    Read* read = new Read{ this, id, record, move(done),
+        unique_ptr<char[]>(buffer) };
+    ring.read(fd, buffer, slot_size, calculateOffset(id),
+        [read](ssize_t result) {
+            unique_ptr<Read> owned(read);
+            File &file = *read->file;
+            char opened[file.cipher != nullptr ? file.record_size : 1];
+            const char* serialized_record = result == (ssize_t)file.slot_size ?
+                file.openRecord(read->id, read->buffer.get(), opened) :
+                nullptr;
+            bool decoded = serialized_record != nullptr &&
+                read->record->decode(serialized_record);
+            if (!decoded) {
+                cout << "Error reading file\n";
+            }
+            read->done(decoded);
+        });
+}
+
+void File::updateRecordAsync(Record* record, Completion done) {
+    updateRecordAsync(record, sync_policy, done);
+}
+
+void File::updateRecordAsync(Record* record, Sync sync, Completion done) {
+    StatTimer timer(STAT_UPDATE_RECORD_ASYNC);
+    Ring &ring = Ring::local();
+    auto fail = [&](const char* message, int error) {
+        cout << message << "\n";
+        timer.check(false);
+        ring.post(-error, [done](ssize_t) { done(false); });
+    };
     int id = record->getId();
-    updateFile(id, record);
+    if (!validId(id)) {
+        fail("Invalid id", EINVAL);
+        return;
+    }
+
+    // only a raf written straight through to its slots can take the write
+    // off the thread; a versioned one is read by views until it's written
+    if (mapping != nullptr || storage == Storage::packed ||
+        versions != nullptr || journal != nullptr || (cache != nullptr &&
+        cache_policy == CachePolicy::write_back)) {
+        updateRecord(record, sync);
+        ring.post(0, [done](ssize_t) { done(true); });
+        return;
+    }
+
+    unique_ptr<char[]> serialized_record(new char[record_size]);
+    if (record->getSize() != record_size ||
+        !record->encode(serialized_record.get())) {
+        fail("Error with serializing record", EINVAL);
+        return;
+    }
+    {
+        unique_lock<mutex> record_guard = lockRecord(id);
+        noteWrite(id);
+        if (projection != nullptr) {
+            projection->update(id, serialized_record.get());
+        }
+        if (cache != nullptr &&
+            !cacheRecord(id, serialized_record.get(), false)) {
+            fail("Writing file failed", EIO);
+            return;
+        }
+    }
+
+    // the slot is written, sealed with a key
+    char* buffer = new char[slot_size];
+    sealRecord(id, serialized_record.get(), buffer);
+    struct Write {
+        Completion done;
+        unique_ptr<char[]> buffer;
+        size_t size;
+    };
+    Write* write = new Write{ move(done), unique_ptr<char[]>(buffer),
+        slot_size };
+    ring.write(fd, buffer, slot_size, calculateOffset(id),
+        sync != Sync::none, sync == Sync::data, [write](ssize_t result) {
+            unique_ptr<Write> owned(write);
+            if (result != (ssize_t)write->size) {
+                cout << "Writing file failed\n";
+            }
+            write->done(result == (ssize_t)write->size);
+        });
+}
+
+size_t File::completeAsync(size_t wait_for /*= 0*/) {
+    return Ring::local().complete(wait_for);
+}
+
+size_t File::getPendingAsync() {
+    return Ring::local().getPending();
 }
\ No newline at end of file
@@ -5,6 +5,8 @@
 //      This file is the implementation of the non-templated functions of the
 //      utility namespace.
 // =============================================================================
+#include <algorithm>
+#include <cstdlib>
 #include <ctime>
 #include "utility.h"
 
@@ -16,4 +18,46 @@ void utility::printDateAndTime() {
     time(&rawtime);
 
     cout << "Today's date and time is " << ctime(&rawtime) << endl;
+}
+
+bool utility::parseCents(const char* begin, const char* end, int64_t &cents) {
+    bool negative = begin < end && *begin == '-';
+    if (negative) {
+        begin++;
+    }
+
+    int64_t value = 0;
+    int decimals = -1; // digits after the point; -1 until there is one
+    bool digits = false;
+    for (const char* c = begin; c < end; c++) {
+        if (*c == '.' && decimals == -1) {
+            decimals = 0;
+            continue;
+        }
+        if (*c < '0' || *c > '9' || decimals == 2 ||
+            __builtin_mul_overflow(value, 10, &value) ||
+            __builtin_add_overflow(value, *c - '0', &value)) {
+            return false;
+        }
+        digits = true;
+        decimals += decimals >= 0;
+    }
+
+    for (int i = max(decimals, 0); i < 2; i++) {
+        if (__builtin_mul_overflow(value, 10, &value)) {
+            return false;
+        }
+    }
+    cents = negative ? -value : value;
+    return digits;
+}
+
+string utility::formatCents(int64_t cents) {
+    // the remainder is printed digit by digit so INT64_MIN needs no negation
+    lldiv_t dollars = lldiv(cents, 100);
+    int remainder = llabs(dollars.rem);
+    string text = cents < 0 && dollars.quot == 0 ? "-" : "";
+    text += to_string(dollars.quot) + '.' + (char)('0' + remainder / 10) +
+        (char)('0' + remainder % 10);
+    return text;
 }
\ No newline at end of file